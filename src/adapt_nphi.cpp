@@ -0,0 +1,97 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include "qsc.hpp"
+
+using namespace qsc;
+
+/** Return the largest relative Fourier tail among the profiles that
+ * most limit the resolution: the axis curvature, sigma, and, if
+ * include_r2 is true, X20. See fourier_tail().
+ */
+qscfloat Qsc::measure_spectral_tail(bool include_r2) {
+  spectral_tail = std::max(fourier_tail(curvature), fourier_tail(sigma));
+  if (include_r2) spectral_tail = std::max(spectral_tail, fourier_tail(X20));
+  return spectral_tail;
+}
+
+/** Return the nphi to which adapt_nphi() would next refine the grid,
+ * or nphi itself if the spectral tail is already below nphi_tolerance
+ * or nphi has reached max_nphi. measure_spectral_tail() must have been
+ * called first.
+ *
+ * The new nphi is estimated by assuming the Fourier amplitudes decay
+ * exponentially with mode number, so usually only one refinement is
+ * needed.
+ */
+int Qsc::refined_nphi() {
+  int new_nphi;
+  qscfloat ratio;
+
+  if (spectral_tail <= nphi_tolerance || nphi >= max_nphi) return nphi;
+  if (spectral_tail < 1) {
+    // Amplitudes ~ exp(-c k), so the needed number of modes scales
+    // with log(tolerance) / log(tail). Add 10% for safety.
+    ratio = 1.1 * std::log(nphi_tolerance) / std::log(spectral_tail);
+  } else {
+    ratio = 2;
+  }
+  new_nphi = (int) std::ceil(ratio * nphi);
+  if (new_nphi < nphi + 2) new_nphi = nphi + 2;
+  if (new_nphi > max_nphi) new_nphi = max_nphi;
+  if (new_nphi % 2 == 0) new_nphi++;
+  return new_nphi;
+}
+
+/** Repeat the calculation through r1_diagnostics(), and also through
+ * calculate_r2() if include_r2 is true, after the grid has been
+ * refined and a coarse solution for sigma has been interpolated onto
+ * it. The coarse sigma and iota are used as the initial guess for
+ * Newton's method. The spectral tail is then measured again.
+ */
+void Qsc::recalculate_refined(bool include_r2) {
+  warm_start_sigma = true;
+  nphi_refinements++;
+
+  init_axis();
+  solve_sigma_equation();
+  r1_diagnostics();
+  if (include_r2) calculate_r2();
+  measure_spectral_tail(include_r2);
+}
+
+/** Increase nphi until the spectral tail is below nphi_tolerance or
+ * nphi reaches max_nphi. The calculation must already have been
+ * carried out through r1_diagnostics(), and also through
+ * calculate_r2() if include_r2 is true; this is repeated at each new
+ * resolution. If the tail is already small enough, nothing is
+ * re-computed.
+ *
+ * nphi is only ever increased here. To let smooth configurations use
+ * fewer points than the input nphi, set min_nphi, from which
+ * calculate() then starts. Each refinement re-allocates the arrays;
+ * a scan instead keeps a QscWorkspaces with a copy of the object for
+ * each nphi it has used, so this happens once per nphi.
+ */
+void Qsc::adapt_nphi(bool include_r2) {
+  int new_nphi;
+  Vector sigma_coarse;
+
+  measure_spectral_tail(include_r2);
+  while ((new_nphi = refined_nphi()) != nphi) {
+    if (verbose > 0) {
+      std::cout << "Spectral tail " << spectral_tail << " exceeds nphi_tolerance " << nphi_tolerance
+		<< " for nphi=" << nphi << ". Increasing nphi to " << new_nphi << std::endl;
+    }
+
+    sigma_coarse.resize(nphi);
+    sigma_coarse = sigma;
+    nphi = new_nphi;
+    allocate();
+    fourier_interpolate(sigma_coarse, sigma);
+    recalculate_refined(include_r2);
+  }
+  if (verbose > 0) {
+    std::cout << "Spectral tail: " << spectral_tail << "  nphi: " << nphi << std::endl;
+  }
+}
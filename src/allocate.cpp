@@ -64,6 +64,7 @@ void Qsc::allocate() {
   Y1s.resize(nphi, 0.0);
   Y1c.resize(nphi, 0.0);
   sigma.resize(nphi, 0.0);
+  warm_start_sigma = false;
   elongation.resize(nphi, 0.0);
   
   quadrant.resize(nphi + 1, 0);
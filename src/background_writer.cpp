@@ -0,0 +1,98 @@
+#include "background_writer.hpp"
+
+using namespace qsc;
+
+qsc::BackgroundWriter::BackgroundWriter() {
+  has_waiting_job = false;
+  waiting_job_skippable = false;
+  running = false;
+  stopping = false;
+  job_exception = nullptr;
+  n_completed_ = 0;
+  n_skipped_ = 0;
+}
+
+/** Finish any jobs that were submitted, then stop the thread. Any
+ * exception from the jobs is discarded, since this may be called
+ * while another exception is propagating.
+ */
+qsc::BackgroundWriter::~BackgroundWriter() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return !has_waiting_job && !running; });
+    stopping = true;
+  }
+  changed.notify_all();
+  if (thread.joinable()) thread.join();
+}
+
+// Must be called with the mutex held.
+void qsc::BackgroundWriter::rethrow() {
+  if (!job_exception) return;
+  std::exception_ptr e = job_exception;
+  job_exception = nullptr;
+  std::rethrow_exception(e);
+}
+
+void qsc::BackgroundWriter::loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this]() { return has_waiting_job || stopping; });
+    if (!has_waiting_job) return;
+    std::function<void()> job = std::move(waiting_job);
+    waiting_job = nullptr;
+    has_waiting_job = false;
+    running = true;
+    // Submitting threads may be waiting for the slot to free up:
+    changed.notify_all();
+
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+      lock.lock();
+      if (!job_exception) job_exception = std::current_exception();
+      lock.unlock();
+    }
+    lock.lock();
+    running = false;
+    n_completed_++;
+    changed.notify_all();
+  }
+}
+
+/** Queue a job. If skippable is true, the job may be dropped if
+ * another job is submitted before it starts.
+ */
+void qsc::BackgroundWriter::submit(std::function<void()> job, bool skippable) {
+  std::unique_lock<std::mutex> lock(mutex);
+  rethrow();
+  if (has_waiting_job && waiting_job_skippable) {
+    n_skipped_++;
+  } else {
+    changed.wait(lock, [this]() { return !has_waiting_job; });
+  }
+  waiting_job = std::move(job);
+  waiting_job_skippable = skippable;
+  has_waiting_job = true;
+  if (!thread.joinable()) thread = std::thread(&BackgroundWriter::loop, this);
+  changed.notify_all();
+}
+
+/** Block until every job submitted so far has finished.
+ */
+void qsc::BackgroundWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this]() { return !has_waiting_job && !running; });
+  rethrow();
+}
+
+big qsc::BackgroundWriter::n_completed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return n_completed_;
+}
+
+big qsc::BackgroundWriter::n_skipped() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return n_skipped_;
+}
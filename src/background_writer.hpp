@@ -0,0 +1,46 @@
+#ifndef QSC_BACKGROUND_WRITER_H
+#define QSC_BACKGROUND_WRITER_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "qsc.hpp"
+
+namespace qsc {
+
+  /** Runs output jobs, such as writing a snapshot of a scan to a file,
+   * on a dedicated thread, so the thread that submits them can carry
+   * on computing. The jobs are double-buffered: one job can run while
+   * one more waits. A job submitted when both slots are taken replaces
+   * the waiting job if that job was submitted as skippable (e.g. a
+   * file that a later job rewrites completely), and otherwise waits
+   * for the running job to finish. Jobs run in the order submitted.
+   * An exception thrown by a job is rethrown by the next call of
+   * submit() or wait(). Since MPI is initialized with
+   * MPI_THREAD_FUNNELED, the jobs must not call MPI.
+   */
+  class BackgroundWriter {
+  private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::function<void()> waiting_job;
+    bool has_waiting_job, waiting_job_skippable, running, stopping;
+    std::exception_ptr job_exception;
+    big n_completed_, n_skipped_;
+    void loop();
+    void rethrow();
+
+  public:
+    BackgroundWriter();
+    ~BackgroundWriter();
+    void submit(std::function<void()>, bool);
+    void wait();
+    big n_completed();
+    big n_skipped();
+  };
+}
+
+#endif
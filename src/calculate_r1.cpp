@@ -3,6 +3,7 @@
 #include <chrono>
 #include <stdexcept>
 #include "qsc.hpp"
+#include "newton.hpp"
 
 using namespace qsc;
 
@@ -59,13 +60,22 @@ void Qsc::solve_sigma_equation() {
   X1s = 0;
   X1c = eta_bar / curvature;
 
-  state = sigma0; // Initial guess for sigma
-  state[0] = 0.0; // Initial guess for iota
+  if (warm_start_sigma) {
+    // Use the solution from a coarser grid, interpolated onto this grid, as the initial guess:
+    state = sigma;
+    state[0] = iota;
+    warm_start_sigma = false;
+  } else {
+    state = sigma0; // Initial guess for sigma
+    state[0] = 0.0; // Initial guess for iota
+  }
     
-  newton_result = newton_solve(sigma_eq_residual, sigma_eq_jacobian,
+  newton_result = newton_solve([this](Vector& s, Vector& r) {sigma_eq_residual(s, r, this);},
+			       [this](Vector& s, Matrix& jac) {sigma_eq_jacobian(s, jac, this);},
 			       state, residual, work1, work2, ipiv, work_matrix,
 			       max_newton_iterations, max_linesearch_iterations,
-			       newton_tolerance, verbose, this);
+			       newton_tolerance, verbose, newton_jacobian_period,
+			       newton_linesearch, newton_stats);
 
   if (verbose > 0) {
     switch (newton_result) {
@@ -81,6 +91,9 @@ void Qsc::solve_sigma_equation() {
     default:
       throw std::runtime_error("Should not get here.");
     }
+    std::cout << "Newton iterations: " << newton_stats.iterations
+	      << "  line search steps: " << newton_stats.linesearch_steps
+	      << "  Jacobian factorizations: " << newton_stats.factorizations << std::endl;
     
     auto end = std::chrono::steady_clock::now();    
     std::chrono::duration<double> elapsed = end - start;
@@ -109,10 +122,13 @@ void Qsc::r1_diagnostics() {
     / (2 * abs(tempvec2));
 
   grid_max_elongation = elongation.max();
+  if (fourier_extrema) {
+    max_elongation = fourier_maximum(elongation);
+  } else {
+    max_elongation = grid_max_elongation;
+  }
   tempvec = elongation * d_l_d_phi;
   mean_elongation = tempvec.sum() / d_l_d_phi.sum();
-  //index = np.argmax(elongation);
-  //max_elongation = -fourier_minimum(-elongation);
 
   matrix_vector_product(d_d_varphi, X1c, d_X1c_d_varphi);
   matrix_vector_product(d_d_varphi, Y1s, d_Y1s_d_varphi);
@@ -57,7 +57,13 @@ int qsc::driver(int argc, char* argv[]) {
     q.run(infile);
 
   } else if (general_option.compare(GENERAL_OPTION_RANDOM) == 0) {
-    MPI_Init(NULL, NULL);
+    // Scans may use several threads per process, but only the main
+    // thread makes MPI calls:
+    int mpi_thread_support;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &mpi_thread_support);
+    // If the support is lower, Scan::random runs without extra threads.
+    if (mpi_thread_support < MPI_THREAD_FUNNELED)
+      std::cout << "Warning: the MPI library does not provide MPI_THREAD_FUNNELED." << std::endl;
     
     qsc::Scan scan;
     scan.run(infile);
@@ -73,7 +79,13 @@ int qsc::driver(int argc, char* argv[]) {
     multiopt.run(infile);
     
   } else if (general_option.compare(GENERAL_OPTION_MULTIOPT_SCAN) == 0) {
-    MPI_Init(NULL, NULL);
+    // With async_output, a background thread writes the output while
+    // the main thread makes the MPI calls:
+    int mpi_thread_support;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &mpi_thread_support);
+    // If the support is lower, MultiOptScan::scan writes synchronously.
+    if (mpi_thread_support < MPI_THREAD_FUNNELED)
+      std::cout << "Warning: the MPI library does not provide MPI_THREAD_FUNNELED." << std::endl;
     
     qsc::MultiOptScan mos;
     mos.run(infile);
@@ -0,0 +1,207 @@
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <vector>
+#include "qsc.hpp"
+
+using namespace qsc;
+
+namespace {
+  /**
+   * cos(2 pi m / n) and sin(2 pi m / n) for m = 0 ... n-1.
+   */
+  struct FourierTable {
+    int n;
+    std::vector<qscfloat> cos_values, sin_values;
+  };
+}
+
+/**
+ * Return the table of cos and sin values for the grid size n. The
+ * tables are computed once per n on each thread and then reused, since
+ * a scan calls fourier_coefficients() for every attempt but on only a
+ * few grid sizes.
+ */
+static const FourierTable& fourier_table(int n) {
+  const std::size_t max_tables = 16;
+  static thread_local std::vector<FourierTable> tables;
+  for (FourierTable& table : tables) {
+    if (table.n == n) return table;
+  }
+  if (tables.size() >= max_tables) tables.clear();
+  tables.push_back(FourierTable());
+  FourierTable& table = tables.back();
+  table.n = n;
+  table.cos_values.resize(n);
+  table.sin_values.resize(n);
+  for (int m = 0; m < n; m++) {
+    table.cos_values[m] = cos((2 * pi * m) / n);
+    table.sin_values[m] = sin((2 * pi * m) / n);
+  }
+  return table;
+}
+
+/**
+ * Compute the coefficients of the trigonometric interpolant through
+ * the values f on the uniform periodic grid theta_j = 2 pi j / n,
+ * j = 0 ... n-1:
+ *
+ *   f(theta) = cos_amplitudes[0] + sum_{k=1}^{n_modes-1} [cos_amplitudes[k] * cos(k theta) + sin_amplitudes[k] * sin(k theta)].
+ *
+ * For even n, the Nyquist mode k = n/2 is included as a cosine only,
+ * with half the usual weight, so the interpolant is real.
+ */
+static void fourier_coefficients(Vector& f, Vector& cos_amplitudes, Vector& sin_amplitudes) {
+  int n = f.size();
+  int n_modes = n / 2 + 1;
+  int j, k, m;
+  qscfloat cos_sum, sin_sum;
+  const FourierTable& table = fourier_table(n);
+
+  cos_amplitudes.resize(n_modes, 0.0);
+  sin_amplitudes.resize(n_modes, 0.0);
+  cos_amplitudes[0] = f.sum() / n;
+  for (k = 1; k < n_modes; k++) {
+    cos_sum = 0;
+    sin_sum = 0;
+    // m = (j * k) mod n, the index of the angle 2 pi j k / n in the table:
+    m = 0;
+    for (j = 0; j < n; j++) {
+      cos_sum += f[j] * table.cos_values[m];
+      sin_sum += f[j] * table.sin_values[m];
+      m += k;
+      if (m >= n) m -= n;
+    }
+    if (n % 2 == 0 && k == n / 2) {
+      cos_amplitudes[k] = cos_sum / n;
+      sin_amplitudes[k] = 0;
+    } else {
+      cos_amplitudes[k] = 2 * cos_sum / n;
+      sin_amplitudes[k] = 2 * sin_sum / n;
+    }
+  }
+}
+
+/**
+ * Evaluate the interpolant and its first two derivatives with respect
+ * to theta. cos(k theta) and sin(k theta) are generated by the angle
+ * addition formulas, so only one cos and one sin are called.
+ */
+static void fourier_evaluate(Vector& cos_amplitudes, Vector& sin_amplitudes, qscfloat theta,
+			     qscfloat& f, qscfloat& d_f_d_theta, qscfloat& d2_f_d_theta2) {
+  qscfloat cos1 = cos(theta), sin1 = sin(theta);
+  qscfloat cosk = 1, sink = 0, temp, term_c, term_s;
+  f = cos_amplitudes[0];
+  d_f_d_theta = 0;
+  d2_f_d_theta2 = 0;
+  int n_modes = cos_amplitudes.size();
+  for (int k = 1; k < n_modes; k++) {
+    temp = cosk * cos1 - sink * sin1;
+    sink = sink * cos1 + cosk * sin1;
+    cosk = temp;
+    term_c = cos_amplitudes[k] * cosk + sin_amplitudes[k] * sink;
+    term_s = sin_amplitudes[k] * cosk - cos_amplitudes[k] * sink;
+    f += term_c;
+    d_f_d_theta += k * term_s;
+    d2_f_d_theta2 -= k * k * term_c;
+  }
+}
+
+/**
+ * Return the minimum over the full period of the trigonometric
+ * interpolant through the values f on a uniform periodic grid, rather
+ * than just the minimum over the grid points. Starting from each
+ * local minimum on the grid, a safeguarded Newton iteration for
+ * d f / d theta = 0 is performed within one grid spacing. The result
+ * is never larger than f.min().
+ */
+qscfloat qsc::fourier_minimum(Vector& f) {
+  int n = f.size();
+  qscfloat result = f.min();
+  if (n < 3) return result;
+
+  Vector cos_amplitudes, sin_amplitudes;
+  fourier_coefficients(f, cos_amplitudes, sin_amplitudes);
+
+  const int max_iterations = 20;
+  const qscfloat h = 2 * pi / n;
+  const qscfloat theta_tolerance = 100 * std::numeric_limits<qscfloat>::epsilon();
+  qscfloat theta, theta0, step, val, d_val, d2_val;
+  int j, j_iteration;
+
+  for (j = 0; j < n; j++) {
+    // Only refine local minima on the grid:
+    if (f[j] > f[(j + n - 1) % n] || f[j] > f[(j + 1) % n]) continue;
+    theta0 = h * j;
+    theta = theta0;
+    for (j_iteration = 0; j_iteration < max_iterations; j_iteration++) {
+      fourier_evaluate(cos_amplitudes, sin_amplitudes, theta, val, d_val, d2_val);
+      if (d2_val > 0) {
+	step = -d_val / d2_val;
+      } else {
+	// Not locally convex, so take a small downhill step instead:
+	step = (d_val > 0) ? -0.25 * h : 0.25 * h;
+      }
+      // Stay within one grid spacing of the starting point:
+      if (theta + step > theta0 + h) step = theta0 + h - theta;
+      if (theta + step < theta0 - h) step = theta0 - h - theta;
+      theta += step;
+      if (std::abs(step) < theta_tolerance) break;
+    }
+    fourier_evaluate(cos_amplitudes, sin_amplitudes, theta, val, d_val, d2_val);
+    if (val < result) result = val;
+  }
+  return result;
+}
+
+/**
+ * Return the maximum over the full period of the trigonometric
+ * interpolant through the values f on a uniform periodic grid. See
+ * fourier_minimum().
+ */
+qscfloat qsc::fourier_maximum(Vector& f) {
+  Vector minus_f = -f;
+  return -fourier_minimum(minus_f);
+}
+
+/**
+ * Resample a profile onto a different uniform periodic grid using
+ * trigonometric interpolation. f holds the values on the original
+ * grid, and f_out must be allocated with the size of the new grid,
+ * typically finer. Both grids start at theta = 0 and span one period.
+ */
+void qsc::fourier_interpolate(Vector& f, Vector& f_out) {
+  assert(f.size() > 0);
+  Vector cos_amplitudes, sin_amplitudes;
+  fourier_coefficients(f, cos_amplitudes, sin_amplitudes);
+
+  int n_out = f_out.size();
+  qscfloat d_val, d2_val;
+  for (int j = 0; j < n_out; j++) {
+    fourier_evaluate(cos_amplitudes, sin_amplitudes, (2 * pi * j) / n_out, f_out[j], d_val, d2_val);
+  }
+}
+
+/**
+ * Measure how well a periodic profile is resolved on its uniform
+ * grid. The return value is the largest Fourier amplitude in the
+ * upper third of the resolvable modes, divided by the largest
+ * amplitude of any mode (including the mean). For a smooth, well
+ * resolved profile this ratio is close to machine precision, while a
+ * value of order 1 indicates that the grid is too coarse.
+ */
+qscfloat qsc::fourier_tail(Vector& f) {
+  Vector cos_amplitudes, sin_amplitudes;
+  fourier_coefficients(f, cos_amplitudes, sin_amplitudes);
+  int n_modes = cos_amplitudes.size();
+  int k_tail = (2 * n_modes) / 3;
+  if (k_tail < 1) k_tail = 1;
+  qscfloat amplitude, max_amplitude = 0, max_tail_amplitude = 0;
+  for (int k = 0; k < n_modes; k++) {
+    amplitude = sqrt(cos_amplitudes[k] * cos_amplitudes[k] + sin_amplitudes[k] * sin_amplitudes[k]);
+    if (amplitude > max_amplitude) max_amplitude = amplitude;
+    if (k >= k_tail && amplitude > max_tail_amplitude) max_tail_amplitude = amplitude;
+  }
+  if (max_amplitude == 0) return 0;
+  return max_tail_amplitude / max_amplitude;
+}
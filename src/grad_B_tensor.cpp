@@ -52,15 +52,33 @@ void Qsc::calculate_grad_B_tensor() {
   }
   L_grad_B_inverse = ((qscfloat)1.0) / L_grad_B;
   grid_min_L_grad_B = L_grad_B.min();
+  // 1 / L_grad_B is smoother than L_grad_B, so interpolate the former:
+  if (fourier_extrema) {
+    min_L_grad_B = 1 / fourier_maximum(L_grad_B_inverse);
+  } else {
+    min_L_grad_B = grid_min_L_grad_B;
+  }
 }
 
-void Qsc::calculate_grad_grad_B_tensor() {
+/** Evaluate the 27 elements of the grad grad B tensor.
+ *
+ * If max_sum_sq > 0, the sum of the squared elements at each grid
+ * point is accumulated in tempvec. After each row of three elements
+ * (j1, j2, 0..2), the evaluation stops if this sum exceeds max_sum_sq
+ * at any grid point. In this case true is returned, and the remaining
+ * elements are not computed. Checking once per row rather than after
+ * every element avoids 18 of the 27 passes over the grid for the max.
+ */
+bool Qsc::calculate_grad_grad_B_elements(qscfloat max_sum_sq) {
   // The elements that follow are computed in the Mathematica notebook "20200407-01 Grad grad B tensor near axis"
   // and then formatted for fortran by the python script process_grad_grad_B_tensor_code
 
-  std::chrono::time_point<std::chrono::steady_clock> start;
-  if (verbose > 0) start = std::chrono::steady_clock::now();
-  if (verbose > 0) std::cout << "Beginning grad_grad_B tensor calculation" << std::endl;
+  auto set_row_and_check = [this, max_sum_sq](int j1, int j2, int j3) {
+    grad_grad_B_tensor.set_row(work1, j1, j2, j3);
+    if (max_sum_sq <= 0) return false;
+    tempvec += work1 * work1;
+    return j3 == 2 && tempvec.max() > max_sum_sq;
+  };
   
   // The order is (normal, binormal, tangent). So element 012 means nbt.
 
@@ -84,7 +102,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 			      2*Y1s*Y1s*d_X2c_d_varphi - 
 			      4*Y1c*Y1s*d_X2s_d_varphi))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 0, 0);
+  if (set_row_and_check(0, 0, 0)) return true;
     
   // Element 001
   work1 = (B0*B0*B0*B0*lp*lp*(Y1c*Y1c*
@@ -120,7 +138,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 					5*X1c*curvature*
 					d_Y1s_d_varphi - 
 					4*d_Y2s_d_varphi))))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 0, 1);
+  if (set_row_and_check(0, 0, 1)) return true;
     
   // Element 002
   work1 = -((B0*B0*B0*lp*lp*(2*Y1c*Y1c*
@@ -145,7 +163,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 				       2*Y1s*(2*B2s*lp - 2*B0*iota_N*Z2c - 
 					      B0*lp*X2s*curvature + 
 					      B0*d_Z2s_d_varphi))))/(G0*G0*G0*G0));
-  grad_grad_B_tensor.set_row(work1, 0, 0, 2);
+  if (set_row_and_check(0, 0, 2)) return true;
 
   // Element 010
   work1 =-((B0*B0*B0*B0*lp*lp*(3*iota_N*X1c*X1c*X1c*Y1s*
@@ -172,7 +190,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 				      Y1c*d_X2c_d_varphi + 
 				      Y1s*d_X2s_d_varphi)))/
 	   (G0*G0*G0));
-  grad_grad_B_tensor.set_row(work1, 0, 1, 0);
+  if (set_row_and_check(0, 1, 0)) return true;
 
   // Element 011
   work1 =(B0*B0*B0*B0*lp*lp*(-4*iota_N*X1c*Y1s*
@@ -194,7 +212,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 			     2*X1c*Y1c*d_Y2c_d_varphi + 
 			     2*X1c*Y1s*d_Y2s_d_varphi))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 1, 1);
+  if (set_row_and_check(0, 1, 1)) return true;
 
   // Element 012
   work1 =(2*B0*B0*B0*lp*lp*X1c*
@@ -207,7 +225,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   G0*Y1s*(2*B2s*lp - 2*B0*iota_N*Z2c - 
 		   2*B0*lp*X2s*curvature + 
 		   B0*d_Z2s_d_varphi)))/(G0*G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 1, 2);
+  if (set_row_and_check(0, 1, 2)) return true;
     
   // Element 020
   work1 =(B0*B0*B0*B0*lp*(-4*lp*lp*X2s*Y1c*Y1s*
@@ -240,7 +258,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 			  torsion*d_Y1s_d_varphi + 
 			  X1c*Y1s*Y1s*d2_X1c_d_varphi2))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 2, 0);
+  if (set_row_and_check(0, 2, 0)) return true;
 
     // Element 021
   work1 =(B0*B0*B0*B0*lp*(-(Y1s*d_X1c_d_varphi*
@@ -262,7 +280,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 				    d_Y1s_d_varphi + 
 				    Y1c*(-2*iota_N*d_Y1c_d_varphi + 
 					 d2_Y1s_d_varphi2)))))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 2, 1);
+  if (set_row_and_check(0, 2, 1)) return true;
 
   // Element 022
   work1 =(B0*B0*B0*B0*lp*lp*X1c*Y1s*
@@ -272,7 +290,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		  curvature) + 
 		Y1s*d_curvature_d_varphi)))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 0, 2, 2);
+  if (set_row_and_check(0, 2, 2)) return true;
 
     // Element 100
   work1 =(-2*B0*B0*B0*B0*lp*lp*X1c*
@@ -287,7 +305,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   Y1c*d_X20_d_varphi - 
 	   Y1c*d_X2c_d_varphi - 
 	   Y1s*d_X2s_d_varphi))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 0, 0);
+  if (set_row_and_check(1, 0, 0)) return true;
 
   // Element 101
   work1 =(2*B0*B0*B0*B0*lp*lp*X1c*
@@ -307,7 +325,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		  X1c*curvature*
 		  d_Y1s_d_varphi + d_Y2s_d_varphi))
 	  )/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 0, 1);
+  if (set_row_and_check(1, 0, 1)) return true;
 
   // Element 102
   work1 =(2*B0*B0*B0*lp*lp*X1c*
@@ -322,7 +340,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	       Y1s*(2*B2s*lp - 2*B0*iota_N*Z2c - 
 		    B0*lp*X2s*curvature + 
 		    B0*d_Z2s_d_varphi))))/(G0*G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 0, 2);
+  if (set_row_and_check(1, 0, 2)) return true;
 
   // Element 110
   work1 =(-2*B0*B0*B0*B0*lp*lp*X1c*
@@ -336,7 +354,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		lp*Y2c*torsion - 
 		d_X20_d_varphi + d_X2c_d_varphi)))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 1, 0);
+  if (set_row_and_check(1, 1, 0)) return true;
 
   // Element 111
   work1 =(-2*B0*B0*B0*B0*lp*lp*X1c*
@@ -349,7 +367,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		d_Y1s_d_varphi) - 
 	   X1c*d_Y20_d_varphi + 
 	   X1c*d_Y2c_d_varphi))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 1, 1);
+  if (set_row_and_check(1, 1, 1)) return true;
 
   // Element 112
   work1 =(-2*B0*B0*B0*lp*lp*X1c*X1c*
@@ -359,7 +377,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   2*B0*G0*lp*X2c*curvature - 
 	   B0*G0*d_Z20_d_varphi + 
 	   B0*G0*d_Z2c_d_varphi))/(G0*G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 1, 2);
+  if (set_row_and_check(1, 1, 2)) return true;
 
   // Element 120
   work1 =(B0*B0*B0*B0*lp*X1c*(-2*lp*lp*X20*Y1c*
@@ -378,7 +396,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 			      d_Y1s_d_varphi - 
 			      lp*X1c*Y1s*Y1s*
 			      d_torsion_d_varphi))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 2, 0);
+  if (set_row_and_check(1, 2, 0)) return true;
 
   // Element 121
   work1 =(B0*B0*B0*B0*lp*X1c*(-(lp*iota_N*X1c*X1c*
@@ -392,13 +410,13 @@ void Qsc::calculate_grad_grad_B_tensor() {
 				    d_Y1s_d_varphi)*d_Y1s_d_varphi 
 				   + Y1s*(-(iota_N*d_Y1c_d_varphi) + 
 					  d2_Y1s_d_varphi2))))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 2, 1);
+  if (set_row_and_check(1, 2, 1)) return true;
 
   // Element 122
   work1 =(B0*B0*B0*B0*lp*lp*X1c*X1c*Y1s*curvature*
 	  (iota_N*X1c + 2*lp*Y1s*torsion))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 1, 2, 2);
+  if (set_row_and_check(1, 2, 2)) return true;
 
   // Element 200
   work1 =(B0*B0*B0*B0*lp*X1c*Y1s*
@@ -413,7 +431,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   Y1c*(iota_N*d_X1c_d_varphi + 
 		lp*torsion*d_Y1s_d_varphi) + 
 	   Y1s*d2_X1c_d_varphi2))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 0, 0);
+  if (set_row_and_check(2, 0, 0)) return true;
 
   
   // Element 201
@@ -427,7 +445,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		d2_Y1c_d_varphi2) + 
 	   Y1c*(2*iota_N*d_Y1c_d_varphi - 
 		d2_Y1s_d_varphi2)))/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 0, 1);
+  if (set_row_and_check(2, 0, 1)) return true;
 
   // Element 202
   work1 =(B0*B0*B0*B0*lp*lp*X1c*X1c*Y1s*
@@ -435,7 +453,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   curvature*d_Y1s_d_varphi + 
 	   Y1s*d_curvature_d_varphi))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 0, 2);
+  if (set_row_and_check(2, 0, 2)) return true;
 
   // Element 210
   work1 =-((B0*B0*B0*B0*lp*X1c*X1c*Y1s*
@@ -444,7 +462,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	     2*lp*torsion*d_Y1s_d_varphi + 
 	     lp*Y1s*d_torsion_d_varphi))/
 	   (G0*G0*G0));
-  grad_grad_B_tensor.set_row(work1, 2, 1, 0);
+  if (set_row_and_check(2, 1, 0)) return true;
 
   // Element 211
   work1 =-((B0*B0*B0*B0*lp*X1c*Y1s*
@@ -458,13 +476,13 @@ void Qsc::calculate_grad_grad_B_tensor() {
 		  lp*torsion*d_Y1s_d_varphi) + 
 	     X1c*(iota_N*d_Y1c_d_varphi - 
 		  d2_Y1s_d_varphi2)))/(G0*G0*G0));
-  grad_grad_B_tensor.set_row(work1, 2, 1, 1);
+  if (set_row_and_check(2, 1, 1)) return true;
   
   // Element 212
   work1 =(B0*B0*B0*B0*lp*lp*X1c*X1c*Y1s*curvature*
 	  (iota_N*X1c + 2*lp*Y1s*torsion))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 1, 2);
+  if (set_row_and_check(2, 1, 2)) return true;
 
   // Element 220
   work1 =(B0*B0*B0*B0*lp*lp*X1c*X1c*Y1s*
@@ -472,7 +490,7 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	   curvature*d_Y1s_d_varphi + 
 	   Y1s*d_curvature_d_varphi))/
     (G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 2, 0);
+  if (set_row_and_check(2, 2, 0)) return true;
 
   // Element 221
   work1 =-((B0*B0*B0*B0*lp*lp*X1c*Y1s*curvature*
@@ -480,46 +498,82 @@ void Qsc::calculate_grad_grad_B_tensor() {
 	     Y1s*(iota_N*Y1s + 
 		  d_Y1c_d_varphi) - 
 	     Y1c*d_Y1s_d_varphi))/(G0*G0*G0));
-  grad_grad_B_tensor.set_row(work1, 2, 2, 1);
+  if (set_row_and_check(2, 2, 1)) return true;
 
   // Element 222
   work1 =(-2*B0*B0*B0*B0*lp*lp*lp*X1c*X1c*Y1s*Y1s*
 	  curvature*curvature)/(G0*G0*G0);
-  grad_grad_B_tensor.set_row(work1, 2, 2, 2);
+  if (set_row_and_check(2, 2, 2)) return true;
+
+  return false;
+}
+
+/** Compute the grad grad B tensor and the scale length L_grad_grad_B.
+ *
+ * If min_L_grad_grad_B_to_keep > 0, the calculation stops as soon as
+ * it is clear that L_grad_grad_B is below this value at some grid
+ * point, i.e. that a scan would reject the configuration. In this case
+ * grad_grad_B_partial is set to true, grad_grad_B_tensor is incomplete,
+ * and L_grad_grad_B is an upper bound on the true value at each
+ * grid point.
+ */
+void Qsc::calculate_grad_grad_B_tensor(qscfloat min_L_grad_grad_B_to_keep) {
+  std::chrono::time_point<std::chrono::steady_clock> start;
+  if (verbose > 0) start = std::chrono::steady_clock::now();
+  if (verbose > 0) std::cout << "Beginning grad_grad_B tensor calculation" << std::endl;
+
+  // From eq (3.2) below, L_grad_grad_B < min_L_grad_grad_B_to_keep
+  // wherever the sum of the squared elements exceeds max_sum_sq:
+  qscfloat max_sum_sq = 0;
+  if (min_L_grad_grad_B_to_keep > 0) {
+    max_sum_sq = 4 * B0 / (min_L_grad_grad_B_to_keep * min_L_grad_grad_B_to_keep);
+    max_sum_sq *= max_sum_sq;
+    tempvec = 0;
+  }
+  grad_grad_B_partial = calculate_grad_grad_B_elements(max_sum_sq);
 
   // Compute the scale length L_{grad grad B},
   // eq (3.2) in Landreman JPP (2021):
-  for (int j = 0; j < nphi; j++) {
-    L_grad_grad_B[j] = sqrt(4 * B0 / sqrt(grad_grad_B_tensor(j, 0, 0, 0) * grad_grad_B_tensor(j, 0, 0, 0) +
-					  grad_grad_B_tensor(j, 0, 0, 1) * grad_grad_B_tensor(j, 0, 0, 1) +
-					  grad_grad_B_tensor(j, 0, 0, 2) * grad_grad_B_tensor(j, 0, 0, 2) +
-					  grad_grad_B_tensor(j, 0, 1, 0) * grad_grad_B_tensor(j, 0, 1, 0) +
-					  grad_grad_B_tensor(j, 0, 1, 1) * grad_grad_B_tensor(j, 0, 1, 1) +
-					  grad_grad_B_tensor(j, 0, 1, 2) * grad_grad_B_tensor(j, 0, 1, 2) +
-					  grad_grad_B_tensor(j, 0, 2, 0) * grad_grad_B_tensor(j, 0, 2, 0) +
-					  grad_grad_B_tensor(j, 0, 2, 1) * grad_grad_B_tensor(j, 0, 2, 1) +
-					  grad_grad_B_tensor(j, 0, 2, 2) * grad_grad_B_tensor(j, 0, 2, 2) +
-					  grad_grad_B_tensor(j, 1, 0, 0) * grad_grad_B_tensor(j, 1, 0, 0) +
-					  grad_grad_B_tensor(j, 1, 0, 1) * grad_grad_B_tensor(j, 1, 0, 1) +
-					  grad_grad_B_tensor(j, 1, 0, 2) * grad_grad_B_tensor(j, 1, 0, 2) +
-					  grad_grad_B_tensor(j, 1, 1, 0) * grad_grad_B_tensor(j, 1, 1, 0) +
-					  grad_grad_B_tensor(j, 1, 1, 1) * grad_grad_B_tensor(j, 1, 1, 1) +
-					  grad_grad_B_tensor(j, 1, 1, 2) * grad_grad_B_tensor(j, 1, 1, 2) +
-					  grad_grad_B_tensor(j, 1, 2, 0) * grad_grad_B_tensor(j, 1, 2, 0) +
-					  grad_grad_B_tensor(j, 1, 2, 1) * grad_grad_B_tensor(j, 1, 2, 1) +
-					  grad_grad_B_tensor(j, 1, 2, 2) * grad_grad_B_tensor(j, 1, 2, 2) +
-					  grad_grad_B_tensor(j, 2, 0, 0) * grad_grad_B_tensor(j, 2, 0, 0) +
-					  grad_grad_B_tensor(j, 2, 0, 1) * grad_grad_B_tensor(j, 2, 0, 1) +
-					  grad_grad_B_tensor(j, 2, 0, 2) * grad_grad_B_tensor(j, 2, 0, 2) +
-					  grad_grad_B_tensor(j, 2, 1, 0) * grad_grad_B_tensor(j, 2, 1, 0) +
-					  grad_grad_B_tensor(j, 2, 1, 1) * grad_grad_B_tensor(j, 2, 1, 1) +
-					  grad_grad_B_tensor(j, 2, 1, 2) * grad_grad_B_tensor(j, 2, 1, 2) +
-					  grad_grad_B_tensor(j, 2, 2, 0) * grad_grad_B_tensor(j, 2, 2, 0) +
-					  grad_grad_B_tensor(j, 2, 2, 1) * grad_grad_B_tensor(j, 2, 2, 1) +
-					  grad_grad_B_tensor(j, 2, 2, 2) * grad_grad_B_tensor(j, 2, 2, 2) ));
+  if (grad_grad_B_partial) {
+    for (int j = 0; j < nphi; j++) L_grad_grad_B[j] = sqrt(4 * B0 / sqrt(tempvec[j]));
+  } else {
+    for (int j = 0; j < nphi; j++) {
+      L_grad_grad_B[j] = sqrt(4 * B0 / sqrt(grad_grad_B_tensor(j, 0, 0, 0) * grad_grad_B_tensor(j, 0, 0, 0) +
+					    grad_grad_B_tensor(j, 0, 0, 1) * grad_grad_B_tensor(j, 0, 0, 1) +
+					    grad_grad_B_tensor(j, 0, 0, 2) * grad_grad_B_tensor(j, 0, 0, 2) +
+					    grad_grad_B_tensor(j, 0, 1, 0) * grad_grad_B_tensor(j, 0, 1, 0) +
+					    grad_grad_B_tensor(j, 0, 1, 1) * grad_grad_B_tensor(j, 0, 1, 1) +
+					    grad_grad_B_tensor(j, 0, 1, 2) * grad_grad_B_tensor(j, 0, 1, 2) +
+					    grad_grad_B_tensor(j, 0, 2, 0) * grad_grad_B_tensor(j, 0, 2, 0) +
+					    grad_grad_B_tensor(j, 0, 2, 1) * grad_grad_B_tensor(j, 0, 2, 1) +
+					    grad_grad_B_tensor(j, 0, 2, 2) * grad_grad_B_tensor(j, 0, 2, 2) +
+					    grad_grad_B_tensor(j, 1, 0, 0) * grad_grad_B_tensor(j, 1, 0, 0) +
+					    grad_grad_B_tensor(j, 1, 0, 1) * grad_grad_B_tensor(j, 1, 0, 1) +
+					    grad_grad_B_tensor(j, 1, 0, 2) * grad_grad_B_tensor(j, 1, 0, 2) +
+					    grad_grad_B_tensor(j, 1, 1, 0) * grad_grad_B_tensor(j, 1, 1, 0) +
+					    grad_grad_B_tensor(j, 1, 1, 1) * grad_grad_B_tensor(j, 1, 1, 1) +
+					    grad_grad_B_tensor(j, 1, 1, 2) * grad_grad_B_tensor(j, 1, 1, 2) +
+					    grad_grad_B_tensor(j, 1, 2, 0) * grad_grad_B_tensor(j, 1, 2, 0) +
+					    grad_grad_B_tensor(j, 1, 2, 1) * grad_grad_B_tensor(j, 1, 2, 1) +
+					    grad_grad_B_tensor(j, 1, 2, 2) * grad_grad_B_tensor(j, 1, 2, 2) +
+					    grad_grad_B_tensor(j, 2, 0, 0) * grad_grad_B_tensor(j, 2, 0, 0) +
+					    grad_grad_B_tensor(j, 2, 0, 1) * grad_grad_B_tensor(j, 2, 0, 1) +
+					    grad_grad_B_tensor(j, 2, 0, 2) * grad_grad_B_tensor(j, 2, 0, 2) +
+					    grad_grad_B_tensor(j, 2, 1, 0) * grad_grad_B_tensor(j, 2, 1, 0) +
+					    grad_grad_B_tensor(j, 2, 1, 1) * grad_grad_B_tensor(j, 2, 1, 1) +
+					    grad_grad_B_tensor(j, 2, 1, 2) * grad_grad_B_tensor(j, 2, 1, 2) +
+					    grad_grad_B_tensor(j, 2, 2, 0) * grad_grad_B_tensor(j, 2, 2, 0) +
+					    grad_grad_B_tensor(j, 2, 2, 1) * grad_grad_B_tensor(j, 2, 2, 1) +
+					    grad_grad_B_tensor(j, 2, 2, 2) * grad_grad_B_tensor(j, 2, 2, 2) ));
+    }
   }
   L_grad_grad_B_inverse = ((qscfloat)1.0) / L_grad_grad_B;
   grid_min_L_grad_grad_B = L_grad_grad_B.min();
+  if (fourier_extrema && !grad_grad_B_partial) {
+    min_L_grad_grad_B = 1 / fourier_maximum(L_grad_grad_B_inverse);
+  } else {
+    min_L_grad_grad_B = grid_min_L_grad_grad_B;
+  }
 
   if (verbose > 0) {
     auto end = std::chrono::steady_clock::now();    
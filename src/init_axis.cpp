@@ -105,7 +105,15 @@ void Qsc::init_axis() {
   grid_max_curvature = curvature.max();
   tempvec = curvature * curvature * d_l_d_phi;
   rms_curvature = sqrt((tempvec.sum() * d_phi * nfp) / axis_length);
-  // At this point in the fortran code, we find the exact max curvature.
+  // As in the fortran code, optionally find the exact max curvature and min R0
+  // between grid points:
+  if (fourier_extrema) {
+    min_R0 = fourier_minimum(R0);
+    max_curvature = fourier_maximum(curvature);
+  } else {
+    min_R0 = grid_min_R0;
+    max_curvature = grid_max_curvature;
+  }
   
   tempvec = R0 * d_l_d_phi;
   mean_R = tempvec.sum() * d_phi * nfp / axis_length;
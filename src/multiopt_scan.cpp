@@ -5,7 +5,9 @@
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <memory>
 #include "multiopt_scan.hpp"
+#include "background_writer.hpp"
 
 using namespace qsc;
 
@@ -16,6 +18,7 @@ void MultiOptScan::defaults() {
   max_seconds = 60;
   print_status_period = 20.0;
   save_period = 5 * 60.0;
+  async_output = false;
   quit_after_init = false;
   
   keep_all = true;
@@ -109,9 +112,21 @@ void MultiOptScan::scan() {
   int proc_that_finished, j;
   std::chrono::time_point<std::chrono::steady_clock> start_time2, end_time, start_time_print_status, start_time_save;
   std::chrono::duration<double> elapsed;
+  // Writes the intermediate results if async_output. A save that is
+  // still waiting when the next one is due is dropped, since each save
+  // rewrites the whole file:
+  BackgroundWriter output_writer;
   
   if (n_procs < 2)
     throw std::runtime_error("For MultiOptScan, the number of MPI processes must be at least 2.");
+  // The background writer runs alongside the MPI calls of the main
+  // thread, which needs MPI_THREAD_FUNNELED:
+  int mpi_thread_support;
+  MPI_Query_thread(&mpi_thread_support);
+  if (mpi_thread_support < MPI_THREAD_FUNNELED && async_output) {
+    if (proc0) std::cout << "The MPI library does not support threads, so using async_output = false." << std::endl;
+    async_output = false;
+  }
   if (n_procs - 1 > n_scan_all)
     throw std::runtime_error("For MultiOptScan, the number of MPI processes cannot exceed n_scan_all + 1.");
   
@@ -148,8 +163,20 @@ void MultiOptScan::scan() {
       elapsed = end_time - start_time_save;
       if (elapsed.count() > save_period) {
 	print_status();
-	filter_global_arrays();
-	write_netcdf();
+	if (async_output) {
+	  // The scan_* arrays of proc 0 stay empty until the end, so the
+	  // snapshot costs only the copy of the global arrays:
+	  std::shared_ptr<MultiOptScanOutput> snapshot = std::make_shared<MultiOptScanOutput>(*this);
+	  std::shared_ptr<Matrix> parameters_copy = std::make_shared<Matrix>(parameters);
+	  std::shared_ptr<std::valarray<int>> int_parameters_copy = std::make_shared<std::valarray<int>>(int_parameters);
+	  int n_scan_all_copy = n_scan_all;
+	  output_writer.submit([snapshot, parameters_copy, int_parameters_copy, n_scan_all_copy]() {
+	      snapshot->filter_global_arrays(*parameters_copy, *int_parameters_copy, n_scan_all_copy);
+	      snapshot->write_netcdf(); }, true);
+	} else {
+	  filter_global_arrays();
+	  write_netcdf();
+	}
 	start_time_save = end_time;
       }
 	
@@ -200,6 +227,9 @@ void MultiOptScan::scan() {
   elapsed = end_time - start_time;
   std::cout << "Proc " << mpi_rank << " finished after " << elapsed.count() << " seconds" << std::endl;
 
+  // The caller writes the final results, so the intermediate ones
+  // must be finished first:
+  output_writer.wait();
   MPI_Barrier(mpi_comm);
   if (proc0) {
     print_status();
@@ -692,6 +722,14 @@ void MultiOptScan::print_status() {
 }
 
 void MultiOptScan::filter_global_arrays() {
+  MultiOptScanOutput::filter_global_arrays(parameters, int_parameters, n_scan_all);
+}
+
+/** Fill the scan_* arrays with the kept configurations from the
+ * global arrays of results, which hold n_scan_all configurations.
+ */
+void MultiOptScanOutput::filter_global_arrays(const Matrix& parameters, const std::valarray<int>& int_parameters,
+					      int n_scan_all) {
   int j, k, j_global;
   std::chrono::time_point<std::chrono::steady_clock> start_time_filter, end_time;
   std::chrono::duration<double> elapsed;
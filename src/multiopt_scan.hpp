@@ -15,8 +15,17 @@
 
 namespace qsc {
 
-  class MultiOptScan {
-  private:
+  /** The inputs and results of a MultiOptScan that are saved in its
+   * output file. MultiOptScan derives from this, so that a
+   * MultiOptScanOutput copy of a MultiOptScan is a snapshot of
+   * everything write_netcdf() reads, without the global arrays of
+   * parameters or the MultiOpt object mo used for the calculation. With
+   * async_output, the background writer thread fills the scan_*
+   * arrays of such a snapshot from a copy of the global arrays, and
+   * writes it, while the scan continues.
+   */
+  class MultiOptScanOutput {
+  protected:
     enum {ATTEMPTS,
       KEPT,
       REJECTED_DUE_TO_R0,
@@ -36,17 +45,10 @@ namespace qsc {
       REJECTED_DUE_TO_MAX_D_XY3_D_VARPHI,
       N_FILTERS};
 
-    std::chrono::time_point<std::chrono::steady_clock> start_time;
-    int filters_local[N_FILTERS];
-    void defaults();
-    
   public:
-    MultiOpt mo_ref, mo;
-    MPI_Comm mpi_comm;
-    int mpi_rank, n_procs;
+    MultiOpt mo_ref;
     bool proc0;
-    qscfloat max_seconds, print_status_period, save_period;
-    int n_scan, n_scan_all, filters[N_FILTERS];
+    int n_scan, filters[N_FILTERS];
     qscfloat filter_fractions[N_FILTERS];
     qscfloat min_R0_to_keep, min_iota_to_keep, max_elongation_to_keep;
     qscfloat min_L_grad_B_to_keep, min_L_grad_grad_B_to_keep;
@@ -57,25 +59,7 @@ namespace qsc {
     bool keep_all;
     int verbose;
     std::string outfilename;
-    int ndim;
-    std::vector<std::string> params;
-    Vector params_max, params_min;
-    std::valarray<bool> params_log;
-    std::valarray<int> params_n, params_stage;
-    std::vector<Vector> params_vals;
     int axis_nmax_plus_1;
-    bool quit_after_init;
-    
-    const int n_parameters_base = 58;
-    const int n_int_parameters_base = 4;
-    const int n_int_parameters = n_int_parameters_base + N_FILTERS;
-    int n_parameters;
-    Matrix parameters;
-    std::valarray<int> int_parameters;
-    Vector parameters_single;
-    std::valarray<int> int_parameters_single;
-    std::valarray<int> n_solves_kept, attempts_per_proc;
-    qscfloat total_cpu_seconds;
     big n_evals;
     
     Vector scan_eta_bar, scan_sigma0, scan_B2s, scan_B2c;
@@ -105,6 +89,48 @@ namespace qsc {
     Vector scan_weight_grad_B, scan_weight_grad_grad_B, scan_weight_r_singularity;
     Vector scan_weight_axis_length, scan_target_axis_length, scan_weight_standard_deviation_of_R;
     Vector scan_weight_B20_mean;
+
+    const int n_parameters_base = 58;
+    const int n_int_parameters_base = 4;
+    
+    void filter_global_arrays(const Matrix&, const std::valarray<int>&, int);
+    void write_netcdf();
+  };
+
+  class MultiOptScan : public MultiOptScanOutput {
+  private:
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+    int filters_local[N_FILTERS];
+    void defaults();
+    
+  public:
+    MultiOpt mo;
+    MPI_Comm mpi_comm;
+    int mpi_rank, n_procs;
+    qscfloat max_seconds, print_status_period, save_period;
+    // If true, the intermediate results at each save_period are
+    // filtered and written by a background thread, from a copy of the
+    // global arrays, so proc 0 keeps handing out work meanwhile. The
+    // copy doubles the memory for the results on proc 0 while it is
+    // written, so this is false by default.
+    bool async_output;
+    int n_scan_all;
+    int ndim;
+    std::vector<std::string> params;
+    Vector params_max, params_min;
+    std::valarray<bool> params_log;
+    std::valarray<int> params_n, params_stage;
+    std::vector<Vector> params_vals;
+    bool quit_after_init;
+    
+    const int n_int_parameters = n_int_parameters_base + N_FILTERS;
+    int n_parameters;
+    Matrix parameters;
+    std::valarray<int> int_parameters;
+    Vector parameters_single;
+    std::valarray<int> int_parameters_single;
+    std::valarray<int> n_solves_kept, attempts_per_proc;
+    qscfloat total_cpu_seconds;
     
     MultiOptScan();
     void run(std::string);
@@ -115,7 +141,6 @@ namespace qsc {
     int proc0_recv();
     void print_status();
     void filter_global_arrays();
-    void write_netcdf();
   };
 }
 
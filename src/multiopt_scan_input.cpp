@@ -23,6 +23,7 @@ void MultiOptScan::input(std::string filename) {
   toml_read(varlist, indata, "verbose", verbose);
   toml_read(varlist, indata, "quit_after_init", quit_after_init);
   toml_read(varlist, indata, "save_period", save_period);
+  toml_read(varlist, indata, "async_output", async_output);
   toml_read(varlist, indata, "print_status_period", print_status_period);
   toml_read(varlist, indata, "max_seconds", max_seconds);
 
@@ -67,6 +68,7 @@ void MultiOptScan::input(std::string filename) {
       std::cout << ", " << params_n[j] << ", " << params_log[j] << ", " << params_stage[j] << std::endl;
     }
     std::cout << "save_period: " << save_period << std::endl;
+    std::cout << "async_output: " << async_output << std::endl;
     std::cout << "max_seconds: " << max_seconds << std::endl;
     std::cout << "keep_all: " << keep_all << std::endl;
     if (!keep_all) {
@@ -6,7 +6,7 @@
 
 using namespace qsc;
 
-void MultiOptScan::write_netcdf() {
+void MultiOptScanOutput::write_netcdf() {
   // Only proc 0 should run this subroutine:
   if (!proc0) return;
   
@@ -93,6 +93,8 @@ void MultiOptScan::write_netcdf() {
   nc.put("max_newton_iterations", mo_ref.opts[0].q.max_newton_iterations, "Maximum iterations of Newton's method for solving the sigma equation", "dimensionless");
   nc.put("max_linesearch_iterations", mo_ref.opts[0].q.max_linesearch_iterations, "Maximum number of times the step size is reduced in the line search for each iteration of Newton's method when solving the sigma equation", "dimensionless");
   nc.put("newton_tolerance", mo_ref.opts[0].q.newton_tolerance, "L2 norm of the residual used as a stopping criterion for Newton's method when solving the sigma equation", "dimensionless");
+  nc.put("newton_jacobian_period", mo_ref.opts[0].q.newton_jacobian_period, "Number of Newton iterations between evaluations and LU factorizations of the Jacobian when solving the sigma equation. 1 corresponds to the standard Newton method, larger values to the Shamanskii or chord methods.", "dimensionless");
+  nc.put("newton_linesearch_option", mo_ref.opts[0].q.newton_linesearch_option, "Line search used in each iteration of Newton's method when solving the sigma equation");
   nc.put("I2", mo_ref.opts[0].q.I2, "r^2 term in I(r), which is the toroidal current inside the flux surface times mu0/(2pi)", "Tesla/meter");
   //nc.put("d_phi", mo_ref.opts[0].q.d_phi, "Grid spacing in phi", "dimensionless");
   nc.put("B0", mo_ref.opts[0].q.B0, "Magnetic field magnitude on the magnetic axis", "Telsa");
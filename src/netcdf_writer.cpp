@@ -5,14 +5,25 @@
 #include <iomanip>
 #include <sstream>
 #include <netcdf.h>
+#include <netcdf_meta.h>
+#if NC_HAS_PARALLEL4
+#include <netcdf_par.h>
+#endif
 #include "qsc.hpp"
 #include "netcdf_writer.hpp"
 
 using namespace qsc;
 
-qsc::NetCDFWriter::NetCDFWriter(std::string filename, bool append) {
+qsc::NetCDFWriter::NetCDFWriter(std::string filename, bool append, bool update_in) {
   int retval;
-  if (append) {
+  parallel = false;
+  update = update_in;
+  if (update) {
+    // Overwrite variables in an existing netcdf file. The file stays
+    // in data mode, since nothing new is defined.
+    if ((retval = nc_open(filename.c_str(), NC_WRITE, &ncid)))
+      ERR(retval);
+  } else if (append) {
     // Add to an existing netcdf file:
     if ((retval = nc_open(filename.c_str(), NC_WRITE, &ncid)))
       ERR(retval);
@@ -29,20 +40,67 @@ qsc::NetCDFWriter::NetCDFWriter(std::string filename, bool append) {
   }
 }
 
+/**
+ * Create a new file that all the processes in an MPI communicator
+ * write to together, using the parallel I/O of NetCDF-4/HDF5. This
+ * constructor and all subsequent calls must be made by every process
+ * in the communicator, with the same variable names and
+ * dimensions. Each process can then supply a different part of the
+ * arrays using put_slab(). Such files cannot be read with
+ * scipy.io.netcdf, which only supports the classic format. If update
+ * is true, an existing file written this way is opened instead, as
+ * for the serial constructor.
+ */
+qsc::NetCDFWriter::NetCDFWriter(std::string filename, MPI_Comm mpi_comm, bool update_in) {
+#if NC_HAS_PARALLEL4
+  int retval;
+  parallel = true;
+  update = update_in;
+  if (update) {
+    if ((retval = nc_open_par(filename.c_str(), NC_WRITE | NC_MPIIO,
+			      mpi_comm, MPI_INFO_NULL, &ncid))) ERR(retval);
+  } else {
+    if ((retval = nc_create_par(filename.c_str(), NC_CLOBBER | NC_NETCDF4 | NC_MPIIO,
+				mpi_comm, MPI_INFO_NULL, &ncid))) ERR(retval);
+  }
+#else
+  throw std::runtime_error("Parallel output requires a NetCDF library built with parallel I/O (NC_HAS_PARALLEL4)");
+#endif
+}
+
 void qsc::NetCDFWriter::ERR(int e) {
   throw std::runtime_error(nc_strerror(e));
 }
 
 /**
- * Create a new dimension.
+ * Create a new dimension. A size of NC_UNLIMITED gives a dimension
+ * that can grow when the file is updated. In update mode, the
+ * existing dimension is returned.
  */
 int qsc::NetCDFWriter::dim(std::string dimname, int val) {
+  if (update) return get_dim(dimname);
   int dim_id, retval;
   if ((retval = nc_def_dim(ncid, dimname.c_str(), val, &dim_id)))
     ERR(retval);
   return dim_id;
 }
 
+/**
+ * Define a new variable, or in update mode, find the existing
+ * variable with the same name.
+ */
+int qsc::NetCDFWriter::def_var(std::string varname, nc_type type, int ndims, const int* dim_ids) {
+  int var_id, retval;
+  if (update) {
+    if ((retval = nc_inq_varid(ncid, varname.c_str(), &var_id)))
+      ERR(retval);
+  } else {
+    if ((retval = nc_def_var(ncid, varname.c_str(), type, ndims, dim_ids, &var_id)))
+      ERR(retval);
+  }
+  return var_id;
+}
+
 /**
  * Get the id for an existing dimension.
  */
@@ -54,10 +112,12 @@ int qsc::NetCDFWriter::get_dim(std::string dimname) {
 }
 
 /**
- * If an empty string is provided, no attribute is written.
+ * If an empty string is provided, no attribute is written. In update
+ * mode the attributes already exist, so nothing is written.
  */
 void qsc::NetCDFWriter::add_attribute(int var_id, std::string str, std::string units) {
   int retval;
+  if (update) return;
   if (str.size() > 0) {
     if ((retval = nc_put_att_text(ncid, var_id, "description",
 				  str.size(), str.c_str())))
@@ -72,9 +132,8 @@ void qsc::NetCDFWriter::add_attribute(int var_id, std::string str, std::string u
 
 void qsc::NetCDFWriter::put(std::string varname, int& val, std::string att, std::string units) {
   // Variant for scalar ints
-  int var_id, retval;
-  if ((retval = nc_def_var(ncid, varname.c_str(), NC_INT, 0, NULL, &var_id)))
-    ERR(retval);
+  int var_id;
+  var_id = def_var(varname, NC_INT, 0, NULL);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_INT);
   pointers.push_back((void*) &val);
@@ -83,9 +142,8 @@ void qsc::NetCDFWriter::put(std::string varname, int& val, std::string att, std:
 
 void qsc::NetCDFWriter::put(std::string varname, qscfloat& val, std::string att, std::string units) {
   // Variant for scalar floats
-  int var_id, retval;
-  if ((retval = nc_def_var(ncid, varname.c_str(), QSCFLOAT, 0, NULL, &var_id)))
-    ERR(retval);
+  int var_id;
+  var_id = def_var(varname, QSCFLOAT, 0, NULL);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_FLOAT);
   pointers.push_back((void*) &val);
@@ -97,10 +155,9 @@ void qsc::NetCDFWriter::put(std::string varname, big& val, std::string att, std:
   // Convert results to qscfloat, since long long ints require netcdf4, which scipy.io.netcdf cannot read
   qscfloat* floatval = new qscfloat;
   *floatval = (qscfloat) val;
-  int var_id, retval;
+  int var_id;
   //if ((retval = nc_def_var(ncid, varname.c_str(), NC_UINT64, 0, NULL, &var_id)))
-  if ((retval = nc_def_var(ncid, varname.c_str(), QSCFLOAT, 0, NULL, &var_id)))
-    ERR(retval);
+  var_id = def_var(varname, QSCFLOAT, 0, NULL);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_FLOAT);
   pointers.push_back((void*) floatval);
@@ -120,15 +177,14 @@ void qsc::NetCDFWriter::put(std::string varname, std::string& val, std::string a
   // See if this dimension already exists:
   int dim_id;
   retval = nc_inq_dimid(ncid, dim_str.c_str(), &dim_id);
-  if (retval != NC_NOERR) {
+  if (retval != NC_NOERR && !update) {
     // The dimension does not yet exist, so create it.
     if ((retval = nc_def_dim(ncid, dim_str.c_str(), len, &dim_id)))
       ERR(retval);
   }
 
   // Now that we have a dimension, define the string variable
-  if ((retval = nc_def_var(ncid, varname.c_str(), NC_CHAR, 1, &dim_id, &var_id)))
-    ERR(retval);
+  var_id = def_var(varname, NC_CHAR, 1, &dim_id);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_STRING);
   pointers.push_back((void*) &val[0]);
@@ -138,9 +194,8 @@ void qsc::NetCDFWriter::put(std::string varname, std::string& val, std::string a
 
 void qsc::NetCDFWriter::put(dim_id_type dim_id, std::string varname, std::valarray<int>& val, std::string att, std::string units) {
   // Variant for 1D int arrays
-  int var_id, retval;
-  if ((retval = nc_def_var(ncid, varname.c_str(), NC_INT, 1, &dim_id, &var_id)))
-    ERR(retval);
+  int var_id;
+  var_id = def_var(varname, NC_INT, 1, &dim_id);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_INT);
   pointers.push_back((void*) &val[0]);
@@ -149,9 +204,8 @@ void qsc::NetCDFWriter::put(dim_id_type dim_id, std::string varname, std::valarr
 
 void qsc::NetCDFWriter::put(dim_id_type dim_id, std::string varname, Vector& val, std::string att, std::string units) {
   // Variant for 1D float arrays
-  int var_id, retval;
-  if ((retval = nc_def_var(ncid, varname.c_str(), QSCFLOAT, 1, &dim_id, &var_id)))
-    ERR(retval);
+  int var_id;
+  var_id = def_var(varname, QSCFLOAT, 1, &dim_id);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_FLOAT);
   pointers.push_back((void*) &val[0]);
@@ -166,22 +220,82 @@ void qsc::NetCDFWriter::put(std::vector<dim_id_type> dim_id, std::string varname
   std::vector<dim_id_type> dim_id_reversed(dim_id);
   std::reverse(std::begin(dim_id_reversed), std::end(dim_id_reversed));
 
-  int var_id, retval;
-  if ((retval = nc_def_var(ncid, varname.c_str(), QSCFLOAT, dim_id.size(), &dim_id_reversed[0], &var_id)))
-    ERR(retval);
+  int var_id;
+  var_id = def_var(varname, QSCFLOAT, dim_id.size(), &dim_id_reversed[0]);
   var_ids.push_back(var_id);
   types.push_back(QSC_NC_FLOAT);
   pointers.push_back((void*) pointer);
   add_attribute(var_id, att, units);
 }
 
+/**
+ * Record that the variable most recently added is written only from
+ * index start to start + count - 1 of its last QSC dimension, which is
+ * the first NetCDF dimension. Other dimensions are written in full.
+ */
+void qsc::NetCDFWriter::add_slab(int var_index, std::vector<dim_id_type>& dim_id, size_t start, size_t count) {
+  int retval;
+  size_t len;
+  // NetCDF's dimension order is the reverse of QSC's:
+  std::vector<size_t> starts(dim_id.size(), 0), counts(dim_id.size());
+  for (size_t j = 0; j < dim_id.size(); j++) {
+    if ((retval = nc_inq_dimlen(ncid, dim_id[dim_id.size() - 1 - j], &len))) ERR(retval);
+    counts[j] = len;
+  }
+  starts[0] = start;
+  counts[0] = count;
+  slab_starts[var_index] = starts;
+  slab_counts[var_index] = counts;
+}
+
+void qsc::NetCDFWriter::put_slab(dim_id_type dim_id, size_t start, std::string varname, std::valarray<int>& val, std::string att, std::string units) {
+  // Variant for part of a 1D int array
+  int var_id;
+  var_id = def_var(varname, NC_INT, 1, &dim_id);
+  var_ids.push_back(var_id);
+  types.push_back(QSC_NC_INT);
+  pointers.push_back(val.size() > 0 ? (void*) &val[0] : NULL);
+  add_attribute(var_id, att, units);
+  std::vector<dim_id_type> dims {dim_id};
+  add_slab(var_ids.size() - 1, dims, start, val.size());
+}
+
+void qsc::NetCDFWriter::put_slab(dim_id_type dim_id, size_t start, std::string varname, Vector& val, std::string att, std::string units) {
+  // Variant for part of a 1D float array
+  int var_id;
+  var_id = def_var(varname, QSCFLOAT, 1, &dim_id);
+  var_ids.push_back(var_id);
+  types.push_back(QSC_NC_FLOAT);
+  pointers.push_back(val.size() > 0 ? (void*) &val[0] : NULL);
+  add_attribute(var_id, att, units);
+  std::vector<dim_id_type> dims {dim_id};
+  add_slab(var_ids.size() - 1, dims, start, val.size());
+}
+
+void qsc::NetCDFWriter::put_slab(std::vector<dim_id_type> dim_id, size_t start, std::string varname, Matrix& val, std::string att, std::string units) {
+  // Variant for part of a 2D float array. The columns of val are
+  // written starting at column "start" of the NetCDF variable.
+  std::vector<dim_id_type> dim_id_reversed(dim_id);
+  std::reverse(std::begin(dim_id_reversed), std::end(dim_id_reversed));
+
+  int var_id;
+  var_id = def_var(varname, QSCFLOAT, dim_id.size(), &dim_id_reversed[0]);
+  var_ids.push_back(var_id);
+  types.push_back(QSC_NC_FLOAT);
+  pointers.push_back(val.size() > 0 ? (void*) &val[0] : NULL);
+  add_attribute(var_id, att, units);
+  add_slab(var_ids.size() - 1, dim_id, start, val.ncols());
+}
+
 void qsc::NetCDFWriter::write_and_close() {
   int retval;
   bool verbose = false;
   char varname[NC_MAX_NAME];
   
   // End define mode. This tells netCDF we are done defining metadata.
-  if ((retval = nc_enddef(ncid))) ERR(retval);
+  if (!update) {
+    if ((retval = nc_enddef(ncid))) ERR(retval);
+  }
 
   // Write the data
   for (int j = 0; j < var_ids.size(); j++) {
@@ -190,7 +304,23 @@ void qsc::NetCDFWriter::write_and_close() {
       nc_inq_varname(ncid, var_ids[j], varname);
       std::cout << "NetCDFWriter::write_and_close: name:" << varname << std::endl;
     }
-    if (types[j] == QSC_NC_INT) {
+#if NC_HAS_PARALLEL4
+    // With parallel I/O, every process takes part in every write, so
+    // collective access lets HDF5 aggregate the hyperslabs:
+    if (parallel) {
+      if ((retval = nc_var_par_access(ncid, var_ids[j], NC_COLLECTIVE))) ERR(retval);
+    }
+#endif
+    if (slab_starts.count(j) > 0) {
+      // Only part of the variable is written by this process
+      if (verbose) std::cout << "NetCDFWriter::write_and_close: Writing a hyperslab" << std::endl;
+      if (types[j] == QSC_NC_INT) {
+	retval = nc_put_vara_int(ncid, var_ids[j], &slab_starts[j][0], &slab_counts[j][0], (int*) pointers[j]);
+      } else {
+	retval = nc_put_vara_qscfloat(ncid, var_ids[j], &slab_starts[j][0], &slab_counts[j][0], (qscfloat*) pointers[j]);
+      }
+      if (retval) ERR(retval);
+    } else if (types[j] == QSC_NC_INT) {
       // ints
       if (verbose) std::cout << "NetCDFWriter::write_and_close: Writing an int" << std::endl;
       if ((retval = nc_put_var_int(ncid, var_ids[j], (int*) pointers[j])))
@@ -1,4 +1,6 @@
 #include <vector>
+#include <map>
+#include <mpi.h>
 #include <netcdf.h>
 #include "qsc.hpp"
 
@@ -17,9 +19,11 @@ using namespace qsc;
 #ifdef SINGLE
 #define QSCFLOAT NC_FLOAT
 #define nc_put_var_qscfloat nc_put_var_float
+#define nc_put_vara_qscfloat nc_put_vara_float
 #else
 #define QSCFLOAT NC_DOUBLE
 #define nc_put_var_qscfloat nc_put_var_double
+#define nc_put_vara_qscfloat nc_put_vara_double
 #endif
 
 namespace qsc {
@@ -35,10 +39,18 @@ namespace qsc {
     std::vector<void*> pointers;
     enum {QSC_NC_INT, QSC_NC_FLOAT, QSC_NC_BIG, QSC_NC_STRING};
     std::vector<int> types;
+    // For variables that are written only in part by this process,
+    // the start and count arrays for nc_put_vara, keyed by the
+    // position of the variable in var_ids:
+    std::map<int, std::vector<size_t>> slab_starts, slab_counts;
+    bool parallel, update;
     static void ERR(int);
+    int def_var(std::string, nc_type, int, const int*);
+    void add_slab(int, std::vector<dim_id_type>&, size_t, size_t);
     
   public:
-    NetCDFWriter(std::string, bool);
+    NetCDFWriter(std::string, bool, bool update = false);
+    NetCDFWriter(std::string, MPI_Comm, bool update = false);
     dim_id_type dim(std::string, int);
     dim_id_type get_dim(std::string);
     void add_attribute(int, std::string, std::string);
@@ -53,6 +65,11 @@ namespace qsc {
     void put(dim_id_type, std::string, Vector&, std::string, std::string);
     // ND vectors for N > 1:
     void put(std::vector<dim_id_type>, std::string, qscfloat*, std::string, std::string);
+    // Arrays of which this process holds only the part beginning at
+    // the given index of the last dimension:
+    void put_slab(dim_id_type, size_t, std::string, std::valarray<int>&, std::string, std::string);
+    void put_slab(dim_id_type, size_t, std::string, Vector&, std::string, std::string);
+    void put_slab(std::vector<dim_id_type>, size_t, std::string, Matrix&, std::string, std::string);
     
     void write_and_close();
   };
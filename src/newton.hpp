@@ -0,0 +1,157 @@
+#ifndef QSC_NEWTON_H
+#define QSC_NEWTON_H
+
+#include <iostream>
+#include <valarray>
+#include "qsc.hpp"
+
+namespace qsc {
+
+  /** Use Newton's method to solve a nonlinear system of equations.
+   *
+   * This is the templated version of newton_solve. The residual and
+   * Jacobian can be any callables with the signatures
+   *   void residual_function(Vector& state, Vector& residual)
+   *   void jacobian_function(Vector& state, Matrix& jacobian)
+   * so they can be inlined, and no void* user data is needed. The
+   * Jacobian function is always called right after the residual
+   * function has been evaluated at the same state.
+   *
+   * The Jacobian is evaluated and LU-factorized only once every
+   * jacobian_period iterations. jacobian_period = 1 gives the
+   * standard Newton method. Larger values give the Shamanskii method,
+   * and a value larger than max_newton_iterations gives the chord
+   * method, in which each iteration costs O(n^2) rather than
+   * O(n^3). If the line search fails with stale LU factors, the
+   * Jacobian is refreshed and the iteration is repeated before giving
+   * up.
+   *
+   * @param linesearch_option One of NEWTON_LINESEARCH_BACKTRACK,
+   *        NEWTON_LINESEARCH_ARMIJO, or NEWTON_LINESEARCH_NONE.
+   * @param stats On exit, the number of iterations, line search steps,
+   *        residual evaluations, and factorizations that were used.
+   *
+   * All other parameters have the same meaning as in the
+   * function-pointer version of newton_solve in newton.cpp.
+   */
+  template<class Residual_function, class Jacobian_function>
+  int newton_solve(Residual_function&& residual_function,
+		   Jacobian_function&& jacobian_function,
+		   Vector& state,
+		   Vector& residual,
+		   Vector& state0, // Work array
+		   Vector& step_direction, // Work array
+		   std::valarray<int>& ipiv,
+		   Matrix& m,
+		   int max_newton_iterations,
+		   int max_linesearch_iterations,
+		   qscfloat tolerance,
+		   int verbose,
+		   int jacobian_period,
+		   int linesearch_option,
+		   NewtonStats& stats) {
+
+    // Coefficient for the sufficient-decrease condition in the Armijo line search:
+    const qscfloat armijo_c = 1.0e-4;
+    qscfloat tolerance_sq = tolerance * tolerance;
+    qscfloat last_residual_norm_sq, step_scale, acceptable_residual_norm_sq;
+    int j_newton, j_linesearch;
+    bool fresh_factors, accepted;
+    // Start with a count that forces a factorization on the first iteration:
+    int iterations_since_factorization = jacobian_period;
+
+    stats.iterations = 0;
+    stats.linesearch_steps = 0;
+    stats.residual_evaluations = 0;
+    stats.factorizations = 0;
+
+    // Find the initial residual:
+    residual_function(state, residual);
+    stats.residual_evaluations++;
+    qscfloat residual_norm_sq = dot_product(residual, residual);
+    if (verbose > 0) {
+      std::cout << "Initial squared residual norm: " << residual_norm_sq << std::endl;
+    }
+
+    for (j_newton = 0; j_newton < max_newton_iterations; j_newton++) {
+      last_residual_norm_sq = residual_norm_sq;
+      if (residual_norm_sq < tolerance_sq) return NEWTON_CONVERGED;
+      stats.iterations++;
+
+      state0 = state;
+      if (verbose > 0) std::cout << "  Newton iteration " << j_newton << std::endl;
+      while (true) {
+	fresh_factors = (iterations_since_factorization >= jacobian_period);
+	if (fresh_factors) {
+	  jacobian_function(state, m);
+	  // LAPACK over-writes the Jacobian with the LU factorization.
+	  lu_factor(m, ipiv);
+	  stats.factorizations++;
+	  iterations_since_factorization = 0;
+	  if (verbose > 0) std::cout << "    Factorized the Jacobian" << std::endl;
+	}
+
+	// step_direction = - matrix \ residual
+	step_direction = -residual;
+	lu_solve(m, step_direction, ipiv);
+
+	step_scale = 1.0;
+	accepted = false;
+	for (j_linesearch = 0; j_linesearch < max_linesearch_iterations; j_linesearch++) {
+	  state = state0 + step_scale * step_direction;
+	  residual_function(state, residual);
+	  stats.residual_evaluations++;
+	  stats.linesearch_steps++;
+	  residual_norm_sq = dot_product(residual, residual);
+	  if (verbose > 0) {
+	    std::cout << "    Line search step " << j_linesearch
+		      << "  Squared residual norm: " << residual_norm_sq << std::endl;
+	  }
+	  if (linesearch_option == NEWTON_LINESEARCH_NONE) {
+	    accepted = true;
+	    break;
+	  }
+	  if (linesearch_option == NEWTON_LINESEARCH_ARMIJO) {
+	    acceptable_residual_norm_sq = (1 - 2 * armijo_c * step_scale) * last_residual_norm_sq;
+	  } else {
+	    acceptable_residual_norm_sq = last_residual_norm_sq;
+	  }
+	  if (residual_norm_sq < acceptable_residual_norm_sq) {
+	    accepted = true;
+	    break;
+	  }
+	  step_scale /= 2.0;
+	}
+	// For the simple backtracking search, a final step that does
+	// not increase the residual is still accepted:
+	if (linesearch_option == NEWTON_LINESEARCH_BACKTRACK
+	    && residual_norm_sq <= last_residual_norm_sq) accepted = true;
+	if (accepted) break;
+
+	// If the line search fails, stop the Newton iteration:
+	state = state0;
+	if (fresh_factors) {
+	  if (verbose > 0) std::cout << "Line search failed to reduce residual." << std::endl;
+	  return NEWTON_LINESEARCH_FAILED;
+	}
+	// The step was computed from stale LU factors, so refresh the
+	// Jacobian at state0 and try again. The residual must be
+	// re-evaluated first, since the Jacobian function may rely on it.
+	if (verbose > 0) std::cout << "    Line search failed with stale factors. Refreshing Jacobian." << std::endl;
+	residual_function(state, residual);
+	stats.residual_evaluations++;
+	residual_norm_sq = last_residual_norm_sq;
+	iterations_since_factorization = jacobian_period;
+      }
+      iterations_since_factorization++;
+    }
+
+    if (residual_norm_sq < tolerance_sq) {
+      return NEWTON_CONVERGED;
+    } else {
+      return NEWTON_MAX_ITERATIONS;
+    }
+  }
+}
+
+#endif
@@ -25,6 +25,8 @@ void Opt::optimize() {
   if (vary_R0s.size() != q.R0s.size()) throw std::runtime_error("Size of vary_R0s is incorrect");
   if (vary_Z0c.size() != q.Z0c.size()) throw std::runtime_error("Size of vary_Z0c is incorrect");
   if (vary_Z0s.size() != q.Z0s.size()) throw std::runtime_error("Size of vary_Z0s is incorrect");
+  // The number of residual terms depends on nphi, so nphi cannot change during the optimization:
+  if (q.nphi_tolerance > 0) throw std::runtime_error("nphi_tolerance > 0 is not supported for optimization. Use the opt nphi array instead.");
   
   // Add fourier_refine modes to the end of input arrays:
   Vector axis_arr;
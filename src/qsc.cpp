@@ -23,6 +23,9 @@ void Qsc::defaults() {
 
   max_newton_iterations = 12;
   max_linesearch_iterations = 4;
+  newton_jacobian_period = 1;
+  newton_linesearch_option = NEWTON_LINESEARCH_OPTION_BACKTRACK;
+  newton_linesearch = NEWTON_LINESEARCH_BACKTRACK;
   if (single) {
     newton_tolerance = 1.0e-5;
   } else {
@@ -30,6 +33,12 @@ void Qsc::defaults() {
   }
 
   order_r_option = "r1";
+  fourier_extrema = false;
+  // nphi_tolerance = 0 means nphi is never adjusted automatically.
+  nphi_tolerance = 0.0;
+  // min_nphi = 0 means the adaptive calculation starts from nphi.
+  min_nphi = 0;
+  max_nphi = 401;
 }
 
 Qsc::Qsc() {
@@ -52,6 +61,16 @@ Qsc::Qsc() {
   grid_min_L_grad_grad_B = 0.0;
   r_singularity_robust = 0.0;
   r_hat_singularity_robust = 0.0;
+  min_R0 = 0.0;
+  max_curvature = 0.0;
+  max_elongation = 0.0;
+  min_L_grad_B = 0.0;
+  min_L_grad_grad_B = 0.0;
+  min_r_singularity = 0.0;
+  spectral_tail = 0.0;
+  grad_grad_B_partial = false;
+  r_singularity_partial = false;
+  nphi_refinements = 0;
   helicity = 0;
   B20_grid_variation = 0.0;
   B20_residual = 0.0;
@@ -74,11 +93,20 @@ void Qsc::calculate() {
   std::chrono::time_point<std::chrono::steady_clock> start;
   if (verbose > 0) start = std::chrono::steady_clock::now();
 
+  nphi_refinements = 0;
+  if (nphi_tolerance > 0 && min_nphi > 0 && nphi != min_nphi) {
+    // Start from the coarse grid, and let adapt_nphi() refine it:
+    nphi = min_nphi;
+    allocate();
+  }
   init_axis();
   solve_sigma_equation();
   r1_diagnostics();
+  // The same sequence of resolution checks is used in Scan::random():
+  if (nphi_tolerance > 0) adapt_nphi(false);
   if (at_least_order_r2) {
     calculate_r2();
+    if (nphi_tolerance > 0) adapt_nphi(true);
     r2_diagnostics();
   }
 
@@ -12,6 +12,10 @@ namespace qsc {
   typedef unsigned long long int big;
   
   Matrix differentiation_matrix(const int N, const qscfloat xmin, const qscfloat xmax);
+  qscfloat fourier_minimum(Vector&);
+  qscfloat fourier_maximum(Vector&);
+  void fourier_interpolate(Vector&, Vector&);
+  qscfloat fourier_tail(Vector&);
 
   typedef void (*residual_function_type)(Vector&, Vector&, void*);
   typedef void (*jacobian_function_type)(Vector&, Matrix&, void*);
@@ -19,6 +23,21 @@ namespace qsc {
 		    Vector&, Vector&, Vector&, Vector&, std::valarray<int>&,
 		    Matrix&, int, int, qscfloat, int, void*);
 
+  enum {
+    NEWTON_LINESEARCH_BACKTRACK,
+    NEWTON_LINESEARCH_ARMIJO,
+    NEWTON_LINESEARCH_NONE};
+
+  const std::string NEWTON_LINESEARCH_OPTION_BACKTRACK = "backtrack";
+  const std::string NEWTON_LINESEARCH_OPTION_ARMIJO = "armijo";
+  const std::string NEWTON_LINESEARCH_OPTION_NONE = "none";
+
+  /** Work counts from one call of newton_solve.
+   */
+  struct NewtonStats {
+    int iterations, linesearch_steps, residual_evaluations, factorizations;
+  };
+
   const std::string ORDER_R_OPTION_R1 = "r1";
   const std::string ORDER_R_OPTION_R2 = "r2";
   const std::string ORDER_R_OPTION_R2p1 = "r2.1";
@@ -50,11 +69,13 @@ namespace qsc {
     Vector fY0_from_X20, fY0_from_Y20, fY0_inhomogeneous;
     Vector fYs_from_X20, fYs_from_Y20, fYs_inhomogeneous;
     Vector fYc_from_X20, fYc_from_Y20, fYc_inhomogeneous;
+    bool warm_start_sigma;
     
     void calculate_helicity();
     static void sigma_eq_residual(Vector&, Vector&, void*);
     static void sigma_eq_jacobian(Vector&, Matrix&, void*);
     void calculate_grad_B_tensor();
+    bool calculate_grad_grad_B_elements(qscfloat);
     
   public:
     int verbose;
@@ -72,7 +93,10 @@ namespace qsc {
     Vector X1s, X1c, sigma, Y1s, Y1c, elongation;
     Vector Boozer_toroidal_angle, L_grad_B, L_grad_B_inverse;
     Vector L_grad_grad_B, L_grad_grad_B_inverse;
-    int max_newton_iterations, max_linesearch_iterations;
+    int max_newton_iterations, max_linesearch_iterations, newton_jacobian_period;
+    std::string newton_linesearch_option;
+    int newton_linesearch;
+    NewtonStats newton_stats;
     qscfloat newton_tolerance, grid_min_R0, G2, I2_over_B0;
     qscfloat iota, iota_N, grid_max_curvature, grid_max_elongation, mean_elongation;
     std::string order_r_option;
@@ -92,7 +116,12 @@ namespace qsc {
     Vector d2_Z20_d_varphi2, d2_Z2s_d_varphi2, d2_Z2c_d_varphi2;
     qscfloat d2_volume_d_psi2, DGeod_times_r2, DWell_times_r2, DMerc_times_r2;
     qscfloat r_singularity_robust;
+    bool grad_grad_B_partial, r_singularity_partial;
+    bool fourier_extrema;
+    qscfloat min_R0, max_curvature, max_elongation, min_L_grad_B, min_L_grad_grad_B, min_r_singularity;
     Vector r_hat_singularity_robust;
+    qscfloat nphi_tolerance, spectral_tail;
+    int min_nphi, max_nphi, nphi_refinements;
     int newton_result;
     Vector X3c1, X3c3, X3s1, X3s3, Y3c1, Y3c3, Y3s1, Y3s3;
     Vector Z3c1, Z3c3, Z3s1, Z3s3, lambda_for_XY3;
@@ -122,9 +151,13 @@ namespace qsc {
     void write_netcdf(std::string);
     void read_netcdf(std::string, char);
     void run(std::string);
-    void calculate_grad_grad_B_tensor();
+    void calculate_grad_grad_B_tensor(qscfloat min_L_grad_grad_B_to_keep = -1.0);
     void mercier();
-    void calculate_r_singularity();
+    void calculate_r_singularity(qscfloat min_r_singularity_to_keep = -1.0);
+    qscfloat measure_spectral_tail(bool);
+    int refined_nphi();
+    void recalculate_refined(bool);
+    void adapt_nphi(bool);
   };
   
   std::string outfile(std::string);
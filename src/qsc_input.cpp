@@ -18,6 +18,9 @@ void qsc::Qsc::input(std::string filename) {
   //auto varlist = std::vector<std::string>({"R0c", "R0s", "Z0c", "Z0s"});
   
   toml_read(varlist, indata, "nphi", nphi);
+  toml_read(varlist, indata, "nphi_tolerance", nphi_tolerance);
+  toml_read(varlist, indata, "min_nphi", min_nphi);
+  toml_read(varlist, indata, "max_nphi", max_nphi);
   toml_read(varlist, indata, "nfp", nfp);
   toml_read(varlist, indata, "eta_bar", eta_bar);
   toml_read(varlist, indata, "spsi", spsi);
@@ -31,8 +34,11 @@ void qsc::Qsc::input(std::string filename) {
   toml_read(varlist, indata, "max_newton_iterations", max_newton_iterations);
   toml_read(varlist, indata, "max_linesearch_iterations", max_linesearch_iterations);
   toml_read(varlist, indata, "newton_tolerance", newton_tolerance);
+  toml_read(varlist, indata, "newton_jacobian_period", newton_jacobian_period);
+  toml_read(varlist, indata, "newton_linesearch_option", newton_linesearch_option);
   toml_read(varlist, indata, "verbose", verbose);
   toml_read(varlist, indata, "order_r_option", order_r_option);
+  toml_read(varlist, indata, "fourier_extrema", fourier_extrema);
   toml_read(varlist, indata, "R0c", R0c);
   toml_read(varlist, indata, "R0s", R0s);
   toml_read(varlist, indata, "Z0c", Z0c);
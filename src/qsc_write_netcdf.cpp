@@ -51,6 +51,17 @@ void Qsc::write_netcdf(std::string filename) {
   nc.put("grid_max_elongation", grid_max_elongation, "Maximum elongation (ratio of major to minor axes of the O(r^1) elliptical surfaces in the plane perpendicular to the magnetic axis), maximizing only over the phi grid points and not interpolating in between", "dimensionless");
   nc.put("grid_min_R0", grid_min_R0, "Minimum major radius of the magnetic axis, minimizing only over the phi grid points and not interpolating in between", "meter");
   nc.put("grid_min_L_grad_B", grid_min_L_grad_B, "Minimum of L_grad_B over the phi grid points", "meter");
+  nc.put("nphi_tolerance", nphi_tolerance, "If > 0, nphi was increased from its input value, or from min_nphi if min_nphi > 0, until the relative Fourier tail of curvature, sigma, and X20 was below this value", "dimensionless");
+  nc.put("min_nphi", min_nphi, "If > 0 and nphi_tolerance > 0, the calculation started from this nphi rather than the input nphi", "dimensionless");
+  nc.put("max_nphi", max_nphi, "Upper limit on nphi when nphi_tolerance > 0", "dimensionless");
+  nc.put("spectral_tail", spectral_tail, "Largest Fourier amplitude in the upper third of the resolved modes of curvature, sigma, and X20, relative to the largest amplitude. Only computed if nphi_tolerance > 0.", "dimensionless");
+  nc.put("nphi_refinements", nphi_refinements, "Number of times nphi was increased because the spectral tail exceeded nphi_tolerance", "dimensionless");
+  int fourier_extrema_int = (int) fourier_extrema;
+  nc.put("fourier_extrema", fourier_extrema_int, "If 1, the extrema max_curvature, min_R0, max_elongation, min_L_grad_B, min_L_grad_grad_B, and min_r_singularity are found from the trigonometric interpolant between the phi grid points. If 0, they are equal to the corresponding grid_ values.", "dimensionless");
+  nc.put("max_curvature", max_curvature, "Maximum curvature of the magnetic axis. See fourier_extrema.", "1/meter");
+  nc.put("max_elongation", max_elongation, "Maximum elongation (ratio of major to minor axes of the O(r^1) elliptical surfaces in the plane perpendicular to the magnetic axis). See fourier_extrema.", "dimensionless");
+  nc.put("min_R0", min_R0, "Minimum major radius of the magnetic axis. See fourier_extrema.", "meter");
+  nc.put("min_L_grad_B", min_L_grad_B, "Minimum of L_grad_B along the magnetic axis. See fourier_extrema.", "meter");
   nc.put("mean_elongation", mean_elongation, "Average elongation (ratio of major to minor axes of the O(r^1) elliptical surfaces in the plane perpendicular to the magnetic axis), where the average is taken with respect to arclength", "dimensionless");
   nc.put("mean_R", mean_R, "Average major radius of the magnetic axis, where the average is taken with respect to arclength", "meter");
   nc.put("mean_Z", mean_Z, "Average Z coordinate of the magnetic axis, where the average is taken with respect to arclength", "meter");
@@ -59,6 +70,11 @@ void Qsc::write_netcdf(std::string filename) {
   nc.put("max_newton_iterations", max_newton_iterations, "Maximum iterations of Newton's method for solving the sigma equation", "dimensionless");
   nc.put("max_linesearch_iterations", max_linesearch_iterations, "Maximum number of times the step size is reduced in the line search for each iteration of Newton's method when solving the sigma equation", "dimensionless");
   nc.put("newton_tolerance", newton_tolerance, "L2 norm of the residual used as a stopping criterion for Newton's method when solving the sigma equation", "dimensionless");
+  nc.put("newton_jacobian_period", newton_jacobian_period, "Number of Newton iterations between evaluations and LU factorizations of the Jacobian when solving the sigma equation. 1 corresponds to the standard Newton method, larger values to the Shamanskii or chord methods.", "dimensionless");
+  nc.put("newton_linesearch_option", newton_linesearch_option, "Line search used in each iteration of Newton's method when solving the sigma equation");
+  nc.put("newton_iterations", newton_stats.iterations, "Number of Newton iterations used to solve the sigma equation", "dimensionless");
+  nc.put("newton_linesearch_steps", newton_stats.linesearch_steps, "Total number of line search steps used to solve the sigma equation", "dimensionless");
+  nc.put("newton_factorizations", newton_stats.factorizations, "Number of LU factorizations of the Jacobian used to solve the sigma equation", "dimensionless");
   nc.put("iota", iota, "Rotational transform", "dimensionless");
   nc.put("iota_N", iota_N, "Rotational transform minus N", "dimensionless");
   if (at_least_order_r2) {
@@ -76,6 +92,8 @@ void Qsc::write_netcdf(std::string filename) {
     nc.put("DMerc_times_r2", DMerc_times_r2, "Overall Mercier stability criterion times the square of the effective minor radius r. DMerc (without the r^2) corresponds to the quantity DMerc in VMEC, and to DMerc in Landreman and Jorge, J Plasma Phys (2020).", "Tesla^{-2} meter^{-2}");
     nc.put("grid_min_L_grad_grad_B", grid_min_L_grad_grad_B, "Minimum of L_grad_grad_B over the phi grid points", "meter");
     nc.put("r_singularity_robust", r_singularity_robust, "Robust estimate of the minor radius at which the flux surface shapes become singular, r_c, as detailed in section 4.2 of Landreman, J Plasma Physics (2021)", "meter");
+    nc.put("min_L_grad_grad_B", min_L_grad_grad_B, "Minimum of L_grad_grad_B along the magnetic axis. See fourier_extrema.", "meter");
+    nc.put("min_r_singularity", min_r_singularity, "Same as r_singularity_robust, except that if fourier_extrema = 1, the minimum is taken over the trigonometric interpolant between the phi grid points.", "meter");
     nc.put("grid_max_XY2", grid_max_XY2, "Maximum over phi of the absolute values of X20, X2c, X2s, Y20, Y2c, and Y2s", "1/meter");
     nc.put("grid_max_Z2", grid_max_Z2, "Maximum over phi of the absolute values of Z20, Z2c, and Z2s", "1/meter");
     nc.put("grid_max_d_XY2_d_varphi", grid_max_d_XY2_d_varphi, "Maximum over phi of the absolute values of the d/dvarphi derivatives of X20, X2c, X2s, Y20, Y2c, and Y2s", "1/meter");
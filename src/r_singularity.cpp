@@ -6,8 +6,15 @@
 using namespace qsc;
 
 /** Compute \hat{r}_c(\varphi) from section 4 of Landreman, J Plasma Physics (2021).
+ *
+ * If min_r_singularity_to_keep > 0, the loop over grid points stops as
+ * soon as \hat{r}_c is below this value at any point, i.e. as soon as
+ * it is clear that a scan would reject the configuration. In this case
+ * r_singularity_partial is set to true, r_hat_singularity_robust is
+ * set to 1e30 at the grid points that were not computed, and
+ * r_singularity_robust is the minimum over the points that were.
  */
-void Qsc::calculate_r_singularity() {
+void Qsc::calculate_r_singularity(qscfloat min_r_singularity_to_keep) {
   qscfloat lp = abs_G0_over_B0; // shorthand
   int j;
   qscfloat K0, K2s, K2c, K4s, K4c;
@@ -36,6 +43,7 @@ void Qsc::calculate_r_singularity() {
     imag_tol = 1.0e-7;
   }
   
+  r_singularity_partial = false;
   for (j = 0; j < nphi; j++) {
     if (verbose > 1) std::cout << "---- r_singularity calculation for jphi = " << j << " ----" << std::endl;
     
@@ -397,9 +405,23 @@ void Qsc::calculate_r_singularity() {
       } // loop over 2 signs of varsigma
     } // loop over the 4 roots of w polynomial
     r_hat_singularity_robust[j] = rc;
+    if (min_r_singularity_to_keep > 0 && rc < min_r_singularity_to_keep) {
+      if (verbose > 1) std::cout << "rc is below min_r_singularity_to_keep, so stopping early." << std::endl;
+      r_singularity_partial = true;
+      r_hat_singularity_robust[std::slice(j + 1, nphi - j - 1, 1)] = 1.0e+30;
+      break;
+    }
   } // loop over nphi
   
   r_singularity_robust = r_hat_singularity_robust.min();
+  // Interpolating is only meaningful if a singularity was found at
+  // every grid point, since otherwise r_hat_singularity_robust has
+  // the placeholder value 1e30 at some points.
+  if (fourier_extrema && r_hat_singularity_robust.max() < 1.0e+29) {
+    min_r_singularity = fourier_minimum(r_hat_singularity_robust);
+  } else {
+    min_r_singularity = r_singularity_robust;
+  }
   
   if (verbose > 0) {
     auto end = std::chrono::steady_clock::now();    
@@ -1,11 +1,35 @@
 #include <cmath>
 #include <chrono>
-#include <random>
 #include <stdexcept>
 #include "random.hpp"
 
 using namespace qsc;
 
+/** Philox4x32-10, following the reference implementation in
+ * Random123. result may not alias counter.
+ */
+void qsc::philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t result[4]) {
+  const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  uint64_t product0, product1;
+  for (int round = 0; round < 10; round++) {
+    product0 = (uint64_t) M0 * c0;
+    product1 = (uint64_t) M1 * c2;
+    c0 = (uint32_t) (product1 >> 32) ^ c1 ^ k0;
+    c1 = (uint32_t) product1;
+    c2 = (uint32_t) (product0 >> 32) ^ c3 ^ k1;
+    c3 = (uint32_t) product0;
+    k0 += W0;
+    k1 += W1;
+  }
+  result[0] = c0;
+  result[1] = c1;
+  result[2] = c2;
+  result[3] = c3;
+}
+
 /**
  * Policy on signs:
  * - Swapping min and max never has any effect.
@@ -18,22 +42,27 @@ using namespace qsc;
 Random::Random(bool deterministic_in,
 	       std::string distrib_in,
 	       qscfloat min_in,
-	       qscfloat max_in) :
-  // Call constructor of member objects:
-  uniform_distrib(0.0, 1.0)
+	       qscfloat max_in,
+	       std::string sequence_in,
+	       int dimension_in,
+	       int n_dimensions,
+	       unsigned long long seed_in)
 {
   deterministic = deterministic_in;
   min = min_in;
   max = max_in;
   logmin = log(std::abs(min));
   logmax = log(std::abs(max));
-  last = 0.0;
 
   sign = 1;
   if (max < 0) sign = -1;
 
-  unsigned my_seed = std::chrono::steady_clock::now().time_since_epoch().count();
-  generator.seed(my_seed);
+  dimension = dimension_in;
+  seed = seed_in;
+  if (seed == 0 && !deterministic) {
+    seed = std::chrono::steady_clock::now().time_since_epoch().count();
+    if (seed == 0) seed = 1;
+  }
   
   // Convert string to int for speed later.
   if (distrib_in.compare(RANDOM_OPTION_LINEAR) == 0) {
@@ -56,24 +85,128 @@ Random::Random(bool deterministic_in,
   } else {
     throw std::runtime_error("Unrecognized random distribution type");
   }
+
+  if (dimension < 0 || dimension >= n_dimensions)
+    throw std::runtime_error("Error initializing Random: dimension must be in the range 0 to n_dimensions - 1");
+  start = 0;
+  increment = 0;
+  halton_base = 2;
+  if (sequence_in.compare(RANDOM_SEQUENCE_GOLDEN_RATIO) == 0) {
+    sequence = RANDOM_INT_SEQUENCE_GOLDEN_RATIO;
+    // 2^64 times the fractional part of the golden ratio, rounded:
+    increment = 0x9E3779B97F4A7C15ULL;
+    
+  } else if (sequence_in.compare(RANDOM_SEQUENCE_R_D) == 0) {
+    sequence = RANDOM_INT_SEQUENCE_R_D;
+    // The R_d sequence of Roberts (2018): x_n = frac(1/2 + n alpha),
+    // with alpha_k = phi_d^{-(k+1)}, where phi_d is the positive root
+    // of x^{d+1} = x + 1.
+    long double phi_d = 2.0L;
+    for (int j = 0; j < 50; j++) {
+      phi_d -= (powl(phi_d, n_dimensions + 1) - phi_d - 1) / ((n_dimensions + 1) * powl(phi_d, n_dimensions) - 1);
+    }
+    long double alpha = powl(phi_d, -(dimension + 1));
+    alpha -= floorl(alpha);
+    increment = (unsigned long long) ldexpl(alpha, 64);
+    start = 1ULL << 63;
+    
+  } else if (sequence_in.compare(RANDOM_SEQUENCE_HALTON) == 0) {
+    sequence = RANDOM_INT_SEQUENCE_HALTON;
+    // The base for each dimension is the (dimension + 1)th prime:
+    int n_primes = 0;
+    for (unsigned long long candidate = 2; n_primes <= dimension; candidate++) {
+      bool is_prime = true;
+      for (unsigned long long factor = 2; factor * factor <= candidate; factor++) {
+	if (candidate % factor == 0) {
+	  is_prime = false;
+	  break;
+	}
+      }
+      if (is_prime) {
+	halton_base = candidate;
+	n_primes++;
+      }
+    }
+    
+  } else {
+    throw std::runtime_error("Unrecognized random sequence type");
+  }
+  position = 0;
 }
 
+/** Return the random number at the current position in the sequence,
+ * and advance the position.
+ */
 qscfloat Random::get() {
+  return get_nth(position++);
+}
+
+/** Return the random number at the 0-based position n in the
+ * sequence, without changing the current position.
+ */
+qscfloat Random::get_nth(unsigned long long n) const {
   // Explicitly handle the case of min==max, to avoid evaluating log(0).
   if (max == min) return max;
   //if (std::abs(max - min) < 1.0e-30) return max;
   
-  // First, get a random float in [0, 1]:
-  qscfloat rand01, temp;
-  if (deterministic) {
-    last = std::fmod(last + gamma, (qscfloat)1.0);
-    rand01 = last;
+  return map_uniform(uniform_nth(n));
+}
+
+/** Return the float in [0, 1] at the 0-based position n in the
+ * underlying uniform sequence.
+ */
+qscfloat Random::uniform_nth(unsigned long long n) const {
+  double val = 0;
+  unsigned long long bits, m;
+  double factor;
+  uint32_t counter[4], key[2], result[4];
+
+  if (!deterministic) {
+    counter[0] = (uint32_t) n;
+    counter[1] = (uint32_t) (n >> 32);
+    counter[2] = (uint32_t) dimension;
+    counter[3] = 0;
+    key[0] = (uint32_t) seed;
+    key[1] = (uint32_t) (seed >> 32);
+    philox4x32(counter, key, result);
+    bits = ((unsigned long long) result[0] << 32) | result[1];
+    val = std::ldexp((double) (bits >> 11), -53);
+    
   } else {
-    rand01 = uniform_distrib(generator);
+    switch (sequence) {
+    case RANDOM_INT_SEQUENCE_GOLDEN_RATIO:
+    case RANDOM_INT_SEQUENCE_R_D:
+      // Unsigned overflow gives the exact fractional part:
+      bits = start + (n + 1) * increment;
+      // Keep the 53 most significant bits, so the result is exactly
+      // representable and < 1:
+      val = std::ldexp((double) (bits >> 11), -53);
+      break;
+      
+    case RANDOM_INT_SEQUENCE_HALTON:
+      // Radical inverse of the index in base halton_base:
+      m = n + 1;
+      factor = 1.0 / halton_base;
+      while (m > 0) {
+	val += (m % halton_base) * factor;
+	m /= halton_base;
+	factor /= halton_base;
+      }
+      break;
+      
+    default:
+      throw std::runtime_error("Unrecognized random sequence type");
+    }
   }
+  // Rounding to single precision could give exactly 1:
+  if ((qscfloat) val >= 1) return std::nextafter((qscfloat) 1, (qscfloat) 0);
+  return val;
+}
 
-  // Map to the distribution we want
-  qscfloat val = 0.0;
+/** Map a float in [0, 1] to the distribution we want.
+ */
+qscfloat Random::map_uniform(qscfloat rand01) const {
+  qscfloat val = 0.0, temp;
   switch (distrib) {
   case RANDOM_INT_OPTION_LINEAR:
     val = min + (max - min) * rand01;
@@ -96,15 +229,136 @@ qscfloat Random::get() {
   return val;
 }
 
-/** For deterministic=true, set the position in the "random" number
- * sequence to the 0-based position n. For deterministic=false this
- * function has no effect.
+/** Fill values with the random numbers at positions first, first + 1,
+ * ..., first + values.size() - 1 of the sequence, giving the same
+ * results as get_nth(). The map to the distribution, including the
+ * exp() for the log distributions, is applied to the whole array at
+ * once, so it can be vectorized. The current position is not changed.
  */
-void Random::set_to_nth(int n) {
-  // This next version introduces roundoff-scale errors that are
-  //sufficient to affect single-precision tests.
-  // last = std::fmod(n * gamma, (qscfloat)1.0);
-  
-  last = 0.0;
-  for (int j = 0; j < n; j++) get();
+void Random::get_batch(unsigned long long first, Vector& values) const {
+  if (max == min) {
+    values = max;
+    return;
+  }
+  get_uniform_batch(first, values);
+  map_batch(values);
+}
+
+/** Fill values with the floats in [0, 1] at positions first, first +
+ * 1, ..., first + values.size() - 1 of the underlying uniform
+ * sequence, before they are mapped to the distribution.
+ */
+void Random::get_uniform_batch(unsigned long long first, Vector& values) const {
+  const int n = values.size();
+  for (int j = 0; j < n; j++) values[j] = uniform_nth(first + j);
+}
+
+/** Map an array of floats in [0, 1] to the distribution we want, in
+ * place. This is map_uniform() applied to the whole array at once.
+ */
+void Random::map_batch(Vector& values) const {
+  if (max == min) {
+    values = max;
+    return;
+  }
+
+  switch (distrib) {
+  case RANDOM_INT_OPTION_LINEAR:
+    values = min + (max - min) * values;
+    break;
+
+  case RANDOM_INT_OPTION_LOG:
+    values = (qscfloat) sign * exp(logmin + (logmax - logmin) * values);
+    break;
+
+  case RANDOM_INT_OPTION_2_SIDED_LOG:
+    {
+      std::valarray<bool> negative = (values > (qscfloat) 0.5);
+      values = exp(logmin + (logmax - logmin) * abs((values - (qscfloat) 0.5) * (qscfloat) 2));
+      values[negative] = -Vector(values[negative]);
+    }
+    break;
+
+  default:
+    throw std::runtime_error("Unrecognized random distribution type");
+  }
+}
+
+/** Like get(), but draw from the distribution restricted to values
+ * >= lower. See get_at_least_nth().
+ */
+qscfloat Random::get_at_least(qscfloat lower, qscfloat& probability) {
+  return get_at_least_nth(position++, lower, probability);
+}
+
+/** Like get_nth(), but draw from the distribution restricted to values
+ * >= lower. The same single random number in [0, 1] that get_nth()
+ * would use is mapped onto the part of [0, 1] that gives values
+ * >= lower.
+ *
+ * On exit, probability is the probability that get() would have
+ * returned a value >= lower. This is the factor by which the density
+ * of the restricted distribution differs from the original one. If
+ * probability is 0, the allowed value closest to lower is returned.
+ * Only the "linear" and "log" distributions are supported.
+ */
+qscfloat Random::get_at_least_nth(unsigned long long n, qscfloat lower, qscfloat& probability) const {
+  if (max == min) {
+    probability = (max >= lower) ? 1.0 : 0.0;
+    return max;
+  }
+
+  // The map from [0, 1] to values is monotonic. Find the value of
+  // rand01 that maps to lower, and whether the map is increasing:
+  qscfloat u_lower;
+  bool increasing;
+  switch (distrib) {
+  case RANDOM_INT_OPTION_LINEAR:
+    u_lower = (lower - min) / (max - min);
+    increasing = (max > min);
+    break;
+
+  case RANDOM_INT_OPTION_LOG:
+    increasing = ((logmax > logmin) == (sign > 0));
+    if (sign * lower <= 0) {
+      // Either every value (if positive) or no value (if negative) is >= lower:
+      u_lower = ((sign > 0) == increasing) ? 0.0 : 1.0;
+    } else {
+      u_lower = (log(std::abs(lower)) - logmin) / (logmax - logmin);
+    }
+    break;
+
+  default:
+    throw std::runtime_error("Random::get_at_least only supports the linear and log distributions");
+  }
+
+  qscfloat u_min = 0.0, u_max = 1.0;
+  if (increasing) {
+    if (u_lower > u_min) u_min = u_lower;
+  } else {
+    if (u_lower < u_max) u_max = u_lower;
+  }
+  probability = u_max - u_min;
+  if (probability <= 0) {
+    probability = 0.0;
+    return map_uniform(increasing ? 1.0 : 0.0);
+  }
+  return map_uniform(u_min + probability * uniform_nth(n));
+}
+
+/** Set the position in the random number sequence to the 0-based
+ * position n, so the next call to get() returns the (n+1)th number,
+ * as if get() had been called n times. This takes O(1) time.
+ */
+void Random::set_to_nth(unsigned long long n) {
+  position = n;
+}
+
+/** Key of the random number sequence if deterministic is false. If 0
+ * was passed to the constructor, this is the seed chosen from the
+ * clock, which can be passed to a new Random object to reproduce the
+ * sequence.
+ */
+unsigned long long Random::get_seed() const {
+  return seed;
 }
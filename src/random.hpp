@@ -1,7 +1,8 @@
 #ifndef QSC_RANDOM_H
 #define QSC_RANDOM_H
 
-#include <random>
+#include <cstdint>
+#include <string>
 #include "vector_matrix.hpp"
 
 namespace qsc {
@@ -10,26 +11,77 @@ namespace qsc {
   const std::string RANDOM_OPTION_LOG = "log";
   const std::string RANDOM_OPTION_2_SIDED_LOG = "2 sided log";
 
+  // Low-discrepancy sequences used when deterministic = true:
+  const std::string RANDOM_SEQUENCE_GOLDEN_RATIO = "golden ratio";
+  const std::string RANDOM_SEQUENCE_R_D = "R_d";
+  const std::string RANDOM_SEQUENCE_HALTON = "Halton";
+
   enum Distrib_type {
     RANDOM_INT_OPTION_LINEAR,
     RANDOM_INT_OPTION_LOG,
     RANDOM_INT_OPTION_2_SIDED_LOG};
+
+  enum Sequence_type {
+    RANDOM_INT_SEQUENCE_GOLDEN_RATIO,
+    RANDOM_INT_SEQUENCE_R_D,
+    RANDOM_INT_SEQUENCE_HALTON};
   
+  /** Philox4x32-10 counter-based generator of Salmon et al. (2011):
+   * encrypt a 128-bit counter with a 64-bit key to give 128 random
+   * bits. Each (key, counter) pair gives an independent result, so
+   * no state needs to be stored or advanced.
+   */
+  void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t result[4]);
+
+  /** Random numbers from a linear, log, or 2-sided log distribution.
+   *
+   * Each Random object returns a sequence of numbers, and the number
+   * at each 0-based position n is a pure function of n, available
+   * from get_nth(n) without changing the object. get() returns the
+   * number at the current position and advances it, and set_to_nth()
+   * jumps to any position in O(1) time.
+   *
+   * If deterministic is true, the sequence is a low-discrepancy
+   * sequence. For the additive sequences ("golden ratio" and "R_d"),
+   * the number at position n is the 64-bit fixed-point fraction
+   * start + (n + 1) * increment, computed exactly modulo 2^64, so
+   * there is no accumulated roundoff error. "Halton" uses the radical
+   * inverse of n + 1. "golden ratio" gives the same 1D sequence for
+   * every dimension. "R_d" and "Halton" give one coordinate of a
+   * sequence in n_dimensions dimensions, so Random objects with
+   * different dimension and the same position together give a
+   * well-distributed point.
+   *
+   * If deterministic is false, the number at position n comes from
+   * philox4x32 with the counter (n, dimension) and the key seed. The
+   * sequence is reproducible for a given seed, and objects with
+   * different dimensions are independent. If seed is 0, a seed is
+   * chosen from the clock.
+   */
   class Random {
   private:
     qscfloat min, max, logmin, logmax;
     bool deterministic;
     Distrib_type distrib;
-    std::default_random_engine generator;
-    std::uniform_real_distribution<qscfloat> uniform_distrib;
-    const qscfloat gamma = (1.0 + sqrt(5.0)) / 2.0;
-    qscfloat last;
+    Sequence_type sequence;
+    unsigned long long position, start, increment, halton_base, seed;
+    int dimension;
     int sign;
+    qscfloat uniform_nth(unsigned long long) const;
+    qscfloat map_uniform(qscfloat) const;
     
   public:    
-    Random(bool, std::string, qscfloat, qscfloat);
+    Random(bool, std::string, qscfloat, qscfloat,
+	   std::string = RANDOM_SEQUENCE_GOLDEN_RATIO, int = 0, int = 1, unsigned long long = 0);
     qscfloat get();
-    void set_to_nth(int);
+    qscfloat get_at_least(qscfloat, qscfloat&);
+    qscfloat get_nth(unsigned long long) const;
+    qscfloat get_at_least_nth(unsigned long long, qscfloat, qscfloat&) const;
+    void get_batch(unsigned long long, Vector&) const;
+    void get_uniform_batch(unsigned long long, Vector&) const;
+    void map_batch(Vector&) const;
+    void set_to_nth(unsigned long long);
+    unsigned long long get_seed() const;
   };
 }
 
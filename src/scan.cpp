@@ -9,9 +9,20 @@ void Scan::defaults() {
   verbose = 1;
   max_seconds = 60;
   save_period = 60;
+  progress_period = 0;
   max_keep_per_proc = 1000;
+  result_chunk_size = 1000;
+  spill_directory = "";
+  candidates_file = "";
+  candidates_distribution = SCAN_CANDIDATES_BLOCK;
+  candidates_chunk_size = 10000;
   max_attempts_per_proc = -1;
+  max_keep = -1;
+  max_attempts = -1;
   deterministic = false;
+  random_sequence = SCAN_SEQUENCE_GOLDEN_RATIO;
+  random_seed = 0;
+  random_seed_used = 0;
   
   eta_bar_min = 1.0;
   eta_bar_max = 1.0;
@@ -47,6 +58,53 @@ void Scan::defaults() {
   min_r_singularity_to_keep = -1.0;
   max_d2_volume_d_psi2_to_keep = 1.0e+30;
   min_DMerc_times_r2_to_keep = -1.0e+30;
+
+  // screening_nphi = 0 means every attempt is evaluated only at the full nphi.
+  screening_nphi = 0;
+  screening_margin = 0.1;
+
+  // If true, the order in which the filters are applied is adapted
+  // during the scan to minimize the expected cost of each rejection.
+  // The kept configurations are unchanged, but the rejected_due_to_*
+  // counts are not. Each thread adapts its own order, so with
+  // n_threads > 1 these counts depend on how the attempts were shared
+  // among the threads, and can differ from run to run.
+  adaptive_filter_order = false;
+
+  // If true, the min_R0 and curvature filters are first tested at a
+  // few toroidal angles, directly from the axis Fourier coefficients.
+  prefilter = false;
+
+  constrained_sampling = false;
+  mean_sampling_weight = 1.0;
+  adaptive_sampling = false;
+  adaptive_sampling_fraction = 0.5;
+  adaptive_sampling_period = 1000;
+  mirror_symmetry = false;
+  emit_mirror_partners = true;
+
+  // Number of threads evaluating configurations on each MPI process:
+  n_threads = 1;
+
+  parallel_netcdf = false;
+  n_scan_offset = 0;
+  append_checkpoints = false;
+  async_output = false;
+  restart = false;
+  diagnostic_sketches = false;
+  pareto_objectives.clear();
+  pareto_maximize.resize(0);
+  pareto_epsilon.resize(0);
+  pareto_max_size = 1000;
+  top_k = 0;
+  top_k_score_names.clear();
+  top_k_score_weights.resize(0);
+  surrogate = false;
+  surrogate_training_attempts = 2000;
+  surrogate_threshold = 0.01;
+  surrogate_audit_fraction = 0.05;
+  next_attempt_local = 0;
+  output_file_started = false;
 }
 
 Scan::Scan() {
@@ -58,4 +116,5 @@ void Scan::run(std::string directory_and_infile) {
   input(directory_and_infile);
   random();
   write_netcdf();
+  if (append_checkpoints) write_restart();
 }
@@ -2,7 +2,10 @@
 #define QSC_SCAN_H
 
 #include <valarray>
+#include <vector>
+#include <memory>
 #include <chrono>
+#include <fstream>
 #include <mpi.h>
 #include "qsc.hpp"
 
@@ -19,6 +22,13 @@ namespace qsc {
   const std::string SCAN_OPTION_2_SIDED_LOG = "2 sided log";
   const std::string SCAN_OPTION_2_SIDED_LOG_EXCEPT_Z0s1 = "2 sided log except Z0s1";
 
+  const std::string SCAN_SEQUENCE_GOLDEN_RATIO = "golden ratio";
+  const std::string SCAN_SEQUENCE_R_D = "R_d";
+  const std::string SCAN_SEQUENCE_HALTON = "Halton";
+
+  const std::string SCAN_CANDIDATES_BLOCK = "block";
+  const std::string SCAN_CANDIDATES_CYCLIC = "cyclic";
+
   enum {ATTEMPTS,
     KEPT,
     REJECTED_DUE_TO_R0_CRUDE,
@@ -32,8 +42,13 @@ namespace qsc {
     REJECTED_DUE_TO_D2_VOLUME_D_PSI2,
     REJECTED_DUE_TO_DMERC,
     REJECTED_DUE_TO_R_SINGULARITY,
+    REJECTED_DUE_TO_SURROGATE,
     N_SIGMA_EQ_SOLVES,
     N_R2_SOLVES,
+    N_SCREENING_REJECTIONS,
+    N_PREFILTER_REJECTIONS,
+    N_SURROGATE_AUDITS,
+    N_SURROGATE_AUDITS_KEPT,
     N_FILTERS};
 
   enum {
@@ -45,18 +60,447 @@ namespace qsc {
     TIME_MERCIER,
     TIME_GRAD_GRAD_B_TENSOR,
     TIME_R_SINGULARITY,
+    TIME_SCREENING,
     N_TIMES};
+
+  // Number of real and integer quantities saved for each kept configuration:
+  const int SCAN_N_PARAMETERS = 18;
+  const int SCAN_N_INT_PARAMETERS = 2;
+
+  // Diagnostics whose distribution over all attempts is sketched:
+  enum {
+    SKETCH_MIN_R0,
+    SKETCH_MAX_CURVATURE,
+    SKETCH_STANDARD_DEVIATION_OF_R,
+    SKETCH_STANDARD_DEVIATION_OF_Z,
+    SKETCH_IOTA,
+    SKETCH_MAX_ELONGATION,
+    SKETCH_MIN_L_GRAD_B,
+    SKETCH_B20_VARIATION,
+    SKETCH_B20_RESIDUAL,
+    SKETCH_D2_VOLUME_D_PSI2,
+    SKETCH_DMERC_TIMES_R2,
+    SKETCH_MIN_L_GRAD_GRAD_B,
+    SKETCH_MIN_R_SINGULARITY,
+    N_SKETCHES};
+
+  // Probabilities 0, 0.01, ..., 1 at which the sketched quantiles are saved:
+  const int SCAN_N_SKETCH_QUANTILES = 101;
+
+  // Outcome of one attempt in a scan, as computed by a worker thread:
+  struct ScanAttempt {
+    big index;
+    int result;
+    bool sigma_eq_solved, r2_solved, screened, prefiltered;
+    // Set by the worker: whether this attempt is evaluated in full even
+    // if the surrogate model predicts it will be rejected. Set by
+    // evaluate_attempt(): whether the surrogate made that prediction.
+    bool surrogate_audit, surrogate_rejected;
+    qscfloat sampling_weight;
+    // Inputs of the configuration, as seen by the surrogate model, if
+    // the attempt reached that stage:
+    Vector features;
+    // Position in [0, 1] in each dimension of the random sequence,
+    // before the map to the parameter's distribution:
+    Vector uniforms;
+    // Value of each SKETCH_* diagnostic, or NaN if the stage that
+    // computes it was not run for this attempt:
+    Vector diagnostics;
+    Vector parameters, fourier_parameters;
+    std::valarray<int> int_parameters;
+  };
+
+  // Stages of the calculation for one configuration in a scan. The
+  // first three stages must be run in this order. The last three each
+  // require STAGE_R2 but are independent of each other.
+  enum {
+    STAGE_INIT_AXIS,
+    STAGE_R1,
+    STAGE_R2,
+    STAGE_MERCIER,
+    STAGE_GRAD_GRAD_B,
+    STAGE_R_SINGULARITY,
+    N_STAGES};
+
+  // One of the filters applied to each configuration in a scan:
+  struct ScanFilter {
+    int rejection; // REJECTED_DUE_TO_* index in the filter counts
+    int stage; // Stage that computes the filtered quantity
+    bool is_min; // true for min_*_to_keep filters, false for max_*_to_keep
+    qscfloat threshold;
+    qscfloat (*value)(Qsc&);
+    big n_tested, n_rejected;
+  };
+
+  /** Copies of the Qsc object at each nphi to which adapt_nphi() has
+   * refined the grid in a scan, so the arrays for each nphi are
+   * allocated once rather than at every refinement. Each thread has
+   * its own. refine() does the same as Qsc::adapt_nphi(), but carries
+   * the coarse solution over to the copy at the new nphi instead of
+   * re-allocating the coarse object, and returns the object that holds
+   * the final result. To bound the memory, at most max_workspaces
+   * copies are kept, and beyond that the least recently used one is
+   * re-allocated.
+   */
+  class QscWorkspaces {
+  private:
+    std::vector<std::unique_ptr<Qsc>> workspaces;
+    std::vector<big> last_use;
+    big n_uses;
+    Qsc& at_nphi(int, const Qsc*);
+
+  public:
+    const Qsc* base; // Inputs that are the same for every configuration
+    std::size_t max_workspaces;
+
+    QscWorkspaces();
+    Qsc& refine(Qsc&, bool);
+    int n_workspaces() const;
+  };
+
+  /** Measured cost of each stage and rejection rate of each filter,
+   * from which adaptive FilterPipelines order their filters. The
+   * totals are for the threads of one proc. The estimates are only
+   * changed by update(), which combines the totals of all procs at a
+   * checkpoint, so between checkpoints every thread and proc orders
+   * the filters in the same way. Before the first update, the stage
+   * costs are typical relative costs for nphi of 31 to 127.
+   */
+  class FilterOrder {
+  public:
+    qscfloat stage_seconds[N_STAGES];
+    big stage_calls[N_STAGES];
+    std::valarray<big> n_tested, n_rejected;
+    // Estimates used to order the filters:
+    qscfloat stage_cost[N_STAGES];
+    Vector rejection_probability;
+
+    FilterOrder();
+    void init(int);
+    void update(MPI_Comm);
+  };
+
+  /** The sequence of calculation stages and filters for the
+   * configurations in a scan. Each filter declares the stage it
+   * depends on, and a stage is only run once some filter needs it.
+   *
+   * If adaptive is false, the filters are applied in the order of the
+   * filters vector. If adaptive is true, the next filter is the one
+   * that minimizes the expected cost per rejection: the cost of the
+   * stages it still needs divided by its rejection probability, both
+   * taken from the FilterOrder last passed to set_order(). Filters on
+   * stages that have already run are therefore free and are applied
+   * first. The pipeline measures the time of each stage and counts
+   * the rejections of each filter, and add_statistics() moves these
+   * into a FilterOrder.
+   */
+  class FilterPipeline {
+  private:
+    qscfloat stage_seconds[N_STAGES];
+    big stage_calls[N_STAGES];
+    bool stage_done[N_STAGES];
+    qscfloat stage_cost[N_STAGES];
+    Vector order_rejection_probability;
+    qscfloat marginal_cost(int);
+    Qsc* current;
+    bool run_stage(int, ScanAttempt*, qscfloat*);
+    bool fails(ScanFilter&, qscfloat);
+    void adapt_nphi(bool);
+
+  public:
+    std::vector<ScanFilter> filters;
+    bool adaptive, keep_all;
+    // If screening, a filter rejects only if it fails by more than
+    // this relative margin, and a configuration for which Newton's
+    // method fails is passed on to the full calculation:
+    bool screening;
+    qscfloat margin;
+    // Thresholds below which calculate_grad_grad_B_tensor and
+    // calculate_r_singularity can stop early. Negative means never.
+    qscfloat min_L_grad_grad_B_to_stop, min_r_singularity_to_stop;
+    int n_stages; // N_STAGES, or STAGE_R2 for O(r^1) calculations
+    // If not NULL, nphi is refined using these copies of the Qsc
+    // object rather than by re-allocating the one passed to run():
+    QscWorkspaces* workspaces;
+
+    FilterPipeline();
+    int run(Qsc&, ScanAttempt*, qscfloat*);
+    Qsc& result();
+    bool stage_ran(int) const;
+    void set_order(const FilterOrder&);
+    void add_statistics(FilterOrder&);
+  };
     
-  class Scan {
+  /** Mergeable sketch of the distribution of one diagnostic over the
+   * attempts of a scan, using O(1) memory. The values are binned on a
+   * logarithmic grid in |value|, separately for each sign, with bins
+   * whose widths are 2% of their centers, so any quantile is known to
+   * within a relative error of 1%. (This is the DDSketch of Masson et
+   * al. (2019).) Magnitudes below 1e-12 share one bin at 0, and
+   * magnitudes above 1e+12 go in the outermost bins. Sketches from
+   * several procs are merged by adding their bins, so the merged
+   * sketch does not depend on how the attempts were split among procs.
+   * Each value carries the sampling weight of its attempt, so the
+   * quantiles describe the box distribution of the scan. Infinite and
+   * NaN values are counted in n_nonfinite but not otherwise added.
+   */
+  class ScanSketch {
+  public:
+    Vector weights; // Sum of the sampling weights in each bin
+    big n, n_nonfinite;
+    qscfloat min, max, weight_sum, weighted_value_sum;
+
+    ScanSketch();
+    void add(qscfloat, qscfloat);
+    qscfloat quantile(qscfloat) const;
+    static int n_bins();
+    static int bin_of(qscfloat);
+    static qscfloat value_of_bin(int);
+  };
+
+  // One configuration in a ParetoArchive:
+  struct ParetoEntry {
+    Vector objectives; // Signed so that every objective is minimized
+    Vector keys; // Box of the epsilon grid, or the objectives if epsilon is 0
+    Vector parameters, fourier_parameters;
+    std::valarray<int> int_parameters;
+  };
+
+  /** Archive of the non-dominated configurations of a scan with
+   * respect to several objectives, each of which is one of the
+   * SCAN_N_PARAMETERS saved for a kept configuration.
+   *
+   * If epsilon is > 0 for an objective, the objective is divided into
+   * boxes of this width, and dominance is decided between boxes
+   * (epsilon-dominance, Laumanns et al. (2002)): at most one entry is
+   * kept per box, the one closest to the box's best corner. This
+   * bounds the size of the archive for a bounded objective space.
+   * Beyond max_size entries, the entry with the smallest crowding
+   * distance is dropped, keeping the extremes of the front.
+   *
+   * The entries are sorted by their first key. Only entries with a
+   * smaller first key can dominate a new entry, and only entries with
+   * a larger first key can be dominated by it. With two objectives,
+   * the second key then decreases along the archive, so both are
+   * found by binary search and an insertion costs O(log n) plus the
+   * move of the later entries. With more objectives, an insertion
+   * scans these entries and so is O(n) in the size of the archive.
+   * Each insertion into a full archive also costs a prune, which is
+   * O(n log n) per objective. n is bounded by max_size.
+   */
+  class ParetoArchive {
   private:
-    big filters_local[N_FILTERS];
-    std::chrono::time_point<std::chrono::steady_clock> start_time;
-    qscfloat timing_local[N_TIMES];
-    void defaults();
-    void collect_results(int, Matrix&, Matrix&, int, std::valarray<int>&, big);
+    std::vector<ParetoEntry> entries;
+    qscfloat corner_distance(const ParetoEntry&) const;
+    void prune();
+
+  public:
+    std::vector<int> parameter_index; // Index of each objective in the parameters
+    std::vector<bool> use_abs; // Whether to use the absolute value of the parameter
+    Vector sign; // 1 to minimize the objective, -1 to maximize it
+    Vector epsilon;
+    int max_size;
+
+    ParetoArchive();
+    bool insert(const Vector&, const Vector&, const std::valarray<int>&);
+    big size() const;
+    const ParetoEntry& entry(big) const;
+    void clear();
+  };
+
+  // One configuration in a ScanTopK:
+  struct ScanTopKEntry {
+    qscfloat score;
+    Vector parameters, fourier_parameters;
+    std::valarray<int> int_parameters;
+  };
+
+  /** The k configurations of a scan with the highest score, a
+   * weighted sum of some of the SCAN_N_PARAMETERS saved for a kept
+   * configuration. The entries are held in a heap with the lowest
+   * score first, so a new configuration is compared only to the
+   * lowest score. Ties in the score are broken by the parameters, so
+   * the set of entries does not depend on the order of insertion.
+   */
+  class ScanTopK {
+  private:
+    std::vector<ScanTopKEntry> heap;
+
+  public:
+    std::vector<int> parameter_index; // Index of each term of the score in the parameters
+    std::vector<bool> use_abs; // Whether to use the absolute value of the parameter
+    Vector weights;
+    int k;
+
+    ScanTopK();
+    qscfloat score(const Vector&) const;
+    bool insert(qscfloat, const Vector&, const Vector&, const std::valarray<int>&);
+    big size() const;
+    const ScanTopKEntry& entry(big) const;
+    void sort();
+    void clear();
+  };
+
+  /** Storage for the configurations kept on one proc, which grows in
+   * chunks of a fixed number of configurations, so memory is only
+   * used for configurations that are actually kept. If a spill file
+   * name is given, each chunk is written to the file once it is full,
+   * so only one chunk is held in memory and the number of
+   * configurations is limited by disk space rather than memory.
+   * Each configuration is stored as its parameters, Fourier
+   * parameters, and int parameters, in the layout of the columns of
+   * the matrices sent by collect_results().
+   */
+  class ScanResultBuffer {
+  private:
+    // One chunk of chunk_size configurations:
+    struct Chunk {
+      Vector parameters, fourier_parameters;
+      std::valarray<int> int_parameters;
+      bool in_memory;
+      std::streamoff file_offset;
+    };
+    int n_parameters, n_fourier_parameters, n_int_parameters, chunk_size_;
+    big n;
+    std::vector<Chunk> chunks;
+    std::string spill_filename;
+    std::fstream spill_file;
+    // Chunk most recently read back from the spill file:
+    Chunk loaded;
+    big loaded_index;
+    void spill(big);
+    const Chunk& get_chunk(big);
+
+  public:
+    ScanResultBuffer();
+    ~ScanResultBuffer();
+    void init(int, int, int, int, std::string);
+    void append(const Vector&, const Vector&, const std::valarray<int>&);
+    void read(big, big, qscfloat*, qscfloat*, int*);
+    void release(big);
+    void clear();
+    big size() const;
+    int chunk_size() const;
+    big n_spilled() const;
+  };
+
+  /** Source of the configurations for a scan with candidates_file
+   * set. Each candidate is a row of values: eta_bar, sigma0, B2c, B2s,
+   * and then the axis_nmax_plus_1 values of each of R0c, R0s, Z0c,
+   * and Z0s. Rows are read from the file in chunks of chunk_size
+   * rows, so only one chunk is held in memory.
+   *
+   * Two formats are supported. A file whose name ends in ".nc" is
+   * read as NetCDF, using the variables scan_eta_bar, scan_sigma0,
+   * scan_B2c, scan_B2s, scan_R0c, scan_R0s, scan_Z0c, and scan_Z0s
+   * of the output of a scan (B2c and B2s are 0 if absent). Any other
+   * file is read as a binary table: the 8 characters "qsccand1", a
+   * 4-byte int with axis_nmax_plus_1, 4 bytes of padding, and then
+   * the rows as 8-byte doubles, in native byte order.
+   */
+  class ScanCandidateReader {
+  private:
+    Vector chunk;
+    big chunk_first, chunk_n;
+  protected:
+    int axis_nmax_plus_1_;
+    big n_candidates;
+    virtual void read_rows(big, big, Vector&) = 0;
+  public:
+    big chunk_size;
+    ScanCandidateReader();
+    virtual ~ScanCandidateReader() {}
+    big size() const;
+    int axis_nmax_plus_1() const;
+    int n_values() const;
+    void get(big, qscfloat*);
+    static ScanCandidateReader* open(std::string);
+    static bool is_netcdf(std::string);
+  };
+
+  ScanCandidateReader* new_netcdf_candidate_reader(std::string);
+
+  /** Proposal distribution for adaptive importance sampling in a
+   * scan. Each random parameter is described by its position u in
+   * [0, 1] in the underlying uniform sequence, so the box distribution
+   * of the scan has density 1 in every dimension. The proposal is a
+   * product over the active dimensions of piecewise-constant densities
+   * on n_bins bins, fit to the histograms of u for the kept
+   * configurations. The histograms are smoothed by one count per bin,
+   * so the density never vanishes.
+   *
+   * A fraction of the attempts is drawn from the proposal and the rest
+   * from the box distribution. Every attempt then gets the importance
+   * weight 1 / ((1 - fraction) + fraction * density(u)), the ratio of
+   * the box density to the density of this mixture.
+   */
+  class ScanProposal {
+  private:
+    Vector density, cdf;
+    std::valarray<big> counts_local, counts_others;
+
+  public:
+    int n_dimensions, n_bins;
+    qscfloat fraction;
+    std::vector<bool> active;
+    big n_fits;
+
+    ScanProposal();
+    void init(const std::vector<bool>&, int, qscfloat);
+    void add(const Vector&);
+    void fit();
+    qscfloat density_at(const Vector&) const;
+    qscfloat sample(int, qscfloat) const;
+    std::valarray<big>& local_counts();
+    void set_other_counts(const std::valarray<big>&);
+  };
+    
+  /** Classifier that predicts, from the inputs of an attempt in a
+   * scan, the probability that the configuration is kept. The model is
+   * a sum of decision stumps (trees of depth 1) fit by gradient
+   * boosting on the logistic loss, so evaluating it costs one
+   * comparison per round. The fit is deterministic.
+   */
+  class ScanSurrogate {
+  private:
+    // Log-odds before the first round:
+    qscfloat bias;
+    // For each round, the feature and threshold of the split, and the
+    // change in the log-odds below and above the threshold:
+    std::vector<int> split_feature;
+    Vector split_threshold, lower_value, upper_value;
+
+  public:
+    int n_rounds;
+    qscfloat learning_rate, regularization;
+    // False until fit() has seen examples of both classes:
+    bool trained;
+
+    ScanSurrogate();
+    void fit(const std::vector<Vector>&, const std::vector<bool>&);
+    qscfloat probability(const Vector&) const;
+    int n_splits() const;
+  };
+    
+  /** The inputs and results of a scan that are saved in its output
+   * and restart files. Scan derives from this, so that a ScanOutput
+   * copy of a Scan is a snapshot of everything the writers read,
+   * without the Qsc object and the per-proc state used for the
+   * calculation. With async_output, the background writer thread
+   * writes such a snapshot while the scan continues.
+   */
+  class ScanOutput {
+    friend class Scan;
+  protected:
+    // State of every proc at the last collect_results(), on proc 0,
+    // for write_restart():
+    std::valarray<big> restart_filters, restart_next_attempt;
+    Vector restart_timing, restart_sampling_weight_sums;
+    bool output_file_started;
+    void write_netcdf_file(int, Qsc&);
+    void write_restart_file();
     
   public:
-    Qsc q;
     MPI_Comm mpi_comm;
     std::string eta_bar_scan_option, sigma0_scan_option;
     std::string B2s_scan_option, B2c_scan_option, fourier_scan_option;
@@ -64,14 +508,182 @@ namespace qsc {
     qscfloat B2s_min, B2s_max, B2c_min, B2c_max;
     Vector R0c_min, R0c_max, R0s_min, R0s_max, Z0c_min, Z0c_max, Z0s_min, Z0s_max;
     qscfloat max_seconds, save_period;
+    // If > 0, proc 0 writes the totals over all procs of the filter
+    // counts and timings, the throughput, and an estimate of the time
+    // remaining to the JSON file progress_filename() about this often,
+    // in seconds. This is much cheaper than a checkpoint.
+    qscfloat progress_period;
     big n_scan, filters[N_FILTERS];
     qscfloat filter_fractions[N_FILTERS], timing[N_TIMES];
     int max_keep_per_proc, max_attempts_per_proc; // Can I read in a "big" from toml?
+    // The configurations kept on each proc are stored in chunks of
+    // result_chunk_size configurations, allocated as needed. If
+    // spill_directory is not empty, each full chunk is written to a
+    // scratch file in this directory, one per proc, and read back when
+    // results are collected, so max_keep_per_proc is limited by disk
+    // space rather than memory. The scratch files are deleted at the
+    // end of the scan.
+    int result_chunk_size;
+    std::string spill_directory;
+    // If not empty, the scan evaluates the candidate configurations in
+    // this file (see ScanCandidateReader) instead of random ones. The
+    // *_min and *_max ranges are then not used, except that the size
+    // of R0c_max must be the number of axis Fourier modes in the file.
+    // With candidates_distribution = "block", each proc evaluates a
+    // contiguous range of the candidates; with "cyclic", chunks of
+    // candidates_chunk_size candidates are dealt to the procs in turn,
+    // which balances the load better if the cost of the candidates
+    // varies along the file.
+    std::string candidates_file, candidates_distribution;
+    int candidates_chunk_size;
+    // If > 0, every proc stops soon after the number of configurations
+    // kept, or the number attempted, summed over all procs reaches
+    // this value. The procs check the totals with nonblocking
+    // reductions, so the totals may overshoot by about the number of
+    // attempts each proc makes during one reduction.
+    int max_keep, max_attempts;
     qscfloat min_R0_to_keep, min_iota_to_keep, max_elongation_to_keep;
     qscfloat min_L_grad_B_to_keep, min_L_grad_grad_B_to_keep;
     qscfloat max_B20_variation_to_keep, min_r_singularity_to_keep;
     qscfloat max_d2_volume_d_psi2_to_keep, min_DMerc_times_r2_to_keep;
     bool keep_all, deterministic;
+    // Low-discrepancy sequence used if deterministic is true:
+    std::string random_sequence;
+    // Seed for the counter-based generator used if deterministic is
+    // false. If 0, a seed is chosen from the clock. random_seed_used is
+    // the seed actually used, which reproduces the scan.
+    int random_seed, random_seed_used;
+    // If screening_nphi > 0, each configuration is first evaluated at
+    // this nphi, which must be less than nphi, and is rejected if a
+    // filter fails there by more than the relative screening_margin.
+    // The margin is a heuristic allowance for the error of the coarse
+    // calculation, not a bound on it: a configuration whose coarse
+    // values are off by more than the margin near a threshold is
+    // rejected when the full calculation would have kept it.
+    int screening_nphi;
+    qscfloat screening_margin;
+    // If true, the filters are applied in the order that minimizes the
+    // expected cost per rejection, re-estimated at each checkpoint
+    // from the measured cost of each stage. See FilterOrder.
+    bool adaptive_filter_order;
+    bool prefilter;
+    // If true, R0c[0] is drawn only from the range for which R0 passes
+    // the crude R0 check, and R0 >= min_R0_to_keep at phi = 0. Each
+    // configuration then carries a sampling weight, the probability
+    // that an unconstrained draw of R0c[0] would have been in this
+    // range.
+    bool constrained_sampling;
+    qscfloat mean_sampling_weight;
+    // Results of the diagnostic sketches, for each SKETCH_*
+    // diagnostic: the number of attempts for which it was computed,
+    // its weighted mean, and its quantiles at sketch_quantile_levels.
+    // sketch_n_nonfinite counts the attempts for which it was infinite
+    // or NaN, which are not included in the others.
+    Vector sketch_quantile_levels, sketch_means;
+    std::valarray<big> sketch_n, sketch_n_nonfinite;
+    std::vector<Vector> sketch_quantiles;
+    // If true, a fraction adaptive_sampling_fraction of the attempts is
+    // drawn from a ScanProposal fit to the configurations kept so far.
+    // The proposal is refit every adaptive_sampling_period attempts on
+    // each proc, and the histograms are exchanged between procs at
+    // each checkpoint. The importance weight of each configuration is
+    // included in its sampling weight.
+    bool adaptive_sampling;
+    qscfloat adaptive_sampling_fraction;
+    int adaptive_sampling_period;
+    // If true, only one member of each pair of configurations related
+    // by the mirror reflection Z -> -Z is evaluated: the one for which
+    // the leading varying Z0s (or Z0c, sigma0, B2s) is positive. The
+    // ranges of these parameters must be symmetric about 0. If
+    // emit_mirror_partners is also true, the mirror image of each kept
+    // configuration is saved too, and the counts of attempts and
+    // rejections include the mirror images. N_SIGMA_EQ_SOLVES and
+    // N_R2_SOLVES still count the solves actually carried out.
+    bool mirror_symmetry, emit_mirror_partners;
+    // If true, each proc sketches the distribution of each SKETCH_*
+    // diagnostic over all its attempts, kept or not, for which the
+    // diagnostic was computed. The sketches are merged at each
+    // checkpoint, giving the full-population quantiles below, without
+    // the memory of keep_all. The sketches cover the attempts since the
+    // scan started or was restarted. Each sketch has a few thousand
+    // bins, so this is off by default.
+    bool diagnostic_sketches;
+    // If not empty, only the configurations that are non-dominated with
+    // respect to these objectives are saved, rather than every kept
+    // configuration. Each objective is the name of one of the scan_*
+    // arrays without the prefix (e.g. "r_singularity",
+    // "max_elongation", "min_L_grad_grad_B"), or "abs_iota". Each is
+    // minimized unless the corresponding pareto_maximize is true. The
+    // thresholds *_to_keep still apply. The archives of all procs are
+    // merged at each checkpoint, so the scan_* arrays hold the
+    // Pareto front of all kept configurations, of size at most
+    // pareto_max_size. pareto_max_size may be at most 100000, since
+    // each insertion into a full archive costs O(n log n). Since the
+    // archive bounds its own size, max_keep_per_proc does not apply. pareto_epsilon, if not empty,
+    // gives the box size of the epsilon-dominance grid for each
+    // objective (0 for no grid).
+    std::vector<std::string> pareto_objectives;
+    std::valarray<bool> pareto_maximize;
+    Vector pareto_epsilon;
+    int pareto_max_size;
+    // If > 0, only the top_k configurations with the highest score are
+    // saved, rather than every kept configuration. The score is the sum
+    // of top_k_score_weights times the quantities named in
+    // top_k_score_names, which are named as for pareto_objectives. The
+    // thresholds *_to_keep still apply. Each proc keeps its best top_k
+    // configurations, and these are merged in a tree over the procs at
+    // each checkpoint, so the scan_* arrays hold the best top_k of all
+    // kept configurations, in order of decreasing score. Since the
+    // heap bounds its own size, max_keep_per_proc does not apply.
+    int top_k;
+    std::vector<std::string> top_k_score_names;
+    Vector top_k_score_weights;
+    // If true, each proc fits a ScanSurrogate to the outcomes of its
+    // first surrogate_training_attempts attempts that pass the crude
+    // R0 check, the pre-filter, and screening. Later attempts that the
+    // surrogate gives a probability of being kept below
+    // surrogate_threshold are rejected without the full calculation,
+    // except for a random fraction surrogate_audit_fraction of them,
+    // which is evaluated anyway to measure the rate of false
+    // rejections. The sampling weight of a skipped attempt is set to 0,
+    // and that of an audited one is divided by the audit fraction, so
+    // weighted statistics over the kept configurations remain unbiased
+    // if the audit fraction is > 0. The model is not saved, so this
+    // cannot be used with restart.
+    bool surrogate;
+    int surrogate_training_attempts;
+    qscfloat surrogate_threshold, surrogate_audit_fraction;
+    int n_threads;
+    // If true, each proc writes its own configurations to the output
+    // file, using parallel NetCDF-4 I/O, instead of sending them to
+    // proc 0. The scan_* arrays then hold only this proc's
+    // configurations, which are rows n_scan_offset, n_scan_offset + 1,
+    // ... of the output arrays.
+    bool parallel_netcdf;
+    big n_scan_offset;
+    // If true, each checkpoint appends only the configurations kept
+    // since the previous checkpoint to the output file, along an
+    // unlimited n_scan dimension, rather than rewriting the whole
+    // file. The scan_* arrays then hold only the configurations from
+    // the most recent checkpoint.
+    bool append_checkpoints;
+    // If true, proc 0 writes the output file (and restart file) at
+    // each checkpoint from a copy of the results, on a background
+    // thread, so the scan continues while the file is written. The
+    // copy doubles the memory for the results on proc 0 while it is
+    // written, so this is false by default. A
+    // checkpoint that finds the previous one still being written
+    // replaces any checkpoint waiting behind it, or with
+    // append_checkpoints waits for the writer. This is not done with
+    // parallel_netcdf, whose writes are collective, or with a NetCDF
+    // candidates_file, since the NetCDF library is not thread-safe.
+    bool async_output;
+    // If true, continue the scan whose output file and restart file,
+    // written with append_checkpoints, have the name outfilename. The
+    // kept configurations are appended to the existing output file,
+    // the counts and timings continue from the saved values, and each
+    // proc continues from its saved position in the random sequences.
+    bool restart;
     int verbose;
     std::string outfilename;
 
@@ -83,13 +695,56 @@ namespace qsc {
     Vector scan_r_singularity, scan_B20_variation, scan_B20_residual;
     Vector scan_d2_volume_d_psi2, scan_DMerc_times_r2;
     Vector scan_standard_deviation_of_R, scan_standard_deviation_of_Z;
-    std::valarray<int> scan_helicity;
+    Vector scan_sampling_weight;
+    std::valarray<int> scan_helicity, scan_nphi;
+
+    std::string restart_filename();
+  };
+    
+  class Scan : public ScanOutput {
+  private:
+    big filters_local[N_FILTERS];
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+    qscfloat timing_local[N_TIMES];
+    qscfloat sampling_weight_sum_local;
+    // Position in the random sequences of the first attempt on this
+    // proc that is not yet included in filters_local:
+    big next_attempt_local;
+    void defaults();
+    void collect_results(ScanResultBuffer&, big);
+    void unpack_results(big, big, Matrix&, Matrix&, int, std::valarray<int>&);
+    void init_filter_pipeline(FilterPipeline&, bool);
+    int prefilter_axis(Qsc&);
+    void evaluate_attempt(Qsc&, Qsc&, FilterPipeline&, FilterPipeline&, bool, const ScanSurrogate*, ScanAttempt&, qscfloat*);
+    void exchange_proposal(ScanProposal&);
+    void mirror_attempt(ScanAttempt&);
+    void read_restart(big&);
+    void record_diagnostics(Qsc&, FilterPipeline&, ScanAttempt&);
+    void add_to_sketches(ScanAttempt&, int);
+    void collect_sketches();
+    void init_pareto_archive(ParetoArchive&);
+    big merge_pareto_archives(big, Matrix&, Matrix&, std::valarray<int>&);
+    // Non-dominated configurations on this proc, if pareto_objectives is set:
+    ParetoArchive pareto_local;
+    static int objective_index(const std::string&, bool&);
+    void init_top_k(ScanTopK&);
+    void reduce_top_k(ScanTopK&);
+    // Best configurations on this proc, if top_k > 0:
+    ScanTopK top_k_local;
+    // Sketches of the diagnostics for the attempts on this proc:
+    std::vector<ScanSketch> sketches_local;
+    void write_progress(const big*, const qscfloat*, int, qscfloat, qscfloat, qscfloat, bool);
+    
+  public:
+    Qsc q;
     
     Scan();
     void run(std::string);
     void input(std::string);
     void random();
     void write_netcdf();
+    void write_restart();
+    std::string progress_filename();
   };
 }
 
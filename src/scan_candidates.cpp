@@ -0,0 +1,104 @@
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ScanCandidateReader::ScanCandidateReader() {
+  chunk_first = 0;
+  chunk_n = 0;
+  chunk_size = 10000;
+  axis_nmax_plus_1_ = 0;
+  n_candidates = 0;
+}
+
+big qsc::ScanCandidateReader::size() const {
+  return n_candidates;
+}
+
+int qsc::ScanCandidateReader::axis_nmax_plus_1() const {
+  return axis_nmax_plus_1_;
+}
+
+/** Number of values in each row.
+ */
+int qsc::ScanCandidateReader::n_values() const {
+  return 4 + 4 * axis_nmax_plus_1_;
+}
+
+/** Copy the values of one candidate into "values". If the candidate is
+ * not in the chunk in memory, the chunk starting at this candidate is
+ * read, so reading the candidates in increasing order reads each
+ * chunk once.
+ */
+void qsc::ScanCandidateReader::get(big row, qscfloat* values) {
+  if (row >= n_candidates) throw std::runtime_error("Attempt to read past the end of the candidates file");
+  if (row < chunk_first || row >= chunk_first + chunk_n) {
+    chunk_first = row;
+    chunk_n = std::min(chunk_size, n_candidates - row);
+    chunk.resize(chunk_n * n_values());
+    read_rows(chunk_first, chunk_n, chunk);
+  }
+  std::copy(&chunk[0] + (row - chunk_first) * n_values(), &chunk[0] + (row - chunk_first + 1) * n_values(), values);
+}
+
+namespace qsc {
+  /** Reader for the binary table format described for
+   * ScanCandidateReader.
+   */
+  class BinaryCandidateReader : public ScanCandidateReader {
+  private:
+    std::ifstream file;
+    std::string filename;
+    static const int header_bytes = 16;
+  protected:
+    void read_rows(big, big, Vector&);
+  public:
+    BinaryCandidateReader(std::string);
+  };
+}
+
+qsc::BinaryCandidateReader::BinaryCandidateReader(std::string filename_in) {
+  filename = filename_in;
+  file.open(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!file.is_open()) throw std::runtime_error("Unable to open candidates file " + filename);
+  char magic[8];
+  int n;
+  file.read(magic, 8);
+  file.read((char*) &n, sizeof(int));
+  if (file.fail() || std::strncmp(magic, "qsccand1", 8) != 0 || n < 1)
+    throw std::runtime_error("Candidates file " + filename + " does not start with a valid header");
+  axis_nmax_plus_1_ = n;
+  file.seekg(0, std::ios::end);
+  big data_bytes = (big) file.tellg() - header_bytes;
+  big row_bytes = n_values() * sizeof(double);
+  if (data_bytes % row_bytes != 0)
+    throw std::runtime_error("The size of candidates file " + filename + " is not a whole number of rows");
+  n_candidates = data_bytes / row_bytes;
+}
+
+void qsc::BinaryCandidateReader::read_rows(big first, big n, Vector& values) {
+  std::vector<double> buffer(n * n_values());
+  file.seekg(header_bytes + first * n_values() * sizeof(double));
+  file.read((char*) buffer.data(), buffer.size() * sizeof(double));
+  if (file.fail()) throw std::runtime_error("Error reading candidates file " + filename);
+  for (big j = 0; j < buffer.size(); j++) values[j] = buffer[j];
+}
+
+/** True if open() reads this file as NetCDF rather than binary.
+ */
+bool qsc::ScanCandidateReader::is_netcdf(std::string filename) {
+  const std::string netcdf_suffix = ".nc";
+  return filename.size() >= netcdf_suffix.size()
+    && filename.compare(filename.size() - netcdf_suffix.size(), netcdf_suffix.size(), netcdf_suffix) == 0;
+}
+
+/** Open a candidates file, choosing the format from the file name.
+ */
+ScanCandidateReader* qsc::ScanCandidateReader::open(std::string filename) {
+  if (is_netcdf(filename)) return new_netcdf_candidate_reader(filename);
+  return new BinaryCandidateReader(filename);
+}
@@ -1,5 +1,6 @@
 #include <chrono>
 #include <vector>
+#include <algorithm>
 #include <mpi.h>
 #include <iostream>
 #include <iomanip>
@@ -10,15 +11,28 @@
 using namespace qsc;
 
 /** Given results on all the MPI processes, send them to proc 0.
+ *
+ * Only the configurations j_scan_first ... j_scan - 1 on each proc are
+ * collected into the scan_* arrays. These are rows n_scan_offset,
+ * n_scan_offset + 1, ... of the complete set of n_scan
+ * configurations. j_scan_first is 0 unless append_checkpoints is
+ * true, in which case earlier configurations were already written to
+ * the output file. With pareto_objectives, these are the entries of
+ * each proc's archive, and the scan_* arrays hold the merged front.
+ * With top_k, the best configurations of all procs have already been
+ * merged onto proc 0, and the other procs send none.
  */
-void Scan::collect_results(int n_parameters,
-			   Matrix& parameters_local,
-			   Matrix& fourier_parameters_local,
-			   int n_int_parameters,
-			   std::valarray<int>& int_parameters_local,
-			   big j_scan) {
+void Scan::collect_results(ScanResultBuffer& results_local,
+			   big j_scan_first) {
+  const int n_parameters = SCAN_N_PARAMETERS;
+  const int n_int_parameters = SCAN_N_INT_PARAMETERS;
   const int axis_nmax_plus_1 = R0c_max.size();
   const int n_fourier_parameters = axis_nmax_plus_1 * 4;
+  const big j_scan = results_local.size();
+  // Configurations are sent to proc 0 in pieces of at most one chunk,
+  // so a proc never needs memory for more than one chunk of its
+  // results beyond what it already holds:
+  const big piece_size = results_local.chunk_size();
   int j, k;
   int mpi_rank, n_procs;
   MPI_Status mpi_status;
@@ -30,9 +44,20 @@ void Scan::collect_results(int n_parameters,
   MPI_Comm_size(mpi_comm, &n_procs);
   bool proc0 = (mpi_rank == 0);
 
-  filters_local[KEPT] = j_scan;
+  big n_new_local = j_scan - j_scan_first;
+  big n_new = 0;
+  std::valarray<big> n_new_per_proc(n_procs);
 
   MPI_Barrier(mpi_comm);
+  MPI_Gather(&n_new_local, 1, MPI_UNSIGNED_LONG_LONG, &n_new_per_proc[0], 1, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+  if (diagnostic_sketches) collect_sketches();
+  qscfloat sampling_weight_sum = 0;
+  MPI_Reduce(&sampling_weight_sum_local, &sampling_weight_sum, 1, MPI_QSCFLOAT, MPI_SUM, 0, mpi_comm);
+  // Save the state of each proc for write_restart():
+  restart_next_attempt.resize(n_procs);
+  restart_sampling_weight_sums.resize(n_procs);
+  MPI_Gather(&next_attempt_local, 1, MPI_UNSIGNED_LONG_LONG, &restart_next_attempt[0], 1, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+  MPI_Gather(&sampling_weight_sum_local, 1, MPI_QSCFLOAT, &restart_sampling_weight_sums[0], 1, MPI_QSCFLOAT, 0, mpi_comm);
 
   if (!proc0) {
     // Procs other than 0: Send all results to proc 0
@@ -40,9 +65,17 @@ void Scan::collect_results(int n_parameters,
     // Note mpi_rank is used as the tag
     MPI_Send(           &filters_local[0],                     N_FILTERS, MPI_UNSIGNED_LONG_LONG, 0, mpi_rank, mpi_comm);
     MPI_Send(            &timing_local[0],                       N_TIMES,           MPI_QSCFLOAT, 0, mpi_rank, mpi_comm);
-    MPI_Send(        &parameters_local[0],         n_parameters * j_scan,           MPI_QSCFLOAT, 0, mpi_rank, mpi_comm);
-    MPI_Send(&fourier_parameters_local[0], n_fourier_parameters * j_scan,           MPI_QSCFLOAT, 0, mpi_rank, mpi_comm);
-    MPI_Send(    &int_parameters_local[0],     n_int_parameters * j_scan,                MPI_INT, 0, mpi_rank, mpi_comm);
+    if (!parallel_netcdf) {
+      Vector parameters_piece(n_parameters * piece_size), fourier_parameters_piece(n_fourier_parameters * piece_size);
+      std::valarray<int> int_parameters_piece(n_int_parameters * piece_size);
+      for (big first = j_scan_first; first < j_scan; first += piece_size) {
+	big n_piece = std::min(piece_size, j_scan - first);
+	results_local.read(first, n_piece, &parameters_piece[0], &fourier_parameters_piece[0], &int_parameters_piece[0]);
+	MPI_Send(        &parameters_piece[0],         n_parameters * n_piece, MPI_QSCFLOAT, 0, mpi_rank, mpi_comm);
+	MPI_Send(&fourier_parameters_piece[0], n_fourier_parameters * n_piece, MPI_QSCFLOAT, 0, mpi_rank, mpi_comm);
+	MPI_Send(    &int_parameters_piece[0],     n_int_parameters * n_piece,      MPI_INT, 0, mpi_rank, mpi_comm);
+      }
+    }
     
   } else {
     // Proc 0 does this following block.
@@ -82,8 +115,15 @@ void Scan::collect_results(int n_parameters,
       }
     }
     qscfloat timing_total = timing_combined.sum();
+    restart_filters.resize(filters_combined.size());
+    restart_filters = filters_combined;
+    restart_timing.resize(timing_combined.size());
+    restart_timing = timing_combined;
 
     n_scan = filters[KEPT];
+    n_new = n_new_per_proc.sum();
+    mean_sampling_weight = (filters[ATTEMPTS] > 0) ? sampling_weight_sum / filters[ATTEMPTS] : 1.0;
+    n_scan_offset = n_scan - n_new;
 
     std::cout << "Attempts on each proc:";
     for (j = 0; j < n_procs; j++) std::cout << " " << attempts_per_proc[j];
@@ -92,90 +132,40 @@ void Scan::collect_results(int n_parameters,
     for (j = 0; j < n_procs; j++) std::cout << " " << n_solves_kept[j];
     std::cout << std::endl;
 
-    // Now that we know the total # of runs that succeeded, we can
-    // allocate big arrays to store the combined results from all
-    // procs.
-    Matrix parameters(n_parameters, n_scan);
-    Matrix fourier_parameters(n_fourier_parameters, n_scan);
-    std::valarray<int> int_parameters(n_int_parameters * n_scan);
-    // Copy proc0 results to the final arrays:
-    for (j = 0; j < j_scan; j++) {
-      for (k = 0; k < n_parameters; k++) {
-	parameters(k, j) = parameters_local(k, j);
-      }
-      for (k = 0; k < n_fourier_parameters; k++) {
-	fourier_parameters(k, j) = fourier_parameters_local(k, j);
+    if (!parallel_netcdf) {
+      // Now that we know the total # of runs that succeeded, we can
+      // allocate big arrays to store the combined results from all
+      // procs.
+      Matrix parameters(n_parameters, n_new);
+      Matrix fourier_parameters(n_fourier_parameters, n_new);
+      std::valarray<int> int_parameters(n_int_parameters * n_new);
+      // Copy proc0 results to the final arrays:
+      if (n_new_local > 0) results_local.read(j_scan_first, n_new_local, &parameters[0], &fourier_parameters[0], &int_parameters[0]);
+      // Receive results from other procs:
+      big offset = n_new_local;
+      for (j = 1; j < n_procs; j++) {
+	// Use mpi_rank as the tag
+	for (big first = 0; first < n_new_per_proc[j]; first += piece_size) {
+	  big n_piece = std::min(piece_size, n_new_per_proc[j] - first);
+	  MPI_Recv(&parameters[0] + n_parameters * offset, n_parameters * n_piece,
+		   MPI_QSCFLOAT, j, j, mpi_comm, &mpi_status);
+	  MPI_Recv(&fourier_parameters[0] + n_fourier_parameters * offset, n_fourier_parameters * n_piece,
+		   MPI_QSCFLOAT, j, j, mpi_comm, &mpi_status);
+	  MPI_Recv(&int_parameters[0] + n_int_parameters * offset, n_int_parameters * n_piece,
+		   MPI_INT, j, j, mpi_comm, &mpi_status);
+	  offset += n_piece;
+	}
       }
-      for (k = 0; k < n_int_parameters; k++) {
-	int_parameters[k + n_int_parameters * j] = int_parameters_local[k + n_int_parameters * j];
-      }
-    }
-    // Receive results from other procs:
-    big offset = j_scan;
-    for (j = 1; j < n_procs; j++) {
-      // Use mpi_rank as the tag
-      MPI_Recv(&parameters(0, offset), n_parameters * n_solves_kept[j],
-	       MPI_QSCFLOAT, j, j, mpi_comm, &mpi_status);
-      MPI_Recv(&fourier_parameters(0, offset), n_fourier_parameters * n_solves_kept[j],
-	       MPI_QSCFLOAT, j, j, mpi_comm, &mpi_status);
-      MPI_Recv(&int_parameters[offset * n_int_parameters], n_int_parameters * n_solves_kept[j],
-	       MPI_INT, j, j, mpi_comm, &mpi_status);
-      offset += n_solves_kept[j];
-    }
-
-    scan_eta_bar.resize(n_scan, 0.0);
-    scan_sigma0.resize(n_scan, 0.0);
-    scan_B2c.resize(n_scan, 0.0);
-    scan_B2s.resize(n_scan, 0.0);
-    scan_min_R0.resize(n_scan, 0.0);
-    scan_max_curvature.resize(n_scan, 0.0);
-    scan_iota.resize(n_scan, 0.0);
-    scan_max_elongation.resize(n_scan, 0.0);
-    scan_min_L_grad_B.resize(n_scan, 0.0);
-    scan_min_L_grad_grad_B.resize(n_scan, 0.0);
-    scan_r_singularity.resize(n_scan, 0.0);
-    scan_d2_volume_d_psi2.resize(n_scan, 0.0);
-    scan_DMerc_times_r2.resize(n_scan, 0.0);
-    scan_B20_variation.resize(n_scan, 0.0);
-    scan_B20_residual.resize(n_scan, 0.0);
-    scan_standard_deviation_of_R.resize(n_scan, 0.0);
-    scan_standard_deviation_of_Z.resize(n_scan, 0.0);
-
-    scan_helicity.resize(n_scan * n_int_parameters, 0);
 
-    scan_R0c.resize(axis_nmax_plus_1, n_scan, 0.0);
-    scan_R0s.resize(axis_nmax_plus_1, n_scan, 0.0);
-    scan_Z0c.resize(axis_nmax_plus_1, n_scan, 0.0);
-    scan_Z0s.resize(axis_nmax_plus_1, n_scan, 0.0);
-    
-    // Unpack parameters
-    for (j = 0; j < n_scan; j++) {
-      scan_eta_bar[j]           = parameters( 0, j);
-      scan_sigma0[j]            = parameters( 1, j);
-      scan_B2c[j]               = parameters( 2, j);
-      scan_B2s[j]               = parameters( 3, j);
-      scan_min_R0[j]            = parameters( 4, j);
-      scan_max_curvature[j]     = parameters( 5, j);
-      scan_iota[j]              = parameters( 6, j);
-      scan_max_elongation[j]    = parameters( 7, j);
-      scan_min_L_grad_B[j]      = parameters( 8, j);
-      scan_min_L_grad_grad_B[j] = parameters( 9, j);
-      scan_r_singularity[j]     = parameters(10, j);
-      scan_d2_volume_d_psi2[j]  = parameters(11, j);
-      scan_DMerc_times_r2[j]    = parameters(12, j);
-      scan_B20_variation[j]     = parameters(13, j);
-      scan_B20_residual[j]      = parameters(14, j);
-      scan_standard_deviation_of_R[j] = parameters(15, j);
-      scan_standard_deviation_of_Z[j] = parameters(16, j);
-      
-      scan_helicity[j] = int_parameters[0 + j * n_int_parameters];
-      
-      for (k = 0; k < axis_nmax_plus_1; k++) {
- 	scan_R0c(k, j) = fourier_parameters(k + 0 * axis_nmax_plus_1, j);
-	scan_R0s(k, j) = fourier_parameters(k + 1 * axis_nmax_plus_1, j);
-	scan_Z0c(k, j) = fourier_parameters(k + 2 * axis_nmax_plus_1, j);
-	scan_Z0s(k, j) = fourier_parameters(k + 3 * axis_nmax_plus_1, j);
+      if (pareto_objectives.size() > 0) {
+	// Only the merged front of the archives is saved:
+	n_new = merge_pareto_archives(n_new, parameters, fourier_parameters, int_parameters);
+      }
+      if (pareto_objectives.size() > 0 || top_k > 0) {
+	n_scan = n_new;
+	n_scan_offset = 0;
       }
+      unpack_results(0, n_new, parameters, fourier_parameters, n_int_parameters, int_parameters);
     }
 
     big total_rejected = 0;
@@ -212,12 +202,31 @@ void Scan::collect_results(int n_parameters,
 	      << " (" << filter_fractions[REJECTED_DUE_TO_DMERC] << ")" << std::endl;
     std::cout << "  Rejected due to r_singularity:     " << std::setw(width) << filters[REJECTED_DUE_TO_R_SINGULARITY]
 	      << " (" << filter_fractions[REJECTED_DUE_TO_R_SINGULARITY] << ")" << std::endl;
+    if (filters[N_SCREENING_REJECTIONS] > 0) {
+      std::cout << "  Rejected at screening_nphi:        " << std::setw(width) << filters[N_SCREENING_REJECTIONS]
+		<< " (" << filter_fractions[N_SCREENING_REJECTIONS] << ")" << std::endl;
+    }
+    if (filters[N_PREFILTER_REJECTIONS] > 0) {
+      std::cout << "  Rejected before init_axis:         " << std::setw(width) << filters[N_PREFILTER_REJECTIONS]
+		<< " (" << filter_fractions[N_PREFILTER_REJECTIONS] << ")" << std::endl;
+    }
+    if (surrogate) {
+      std::cout << "  Rejected by the surrogate model:   " << std::setw(width) << filters[REJECTED_DUE_TO_SURROGATE]
+		<< " (" << filter_fractions[REJECTED_DUE_TO_SURROGATE] << ")" << std::endl;
+      std::cout << "  Surrogate rejections audited:      " << std::setw(width) << filters[N_SURROGATE_AUDITS]
+		<< " (" << filter_fractions[N_SURROGATE_AUDITS] << ")" << std::endl;
+      std::cout << "  Audited, but kept:                 " << std::setw(width) << filters[N_SURROGATE_AUDITS_KEPT]
+		<< " (" << filter_fractions[N_SURROGATE_AUDITS_KEPT] << ")" << std::endl;
+    }
     std::cout << "  Total rejected:                    " << std::setw(width) << total_rejected
 	      << " (" << ((qscfloat)total_rejected) / filters[ATTEMPTS] << ")" << std::endl;
     std::cout << "  Kept:                              " << std::setw(width) << n_scan
 	      << " (" << filter_fractions[KEPT] << ")" << std::endl;
     std::cout << "  Kept + rejected:                   " << std::setw(width) << n_scan + total_rejected
 	      << std::endl;
+    if (constrained_sampling || adaptive_sampling) {
+      std::cout << "  Mean sampling weight:              " << std::setw(width) << mean_sampling_weight << std::endl;
+    }
     
     std::cout << std::setprecision(4) << "Time elapsed, summed over processors:" << std::endl;
     width = 10;
@@ -225,6 +234,11 @@ void Scan::collect_results(int n_parameters,
     std::cout << "  Time for random number generation: " << std::setw(width) << timing[TIME_RANDOM]
 	      << " (" << timing[TIME_RANDOM] / timing_total << ")" << std::endl;
     
+    if (timing[TIME_SCREENING] > 0) {
+      std::cout << "  Time for screening:                " << std::setw(width) << timing[TIME_SCREENING]
+		<< " (" << timing[TIME_SCREENING] / timing_total << ")" << std::endl;
+    }
+    
     std::cout << "  Time for init_axis:                " << std::setw(width) << timing[TIME_INIT_AXIS]
 	      << " (" << timing[TIME_INIT_AXIS] / timing_total << ")" << std::endl;
     
@@ -248,7 +262,7 @@ void Scan::collect_results(int n_parameters,
 		<< " (" << timing[TIME_R_SINGULARITY] / timing_total << ")" << std::endl;
     }
     
-    if (n_scan < 1000) {
+    if (n_scan < 1000 && !parallel_netcdf) {
       std::cout << std::setprecision(2) << std::endl;
       std::cout << "min_R0: " << scan_min_R0 << std::endl;
       std::cout << std::endl;
@@ -257,7 +271,7 @@ void Scan::collect_results(int n_parameters,
       std::cout << "max_elongation: " << scan_max_elongation << std::endl;
       std::cout << std::endl;
       std::cout << "helicity:";
-      for (j = 0; j < n_scan; j++) std::cout << " " << scan_helicity[j];
+      for (std::size_t j_helicity = 0; j_helicity < scan_helicity.size(); j_helicity++) std::cout << " " << scan_helicity[j_helicity];
       std::cout << std::endl;
       std::cout << std::endl;
       std::cout << "min_L_grad_B: " << scan_min_L_grad_B << std::endl;
@@ -284,6 +298,29 @@ void Scan::collect_results(int n_parameters,
     }
   } // if proc0
 
+  if (parallel_netcdf) {
+    // Every proc keeps its own new configurations, and
+    // write_netcdf() writes them to the rows n_scan_offset ...
+    // n_scan_offset + n_new_local - 1. All procs need the same
+    // totals, since they all define the same NetCDF variables.
+    MPI_Bcast(&n_scan, 1, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+    MPI_Bcast(&n_new, 1, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+    MPI_Bcast(filters, N_FILTERS, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+    MPI_Bcast(filter_fractions, N_FILTERS, MPI_QSCFLOAT, 0, mpi_comm);
+    MPI_Bcast(timing, N_TIMES, MPI_QSCFLOAT, 0, mpi_comm);
+    MPI_Bcast(&mean_sampling_weight, 1, MPI_QSCFLOAT, 0, mpi_comm);
+    big offset_in_batch = 0;
+    MPI_Exscan(&n_new_local, &offset_in_batch, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, mpi_comm);
+    // The result of MPI_Exscan is undefined on proc 0:
+    if (proc0) offset_in_batch = 0;
+    n_scan_offset = n_scan - n_new + offset_in_batch;
+    Matrix parameters(n_parameters, n_new_local);
+    Matrix fourier_parameters(n_fourier_parameters, n_new_local);
+    std::valarray<int> int_parameters(n_int_parameters * n_new_local);
+    if (n_new_local > 0) results_local.read(j_scan_first, n_new_local, &parameters[0], &fourier_parameters[0], &int_parameters[0]);
+    unpack_results(0, n_new_local, parameters, fourier_parameters, n_int_parameters, int_parameters);
+  }
+
   MPI_Barrier(mpi_comm);
   if (proc0 && verbose) {
     auto end = std::chrono::steady_clock::now();
@@ -292,3 +329,76 @@ void Scan::collect_results(int n_parameters,
 	      << elapsed.count() << " seconds" << std::endl;
   }
 }
+
+/** Copy the packed results for the n_kept configurations starting at
+ *  column "first" into the scan_* arrays.
+ */
+void Scan::unpack_results(big first,
+			  big n_kept,
+			  Matrix& parameters,
+			  Matrix& fourier_parameters,
+			  int n_int_parameters,
+			  std::valarray<int>& int_parameters) {
+  const int axis_nmax_plus_1 = R0c_max.size();
+  big j;
+  int k;
+
+  scan_eta_bar.resize(n_kept, 0.0);
+  scan_sigma0.resize(n_kept, 0.0);
+  scan_B2c.resize(n_kept, 0.0);
+  scan_B2s.resize(n_kept, 0.0);
+  scan_min_R0.resize(n_kept, 0.0);
+  scan_max_curvature.resize(n_kept, 0.0);
+  scan_iota.resize(n_kept, 0.0);
+  scan_max_elongation.resize(n_kept, 0.0);
+  scan_min_L_grad_B.resize(n_kept, 0.0);
+  scan_min_L_grad_grad_B.resize(n_kept, 0.0);
+  scan_r_singularity.resize(n_kept, 0.0);
+  scan_d2_volume_d_psi2.resize(n_kept, 0.0);
+  scan_DMerc_times_r2.resize(n_kept, 0.0);
+  scan_B20_variation.resize(n_kept, 0.0);
+  scan_B20_residual.resize(n_kept, 0.0);
+  scan_standard_deviation_of_R.resize(n_kept, 0.0);
+  scan_standard_deviation_of_Z.resize(n_kept, 0.0);
+  scan_sampling_weight.resize(n_kept, 0.0);
+
+  scan_helicity.resize(n_kept, 0);
+  scan_nphi.resize(n_kept, 0);
+
+  scan_R0c.resize(axis_nmax_plus_1, n_kept, 0.0);
+  scan_R0s.resize(axis_nmax_plus_1, n_kept, 0.0);
+  scan_Z0c.resize(axis_nmax_plus_1, n_kept, 0.0);
+  scan_Z0s.resize(axis_nmax_plus_1, n_kept, 0.0);
+
+  // Unpack parameters
+  for (j = 0; j < n_kept; j++) {
+    scan_eta_bar[j]           = parameters( 0, first + j);
+    scan_sigma0[j]            = parameters( 1, first + j);
+    scan_B2c[j]               = parameters( 2, first + j);
+    scan_B2s[j]               = parameters( 3, first + j);
+    scan_min_R0[j]            = parameters( 4, first + j);
+    scan_max_curvature[j]     = parameters( 5, first + j);
+    scan_iota[j]              = parameters( 6, first + j);
+    scan_max_elongation[j]    = parameters( 7, first + j);
+    scan_min_L_grad_B[j]      = parameters( 8, first + j);
+    scan_min_L_grad_grad_B[j] = parameters( 9, first + j);
+    scan_r_singularity[j]     = parameters(10, first + j);
+    scan_d2_volume_d_psi2[j]  = parameters(11, first + j);
+    scan_DMerc_times_r2[j]    = parameters(12, first + j);
+    scan_B20_variation[j]     = parameters(13, first + j);
+    scan_B20_residual[j]      = parameters(14, first + j);
+    scan_standard_deviation_of_R[j] = parameters(15, first + j);
+    scan_standard_deviation_of_Z[j] = parameters(16, first + j);
+    scan_sampling_weight[j]   = parameters(17, first + j);
+
+    scan_helicity[j] = int_parameters[0 + (first + j) * n_int_parameters];
+    scan_nphi[j]     = int_parameters[1 + (first + j) * n_int_parameters];
+
+    for (k = 0; k < axis_nmax_plus_1; k++) {
+      scan_R0c(k, j) = fourier_parameters(k + 0 * axis_nmax_plus_1, first + j);
+      scan_R0s(k, j) = fourier_parameters(k + 1 * axis_nmax_plus_1, first + j);
+      scan_Z0c(k, j) = fourier_parameters(k + 2 * axis_nmax_plus_1, first + j);
+      scan_Z0s(k, j) = fourier_parameters(k + 3 * axis_nmax_plus_1, first + j);
+    }
+  }
+}
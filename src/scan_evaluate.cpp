@@ -0,0 +1,239 @@
+#include <chrono>
+#include <iostream>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::QscWorkspaces::QscWorkspaces() {
+  base = NULL;
+  max_workspaces = 8;
+  n_uses = 0;
+}
+
+/** The workspace at a given nphi, created from base the first time
+ * that nphi is needed. in_use is the object being refined, which must
+ * not be re-allocated.
+ */
+Qsc& qsc::QscWorkspaces::at_nphi(int nphi, const Qsc* in_use) {
+  std::size_t j, j_oldest = workspaces.size();
+  n_uses++;
+  for (j = 0; j < workspaces.size(); j++) {
+    if (workspaces[j]->nphi == nphi) {
+      last_use[j] = n_uses;
+      return *workspaces[j];
+    }
+  }
+  if (workspaces.size() >= max_workspaces) {
+    // Re-use the least recently used workspace:
+    for (j = 0; j < workspaces.size(); j++) {
+      if (workspaces[j].get() == in_use) continue;
+      if (j_oldest == workspaces.size() || last_use[j] < last_use[j_oldest]) j_oldest = j;
+    }
+  }
+  if (j_oldest == workspaces.size()) {
+    workspaces.push_back(std::unique_ptr<Qsc>(new Qsc(*base)));
+    last_use.push_back(0);
+  }
+  j = j_oldest;
+  last_use[j] = n_uses;
+  workspaces[j]->nphi = nphi;
+  workspaces[j]->allocate();
+  return *workspaces[j];
+}
+
+/** Number of copies of the Qsc object currently kept.
+ */
+int qsc::QscWorkspaces::n_workspaces() const {
+  return workspaces.size();
+}
+
+/** Refine nphi for the configuration in coarse, as in
+ * Qsc::adapt_nphi(), and return the workspace holding the result,
+ * which is coarse itself if no refinement was needed. coarse is left
+ * unchanged apart from its spectral_tail.
+ */
+Qsc& qsc::QscWorkspaces::refine(Qsc& coarse, bool include_r2) {
+  Qsc* q = &coarse;
+  int new_nphi;
+
+  q->measure_spectral_tail(include_r2);
+  while ((new_nphi = q->refined_nphi()) != q->nphi) {
+    Qsc& fine = at_nphi(new_nphi, q);
+    // These are the inputs that vary between configurations:
+    fine.eta_bar = q->eta_bar;
+    fine.sigma0 = q->sigma0;
+    fine.B2c = q->B2c;
+    fine.B2s = q->B2s;
+    fine.R0c = q->R0c;
+    fine.R0s = q->R0s;
+    fine.Z0c = q->Z0c;
+    fine.Z0s = q->Z0s;
+    fine.nphi_refinements = q->nphi_refinements;
+    fine.iota = q->iota;
+    fourier_interpolate(q->sigma, fine.sigma);
+    fine.recalculate_refined(include_r2);
+    q = &fine;
+  }
+  return *q;
+}
+
+/**
+ * Run the chain of calculations and filters for one randomly drawn
+ * configuration. qw must already hold the random inputs. qw and qs
+ * are working copies of the Qsc object owned by a single thread, so
+ * this function can be called from several threads at once: it
+ * writes only to qw, qs, the two pipelines, attempt, and timing, and
+ * it reads the Scan's input parameters and surrogate_model, which is
+ * NULL if attempts should not be skipped by the surrogate. On exit,
+ * attempt.result is KEPT or one of the REJECTED_DUE_TO_* values.
+ */
+void Scan::evaluate_attempt(Qsc& qw, Qsc& qs, FilterPipeline& pipeline, FilterPipeline& screening_pipeline,
+			    bool screening, const ScanSurrogate* surrogate_model, ScanAttempt& attempt, qscfloat* timing) {
+  std::chrono::time_point<std::chrono::steady_clock> section_start_time, section_end_time;
+  std::chrono::duration<double> elapsed;
+  int j, result;
+  const int axis_nmax_plus_1 = qw.R0c.size();
+
+  attempt.sigma_eq_solved = false;
+  attempt.r2_solved = false;
+  attempt.screened = false;
+  attempt.prefiltered = false;
+  attempt.surrogate_rejected = false;
+  attempt.diagnostics.resize(0);
+  attempt.features.resize(0);
+
+  // Crude check of whether R0 goes negative:
+  qscfloat R0_at_0 = qw.R0c.sum();
+  qscfloat R0_at_half_period = 0;
+  for (j = 0; j < axis_nmax_plus_1; j++) {
+    if (j % 2 == 0) {
+      R0_at_half_period += qw.R0c[j];
+    } else {
+      R0_at_half_period -= qw.R0c[j];
+    }
+  }
+  if (R0_at_0 <= 0 || R0_at_half_period <= 0) {
+    attempt.result = REJECTED_DUE_TO_R0_CRUDE;
+    return;
+  }
+
+  if (prefilter && !keep_all) {
+    result = prefilter_axis(qw);
+    if (result != KEPT) {
+      attempt.result = result;
+      attempt.prefiltered = true;
+      return;
+    }
+  }
+
+  // Coarse-to-fine cascade: discard configurations that fail a
+  // filter by a clear margin at low resolution.
+  if (screening) {
+    section_start_time = std::chrono::steady_clock::now();
+    qs.eta_bar = qw.eta_bar;
+    qs.sigma0 = qw.sigma0;
+    qs.B2c = qw.B2c;
+    qs.B2s = qw.B2s;
+    qs.R0c = qw.R0c;
+    qs.R0s = qw.R0s;
+    qs.Z0c = qw.Z0c;
+    qs.Z0s = qw.Z0s;
+    result = screening_pipeline.run(qs, NULL, NULL);
+    section_end_time = std::chrono::steady_clock::now();
+    elapsed = section_end_time - section_start_time;
+    timing[TIME_SCREENING] += elapsed.count();
+    if (result != KEPT) {
+      attempt.result = result;
+      attempt.screened = true;
+      return;
+    }
+  }
+
+  if (surrogate) {
+    attempt.features.resize(4 + 4 * axis_nmax_plus_1);
+    attempt.features[0] = qw.eta_bar;
+    attempt.features[1] = qw.sigma0;
+    attempt.features[2] = qw.B2c;
+    attempt.features[3] = qw.B2s;
+    for (j = 0; j < axis_nmax_plus_1; j++) {
+      attempt.features[4 + j + 0 * axis_nmax_plus_1] = qw.R0c[j];
+      attempt.features[4 + j + 1 * axis_nmax_plus_1] = qw.R0s[j];
+      attempt.features[4 + j + 2 * axis_nmax_plus_1] = qw.Z0c[j];
+      attempt.features[4 + j + 3 * axis_nmax_plus_1] = qw.Z0s[j];
+    }
+    if (surrogate_model && surrogate_model->trained
+	&& surrogate_model->probability(attempt.features) < surrogate_threshold) {
+      attempt.surrogate_rejected = true;
+      if (!attempt.surrogate_audit) {
+	// A skipped attempt stands for no configurations, and an
+	// audited one for 1 / surrogate_audit_fraction of them:
+	attempt.sampling_weight = 0;
+	attempt.result = REJECTED_DUE_TO_SURROGATE;
+	return;
+      }
+      attempt.sampling_weight /= surrogate_audit_fraction;
+    }
+  }
+
+  // If nphi_tolerance > 0, nphi is refined in the pipeline's
+  // workspaces, so qw stays at the starting nphi:
+  qw.nphi_refinements = 0;
+  attempt.result = pipeline.run(qw, &attempt, timing);
+  // The results are in qw unless nphi was refined:
+  Qsc& qr = pipeline.result();
+  if (diagnostic_sketches) record_diagnostics(qr, pipeline, attempt);
+  if (attempt.result != KEPT) return;
+
+  // If we made it this far, then we found a keeper.
+  attempt.parameters.resize(SCAN_N_PARAMETERS);
+  attempt.parameters[0 ] = qr.eta_bar;
+  attempt.parameters[1 ] = qr.sigma0;
+  attempt.parameters[2 ] = qr.B2c;
+  attempt.parameters[3 ] = qr.B2s;
+  attempt.parameters[4 ] = qr.min_R0;
+  attempt.parameters[5 ] = qr.max_curvature;
+  attempt.parameters[6 ] = qr.iota;
+  attempt.parameters[7 ] = qr.max_elongation;
+  attempt.parameters[8 ] = qr.min_L_grad_B;
+  attempt.parameters[9 ] = qr.min_L_grad_grad_B;
+  attempt.parameters[10] = qr.min_r_singularity;
+  attempt.parameters[11] = qr.d2_volume_d_psi2;
+  attempt.parameters[12] = qr.DMerc_times_r2;
+  attempt.parameters[13] = qr.B20_grid_variation;
+  attempt.parameters[14] = qr.B20_residual;
+  attempt.parameters[15] = qr.standard_deviation_of_R;
+  attempt.parameters[16] = qr.standard_deviation_of_Z;
+  attempt.parameters[17] = attempt.sampling_weight;
+
+  attempt.int_parameters.resize(SCAN_N_INT_PARAMETERS);
+  attempt.int_parameters[0] = qr.helicity;
+  attempt.int_parameters[1] = qr.nphi;
+
+  attempt.fourier_parameters.resize(4 * axis_nmax_plus_1);
+  for (j = 0; j < axis_nmax_plus_1; j++) {
+    attempt.fourier_parameters[j + 0 * axis_nmax_plus_1] = qr.R0c[j];
+    attempt.fourier_parameters[j + 1 * axis_nmax_plus_1] = qr.R0s[j];
+    attempt.fourier_parameters[j + 2 * axis_nmax_plus_1] = qr.Z0c[j];
+    attempt.fourier_parameters[j + 3 * axis_nmax_plus_1] = qr.Z0s[j];
+  }
+}
+
+/**
+ * Replace the results for a kept configuration by those for its
+ * mirror image under Z -> -Z, without recomputing them. For I2 = 0,
+ * negating Z0c, Z0s, sigma0, and B2s gives the mirror image, for which
+ * iota and the helicity change sign and the other outputs are
+ * unchanged.
+ */
+void Scan::mirror_attempt(ScanAttempt& attempt) {
+  const int axis_nmax_plus_1 = attempt.fourier_parameters.size() / 4;
+  attempt.parameters[1] = -attempt.parameters[1];
+  if (q.at_least_order_r2) attempt.parameters[3] = -attempt.parameters[3];
+  attempt.parameters[6] = -attempt.parameters[6];
+  attempt.int_parameters[0] = -attempt.int_parameters[0];
+  for (int j = 0; j < axis_nmax_plus_1; j++) {
+    attempt.fourier_parameters[j + 2 * axis_nmax_plus_1] = -attempt.fourier_parameters[j + 2 * axis_nmax_plus_1];
+    attempt.fourier_parameters[j + 3 * axis_nmax_plus_1] = -attempt.fourier_parameters[j + 3 * axis_nmax_plus_1];
+  }
+}
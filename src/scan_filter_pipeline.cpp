@@ -0,0 +1,324 @@
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+// Typical cost of each stage relative to init_axis, measured for nphi
+// of 31 to 127. These are used to order the filters until the costs
+// have been measured in the scan.
+static const qscfloat typical_stage_cost[N_STAGES] = {1, 8, 12, 0.1, 2, 10};
+
+qsc::FilterOrder::FilterOrder() {
+  for (int j = 0; j < N_STAGES; j++) {
+    stage_seconds[j] = 0;
+    stage_calls[j] = 0;
+    stage_cost[j] = typical_stage_cost[j];
+  }
+}
+
+/** Set up the totals and estimates for a pipeline with n_filters
+ * filters.
+ */
+void qsc::FilterOrder::init(int n_filters) {
+  n_tested.resize(n_filters, 0);
+  n_rejected.resize(n_filters, 0);
+  rejection_probability.resize(n_filters, 0.5);
+}
+
+/** Re-estimate the cost of each stage and the rejection probability
+ * of each filter from the totals of all procs in comm. This is a
+ * collective call. A stage that has not yet run anywhere keeps its
+ * typical cost relative to the measured cost of init_axis. The +1 and
+ * +2 keep the rejection probabilities away from 0 and 1 before there
+ * is much data.
+ */
+void qsc::FilterOrder::update(MPI_Comm comm) {
+  const int n_filters = n_tested.size();
+  qscfloat seconds_total[N_STAGES];
+  big calls_total[N_STAGES];
+  std::valarray<big> n_tested_total(n_filters), n_rejected_total(n_filters);
+  int j;
+
+  MPI_Allreduce(stage_seconds, seconds_total, N_STAGES, MPI_QSCFLOAT, MPI_SUM, comm);
+  MPI_Allreduce(stage_calls, calls_total, N_STAGES, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  if (n_filters > 0) {
+    MPI_Allreduce(&n_tested[0], &n_tested_total[0], n_filters, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&n_rejected[0], &n_rejected_total[0], n_filters, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  }
+
+  if (calls_total[STAGE_INIT_AXIS] > 0) {
+    for (j = 0; j < N_STAGES; j++) {
+      if (calls_total[j] > 0) {
+	stage_cost[j] = seconds_total[j] / calls_total[j];
+      } else {
+	stage_cost[j] = typical_stage_cost[j] * seconds_total[STAGE_INIT_AXIS] / calls_total[STAGE_INIT_AXIS];
+      }
+    }
+  }
+  for (j = 0; j < n_filters; j++) {
+    rejection_probability[j] = (n_rejected_total[j] + 1.0) / (n_tested_total[j] + 2.0);
+  }
+}
+
+qsc::FilterPipeline::FilterPipeline() {
+  adaptive = false;
+  keep_all = false;
+  screening = false;
+  margin = 0;
+  min_L_grad_grad_B_to_stop = -1;
+  min_r_singularity_to_stop = -1;
+  n_stages = N_STAGES;
+  workspaces = NULL;
+  current = NULL;
+  for (int j = 0; j < N_STAGES; j++) {
+    stage_seconds[j] = 0;
+    stage_calls[j] = 0;
+    stage_done[j] = false;
+    stage_cost[j] = typical_stage_cost[j];
+  }
+}
+
+/** Set up the filters for a scan, in the order in which they were
+ * originally applied. The screening pipeline uses the same filters
+ * with thresholds loosened by screening_margin.
+ */
+void Scan::init_filter_pipeline(FilterPipeline& pipeline, bool for_screening) {
+  pipeline.filters.clear();
+  pipeline.filters.push_back({REJECTED_DUE_TO_R0, STAGE_INIT_AXIS, true, min_R0_to_keep,
+      [](Qsc& qs) -> qscfloat { return qs.min_R0; }, 0, 0});
+  pipeline.filters.push_back({REJECTED_DUE_TO_CURVATURE, STAGE_INIT_AXIS, true, min_L_grad_B_to_keep,
+      [](Qsc& qs) -> qscfloat { return 1.0 / qs.max_curvature; }, 0, 0});
+  pipeline.filters.push_back({REJECTED_DUE_TO_IOTA, STAGE_R1, true, min_iota_to_keep,
+      [](Qsc& qs) -> qscfloat { return std::abs(qs.iota); }, 0, 0});
+  pipeline.filters.push_back({REJECTED_DUE_TO_ELONGATION, STAGE_R1, false, max_elongation_to_keep,
+      [](Qsc& qs) -> qscfloat { return qs.max_elongation; }, 0, 0});
+  pipeline.filters.push_back({REJECTED_DUE_TO_L_GRAD_B, STAGE_R1, true, min_L_grad_B_to_keep,
+      [](Qsc& qs) -> qscfloat { return qs.min_L_grad_B; }, 0, 0});
+  if (q.at_least_order_r2) {
+    pipeline.filters.push_back({REJECTED_DUE_TO_B20_VARIATION, STAGE_R2, false, max_B20_variation_to_keep,
+	[](Qsc& qs) -> qscfloat { return qs.B20_grid_variation; }, 0, 0});
+    pipeline.filters.push_back({REJECTED_DUE_TO_D2_VOLUME_D_PSI2, STAGE_MERCIER, false, max_d2_volume_d_psi2_to_keep,
+	[](Qsc& qs) -> qscfloat { return qs.d2_volume_d_psi2; }, 0, 0});
+    pipeline.filters.push_back({REJECTED_DUE_TO_DMERC, STAGE_MERCIER, true, min_DMerc_times_r2_to_keep,
+	[](Qsc& qs) -> qscfloat { return qs.DMerc_times_r2; }, 0, 0});
+    pipeline.filters.push_back({REJECTED_DUE_TO_L_GRAD_GRAD_B, STAGE_GRAD_GRAD_B, true, min_L_grad_grad_B_to_keep,
+	[](Qsc& qs) -> qscfloat { return qs.min_L_grad_grad_B; }, 0, 0});
+    pipeline.filters.push_back({REJECTED_DUE_TO_R_SINGULARITY, STAGE_R_SINGULARITY, true, min_r_singularity_to_keep,
+	[](Qsc& qs) -> qscfloat { return qs.min_r_singularity; }, 0, 0});
+  }
+
+  pipeline.set_order(FilterOrder());
+  pipeline.adaptive = adaptive_filter_order;
+  pipeline.keep_all = keep_all;
+  pipeline.screening = for_screening;
+  pipeline.margin = for_screening ? screening_margin : 0;
+  pipeline.n_stages = q.at_least_order_r2 ? N_STAGES : STAGE_R2;
+  // A grid point below these bounds fails the filter, so the
+  // diagnostics can stop early:
+  pipeline.min_L_grad_grad_B_to_stop = keep_all ? -1.0 : min_L_grad_grad_B_to_keep * (1 - pipeline.margin);
+  pipeline.min_r_singularity_to_stop = keep_all ? -1.0 : min_r_singularity_to_keep * (1 - pipeline.margin);
+}
+
+/** Use the estimates in order to choose the order of the filters for
+ * the configurations that follow.
+ */
+void qsc::FilterPipeline::set_order(const FilterOrder& order) {
+  for (int j = 0; j < N_STAGES; j++) stage_cost[j] = order.stage_cost[j];
+  order_rejection_probability.resize(filters.size(), 0.5);
+  if (order.rejection_probability.size() == filters.size()) order_rejection_probability = order.rejection_probability;
+}
+
+/** Add the stage times and filter counts measured since the last call
+ * to the totals in order, and start counting again from 0.
+ */
+void qsc::FilterPipeline::add_statistics(FilterOrder& order) {
+  int j;
+  for (j = 0; j < N_STAGES; j++) {
+    order.stage_seconds[j] += stage_seconds[j];
+    order.stage_calls[j] += stage_calls[j];
+    stage_seconds[j] = 0;
+    stage_calls[j] = 0;
+  }
+  for (j = 0; j < (int) filters.size(); j++) {
+    order.n_tested[j] += filters[j].n_tested;
+    order.n_rejected[j] += filters[j].n_rejected;
+    filters[j].n_tested = 0;
+    filters[j].n_rejected = 0;
+  }
+}
+
+/** Estimated cost of running a stage and any of its prerequisites
+ * that have not yet run for the current configuration.
+ */
+qscfloat qsc::FilterPipeline::marginal_cost(int stage) {
+  qscfloat cost = 0;
+  int s = stage;
+  while (!stage_done[s]) {
+    cost += stage_cost[s];
+    if (s == STAGE_INIT_AXIS) break;
+    s = (s > STAGE_R2) ? STAGE_R2 : s - 1;
+  }
+  return cost;
+}
+
+/** Return true if value fails the filter. For the screening pipeline,
+ * the value must fail by more than the relative margin, allowing for
+ * the error of a coarse calculation.
+ */
+bool qsc::FilterPipeline::fails(ScanFilter& filter, qscfloat value) {
+  qscfloat tolerance = margin * std::max(std::abs(filter.threshold), std::abs(value));
+  if (filter.is_min) {
+    return value < filter.threshold - tolerance;
+  } else {
+    return value > filter.threshold + tolerance;
+  }
+}
+
+/** Run a stage of the calculation, after any prerequisites, unless it
+ * has already run for the current configuration. Returns false if
+ * Newton's method fails in the screening pipeline, in which case the
+ * coarse results say nothing reliable.
+ */
+bool qsc::FilterPipeline::run_stage(int stage, ScanAttempt* attempt, qscfloat* timing) {
+  if (stage_done[stage]) return true;
+  if (stage > STAGE_INIT_AXIS) {
+    if (!run_stage((stage > STAGE_R2) ? STAGE_R2 : stage - 1, attempt, timing)) return false;
+  }
+  // The prerequisites may have moved the calculation to a finer grid:
+  Qsc& qs = *current;
+
+  std::chrono::time_point<std::chrono::steady_clock> start_time, section_start_time, section_end_time;
+  std::chrono::duration<double> elapsed;
+  int time_index;
+  start_time = std::chrono::steady_clock::now();
+  section_start_time = start_time;
+  switch (stage) {
+  case STAGE_INIT_AXIS:
+    qs.init_axis();
+    time_index = TIME_INIT_AXIS;
+    break;
+  case STAGE_R1:
+    // Here is the main O(r^1) solve:
+    qs.solve_sigma_equation();
+    if (attempt) attempt->sigma_eq_solved = true;
+    section_end_time = std::chrono::steady_clock::now();
+    elapsed = section_end_time - section_start_time;
+    if (timing) timing[TIME_SIGMA_EQUATION] += elapsed.count();
+    if (screening && qs.newton_result != NEWTON_CONVERGED) return false;
+    section_start_time = section_end_time;
+    qs.r1_diagnostics();
+    if (qs.nphi_tolerance > 0) adapt_nphi(false);
+    time_index = TIME_R1_DIAGNOSTICS;
+    break;
+  case STAGE_R2:
+    // Here is the main O(r^2) solve:
+    qs.calculate_r2();
+    if (qs.nphi_tolerance > 0) adapt_nphi(true);
+    if (attempt) attempt->r2_solved = true;
+    time_index = TIME_CALCULATE_R2;
+    break;
+  case STAGE_MERCIER:
+    qs.mercier();
+    time_index = TIME_MERCIER;
+    break;
+  case STAGE_GRAD_GRAD_B:
+    qs.calculate_grad_grad_B_tensor(min_L_grad_grad_B_to_stop);
+    time_index = TIME_GRAD_GRAD_B_TENSOR;
+    break;
+  case STAGE_R_SINGULARITY:
+    qs.calculate_r_singularity(min_r_singularity_to_stop);
+    time_index = TIME_R_SINGULARITY;
+    break;
+  default:
+    throw std::runtime_error("Unrecognized stage in FilterPipeline::run_stage");
+  }
+  section_end_time = std::chrono::steady_clock::now();
+  elapsed = section_end_time - section_start_time;
+  if (timing) timing[time_index] += elapsed.count();
+  elapsed = section_end_time - start_time;
+  stage_seconds[stage] += elapsed.count();
+  stage_calls[stage]++;
+  stage_done[stage] = true;
+  return true;
+}
+
+/** Refine nphi for the current configuration if its spectral tail
+ * exceeds nphi_tolerance, either in place or, if workspaces is set,
+ * by moving to the workspace at the new nphi.
+ */
+void qsc::FilterPipeline::adapt_nphi(bool include_r2) {
+  if (workspaces) {
+    current = &workspaces->refine(*current, include_r2);
+  } else {
+    current->adapt_nphi(include_r2);
+  }
+}
+
+/** The Qsc object holding the results for the most recent
+ * configuration. This is the object passed to run(), unless nphi was
+ * refined using workspaces.
+ */
+Qsc& qsc::FilterPipeline::result() {
+  return *current;
+}
+
+/** Whether a stage was run for the most recent configuration.
+ */
+bool qsc::FilterPipeline::stage_ran(int stage) const {
+  return stage_done[stage];
+}
+
+/** Run the stages and filters for one configuration, held in qs.
+ *
+ * Returns the REJECTED_DUE_TO_* index of the filter that rejects the
+ * configuration, or KEPT. For a kept configuration, all stages have
+ * been run. The results are in result(). attempt and timing may be
+ * NULL.
+ */
+int qsc::FilterPipeline::run(Qsc& qs, ScanAttempt* attempt, qscfloat* timing) {
+  const int n_filters = filters.size();
+  int j, j_step, j_filter;
+  qscfloat score, best_score = 0;
+  std::vector<bool> tested(n_filters, false);
+
+  for (j = 0; j < N_STAGES; j++) stage_done[j] = false;
+  current = &qs;
+
+  if (!keep_all) {
+    for (j_step = 0; j_step < n_filters; j_step++) {
+      // Pick the next filter to apply:
+      j_filter = -1;
+      for (j = 0; j < n_filters; j++) {
+	if (tested[j]) continue;
+	if (!adaptive) {
+	  j_filter = j;
+	  break;
+	}
+	score = marginal_cost(filters[j].stage) / order_rejection_probability[j];
+	if (j_filter < 0 || score < best_score) {
+	  j_filter = j;
+	  best_score = score;
+	}
+      }
+
+      ScanFilter& filter = filters[j_filter];
+      if (!run_stage(filter.stage, attempt, timing)) return KEPT;
+      tested[j_filter] = true;
+      filter.n_tested++;
+      if (fails(filter, filter.value(*current))) {
+	filter.n_rejected++;
+	return filter.rejection;
+      }
+    }
+  }
+
+  // All the outputs are saved for a kept configuration, so make sure
+  // every stage has been run:
+  for (j = 0; j < n_stages; j++) {
+    if (!run_stage(j, attempt, timing)) return KEPT;
+  }
+  return KEPT;
+}
@@ -41,10 +41,20 @@ void Scan::input(std::string filename) {
   toml_read(varlist, indata, "Z0s_max", Z0s_max);
 
   toml_read(varlist, indata, "deterministic", deterministic);
+  toml_read(varlist, indata, "random_sequence", random_sequence);
+  toml_read(varlist, indata, "random_seed", random_seed);
   toml_read(varlist, indata, "save_period", save_period);
+  toml_read(varlist, indata, "progress_period", progress_period);
   toml_read(varlist, indata, "max_seconds", max_seconds);
   toml_read(varlist, indata, "max_keep_per_proc", max_keep_per_proc);
+  toml_read(varlist, indata, "result_chunk_size", result_chunk_size);
+  toml_read(varlist, indata, "spill_directory", spill_directory);
+  toml_read(varlist, indata, "candidates_file", candidates_file);
+  toml_read(varlist, indata, "candidates_distribution", candidates_distribution);
+  toml_read(varlist, indata, "candidates_chunk_size", candidates_chunk_size);
   toml_read(varlist, indata, "max_attempts_per_proc", max_attempts_per_proc);
+  toml_read(varlist, indata, "max_keep", max_keep);
+  toml_read(varlist, indata, "max_attempts", max_attempts);
 
   toml_read(varlist, indata, "keep_all", keep_all);
   toml_read(varlist, indata, "min_R0_to_keep", min_R0_to_keep);
@@ -56,6 +66,33 @@ void Scan::input(std::string filename) {
   toml_read(varlist, indata, "min_r_singularity_to_keep", min_r_singularity_to_keep);
   toml_read(varlist, indata, "min_DMerc_times_r2_to_keep", min_DMerc_times_r2_to_keep);
   toml_read(varlist, indata, "max_d2_volume_d_psi2_to_keep", max_d2_volume_d_psi2_to_keep);
+  toml_read(varlist, indata, "screening_nphi", screening_nphi);
+  toml_read(varlist, indata, "screening_margin", screening_margin);
+  toml_read(varlist, indata, "adaptive_filter_order", adaptive_filter_order);
+  toml_read(varlist, indata, "prefilter", prefilter);
+  toml_read(varlist, indata, "constrained_sampling", constrained_sampling);
+  toml_read(varlist, indata, "adaptive_sampling", adaptive_sampling);
+  toml_read(varlist, indata, "adaptive_sampling_fraction", adaptive_sampling_fraction);
+  toml_read(varlist, indata, "adaptive_sampling_period", adaptive_sampling_period);
+  toml_read(varlist, indata, "restart", restart);
+  toml_read(varlist, indata, "diagnostic_sketches", diagnostic_sketches);
+  toml_read(varlist, indata, "pareto_objectives", pareto_objectives);
+  toml_read(varlist, indata, "pareto_maximize", pareto_maximize);
+  toml_read(varlist, indata, "pareto_epsilon", pareto_epsilon);
+  toml_read(varlist, indata, "pareto_max_size", pareto_max_size);
+  toml_read(varlist, indata, "top_k", top_k);
+  toml_read(varlist, indata, "top_k_score_names", top_k_score_names);
+  toml_read(varlist, indata, "top_k_score_weights", top_k_score_weights);
+  toml_read(varlist, indata, "surrogate", surrogate);
+  toml_read(varlist, indata, "surrogate_training_attempts", surrogate_training_attempts);
+  toml_read(varlist, indata, "surrogate_threshold", surrogate_threshold);
+  toml_read(varlist, indata, "surrogate_audit_fraction", surrogate_audit_fraction);
+  toml_read(varlist, indata, "mirror_symmetry", mirror_symmetry);
+  toml_read(varlist, indata, "emit_mirror_partners", emit_mirror_partners);
+  toml_read(varlist, indata, "n_threads", n_threads);
+  toml_read(varlist, indata, "parallel_netcdf", parallel_netcdf);
+  toml_read(varlist, indata, "append_checkpoints", append_checkpoints);
+  toml_read(varlist, indata, "async_output", async_output);
 
   toml_unused(varlist, indata);
   
@@ -100,9 +137,40 @@ void Scan::input(std::string filename) {
   std::cout << "fourier_scan_option: " << fourier_scan_option << std::endl;
 
   std::cout << "save_period: " << save_period << std::endl;
+  std::cout << "progress_period: " << progress_period << std::endl;
   std::cout << "max_seconds: " << max_seconds << std::endl;
   std::cout << "max_keep_per_proc: " << max_keep_per_proc << std::endl;
+  std::cout << "result_chunk_size: " << result_chunk_size << std::endl;
+  if (!spill_directory.empty()) std::cout << "spill_directory: " << spill_directory << std::endl;
+  if (!candidates_file.empty()) {
+    std::cout << "candidates_file: " << candidates_file << std::endl;
+    std::cout << "candidates_distribution: " << candidates_distribution << std::endl;
+    std::cout << "candidates_chunk_size: " << candidates_chunk_size << std::endl;
+  }
+  if (max_keep > 0) std::cout << "max_keep: " << max_keep << std::endl;
+  if (max_attempts > 0) std::cout << "max_attempts: " << max_attempts << std::endl;
   std::cout << "deterministic: " << deterministic << std::endl;
+  std::cout << "random_sequence: " << random_sequence << std::endl;
+  std::cout << "random_seed: " << random_seed << std::endl;
+  std::cout << "restart: " << restart << std::endl;
+  std::cout << "diagnostic_sketches: " << diagnostic_sketches << std::endl;
+  if (pareto_objectives.size() > 0) {
+    std::cout << "pareto_objectives:";
+    for (std::size_t j = 0; j < pareto_objectives.size(); j++) std::cout << " " << pareto_objectives[j];
+    std::cout << std::endl;
+    std::cout << "pareto_maximize: " << pareto_maximize << std::endl;
+    std::cout << "pareto_epsilon: " << pareto_epsilon << std::endl;
+    std::cout << "pareto_max_size: " << pareto_max_size << std::endl;
+  }
+  if (top_k > 0) {
+    std::cout << "top_k: " << top_k << std::endl;
+    std::cout << "top_k_score_names:";
+    for (std::size_t j = 0; j < top_k_score_names.size(); j++) std::cout << " " << top_k_score_names[j];
+    std::cout << std::endl;
+    std::cout << "top_k_score_weights: " << top_k_score_weights << std::endl;
+  }
+  std::cout << "mirror_symmetry: " << mirror_symmetry << std::endl;
+  if (mirror_symmetry) std::cout << "emit_mirror_partners: " << emit_mirror_partners << std::endl;
   std::cout << "keep_all: " << keep_all << std::endl;
   if (!keep_all) {
     std::cout << "min_R0_to_keep: " << min_R0_to_keep << std::endl;
@@ -114,5 +182,25 @@ void Scan::input(std::string filename) {
     std::cout << "min_r_singularity_to_keep: " << min_r_singularity_to_keep << std::endl;
     std::cout << "max_d2_volume_d_psi2_to_keep: " << max_d2_volume_d_psi2_to_keep << std::endl;
     std::cout << "min_DMerc_times_r2_to_keep: " << min_DMerc_times_r2_to_keep << std::endl;
+    std::cout << "screening_nphi: " << screening_nphi << std::endl;
+    std::cout << "screening_margin: " << screening_margin << std::endl;
+    std::cout << "adaptive_filter_order: " << adaptive_filter_order << std::endl;
+    std::cout << "prefilter: " << prefilter << std::endl;
+    std::cout << "surrogate: " << surrogate << std::endl;
+    if (surrogate) {
+      std::cout << "surrogate_training_attempts: " << surrogate_training_attempts << std::endl;
+      std::cout << "surrogate_threshold: " << surrogate_threshold << std::endl;
+      std::cout << "surrogate_audit_fraction: " << surrogate_audit_fraction << std::endl;
+    }
+    std::cout << "constrained_sampling: " << constrained_sampling << std::endl;
+    std::cout << "adaptive_sampling: " << adaptive_sampling << std::endl;
+    if (adaptive_sampling) {
+      std::cout << "adaptive_sampling_fraction: " << adaptive_sampling_fraction << std::endl;
+      std::cout << "adaptive_sampling_period: " << adaptive_sampling_period << std::endl;
+    }
+    std::cout << "n_threads: " << n_threads << std::endl;
+    std::cout << "parallel_netcdf: " << parallel_netcdf << std::endl;
+    std::cout << "append_checkpoints: " << append_checkpoints << std::endl;
+    std::cout << "async_output: " << async_output << std::endl;
   }
 }
@@ -0,0 +1,217 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ParetoArchive::ParetoArchive() {
+  max_size = 1000;
+}
+
+big qsc::ParetoArchive::size() const {
+  return entries.size();
+}
+
+const ParetoEntry& qsc::ParetoArchive::entry(big j) const {
+  return entries[j];
+}
+
+void qsc::ParetoArchive::clear() {
+  entries.clear();
+}
+
+// Returns true if every key of a is <= the corresponding key of b:
+static bool weakly_dominates(const Vector& a, const Vector& b) {
+  for (std::size_t j = 0; j < a.size(); j++) {
+    if (a[j] > b[j]) return false;
+  }
+  return true;
+}
+
+static bool same_keys(const Vector& a, const Vector& b) {
+  for (std::size_t j = 0; j < a.size(); j++) {
+    if (a[j] != b[j]) return false;
+  }
+  return true;
+}
+
+/** Distance of an entry from the best corner of its box, in units of
+ * the box size. 0 if there is no grid.
+ */
+qscfloat qsc::ParetoArchive::corner_distance(const ParetoEntry& e) const {
+  qscfloat distance = 0, d;
+  for (std::size_t j = 0; j < e.objectives.size(); j++) {
+    if (epsilon[j] <= 0) continue;
+    d = e.objectives[j] / epsilon[j] - e.keys[j];
+    distance += d * d;
+  }
+  return distance;
+}
+
+/** Offer a kept configuration to the archive. Returns true if it was
+ * added, in which case any entries it dominates have been removed.
+ */
+bool qsc::ParetoArchive::insert(const Vector& parameters, const Vector& fourier_parameters,
+				const std::valarray<int>& int_parameters) {
+  const int n_objectives = parameter_index.size();
+  ParetoEntry e;
+  e.objectives.resize(n_objectives);
+  e.keys.resize(n_objectives);
+  for (int j = 0; j < n_objectives; j++) {
+    qscfloat value = parameters[parameter_index[j]];
+    if (use_abs[j]) value = std::abs(value);
+    e.objectives[j] = sign[j] * value;
+    e.keys[j] = (epsilon[j] > 0) ? std::floor(e.objectives[j] / epsilon[j]) : e.objectives[j];
+  }
+  if (std::isnan(e.keys.sum())) return false;
+
+  auto key0_less = [](const ParetoEntry& a, const ParetoEntry& b) { return a.keys[0] < b.keys[0]; };
+  auto begin_larger = std::lower_bound(entries.begin(), entries.end(), e, key0_less);
+  auto end_smaller = std::upper_bound(begin_larger, entries.end(), e, key0_less);
+
+  // Entries that might dominate the new one have a first key <= its
+  // own. With two objectives, the second key of the front decreases
+  // as the first increases, so only the last of these can:
+  auto begin_smaller = entries.begin();
+  if (n_objectives == 2 && end_smaller != entries.begin()) begin_smaller = end_smaller - 1;
+  for (auto it = begin_smaller; it != end_smaller; ++it) {
+    if (!weakly_dominates(it->keys, e.keys)) continue;
+    if (!same_keys(it->keys, e.keys)) return false;
+    // Same box: keep the entry that dominates the other, or else the
+    // one closer to the best corner of the box:
+    bool new_dominates = weakly_dominates(e.objectives, it->objectives) && !same_keys(e.objectives, it->objectives);
+    bool old_dominates = weakly_dominates(it->objectives, e.objectives);
+    if (old_dominates || (!new_dominates && corner_distance(e) >= corner_distance(*it))) return false;
+    // The box is the same, so no other entries are affected:
+    it->objectives = e.objectives;
+    it->parameters = parameters;
+    it->fourier_parameters = fourier_parameters;
+    it->int_parameters = int_parameters;
+    return true;
+  }
+
+  // Entries the new one might dominate have a first key >= its own.
+  // With two objectives they are the ones just after begin_larger
+  // with a second key >= its own:
+  big position = begin_larger - entries.begin();
+  if (n_objectives == 2) {
+    entries.erase(begin_larger, std::partition_point(begin_larger, entries.end(), [&](const ParetoEntry& a) {
+	  return a.keys[1] >= e.keys[1]; }));
+  } else {
+    entries.erase(std::remove_if(begin_larger, entries.end(), [&](const ParetoEntry& a) {
+	  return weakly_dominates(e.keys, a.keys); }), entries.end());
+  }
+
+  e.parameters = parameters;
+  e.fourier_parameters = fourier_parameters;
+  e.int_parameters = int_parameters;
+  entries.insert(entries.begin() + position, std::move(e));
+  if ((int) entries.size() > max_size) prune();
+  return true;
+}
+
+/** Drop the entry with the smallest crowding distance: the sum over
+ * objectives of the distance between its neighbors on the front,
+ * relative to the range of the objective. The entries with the
+ * smallest and largest value of any objective are never dropped.
+ */
+void qsc::ParetoArchive::prune() {
+  const big n = entries.size();
+  const int n_objectives = parameter_index.size();
+  std::vector<qscfloat> crowding(n, 0.0);
+  std::vector<big> order(n);
+  for (int k = 0; k < n_objectives; k++) {
+    for (big j = 0; j < n; j++) order[j] = j;
+    std::sort(order.begin(), order.end(), [&](big a, big b) {
+	return entries[a].objectives[k] < entries[b].objectives[k]; });
+    qscfloat range = entries[order[n - 1]].objectives[k] - entries[order[0]].objectives[k];
+    crowding[order[0]] = std::numeric_limits<qscfloat>::infinity();
+    crowding[order[n - 1]] = std::numeric_limits<qscfloat>::infinity();
+    if (range <= 0) continue;
+    for (big j = 1; j < n - 1; j++) {
+      crowding[order[j]] += (entries[order[j + 1]].objectives[k] - entries[order[j - 1]].objectives[k]) / range;
+    }
+  }
+  big j_min = std::min_element(crowding.begin(), crowding.end()) - crowding.begin();
+  entries.erase(entries.begin() + j_min);
+}
+
+/** Index in the parameters saved for each kept configuration of the
+ * quantity with the given name, which is the name of one of the
+ * scan_* arrays without the prefix, or "abs_iota". use_abs is set to
+ * true for "abs_iota".
+ */
+int Scan::objective_index(const std::string& name, bool& use_abs) {
+  // Names of the quantities, in the order of the parameters saved for
+  // each kept configuration:
+  const std::string names[] = {"eta_bar", "sigma0", "B2c", "B2s", "min_R0", "max_curvature", "iota",
+			       "max_elongation", "min_L_grad_B", "min_L_grad_grad_B", "r_singularity",
+			       "d2_volume_d_psi2", "DMerc_times_r2", "B20_variation", "B20_residual",
+			       "standard_deviation_of_R", "standard_deviation_of_Z"};
+  const int n_names = sizeof(names) / sizeof(names[0]);
+  use_abs = (name == "abs_iota");
+  int k = std::find(names, names + n_names, use_abs ? std::string("iota") : name) - names;
+  if (k == n_names) throw std::runtime_error("Unrecognized quantity for a pareto objective or top_k score: " + name);
+  return k;
+}
+
+/** Set up an empty archive from the pareto_* inputs.
+ */
+void Scan::init_pareto_archive(ParetoArchive& archive) {
+  const int n_objectives = pareto_objectives.size();
+  if (pareto_maximize.size() != 0 && (int) pareto_maximize.size() != n_objectives)
+    throw std::runtime_error("pareto_maximize must be empty or have the same size as pareto_objectives");
+  if (pareto_epsilon.size() != 0 && (int) pareto_epsilon.size() != n_objectives)
+    throw std::runtime_error("pareto_epsilon must be empty or have the same size as pareto_objectives");
+  if (pareto_max_size < 1 || pareto_max_size > 100000)
+    throw std::runtime_error("pareto_max_size must be between 1 and 100000");
+
+  archive.clear();
+  archive.max_size = pareto_max_size;
+  archive.parameter_index.resize(n_objectives);
+  archive.use_abs.resize(n_objectives);
+  archive.sign.resize(n_objectives);
+  archive.epsilon.resize(n_objectives);
+  for (int j = 0; j < n_objectives; j++) {
+    bool use_abs;
+    archive.parameter_index[j] = objective_index(pareto_objectives[j], use_abs);
+    archive.use_abs[j] = use_abs;
+    archive.sign[j] = (pareto_maximize.size() > 0 && pareto_maximize[j]) ? -1.0 : 1.0;
+    archive.epsilon[j] = (pareto_epsilon.size() > 0) ? pareto_epsilon[j] : 0.0;
+    if (archive.epsilon[j] < 0) throw std::runtime_error("pareto_epsilon must be >= 0");
+  }
+}
+
+/** On proc 0, merge the archives of all procs, held in the first n
+ * columns of the packed results, into a single archive, and pack its
+ * entries into the first columns. Returns the size of the merged
+ * archive.
+ */
+big Scan::merge_pareto_archives(big n, Matrix& parameters, Matrix& fourier_parameters,
+				std::valarray<int>& int_parameters) {
+  const int n_parameters = parameters.nrows();
+  const int n_fourier_parameters = fourier_parameters.nrows();
+  const int n_int_parameters = SCAN_N_INT_PARAMETERS;
+  big j;
+  int k;
+  ParetoArchive archive;
+  init_pareto_archive(archive);
+  Vector p(n_parameters), f(n_fourier_parameters);
+  std::valarray<int> ip(n_int_parameters);
+  for (j = 0; j < n; j++) {
+    for (k = 0; k < n_parameters; k++) p[k] = parameters(k, j);
+    for (k = 0; k < n_fourier_parameters; k++) f[k] = fourier_parameters(k, j);
+    for (k = 0; k < n_int_parameters; k++) ip[k] = int_parameters[k + n_int_parameters * j];
+    archive.insert(p, f, ip);
+  }
+  for (j = 0; j < archive.size(); j++) {
+    const ParetoEntry& e = archive.entry(j);
+    for (k = 0; k < n_parameters; k++) parameters(k, j) = e.parameters[k];
+    for (k = 0; k < n_fourier_parameters; k++) fourier_parameters(k, j) = e.fourier_parameters[k];
+    for (k = 0; k < n_int_parameters; k++) int_parameters[k + n_int_parameters * j] = e.int_parameters[k];
+  }
+  return archive.size();
+}
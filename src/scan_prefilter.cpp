@@ -0,0 +1,85 @@
+#include <cmath>
+#include <limits>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+/**
+ * Evaluate R0 and the axis curvature at a single toroidal angle
+ * directly from the Fourier coefficients, using the same formulas as
+ * init_axis(). This costs O(n_modes), rather than O(nphi * n_modes)
+ * for the whole grid.
+ */
+static void axis_at_phi(Qsc& qw, qscfloat phi, qscfloat& R, qscfloat& curvature) {
+  qscfloat Rp = 0, Rpp = 0, Zp = 0, Zpp = 0;
+  qscfloat sinangle, cosangle, d_l, d2_l, t1, t2, t3;
+  int n, nfp = qw.nfp, n_modes = qw.R0c.size();
+
+  R = qw.R0c[0];
+  for (n = 1; n < n_modes; n++) {
+    sinangle = sin((n * nfp) * phi);
+    cosangle = cos((n * nfp) * phi);
+    R += qw.R0c[n] * cosangle + qw.R0s[n] * sinangle;
+    Rp += qw.R0c[n] * (-n*nfp)*sinangle + qw.R0s[n] * (n*nfp)*cosangle;
+    Zp += qw.Z0c[n] * (-n*nfp)*sinangle + qw.Z0s[n] * (n*nfp)*cosangle;
+    Rpp += qw.R0c[n] * (-n*nfp*n*nfp)*cosangle
+      + qw.R0s[n] * (-n*nfp*n*nfp)*sinangle;
+    Zpp += qw.Z0c[n] * (-n*nfp*n*nfp)*cosangle
+      + qw.Z0s[n] * (-n*nfp*n*nfp)*sinangle;
+  }
+  d_l = sqrt(R * R + Rp * Rp + Zp * Zp);
+  d2_l = (R * Rp + Rp * Rpp + Zp * Zpp) / d_l;
+  // Components of d tangent / d l in cylindrical coordinates:
+  t1 = (-Rp * d2_l / d_l + (Rpp - R)) / (d_l * d_l);
+  t2 = (-R * d2_l / d_l + 2 * Rp) / (d_l * d_l);
+  t3 = (-Zp * d2_l / d_l + Zpp) / (d_l * d_l);
+  curvature = sqrt(t1 * t1 + t2 * t2 + t3 * t3);
+}
+
+/**
+ * Cheap tests of the min_R0_to_keep and curvature filters, applied
+ * before init_axis(). qw must hold the random axis coefficients.
+ *
+ * R0 and the curvature are evaluated at a few points of the phi grid
+ * of the template q. min_R0 can be no larger than R0 at any of these
+ * points, and max_curvature can be no smaller than the curvature at
+ * any of them, so a configuration rejected here would certainly be
+ * rejected by the same filter after init_axis().
+ *
+ * To keep the rejected_due_to_* counts the same as without this
+ * stage, the curvature test is only applied if the lower bound
+ * R0c[0] - sum_n (|R0c[n]| + |R0s[n]|) on R0 shows that the min_R0
+ * filter, which is applied first, must pass.
+ *
+ * Returns KEPT, REJECTED_DUE_TO_R0, or REJECTED_DUE_TO_CURVATURE.
+ */
+int Scan::prefilter_axis(Qsc& qw) {
+  const int n_samples = 4;
+  // Allow for rounding differences from the values in init_axis():
+  const qscfloat tolerance = 1000 * std::numeric_limits<qscfloat>::epsilon();
+  const int nphi = q.nphi;
+  const int axis_nmax = qw.R0c.size() - 1;
+  qscfloat phi, R, curvature, min_R = std::numeric_limits<qscfloat>::max(), max_curvature = 0;
+  int j, n;
+
+  for (j = 0; j < n_samples; j++) {
+    // Index j * nphi / n_samples of the phi grid:
+    phi = (2 * pi * ((j * nphi) / n_samples)) / (nphi * qw.nfp);
+    axis_at_phi(qw, phi, R, curvature);
+    if (R < min_R) min_R = R;
+    if (curvature > max_curvature) max_curvature = curvature;
+  }
+
+  if (min_R < min_R0_to_keep - tolerance * std::abs(qw.R0c[0])) return REJECTED_DUE_TO_R0;
+
+  // With fourier_extrema, min_R0 is the minimum of the interpolant,
+  // which equals the exact R0 only if the grid resolves every mode:
+  if (q.fourier_extrema && nphi <= 2 * axis_nmax) return KEPT;
+  qscfloat R0_lower_bound = qw.R0c[0];
+  for (n = 1; n <= axis_nmax; n++) R0_lower_bound -= std::abs(qw.R0c[n]) + std::abs(qw.R0s[n]);
+  if (R0_lower_bound < min_R0_to_keep + tolerance * std::abs(qw.R0c[0])) return KEPT;
+
+  if (max_curvature * min_L_grad_B_to_keep > 1 + tolerance) return REJECTED_DUE_TO_CURVATURE;
+  return KEPT;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <mpi.h>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+// Names of the filters and timings in the progress file, which match
+// the names of the corresponding variables in the output file:
+static const char* filter_names[N_FILTERS] = {
+  "attempts",
+  "kept",
+  "rejected_due_to_R0_crude",
+  "rejected_due_to_R0",
+  "rejected_due_to_curvature",
+  "rejected_due_to_iota",
+  "rejected_due_to_elongation",
+  "rejected_due_to_L_grad_B",
+  "rejected_due_to_B20_variation",
+  "rejected_due_to_L_grad_grad_B",
+  "rejected_due_to_d2_volume_d_psi2",
+  "rejected_due_to_DMerc",
+  "rejected_due_to_r_singularity",
+  "rejected_due_to_surrogate",
+  "n_sigma_eq_solves",
+  "n_r2_solves",
+  "n_screening_rejections",
+  "n_prefilter_rejections",
+  "n_surrogate_audits",
+  "n_surrogate_audits_kept"};
+
+static const char* timing_names[N_TIMES] = {
+  "random",
+  "init_axis",
+  "sigma_equation",
+  "r1_diagnostics",
+  "calculate_r2",
+  "mercier",
+  "grad_grad_B_tensor",
+  "r_singularity",
+  "screening"};
+
+/** Name of the JSON file with the progress of a running scan, which
+ * is written next to the output file.
+ */
+std::string Scan::progress_filename() {
+  return outfilename + ".progress.json";
+}
+
+/** Write a small JSON file describing the progress of a running scan,
+ * from the totals over all procs of the filter counts and timings. The
+ * totals come from the nonblocking reductions in random(), so unlike a
+ * checkpoint this does not collect any configurations. The estimated
+ * time remaining is the smallest of the estimates for each of the
+ * limits on the scan. The file is written to a temporary file that is
+ * then renamed, so a reader never sees a partial file. Only proc 0
+ * calls this.
+ */
+void Scan::write_progress(const big* filters_total, const qscfloat* timing_total, int n_running,
+			  qscfloat elapsed, qscfloat attempts_per_second, qscfloat kept_per_second, bool finished) {
+  int n_procs, j;
+  MPI_Comm_size(mpi_comm, &n_procs);
+  qscfloat attempts = filters_total[ATTEMPTS];
+  qscfloat kept = filters_total[KEPT];
+
+  qscfloat eta = max_seconds - elapsed;
+  if (max_attempts_per_proc > 0 && attempts_per_second > 0)
+    eta = std::min(eta, (((qscfloat) max_attempts_per_proc) * n_procs - attempts) / attempts_per_second);
+  if (max_attempts > 0 && attempts_per_second > 0)
+    eta = std::min(eta, (max_attempts - attempts) / attempts_per_second);
+  if (max_keep > 0 && kept_per_second > 0)
+    eta = std::min(eta, (max_keep - kept) / kept_per_second);
+  if (finished || eta < 0) eta = 0;
+
+  std::string filename = progress_filename();
+  std::string temp_filename = filename + ".tmp";
+  std::ofstream file(temp_filename.c_str());
+  if (!file.is_open()) throw std::runtime_error("Unable to open progress file " + temp_filename);
+  file << std::setprecision(6);
+  file << "{" << std::endl;
+  file << "  \"finished\": " << (finished ? "true" : "false") << "," << std::endl;
+  file << "  \"n_procs\": " << n_procs << "," << std::endl;
+  file << "  \"n_procs_running\": " << n_running << "," << std::endl;
+  file << "  \"elapsed_seconds\": " << elapsed << "," << std::endl;
+  file << "  \"eta_seconds\": " << eta << "," << std::endl;
+  file << "  \"attempts\": " << filters_total[ATTEMPTS] << "," << std::endl;
+  file << "  \"kept\": " << filters_total[KEPT] << "," << std::endl;
+  file << "  \"fraction_kept\": " << (attempts > 0 ? kept / attempts : 0) << "," << std::endl;
+  file << "  \"attempts_per_second\": " << attempts_per_second << "," << std::endl;
+  file << "  \"kept_per_second\": " << kept_per_second << "," << std::endl;
+  file << "  \"filters\": {";
+  for (j = 0; j < N_FILTERS; j++) {
+    file << (j > 0 ? ", " : "") << "\"" << filter_names[j] << "\": " << filters_total[j];
+  }
+  file << "}," << std::endl;
+  file << "  \"fractions\": {";
+  for (j = 0; j < N_FILTERS; j++) {
+    file << (j > 0 ? ", " : "") << "\"" << filter_names[j] << "\": " << (attempts > 0 ? filters_total[j] / attempts : 0);
+  }
+  file << "}," << std::endl;
+  file << "  \"timing_seconds\": {";
+  for (j = 0; j < N_TIMES; j++) {
+    file << (j > 0 ? ", " : "") << "\"" << timing_names[j] << "\": " << timing_total[j];
+  }
+  file << "}" << std::endl;
+  file << "}" << std::endl;
+
+  file.close();
+  if (file.fail()) throw std::runtime_error("Error writing progress file " + temp_filename);
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0)
+    throw std::runtime_error("Unable to rename " + temp_filename + " to " + filename);
+}
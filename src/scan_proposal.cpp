@@ -0,0 +1,116 @@
+#include <cmath>
+#include <stdexcept>
+#include <mpi.h>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ScanProposal::ScanProposal() {
+  n_dimensions = 0;
+  n_bins = 0;
+  fraction = 0;
+  n_fits = 0;
+}
+
+/** Set up an empty proposal, which is the box distribution, with
+ * n_bins bins in each dimension. Only the dimensions for which
+ * active_in is true are adapted.
+ */
+void qsc::ScanProposal::init(const std::vector<bool>& active_in, int n_bins_in, qscfloat fraction_in) {
+  if (n_bins_in < 1) throw std::runtime_error("ScanProposal needs at least 1 bin");
+  if (fraction_in < 0 || fraction_in >= 1)
+    throw std::runtime_error("adaptive_sampling_fraction must be >= 0 and < 1");
+  n_dimensions = active_in.size();
+  n_bins = n_bins_in;
+  fraction = fraction_in;
+  active = active_in;
+  counts_local.resize(n_dimensions * n_bins, 0);
+  counts_others.resize(n_dimensions * n_bins, 0);
+  density.resize(n_dimensions * n_bins, 1.0);
+  cdf.resize(n_dimensions * (n_bins + 1), 0.0);
+  n_fits = 0;
+  fit();
+}
+
+static int bin_of(qscfloat u, int n_bins) {
+  int bin = (int) (u * n_bins);
+  if (bin < 0) bin = 0;
+  if (bin >= n_bins) bin = n_bins - 1;
+  return bin;
+}
+
+/** Add a kept configuration, given by its positions u in [0, 1], to
+ * the histograms on this proc. The proposal only changes at the next
+ * fit().
+ */
+void qsc::ScanProposal::add(const Vector& uniforms) {
+  for (int d = 0; d < n_dimensions; d++) {
+    if (active[d]) counts_local[d * n_bins + bin_of(uniforms[d], n_bins)]++;
+  }
+}
+
+/** Recompute the densities and cumulative distributions from the
+ * histograms of this proc and of the other procs.
+ */
+void qsc::ScanProposal::fit() {
+  int d, b;
+  qscfloat total, count;
+  for (d = 0; d < n_dimensions; d++) {
+    total = n_bins;
+    for (b = 0; b < n_bins; b++) total += counts_local[d * n_bins + b] + counts_others[d * n_bins + b];
+    cdf[d * (n_bins + 1)] = 0;
+    for (b = 0; b < n_bins; b++) {
+      count = 1.0 + counts_local[d * n_bins + b] + counts_others[d * n_bins + b];
+      if (!active[d]) count = total / n_bins;
+      density[d * n_bins + b] = count * n_bins / total;
+      cdf[d * (n_bins + 1) + b + 1] = cdf[d * (n_bins + 1) + b] + count / total;
+    }
+    cdf[d * (n_bins + 1) + n_bins] = 1.0;
+  }
+  n_fits++;
+}
+
+/** Product of the proposal densities at the positions u, relative to
+ * the box distribution.
+ */
+qscfloat qsc::ScanProposal::density_at(const Vector& uniforms) const {
+  qscfloat product = 1.0;
+  for (int d = 0; d < n_dimensions; d++) {
+    if (active[d]) product *= density[d * n_bins + bin_of(uniforms[d], n_bins)];
+  }
+  return product;
+}
+
+/** Map a uniform float v in [0, 1] to a sample of the proposal in
+ * dimension d, by inverting the piecewise-linear cumulative
+ * distribution.
+ */
+qscfloat qsc::ScanProposal::sample(int d, qscfloat v) const {
+  if (!active[d]) return v;
+  const qscfloat* c = &cdf[d * (n_bins + 1)];
+  int b = 0;
+  while (b < n_bins - 1 && v >= c[b + 1]) b++;
+  qscfloat u = (b + (v - c[b]) / (c[b + 1] - c[b])) / n_bins;
+  if (u >= 1) u = std::nextafter((qscfloat) 1, (qscfloat) 0);
+  return u;
+}
+
+std::valarray<big>& qsc::ScanProposal::local_counts() {
+  return counts_local;
+}
+
+void qsc::ScanProposal::set_other_counts(const std::valarray<big>& counts) {
+  counts_others = counts;
+}
+
+/** Add up the histograms of the kept configurations from all procs,
+ * and refit the proposal. This must be called by every proc.
+ */
+void Scan::exchange_proposal(ScanProposal& proposal) {
+  std::valarray<big>& counts_local = proposal.local_counts();
+  std::valarray<big> counts_total(counts_local.size());
+  MPI_Allreduce(&counts_local[0], &counts_total[0], counts_local.size(), MPI_UNSIGNED_LONG_LONG, MPI_SUM, mpi_comm);
+  proposal.set_other_counts(counts_total - counts_local);
+  proposal.fit();
+}
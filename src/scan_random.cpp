@@ -1,25 +1,81 @@
 #include <chrono>
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <limits>
 #include <mpi.h>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
 #include "qsc.hpp"
 #include "scan.hpp"
 #include "random.hpp"
+#include "background_writer.hpp"
 
 using namespace qsc;
 
+/** True if the distribution of a scan parameter is unchanged by
+ * negating the parameter.
+ */
+static bool symmetric_range(const std::string& option, qscfloat min, qscfloat max) {
+  if (min == max) return (min == 0);
+  if (option.compare(RANDOM_OPTION_2_SIDED_LOG) == 0) return true;
+  if (option.compare(RANDOM_OPTION_LINEAR) == 0) return (min == -max);
+  return false;
+}
+
+/** A Qsc object with the settings of q that write_netcdf_file()
+ * saves, without the arrays allocated for the calculation, for the
+ * snapshots written with async_output.
+ */
+static Qsc output_settings(const Qsc& q) {
+  Qsc settings;
+  settings.order_r_option = q.order_r_option;
+  settings.at_least_order_r2 = q.at_least_order_r2;
+  settings.nfp = q.nfp;
+  settings.nphi = q.nphi;
+  settings.nphi_tolerance = q.nphi_tolerance;
+  settings.min_nphi = q.min_nphi;
+  settings.max_nphi = q.max_nphi;
+  settings.fourier_extrema = q.fourier_extrema;
+  settings.max_newton_iterations = q.max_newton_iterations;
+  settings.max_linesearch_iterations = q.max_linesearch_iterations;
+  settings.newton_tolerance = q.newton_tolerance;
+  settings.newton_jacobian_period = q.newton_jacobian_period;
+  settings.newton_linesearch_option = q.newton_linesearch_option;
+  settings.I2 = q.I2;
+  settings.p2 = q.p2;
+  settings.B0 = q.B0;
+  settings.sG = q.sG;
+  settings.spsi = q.spsi;
+  settings.d_phi = q.d_phi;
+  settings.phi = q.phi;
+  return settings;
+}
+
 void Scan::random() {
-  const int n_parameters = 17;
-  const int n_int_parameters = 1;
+  const int n_parameters = SCAN_N_PARAMETERS;
+  const int n_int_parameters = SCAN_N_INT_PARAMETERS;
   const int axis_nmax_plus_1 = R0c_max.size();
   const int n_fourier_parameters = axis_nmax_plus_1 * 4;
-  Matrix parameters_local(n_parameters, max_keep_per_proc);
-  Matrix fourier_parameters_local(n_fourier_parameters, max_keep_per_proc);
-  std::valarray<int> int_parameters_local(n_int_parameters * max_keep_per_proc);
+  // With pareto_objectives or top_k, the kept configurations go into
+  // an archive of bounded size, which is packed into a separate buffer
+  // only when results are collected:
+  const bool pareto = (pareto_objectives.size() > 0);
+  const bool best_only = (top_k > 0);
+  // The Pareto archive and the top_k heap bound their own size, so
+  // max_keep_per_proc does not limit the number of kept configurations:
+  const big keep_limit = (pareto || best_only) ? std::numeric_limits<big>::max() : (big) max_keep_per_proc;
+  ScanResultBuffer results_local, packed_results;
   big j_scan = 0;
-  int j, k;
-  qscfloat R0_at_0, R0_at_half_period, val;
+  // Number of configurations in results_local already in the output file:
+  big j_scan_saved = 0;
+  int j;
   int mpi_rank, n_procs;
   MPI_Status mpi_status;
   
@@ -27,41 +83,127 @@ void Scan::random() {
   MPI_Comm_rank(mpi_comm, &mpi_rank);
   MPI_Comm_size(mpi_comm, &n_procs);
   bool proc0 = (mpi_rank == 0);
+
+  std::string spill_filename;
+  if (!spill_directory.empty()) {
+    std::string basename = outfilename.substr(outfilename.find_last_of('/') + 1);
+    spill_filename = spill_directory + "/" + basename + ".spill" + std::to_string(mpi_rank);
+  }
+  results_local.init(n_parameters, n_fourier_parameters, n_int_parameters, result_chunk_size, spill_filename);
+  packed_results.init(n_parameters, n_fourier_parameters, n_int_parameters, result_chunk_size, "");
   
-  // Initialize random distributions:
-  Random random_eta_bar(deterministic, eta_bar_scan_option, eta_bar_min, eta_bar_max);
-  Random random_sigma0(deterministic, sigma0_scan_option, sigma0_min, sigma0_max);
-  Random random_B2c(deterministic, B2c_scan_option, B2c_min, B2c_max);
-  Random random_B2s(deterministic, B2s_scan_option, B2s_min, B2s_max);
-  random_eta_bar.set_to_nth(mpi_rank * max_attempts_per_proc + 0);
-  random_sigma0.set_to_nth(mpi_rank * max_attempts_per_proc + 1);
-  random_B2c.set_to_nth(mpi_rank * max_attempts_per_proc + 2);
-  random_B2s.set_to_nth(mpi_rank * max_attempts_per_proc + 3);
-  Random* random_R0c[axis_nmax_plus_1];
-  Random* random_R0s[axis_nmax_plus_1];
-  Random* random_Z0c[axis_nmax_plus_1];
-  Random* random_Z0s[axis_nmax_plus_1];
+  // When continuing a scan, the seed, counts, and position in the
+  // random sequences of each proc are read from the restart file:
+  big first_attempt = 0;
+  if (pareto) {
+    if (append_checkpoints || parallel_netcdf)
+      throw std::runtime_error("pareto_objectives cannot be used with append_checkpoints or parallel_netcdf, since the front changes between checkpoints");
+    init_pareto_archive(pareto_local);
+  }
+  if (best_only) {
+    if (append_checkpoints || parallel_netcdf)
+      throw std::runtime_error("top_k cannot be used with append_checkpoints or parallel_netcdf, since the best configurations change between checkpoints");
+    if (pareto) throw std::runtime_error("top_k cannot be used together with pareto_objectives");
+    init_top_k(top_k_local);
+  }
+  if (restart) {
+    if (!append_checkpoints) throw std::runtime_error("restart requires append_checkpoints = true");
+    if (adaptive_sampling) throw std::runtime_error("restart cannot be used with adaptive_sampling, since the proposal is not saved");
+    if (surrogate) throw std::runtime_error("restart cannot be used with surrogate, since the model is not saved");
+    read_restart(first_attempt);
+  }
+
+  // With candidates_file, attempt n on this proc is the candidate at
+  // row candidate_row(n) of the file, and the number of attempts is
+  // limited by the number of candidates for this proc:
+  std::unique_ptr<ScanCandidateReader> candidates;
+  big n_candidates_local = 0;
+  const bool cyclic = (candidates_distribution.compare(SCAN_CANDIDATES_CYCLIC) == 0);
+  if (!candidates_file.empty()) {
+    if (!cyclic && candidates_distribution.compare(SCAN_CANDIDATES_BLOCK) != 0)
+      throw std::runtime_error("candidates_distribution must be block or cyclic");
+    if (adaptive_sampling || constrained_sampling || mirror_symmetry)
+      throw std::runtime_error("candidates_file cannot be used with adaptive_sampling, constrained_sampling, or mirror_symmetry");
+    if (candidates_chunk_size < 1) throw std::runtime_error("candidates_chunk_size must be at least 1");
+    candidates.reset(ScanCandidateReader::open(candidates_file));
+    candidates->chunk_size = candidates_chunk_size;
+    if (candidates->axis_nmax_plus_1() != axis_nmax_plus_1)
+      throw std::runtime_error("The size of R0c_max must be the number of axis Fourier modes in candidates_file");
+    const big n_candidates = candidates->size();
+    if (cyclic) {
+      const big chunk = candidates_chunk_size;
+      const big n_chunks = (n_candidates + chunk - 1) / chunk;
+      for (big j_chunk = mpi_rank; j_chunk < n_chunks; j_chunk += n_procs) {
+	n_candidates_local += std::min(chunk, n_candidates - j_chunk * chunk);
+      }
+    } else {
+      n_candidates_local = n_candidates / n_procs + ((big) mpi_rank < n_candidates % n_procs ? 1 : 0);
+    }
+  }
+  auto candidate_row = [&](big n) {
+    if (cyclic) {
+      const big chunk = candidates_chunk_size;
+      return ((n / chunk) * n_procs + mpi_rank) * chunk + n % chunk;
+    }
+    const big n_candidates = candidates->size();
+    return mpi_rank * (n_candidates / n_procs) + std::min((big) mpi_rank, n_candidates % n_procs) + n;
+  };
+  big attempts_limit = (max_attempts_per_proc > 0) ? (big) max_attempts_per_proc : std::numeric_limits<big>::max();
+  if (candidates) attempts_limit = std::min(attempts_limit, n_candidates_local);
+
+  // For non-deterministic runs, every proc uses the same seed, so a
+  // scan can be reproduced by setting random_seed to random_seed_used:
+  if (!restart) random_seed_used = random_seed;
+  if (!restart && !deterministic && random_seed_used == 0) {
+    if (proc0) random_seed_used = 1 + std::chrono::system_clock::now().time_since_epoch().count() % 2147483646;
+    MPI_Bcast(&random_seed_used, 1, MPI_INT, 0, mpi_comm);
+  }
+
+  // Initialize random distributions. Each parameter is one dimension
+  // of the sequence, in the order eta_bar, sigma0, B2c, B2s, then
+  // R0c, R0s, Z0c, Z0s for each mode:
+  const int n_dimensions = 4 + 4 * axis_nmax_plus_1;
+  std::vector<Random> randoms;
+  // Parameters with a nonzero range, which adaptive sampling can adapt:
+  std::vector<bool> varies;
+  auto add_random = [&](const std::string& option, qscfloat min, qscfloat max) {
+    randoms.push_back(Random(deterministic, option, min, max, random_sequence,
+			     randoms.size(), n_dimensions, random_seed_used));
+    varies.push_back(min != max);
+  };
+  add_random(eta_bar_scan_option, eta_bar_min, eta_bar_max);
+  add_random(sigma0_scan_option, sigma0_min, sigma0_max);
+  add_random(B2c_scan_option, B2c_min, B2c_max);
+  add_random(B2s_scan_option, B2s_min, B2s_max);
   for (j = 0; j < axis_nmax_plus_1; j++) {
     // For fourier_scan_option = "2 sided log", handle R0c[0] separately so it is not negative
     if (j == 0 && fourier_scan_option.compare(RANDOM_OPTION_2_SIDED_LOG) == 0) {
-      random_R0c[j] = new Random(deterministic, RANDOM_OPTION_LOG, R0c_min[j], R0c_max[j]);
+      add_random(RANDOM_OPTION_LOG, R0c_min[j], R0c_max[j]);
     } else {
-      random_R0c[j] = new Random(deterministic, fourier_scan_option, R0c_min[j], R0c_max[j]);
+      add_random(fourier_scan_option, R0c_min[j], R0c_max[j]);
     }
-    random_R0s[j] = new Random(deterministic, fourier_scan_option, R0s_min[j], R0s_max[j]);
-    random_Z0c[j] = new Random(deterministic, fourier_scan_option, Z0c_min[j], Z0c_max[j]);
-    random_Z0s[j] = new Random(deterministic, fourier_scan_option, Z0s_min[j], Z0s_max[j]);
-    random_R0c[j]->set_to_nth(mpi_rank * max_attempts_per_proc + 4);
-    random_R0s[j]->set_to_nth(mpi_rank * max_attempts_per_proc + 5);
-    random_Z0c[j]->set_to_nth(mpi_rank * max_attempts_per_proc + 6);
-    random_Z0s[j]->set_to_nth(mpi_rank * max_attempts_per_proc + 7);
-    // The set_to_nth() calls are so we can test that results are
-    // independent of the number of MPI procs for deterministic
-    // runs. Also, the +1, +2, ... in these calls is so the parameters
-    // are a bit less correlated for deterministic runs.
+    add_random(fourier_scan_option, R0s_min[j], R0s_max[j]);
+    add_random(fourier_scan_option, Z0c_min[j], Z0c_max[j]);
+    add_random(fourier_scan_option, Z0s_min[j], Z0s_max[j]);
+  }
+
+  // The parameters for attempt n on this proc are the numbers at
+  // position first_position[d] + n of each sequence d. Each proc
+  // starts at its own position in the sequences, so we can test that
+  // results are independent of the number of MPI procs. Since the
+  // random numbers are a pure function of the position, they can be
+  // drawn by any thread in any order. With the golden ratio sequence,
+  // every parameter uses the same 1D sequence, so the +1, +2, ...
+  // make the parameters a bit less correlated.
+  const big attempts_stride = (max_attempts_per_proc > 0) ? (big) max_attempts_per_proc : (1ULL << 40);
+  big stride = (deterministic && random_sequence.compare(SCAN_SEQUENCE_GOLDEN_RATIO) == 0) ? 1 : 0;
+  std::vector<big> first_position(n_dimensions);
+  for (j = 0; j < n_dimensions; j++) {
+    first_position[j] = ((big) mpi_rank) * attempts_stride + stride * ((j < 4) ? j : 4 + (j - 4) % 4);
   }
 
-  for (j = 0; j < N_FILTERS; j++) filters_local[j] = 0;
+  if (!restart) for (j = 0; j < N_FILTERS; j++) filters_local[j] = 0;
+  sketches_local.assign(diagnostic_sketches ? N_SKETCHES : 0, ScanSketch());
 
   q.R0c.resize(axis_nmax_plus_1, 0.0);
   q.R0s.resize(axis_nmax_plus_1, 0.0);
@@ -69,203 +211,632 @@ void Scan::random() {
   q.Z0s.resize(axis_nmax_plus_1, 0.0);
 
   std::chrono::time_point<std::chrono::steady_clock> end_time, checkpoint_time;
-  std::chrono::time_point<std::chrono::steady_clock> section_start_time, section_end_time;
   start_time = std::chrono::steady_clock::now();
   checkpoint_time = start_time;
   std::chrono::duration<double> elapsed;
-  for (j = 0; j < N_TIMES; j++) timing_local[j] = 0.0;
+  if (restart) {
+    // The configurations kept before the restart are already in the
+    // output file, so results_local holds only later ones:
+    j_scan = filters_local[KEPT];
+    output_file_started = true;
+  } else {
+    for (j = 0; j < N_TIMES; j++) timing_local[j] = 0.0;
+    sampling_weight_sum_local = 0.0;
+    output_file_started = false;
+  }
 
-  // Initialize the Qsc object:
+  // Initialize the Qsc object. Each thread works on its own copy of
+  // q, so q itself serves as a template that is not modified below.
   q.validate();
   q.allocate();
-  
-  bool keep_going = true;
-  while (keep_going) {
-    end_time = std::chrono::steady_clock::now();
-    elapsed = end_time - start_time;
-    if (elapsed.count() > max_seconds) keep_going = false;
-    
-    end_time = std::chrono::steady_clock::now();
-    elapsed = end_time - checkpoint_time;
-    if (elapsed.count() > save_period) {
-      checkpoint_time = end_time;
-      collect_results(n_parameters, parameters_local, fourier_parameters_local,
-		      n_int_parameters, int_parameters_local, j_scan);
-      write_netcdf();
-    }
-    
-    if (max_attempts_per_proc > 0 && filters_local[ATTEMPTS] >= max_attempts_per_proc) break;
-    
-    filters_local[ATTEMPTS]++;
-
-    // Pick random parameters. A small amount of time could be saved
-    // if random numbers were requested later, only when needed, if
-    // you make it past initial filters. However this makes it hard to
-    // test that the results are independent of the # of MPI
-    // processes, because then proc j would need a seed that depends
-    // on how many cases pass the filters on proc j-1. I don't think
-    // the random number generation is likely to take much of the
-    // overall time for a scan, so let's just get the random values
-    // here.
-    section_start_time = std::chrono::steady_clock::now();
-    q.eta_bar = random_eta_bar.get();
-    q.sigma0 = random_sigma0.get();
+
+  bool screening = (!keep_all && screening_nphi > 0);
+  if (screening && screening_nphi < 3) throw std::runtime_error("screening_nphi must be at least 3");
+  // Screening only saves time if it is coarser than the grid on which
+  // the full calculation starts:
+  if (screening && screening_nphi >= ((q.nphi_tolerance > 0 && q.min_nphi > 0) ? q.min_nphi : q.nphi))
+    throw std::runtime_error("screening_nphi must be less than nphi, or than min_nphi if it is used");
+  if (screening_margin < 0) throw std::runtime_error("screening_margin must be >= 0");
+  if (n_threads < 1) throw std::runtime_error("n_threads must be at least 1");
+  // Worker threads and the background writer run alongside the MPI
+  // calls of the main thread, which needs MPI_THREAD_FUNNELED:
+  int mpi_thread_support;
+  MPI_Query_thread(&mpi_thread_support);
+  if (mpi_thread_support < MPI_THREAD_FUNNELED && (n_threads > 1 || async_output)) {
+    if (proc0) std::cout << "The MPI library does not support threads, so using n_threads = 1 and async_output = false." << std::endl;
+    n_threads = 1;
+    async_output = false;
+  }
+
+  // For mirror_symmetry: the parameters negated by the mirror
+  // reflection Z -> -Z, and the first of them that varies, whose sign
+  // picks the representative of each mirror pair:
+  std::vector<int> mirror_dimensions;
+  int mirror_lead = -1;
+  if (mirror_symmetry) {
+    if (q.I2 != 0) throw std::runtime_error("mirror_symmetry requires I2 = 0");
+    mirror_dimensions.push_back(1);
+    if (!symmetric_range(sigma0_scan_option, sigma0_min, sigma0_max))
+      throw std::runtime_error("mirror_symmetry requires a range for sigma0 that is symmetric about 0");
     if (q.at_least_order_r2) {
-      q.B2c = random_B2c.get();
-      q.B2s = random_B2s.get();
+      mirror_dimensions.push_back(3);
+      if (!symmetric_range(B2s_scan_option, B2s_min, B2s_max))
+	throw std::runtime_error("mirror_symmetry requires a range for B2s that is symmetric about 0");
     }
-    // Initialize axis, and do a crude check of whether R0 goes negative:
-    R0_at_half_period = 0;
     for (j = 0; j < axis_nmax_plus_1; j++) {
-      q.R0s[j] = random_R0s[j]->get();
-      q.Z0s[j] = random_Z0s[j]->get();
-      q.Z0c[j] = random_Z0c[j]->get();
-      val = random_R0c[j]->get();
-      q.R0c[j] = val;
-
-      if (j % 2 == 0) {
-	R0_at_half_period += val;
-      } else {
-	R0_at_half_period -= val;
-      }
+      mirror_dimensions.push_back(6 + 4 * j);
+      mirror_dimensions.push_back(7 + 4 * j);
+      if (!symmetric_range(fourier_scan_option, Z0c_min[j], Z0c_max[j])
+	  || !symmetric_range(fourier_scan_option, Z0s_min[j], Z0s_max[j]))
+	throw std::runtime_error("mirror_symmetry requires ranges for Z0c and Z0s that are symmetric about 0");
+    }
+    // Prefer the leading Z0s mode:
+    for (j = 1; j < axis_nmax_plus_1 && mirror_lead < 0; j++) {
+      if (varies[7 + 4 * j]) mirror_lead = 7 + 4 * j;
+    }
+    for (int dm : mirror_dimensions) {
+      if (mirror_lead < 0 && varies[dm]) mirror_lead = dm;
+    }
+    if (mirror_lead < 0) throw std::runtime_error("mirror_symmetry requires Z0s, Z0c, sigma0, or B2s to vary");
+  }
+
+  // The proposal for adaptive sampling. B2c and B2s only matter at
+  // O(r^2), and with constrained_sampling R0c[0] is drawn separately:
+  const int adaptive_sampling_n_bins = 16;
+  ScanProposal proposal;
+  if (adaptive_sampling) {
+    if (adaptive_sampling_period < 1) throw std::runtime_error("adaptive_sampling_period must be at least 1");
+    // The golden ratio sequence puts every parameter on one line in
+    // parameter space, so the product of the 1D densities would not
+    // give correct importance weights:
+    if (deterministic && random_sequence.compare(SCAN_SEQUENCE_GOLDEN_RATIO) == 0)
+      throw std::runtime_error("adaptive_sampling requires random_sequence = R_d or Halton, or deterministic = false");
+    std::vector<bool> active = varies;
+    if (!q.at_least_order_r2) active[2] = active[3] = false;
+    if (constrained_sampling) active[4] = false;
+    proposal.init(active, adaptive_sampling_n_bins, adaptive_sampling_fraction);
+  }
+  // Chooses which attempts are drawn from the proposal. This uses the
+  // counter-based generator even for deterministic runs, since a
+  // regular pattern of attempts can pick out a biased subset of a
+  // low-discrepancy sequence:
+  Random proposal_selector(false, RANDOM_OPTION_LINEAR, 0.0, 1.0, RANDOM_SEQUENCE_GOLDEN_RATIO,
+			   n_dimensions, n_dimensions + 1, (random_seed_used == 0) ? 1 : random_seed_used);
+
+  // The surrogate model is fit when the first
+  // surrogate_training_attempts attempts have been folded, and is not
+  // changed afterwards. Later attempts wait for the fit, so the
+  // results do not depend on n_threads. The attempts to audit are
+  // chosen in the same way as those drawn from the proposal:
+  ScanSurrogate surrogate_model;
+  std::vector<Vector> surrogate_features;
+  std::vector<bool> surrogate_labels;
+  bool surrogate_fitted = false;
+  std::condition_variable surrogate_fit_done;
+  Random audit_selector(false, RANDOM_OPTION_LINEAR, 0.0, 1.0, RANDOM_SEQUENCE_GOLDEN_RATIO,
+			n_dimensions + 1, n_dimensions + 2, (random_seed_used == 0) ? 1 : random_seed_used);
+  if (surrogate) {
+    if (surrogate_training_attempts < 1) throw std::runtime_error("surrogate_training_attempts must be at least 1");
+    if (surrogate_threshold < 0 || surrogate_threshold > 1) throw std::runtime_error("surrogate_threshold must be in [0, 1]");
+    if (surrogate_audit_fraction < 0 || surrogate_audit_fraction > 1)
+      throw std::runtime_error("surrogate_audit_fraction must be in [0, 1]");
+  }
+  const big surrogate_end = surrogate ? (big) surrogate_training_attempts : 0;
+
+  // State shared by the threads, all protected by the mutex. Attempt
+  // numbers are handed out in order, in blocks of attempt_block_size,
+  // and attempt n always gets the same random parameters. Evaluated
+  // attempts can finish in any order, so they wait in "pending" until all earlier attempts
+  // have finished, and the results are then folded into the counters
+  // and the list of keepers in order. This makes the results
+  // independent of n_threads for deterministic runs.
+  std::mutex mutex;
+  const int attempt_block_size = 16;
+  bool keep_going = true;
+
+  // With max_keep or max_attempts, or with progress reports, the
+  // totals over all procs are added up by a chain of nonblocking
+  // reductions, so no proc waits for the others while the scan runs.
+  // Each proc starts the next reduction when the previous one
+  // completes (or, if only progress is reported, progress_period
+  // later), and every proc sees the same totals from each reduction,
+  // so all procs decide to stop at the same reduction. A proc that
+  // finishes on its own (e.g. at max_seconds) keeps taking part in the
+  // reductions, reporting that it is no longer running, until every
+  // proc has stopped. The reductions use their own communicator, so
+  // they cannot be confused with the collectives of the checkpoints.
+  const bool global_stop = (max_keep > 0 || max_attempts > 0);
+  const bool status_reductions = global_stop || progress_period > 0;
+  MPI_Comm status_comm = MPI_COMM_NULL;
+  MPI_Request status_requests[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+  // The counts are the filters, followed by the number of procs
+  // still running:
+  big counts_local[N_FILTERS + 1], counts_total[N_FILTERS + 1], counts_at_start[N_FILTERS + 1];
+  qscfloat timing_total[N_TIMES];
+  bool status_decided = false, status_in_flight = false, first_status = true;
+  std::chrono::time_point<std::chrono::steady_clock> status_start_time, progress_time;
+  auto start_status_reduction = [&](bool running) {
+    for (int jj = 0; jj < N_FILTERS; jj++) counts_local[jj] = filters_local[jj];
+    counts_local[N_FILTERS] = running ? 1 : 0;
+    MPI_Iallreduce(counts_local, counts_total, N_FILTERS + 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, status_comm, &status_requests[0]);
+    MPI_Iallreduce(timing_local, timing_total, N_TIMES, MPI_QSCFLOAT, MPI_SUM, status_comm, &status_requests[1]);
+    status_start_time = std::chrono::steady_clock::now();
+    status_in_flight = true;
+  };
+  // Returns true if the reduction completed, in which case
+  // status_decided is set if the scan should end on every proc, and
+  // proc 0 writes the progress file if it is due:
+  auto test_status_reduction = [&](bool wait) {
+    int completed = 1;
+    if (wait) {
+      MPI_Waitall(2, status_requests, MPI_STATUSES_IGNORE);
+    } else {
+      MPI_Testall(2, status_requests, &completed, MPI_STATUSES_IGNORE);
+    }
+    if (!completed) return false;
+    status_in_flight = false;
+    if ((max_keep > 0 && counts_total[KEPT] >= (big) max_keep)
+	|| (max_attempts > 0 && counts_total[ATTEMPTS] >= (big) max_attempts)
+	|| counts_total[N_FILTERS] == 0) status_decided = true;
+    // The first reduction is started before any attempts, so it gives
+    // the counts at the start, which are nonzero after a restart:
+    if (first_status) {
+      for (int jj = 0; jj <= N_FILTERS; jj++) counts_at_start[jj] = counts_total[jj];
+      first_status = false;
     }
-    R0_at_0 = q.R0c.sum();
-    section_end_time = std::chrono::steady_clock::now();
-    elapsed = section_end_time - section_start_time;
-    timing_local[TIME_RANDOM] += elapsed.count();
-    if (R0_at_0 <= 0 || R0_at_half_period <= 0) {
-      filters_local[REJECTED_DUE_TO_R0_CRUDE]++;
-      continue;
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> since_progress = now - progress_time;
+    if (proc0 && progress_period > 0 && (status_decided || since_progress.count() >= progress_period)) {
+      progress_time = now;
+      std::chrono::duration<double> since_start = now - start_time;
+      qscfloat seconds = std::max(since_start.count(), 1.0e-9);
+      write_progress(counts_total, timing_total, (int) counts_total[N_FILTERS], since_start.count(),
+		     (counts_total[ATTEMPTS] - counts_at_start[ATTEMPTS]) / seconds,
+		     (counts_total[KEPT] - counts_at_start[KEPT]) / seconds, status_decided);
     }
+    return true;
+  };
+  if (status_reductions) {
+    MPI_Comm_dup(mpi_comm, &status_comm);
+    progress_time = start_time;
+    start_status_reduction(true);
+  }
+  big next_attempt = first_attempt, next_to_fold = first_attempt;
+  next_attempt_local = first_attempt;
+  std::map<big, ScanAttempt> pending;
+  std::exception_ptr worker_exception = nullptr;
 
-    section_start_time = std::chrono::steady_clock::now();
-    q.init_axis();
-    section_end_time = std::chrono::steady_clock::now();
-    elapsed = section_end_time - section_start_time;
-    timing_local[TIME_INIT_AXIS] += elapsed.count();
-    if (!keep_all && q.grid_min_R0 < min_R0_to_keep) {
-      filters_local[REJECTED_DUE_TO_R0]++;
-      continue;
+  // With async_output, the checkpoints are written by this thread from
+  // snapshots of the scan. Each snapshot owns its copy of the output
+  // arrays and scalars, but not of q or the state of this proc, so the
+  // scan can change freely while it is written. Without
+  // append_checkpoints, each file replaces the previous one, so a
+  // snapshot still waiting to be written can be dropped for a newer
+  // one:
+  const bool async = async_output && !parallel_netcdf
+    && !(!candidates_file.empty() && ScanCandidateReader::is_netcdf(candidates_file));
+  BackgroundWriter output_writer;
+  auto write_checkpoint = [&]() {
+    if (!async) {
+      write_netcdf();
+      if (append_checkpoints) write_restart();
+      return;
     }
-    if (!keep_all && 1.0 / q.grid_max_curvature < min_L_grad_B_to_keep) {
-      filters_local[REJECTED_DUE_TO_CURVATURE]++;
-      continue;
+    if (!proc0) return;
+    std::shared_ptr<ScanOutput> snapshot = std::make_shared<ScanOutput>(*this);
+    std::shared_ptr<Qsc> q_snapshot = std::make_shared<Qsc>(output_settings(q));
+    output_writer.submit([snapshot, q_snapshot]() {
+	snapshot->write_netcdf_file(0, *q_snapshot);
+	if (snapshot->append_checkpoints) snapshot->write_restart_file();
+      }, !append_checkpoints);
+    // The next snapshot should update the file this one creates:
+    output_file_started = true;
+  };
+
+  // Copy the archive into packed_results:
+  auto pack_pareto_archive = [&]() -> ScanResultBuffer& {
+    packed_results.clear();
+    for (big jj = 0; jj < pareto_local.size(); jj++) {
+      const ParetoEntry& e = pareto_local.entry(jj);
+      packed_results.append(e.parameters, e.fourier_parameters, e.int_parameters);
     }
+    return packed_results;
+  };
 
-    // Here is the main O(r^1) solve:
-    section_start_time = std::chrono::steady_clock::now();
-    q.solve_sigma_equation();
-    section_end_time = std::chrono::steady_clock::now();
-    elapsed = section_end_time - section_start_time;
-    timing_local[TIME_SIGMA_EQUATION] += elapsed.count();
-    filters_local[N_SIGMA_EQ_SOLVES]++;
-    
-    section_start_time = std::chrono::steady_clock::now();
-    q.r1_diagnostics();
-    section_end_time = std::chrono::steady_clock::now();
-    elapsed = section_end_time - section_start_time;
-    timing_local[TIME_R1_DIAGNOSTICS] += elapsed.count();
-    if (!keep_all && std::abs(q.iota) < min_iota_to_keep) {
-      filters_local[REJECTED_DUE_TO_IOTA]++;
-      continue;
+  // Merge the best configurations of all procs, and on proc 0 copy
+  // them into packed_results:
+  auto pack_top_k = [&]() -> ScanResultBuffer& {
+    ScanTopK best = top_k_local;
+    reduce_top_k(best);
+    packed_results.clear();
+    if (!proc0) return packed_results;
+    for (big jj = 0; jj < best.size(); jj++) {
+      const ScanTopKEntry& e = best.entry(jj);
+      packed_results.append(e.parameters, e.fourier_parameters, e.int_parameters);
+    }
+    return packed_results;
+  };
+
+  auto fold = [&](ScanAttempt& attempt) {
+    // Once max_keep_per_proc is reached, discard any later attempts
+    // that other threads happened to be evaluating:
+    if (j_scan >= keep_limit) return;
+    // Attempts are folded in order, so this is where a restarted scan
+    // continues on this proc:
+    next_attempt_local = attempt.index + 1;
+    // With mirror partners, each attempt stands for both members of
+    // its mirror pair, which are kept or rejected together:
+    const int multiplicity = (mirror_symmetry && emit_mirror_partners) ? 2 : 1;
+    filters_local[ATTEMPTS] += multiplicity;
+    sampling_weight_sum_local += multiplicity * attempt.sampling_weight;
+    if (adaptive_sampling) {
+      if (attempt.result == KEPT) proposal.add(attempt.uniforms);
+      if ((attempt.index + 1) % adaptive_sampling_period == 0) proposal.fit();
+    }
+    // The solve counts are of the solves actually carried out, which
+    // a mirror pair shares:
+    if (attempt.sigma_eq_solved) filters_local[N_SIGMA_EQ_SOLVES]++;
+    if (attempt.r2_solved) filters_local[N_R2_SOLVES]++;
+    if (attempt.screened) filters_local[N_SCREENING_REJECTIONS] += multiplicity;
+    if (attempt.prefiltered) filters_local[N_PREFILTER_REJECTIONS] += multiplicity;
+    if (attempt.surrogate_rejected && attempt.result != REJECTED_DUE_TO_SURROGATE) {
+      filters_local[N_SURROGATE_AUDITS] += multiplicity;
+      if (attempt.result == KEPT) filters_local[N_SURROGATE_AUDITS_KEPT] += multiplicity;
+    }
+    if (diagnostic_sketches) add_to_sketches(attempt, multiplicity);
+    if (surrogate && attempt.index < surrogate_end) {
+      if (attempt.features.size() > 0) {
+	surrogate_features.push_back(attempt.features);
+	surrogate_labels.push_back(attempt.result == KEPT);
+      }
+      if (attempt.index + 1 == surrogate_end) {
+	surrogate_model.fit(surrogate_features, surrogate_labels);
+	if (verbose > 0 && proc0) {
+	  std::cout << "Surrogate fit to " << surrogate_features.size() << " attempts on proc 0: "
+		    << surrogate_model.n_splits() << " stumps" << std::endl;
+	  if (!surrogate_model.trained)
+	    std::cout << "The surrogate will not be used, since these attempts were all kept or all rejected" << std::endl;
+	}
+	std::vector<Vector>().swap(surrogate_features);
+	std::vector<bool>().swap(surrogate_labels);
+	surrogate_fitted = true;
+	surrogate_fit_done.notify_all();
+      }
     }
-    if (!keep_all && q.grid_max_elongation > max_elongation_to_keep) {
-      filters_local[REJECTED_DUE_TO_ELONGATION]++;
-      continue;
+    if (attempt.result != KEPT) {
+      filters_local[attempt.result] += multiplicity;
+      return;
     }
-    if (!keep_all && q.grid_min_L_grad_B < min_L_grad_B_to_keep) {
-      filters_local[REJECTED_DUE_TO_L_GRAD_B]++;
-      continue;
+    for (int j_copy = 0; j_copy < multiplicity && j_scan < keep_limit; j_copy++) {
+      if (j_copy == 1) mirror_attempt(attempt);
+      if (pareto) {
+	pareto_local.insert(attempt.parameters, attempt.fourier_parameters, attempt.int_parameters);
+      } else if (best_only) {
+	top_k_local.insert(top_k_local.score(attempt.parameters), attempt.parameters,
+			   attempt.fourier_parameters, attempt.int_parameters);
+      } else {
+	results_local.append(attempt.parameters, attempt.fourier_parameters, attempt.int_parameters);
+      }
+      filters_local[KEPT]++;
+      j_scan++;
     }
+    if (j_scan >= keep_limit) keep_going = false;
+  };
 
-    if (q.at_least_order_r2) {
-      // Here is the main O(r^2) solve:
-      section_start_time = std::chrono::steady_clock::now();
-      q.calculate_r2();
-      filters_local[N_R2_SOLVES]++;
-      section_end_time = std::chrono::steady_clock::now();
-      elapsed = section_end_time - section_start_time;
-      timing_local[TIME_CALCULATE_R2] += elapsed.count();
+  // Each thread has its own filter pipelines, so their statistics
+  // can be updated without locking:
+  std::vector<FilterPipeline> pipelines(n_threads), screening_pipelines(n_threads);
+  for (j = 0; j < n_threads; j++) {
+    init_filter_pipeline(pipelines[j], false);
+    init_filter_pipeline(screening_pipelines[j], true);
+  }
+  // With adaptive_filter_order, each thread adds its statistics to
+  // these totals and takes the current estimates when it claims a
+  // block of attempts. The estimates are combined over all procs at
+  // each checkpoint, so the order only changes at block boundaries.
+  FilterOrder filter_order, screening_filter_order;
+  filter_order.init(pipelines[0].filters.size());
+  screening_filter_order.init(screening_pipelines[0].filters.size());
 
-      // Filter results:
-      if (!keep_all && q.B20_grid_variation > max_B20_variation_to_keep) {
-	filters_local[REJECTED_DUE_TO_B20_VARIATION]++;
-	continue;
+  auto worker = [&](int j_thread) {
+    Qsc qw = q;
+    // With nphi_tolerance > 0, each configuration starts from min_nphi
+    // if it is set, and the finer grids are kept in workspaces:
+    QscWorkspaces workspaces;
+    if (q.nphi_tolerance > 0) {
+      if (q.min_nphi > 0) {
+	qw.nphi = q.min_nphi;
+	qw.allocate();
       }
+      workspaces.base = &q;
+      pipelines[j_thread].workspaces = &workspaces;
+    }
+    // Set up a coarse copy of the Qsc object for screening:
+    Qsc qs = q;
+    if (screening) {
+      qs.nphi = screening_nphi;
+      qs.nphi_tolerance = 0;
+      qs.allocate();
+    }
+    ScanAttempt attempt;
+    qscfloat timing_attempt[N_TIMES];
+    std::chrono::time_point<std::chrono::steady_clock> now, section_start_time, section_end_time;
+    std::chrono::duration<double> thread_elapsed;
+    qscfloat R0_rest_at_0, R0_rest_at_half_period, R0c0_lower, probability;
+    int jj, d;
+    // Random numbers for this thread's current block of attempts,
+    // indexed by dimension and then by attempt within the block, before
+    // and after the map to each parameter's distribution:
+    std::vector<Vector> block_uniforms(n_dimensions, Vector(attempt_block_size));
+    std::vector<Vector> draws(n_dimensions, Vector(attempt_block_size));
+    Vector block_weights(1.0, attempt_block_size), uniforms(n_dimensions);
+    big block_start = 0, block_end = 0, k;
+    // The thread's copy of the proposal, taken when each block is
+    // claimed, so it can be used without the mutex:
+    ScanProposal thread_proposal;
+    // With candidates_file, the values of the candidates in the
+    // thread's current block, read while holding the mutex since the
+    // reader is shared:
+    const int n_candidate_values = candidates ? candidates->n_values() : 0;
+    Vector block_candidates(n_candidate_values * attempt_block_size);
+    big block_first = 0;
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      now = std::chrono::steady_clock::now();
+      thread_elapsed = now - start_time;
+      if (thread_elapsed.count() > max_seconds) keep_going = false;
 
-      section_start_time = std::chrono::steady_clock::now();
-      q.mercier();
-      section_end_time = std::chrono::steady_clock::now();
-      elapsed = section_end_time - section_start_time;
-      timing_local[TIME_MERCIER] += elapsed.count();
-      if (!keep_all && q.d2_volume_d_psi2 > max_d2_volume_d_psi2_to_keep) {
-	filters_local[REJECTED_DUE_TO_D2_VOLUME_D_PSI2]++;
-	continue;
+      // Only the main thread writes checkpoints, since this involves MPI:
+      thread_elapsed = now - checkpoint_time;
+      if (j_thread == 0 && thread_elapsed.count() > save_period) {
+	checkpoint_time = now;
+	collect_results(pareto ? pack_pareto_archive() : (best_only ? pack_top_k() : results_local),
+			(pareto || best_only) ? 0 : j_scan_saved);
+	write_checkpoint();
+	if (append_checkpoints) {
+	  // The configurations written so far are no longer needed:
+	  j_scan_saved = results_local.size();
+	  results_local.release(j_scan_saved);
+	}
+	if (adaptive_sampling) exchange_proposal(proposal);
+	if (adaptive_filter_order && !keep_all) {
+	  pipelines[0].add_statistics(filter_order);
+	  screening_pipelines[0].add_statistics(screening_filter_order);
+	  filter_order.update(mpi_comm);
+	  screening_filter_order.update(mpi_comm);
+	}
+      }
+
+      // Only the main thread checks the totals over all procs:
+      if (j_thread == 0 && status_reductions && !status_decided) {
+	if (status_in_flight) test_status_reduction(false);
+	if (status_decided) {
+	  keep_going = false;
+	} else if (!status_in_flight) {
+	  thread_elapsed = now - status_start_time;
+	  if (global_stop || thread_elapsed.count() >= progress_period) start_status_reduction(true);
+	}
       }
-      if (!keep_all && q.DMerc_times_r2 < min_DMerc_times_r2_to_keep) {
-	filters_local[REJECTED_DUE_TO_DMERC]++;
-	continue;
+      
+      if (!keep_going) break;
+      bool new_block = (block_start == block_end);
+      if (new_block) {
+	if (next_attempt >= attempts_limit) break;
+	block_start = next_attempt;
+	block_end = block_start + attempt_block_size;
+	if (block_end > attempts_limit) block_end = attempts_limit;
+	next_attempt = block_end;
+	if (adaptive_sampling) thread_proposal = proposal;
+	pipelines[j_thread].add_statistics(filter_order);
+	screening_pipelines[j_thread].add_statistics(screening_filter_order);
+	pipelines[j_thread].set_order(filter_order);
+	screening_pipelines[j_thread].set_order(screening_filter_order);
+	if (candidates) {
+	  block_first = block_start;
+	  try {
+	    for (k = block_start; k < block_end; k++) {
+	      candidates->get(candidate_row(k), &block_candidates[(k - block_first) * n_candidate_values]);
+	    }
+	  } catch (...) {
+	    if (!worker_exception) worker_exception = std::current_exception();
+	    keep_going = false;
+	    break;
+	  }
+	}
       }
+      attempt.index = block_start++;
+      if (attempt.index >= surrogate_end && surrogate && !surrogate_fitted) {
+	// Wait for the other threads to finish the training attempts.
+	// The timeout lets this thread notice if the scan stops first:
+	while (!surrogate_fitted && keep_going) surrogate_fit_done.wait_for(lock, std::chrono::milliseconds(10));
+	if (!keep_going) break;
+      }
+      const ScanSurrogate* attempt_surrogate = (surrogate && attempt.index >= surrogate_end) ? &surrogate_model : NULL;
+      attempt.surrogate_audit = surrogate && (audit_selector.get_nth(first_position[0] + attempt.index) < surrogate_audit_fraction);
+
+      // The rest of the attempt runs without holding the mutex:
+      lock.unlock();
+      for (jj = 0; jj < N_TIMES; jj++) timing_attempt[jj] = 0.0;
 
+      // Pick random parameters. A small amount of time could be saved
+      // if random numbers were requested later, only when needed, if
+      // you make it past initial filters. However this makes it hard to
+      // test that the results are independent of the # of MPI
+      // processes, because then proc j would need a seed that depends
+      // on how many cases pass the filters on proc j-1. The numbers for
+      // each parameter are generated for a whole block of attempts at
+      // once, so this takes little of the overall time for a scan.
       section_start_time = std::chrono::steady_clock::now();
-      q.calculate_grad_grad_B_tensor();
+      if (new_block && !candidates) {
+	const big block_first = attempt.index;
+	const int block_size = block_end - block_first;
+	for (d = 0; d < n_dimensions; d++) {
+	  if ((int) block_uniforms[d].size() != block_size) block_uniforms[d].resize(block_size);
+	  randoms[d].get_uniform_batch(first_position[d] + block_first, block_uniforms[d]);
+	}
+	const qscfloat f = thread_proposal.fraction;
+	if (adaptive_sampling) {
+	  for (jj = 0; jj < block_size; jj++) {
+	    k = block_first + jj;
+	    if (proposal_selector.get_nth(first_position[0] + k) >= f) continue;
+	    for (d = 0; d < n_dimensions; d++) {
+	      block_uniforms[d][jj] = thread_proposal.sample(d, block_uniforms[d][jj]);
+	    }
+	  }
+	}
+	for (d = 0; d < n_dimensions; d++) {
+	  draws[d] = block_uniforms[d];
+	  randoms[d].map_batch(draws[d]);
+	}
+	if (mirror_symmetry) {
+	  // Replace each configuration by the mirror image with
+	  // mirror_lead > 0. The ranges are symmetric, so in the uniform
+	  // coordinates the mirror image is at 1 - u:
+	  for (jj = 0; jj < block_size; jj++) {
+	    if (draws[mirror_lead][jj] >= 0) continue;
+	    for (int dm : mirror_dimensions) {
+	      draws[dm][jj] = -draws[dm][jj];
+	      block_uniforms[dm][jj] = 1 - block_uniforms[dm][jj];
+	    }
+	  }
+	}
+	if ((int) block_weights.size() != block_size) block_weights.resize(block_size);
+	block_weights = 1.0;
+	if (adaptive_sampling) {
+	  for (jj = 0; jj < block_size; jj++) {
+	    for (d = 0; d < n_dimensions; d++) uniforms[d] = block_uniforms[d][jj];
+	    qscfloat density = thread_proposal.density_at(uniforms);
+	    if (mirror_symmetry) {
+	      // Either member of the mirror pair could have been drawn:
+	      for (int dm : mirror_dimensions) uniforms[dm] = 1 - uniforms[dm];
+	      density = 0.5 * (density + thread_proposal.density_at(uniforms));
+	    }
+	    block_weights[jj] = 1.0 / ((1 - f) + f * density);
+	  }
+	}
+      }
+      // The previous attempt was moved into pending, so resize:
+      attempt.uniforms.resize(n_dimensions);
+      if (candidates) {
+	const qscfloat* values = &block_candidates[(attempt.index - block_first) * n_candidate_values];
+	attempt.uniforms = 0.0;
+	qw.eta_bar = values[0];
+	qw.sigma0 = values[1];
+	if (qw.at_least_order_r2) {
+	  qw.B2c = values[2];
+	  qw.B2s = values[3];
+	}
+	for (d = 0; d < axis_nmax_plus_1; d++) {
+	  qw.R0c[d] = values[4 + d];
+	  qw.R0s[d] = values[4 + axis_nmax_plus_1 + d];
+	  qw.Z0c[d] = values[4 + 2 * axis_nmax_plus_1 + d];
+	  qw.Z0s[d] = values[4 + 3 * axis_nmax_plus_1 + d];
+	}
+	attempt.sampling_weight = 1.0;
+      } else {
+	// Position of this attempt within the block:
+	jj = draws[0].size() - (block_end - attempt.index);
+	for (d = 0; d < n_dimensions; d++) attempt.uniforms[d] = block_uniforms[d][jj];
+	qw.eta_bar = draws[0][jj];
+	qw.sigma0 = draws[1][jj];
+	if (qw.at_least_order_r2) {
+	  qw.B2c = draws[2][jj];
+	  qw.B2s = draws[3][jj];
+	}
+	for (d = 0; d < axis_nmax_plus_1; d++) {
+	  if (d > 0 || !constrained_sampling) qw.R0c[d] = draws[4 + 4 * d][jj];
+	  qw.R0s[d] = draws[5 + 4 * d][jj];
+	  qw.Z0c[d] = draws[6 + 4 * d][jj];
+	  qw.Z0s[d] = draws[7 + 4 * d][jj];
+	}
+	attempt.sampling_weight = block_weights[jj];
+      }
+      if (constrained_sampling) {
+	// R0 at phi = 0 and at half a field period is R0c[0] plus a sum
+	// over the other modes. Draw R0c[0] from the range in which R0 >
+	// 0 at both angles, which is where the crude R0 check passes.
+	// phi = 0 is also a grid point, so min_R0 can be no larger than
+	// R0 there.
+	R0_rest_at_0 = 0;
+	R0_rest_at_half_period = 0;
+	for (jj = 1; jj < axis_nmax_plus_1; jj++) {
+	  R0_rest_at_0 += qw.R0c[jj];
+	  R0_rest_at_half_period += (jj % 2 == 0) ? qw.R0c[jj] : -qw.R0c[jj];
+	}
+	R0c0_lower = std::max(-R0_rest_at_0, -R0_rest_at_half_period);
+	if (!keep_all) R0c0_lower = std::max(R0c0_lower, min_R0_to_keep - R0_rest_at_0);
+	qw.R0c[0] = randoms[4].get_at_least_nth(first_position[4] + attempt.index, R0c0_lower, probability);
+	attempt.sampling_weight *= probability;
+      }
       section_end_time = std::chrono::steady_clock::now();
-      elapsed = section_end_time - section_start_time;
-      timing_local[TIME_GRAD_GRAD_B_TENSOR] += elapsed.count();
-      if (!keep_all && q.grid_min_L_grad_grad_B < min_L_grad_grad_B_to_keep) {
-	filters_local[REJECTED_DUE_TO_L_GRAD_GRAD_B]++;
-	continue;
+      thread_elapsed = section_end_time - section_start_time;
+      timing_attempt[TIME_RANDOM] += thread_elapsed.count();
+
+      try {
+	evaluate_attempt(qw, qs, pipelines[j_thread], screening_pipelines[j_thread],
+			 screening, attempt_surrogate, attempt, timing_attempt);
+      } catch (...) {
+	lock.lock();
+	if (!worker_exception) worker_exception = std::current_exception();
+	keep_going = false;
+	break;
       }
+      lock.lock();
 
-      section_start_time = std::chrono::steady_clock::now();
-      q.calculate_r_singularity();
-      section_end_time = std::chrono::steady_clock::now();
-      elapsed = section_end_time - section_start_time;
-      timing_local[TIME_R_SINGULARITY] += elapsed.count();
-      if (!keep_all && q.r_singularity_robust < min_r_singularity_to_keep) {
-	filters_local[REJECTED_DUE_TO_R_SINGULARITY]++;
-	continue;
+      for (jj = 0; jj < N_TIMES; jj++) timing_local[jj] += timing_attempt[jj];
+      pending[attempt.index] = std::move(attempt);
+      while (!pending.empty() && pending.begin()->first == next_to_fold) {
+	fold(pending.begin()->second);
+	pending.erase(pending.begin());
+	next_to_fold++;
       }
-    } // if at_least_order_r2
-
-    // If we made it this far, then we found a keeper.
-    parameters_local(0 , j_scan) = q.eta_bar;
-    parameters_local(1 , j_scan) = q.sigma0;
-    parameters_local(2 , j_scan) = q.B2c;
-    parameters_local(3 , j_scan) = q.B2s;
-    parameters_local(4 , j_scan) = q.grid_min_R0;
-    parameters_local(5 , j_scan) = q.grid_max_curvature;
-    parameters_local(6 , j_scan) = q.iota;
-    parameters_local(7 , j_scan) = q.grid_max_elongation;
-    parameters_local(8 , j_scan) = q.grid_min_L_grad_B;
-    parameters_local(9 , j_scan) = q.grid_min_L_grad_grad_B;
-    parameters_local(10, j_scan) = q.r_singularity_robust;
-    parameters_local(11, j_scan) = q.d2_volume_d_psi2;
-    parameters_local(12, j_scan) = q.DMerc_times_r2;
-    parameters_local(13, j_scan) = q.B20_grid_variation;
-    parameters_local(14, j_scan) = q.B20_residual;
-    parameters_local(15, j_scan) = q.standard_deviation_of_R;
-    parameters_local(16, j_scan) = q.standard_deviation_of_Z;
-
-    int_parameters_local[0 + n_int_parameters * j_scan] = q.helicity;
-    
-    for (j = 0; j < axis_nmax_plus_1; j++) {
-      fourier_parameters_local(j + 0 * axis_nmax_plus_1, j_scan) = q.R0c[j];
-      fourier_parameters_local(j + 1 * axis_nmax_plus_1, j_scan) = q.R0s[j];
-      fourier_parameters_local(j + 2 * axis_nmax_plus_1, j_scan) = q.Z0c[j];
-      fourier_parameters_local(j + 3 * axis_nmax_plus_1, j_scan) = q.Z0s[j];
     }
-    
-    j_scan++;
+    pipelines[j_thread].workspaces = NULL;
+  };
+
+  // The calling thread is worker 0, so MPI is only called from the
+  // main thread:
+  std::vector<std::thread> threads;
+  for (j = 1; j < n_threads; j++) threads.push_back(std::thread(worker, j));
+  worker(0);
+  for (std::thread& thread : threads) thread.join();
 
-    if (j_scan >= max_keep_per_proc) keep_going = false;
+  if (status_reductions) {
+    // Take part in the reductions until every proc has stopped:
+    while (!status_decided) {
+      if (!status_in_flight) start_status_reduction(false);
+      test_status_reduction(true);
+    }
+    MPI_Comm_free(&status_comm);
+    if (proc0 && verbose > 0) std::cout << "Totals over all procs when the scan stopped: kept " << counts_total[KEPT]
+					<< ", attempts " << counts_total[ATTEMPTS] << std::endl;
+  }
+
+  if (worker_exception) std::rethrow_exception(worker_exception);
+
+  if (proc0 && verbose > 0 && adaptive_filter_order && !keep_all) {
+    for (j = 0; j < n_threads; j++) pipelines[j].add_statistics(filter_order);
+    std::cout << "Filter statistics for proc 0:" << std::endl;
+    for (j = 0; j < (int) pipelines[0].filters.size(); j++) {
+      std::cout << "  Filter " << pipelines[0].filters[j].rejection << ": tested " << filter_order.n_tested[j]
+		<< " times, rejected " << filter_order.n_rejected[j] << std::endl;
+    }
+    for (j = 0; j < N_STAGES; j++) {
+      std::cout << "  Stage " << j << ": mean time "
+		<< ((filter_order.stage_calls[j] > 0) ? filter_order.stage_seconds[j] / filter_order.stage_calls[j] : 0)
+		<< " seconds" << std::endl;
+    }
   }
 
   end_time = std::chrono::steady_clock::now();
   elapsed = end_time - start_time;
   std::cout << "Proc " << mpi_rank << " finished after " << elapsed.count() << " seconds" << std::endl;
 
-  collect_results(n_parameters, parameters_local, fourier_parameters_local,
-		  n_int_parameters, int_parameters_local, j_scan);
+  collect_results(pareto ? pack_pareto_archive() : (best_only ? pack_top_k() : results_local),
+		  (pareto || best_only) ? 0 : j_scan_saved);
 
+  // The caller writes the final results, so the checkpoints must be
+  // finished first:
+  output_writer.wait();
 }
@@ -0,0 +1,87 @@
+#include <vector>
+#include <stdexcept>
+#include <netcdf.h>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+namespace qsc {
+  /** Reader for candidates in the NetCDF output of a scan, as
+   * described for ScanCandidateReader.
+   */
+  class NetCDFCandidateReader : public ScanCandidateReader {
+  private:
+    int ncid;
+    // Variable ids, or -1 for B2c and B2s if absent:
+    int eta_bar_id, sigma0_id, B2c_id, B2s_id, fourier_ids[4];
+    std::string filename;
+    void check(int);
+  protected:
+    void read_rows(big, big, Vector&);
+  public:
+    NetCDFCandidateReader(std::string);
+    ~NetCDFCandidateReader();
+  };
+}
+
+void qsc::NetCDFCandidateReader::check(int retval) {
+  if (retval) throw std::runtime_error("Error reading candidates file " + filename + ": " + nc_strerror(retval));
+}
+
+qsc::NetCDFCandidateReader::NetCDFCandidateReader(std::string filename_in) {
+  int dim_id;
+  size_t length;
+  filename = filename_in;
+  check(nc_open(filename.c_str(), NC_NOWRITE, &ncid));
+  check(nc_inq_dimid(ncid, "n_scan", &dim_id));
+  check(nc_inq_dimlen(ncid, dim_id, &length));
+  n_candidates = length;
+  check(nc_inq_dimid(ncid, "axis_nmax_plus_1", &dim_id));
+  check(nc_inq_dimlen(ncid, dim_id, &length));
+  axis_nmax_plus_1_ = length;
+
+  check(nc_inq_varid(ncid, "scan_eta_bar", &eta_bar_id));
+  check(nc_inq_varid(ncid, "scan_sigma0", &sigma0_id));
+  // Scans at O(r^1) do not save B2c and B2s:
+  if (nc_inq_varid(ncid, "scan_B2c", &B2c_id)) B2c_id = -1;
+  if (nc_inq_varid(ncid, "scan_B2s", &B2s_id)) B2s_id = -1;
+  check(nc_inq_varid(ncid, "scan_R0c", &fourier_ids[0]));
+  check(nc_inq_varid(ncid, "scan_R0s", &fourier_ids[1]));
+  check(nc_inq_varid(ncid, "scan_Z0c", &fourier_ids[2]));
+  check(nc_inq_varid(ncid, "scan_Z0s", &fourier_ids[3]));
+}
+
+qsc::NetCDFCandidateReader::~NetCDFCandidateReader() {
+  nc_close(ncid);
+}
+
+void qsc::NetCDFCandidateReader::read_rows(big first, big n, Vector& values) {
+  const int n_modes = axis_nmax_plus_1_;
+  std::vector<double> column(n), fourier(n * n_modes);
+  size_t start[2] = {first, 0}, count[2] = {n, (size_t) n_modes};
+  big j;
+  int k, m;
+
+  // Scalars are stored one variable at a time:
+  const int scalar_ids[4] = {eta_bar_id, sigma0_id, B2c_id, B2s_id};
+  for (k = 0; k < 4; k++) {
+    if (scalar_ids[k] < 0) {
+      for (j = 0; j < n; j++) values[j * n_values() + k] = 0;
+      continue;
+    }
+    check(nc_get_vara_double(ncid, scalar_ids[k], start, count, column.data()));
+    for (j = 0; j < n; j++) values[j * n_values() + k] = column[j];
+  }
+  // The Fourier amplitudes have dimensions (n_scan, axis_nmax_plus_1):
+  for (k = 0; k < 4; k++) {
+    check(nc_get_vara_double(ncid, fourier_ids[k], start, count, fourier.data()));
+    for (j = 0; j < n; j++) {
+      for (m = 0; m < n_modes; m++) values[j * n_values() + 4 + k * n_modes + m] = fourier[j * n_modes + m];
+    }
+  }
+}
+
+ScanCandidateReader* qsc::new_netcdf_candidate_reader(std::string filename) {
+  return new NetCDFCandidateReader(filename);
+}
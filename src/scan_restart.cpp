@@ -0,0 +1,151 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <stdexcept>
+#include <mpi.h>
+#include "toml.hpp"
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+/** Name of the file with the state needed to continue a scan, which
+ * is written next to the output file.
+ */
+std::string ScanOutput::restart_filename() {
+  return outfilename + ".restart";
+}
+
+/** Save the state of each proc at the most recent call of
+ * collect_results(), so a scan can be continued with restart = true
+ * after the job ends. The state is the position in the random
+ * sequences of the first attempt not yet counted on each proc, the
+ * filter counts, the timings, and the sum of the sampling weights.
+ * Together with an output file written with append_checkpoints, this
+ * is everything needed to continue the scan without repeating or
+ * losing any attempts.
+ *
+ * The file is in TOML format. It is written to a temporary file that
+ * is then renamed, so a job that is killed while writing leaves the
+ * previous restart file intact. Only proc 0 writes the file.
+ */
+void Scan::write_restart() {
+  int mpi_rank;
+  MPI_Comm_rank(mpi_comm, &mpi_rank);
+  if (mpi_rank != 0) return;
+  write_restart_file();
+}
+
+/** The body of write_restart(), which makes no MPI calls, so it can be
+ * run on a snapshot of the scan by the background writer thread.
+ */
+void ScanOutput::write_restart_file() {
+  const int n_procs = restart_next_attempt.size();
+  int k;
+  if (n_procs == 0) return; // collect_results() has not been called.
+
+  std::string filename = restart_filename();
+  std::string temp_filename = filename + ".tmp";
+  std::ofstream file(temp_filename.c_str());
+  if (!file.is_open()) throw std::runtime_error("Unable to open restart file " + temp_filename);
+  // Scientific notation ensures TOML reads every real number as a float:
+  file << std::scientific << std::setprecision(17);
+  file << "# State for continuing a qsc scan with restart = true" << std::endl;
+  file << "n_procs = " << n_procs << std::endl;
+  file << "random_seed = " << random_seed_used << std::endl;
+  file << "random_sequence = \"" << random_sequence << "\"" << std::endl;
+  file << "max_attempts_per_proc = " << max_attempts_per_proc << std::endl;
+  file << "n_filters = " << N_FILTERS << std::endl;
+  file << "n_times = " << N_TIMES << std::endl;
+
+  file << "next_attempt = [";
+  for (k = 0; k < n_procs; k++) file << (k > 0 ? ", " : "") << restart_next_attempt[k];
+  file << "]" << std::endl;
+
+  file << "sampling_weight_sum = [";
+  for (k = 0; k < n_procs; k++) file << (k > 0 ? ", " : "") << restart_sampling_weight_sums[k];
+  file << "]" << std::endl;
+
+  file << "filters = [";
+  for (k = 0; k < n_procs * N_FILTERS; k++) file << (k > 0 ? ", " : "") << restart_filters[k];
+  file << "]" << std::endl;
+
+  file << "timing = [";
+  for (k = 0; k < n_procs * N_TIMES; k++) file << (k > 0 ? ", " : "") << restart_timing[k];
+  file << "]" << std::endl;
+
+  file.close();
+  if (file.fail()) throw std::runtime_error("Error writing restart file " + temp_filename);
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0)
+    throw std::runtime_error("Unable to rename " + temp_filename + " to " + filename);
+  if (verbose > 0) std::cout << "Wrote restart file " << filename << std::endl;
+}
+
+/** Restore the state saved by write_restart() on every proc. On exit,
+ * filters_local, timing_local, sampling_weight_sum_local, and
+ * random_seed_used hold the saved values, and first_attempt is the
+ * position in the random sequences of the next attempt on this proc.
+ * The number of procs and the inputs that determine the positions in
+ * the random sequences must not have changed.
+ */
+void Scan::read_restart(big& first_attempt) {
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(mpi_comm, &mpi_rank);
+  MPI_Comm_size(mpi_comm, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  std::valarray<big> filters_all(N_FILTERS * n_procs), next_attempt_all(n_procs);
+  Vector timing_all(N_TIMES * n_procs), sampling_weight_sums_all(n_procs);
+  std::string error_message;
+
+  if (proc0) {
+    std::string filename = restart_filename();
+    std::cout << "Reading restart file " << filename << std::endl;
+    try {
+      auto data = toml::parse(filename);
+      if (toml::find<int>(data, "n_procs") != n_procs) {
+	error_message = "The number of MPI processes must be the same as in the run that wrote the restart file";
+      } else if (toml::find<int>(data, "n_filters") != N_FILTERS || toml::find<int>(data, "n_times") != N_TIMES) {
+	error_message = "The restart file was written by an incompatible version of qsc";
+      } else if (toml::find<int>(data, "max_attempts_per_proc") != max_attempts_per_proc
+		 || toml::find<std::string>(data, "random_sequence") != random_sequence) {
+	error_message = "max_attempts_per_proc and random_sequence must be the same as in the run that wrote the restart file";
+      } else {
+	random_seed_used = toml::find<int>(data, "random_seed");
+	std::vector<long long> next_attempt_vector = toml::find<std::vector<long long>>(data, "next_attempt");
+	std::vector<long long> filters_vector = toml::find<std::vector<long long>>(data, "filters");
+	std::vector<double> sampling_weight_vector = toml::find<std::vector<double>>(data, "sampling_weight_sum");
+	std::vector<double> timing_vector = toml::find<std::vector<double>>(data, "timing");
+	if ((int) next_attempt_vector.size() != n_procs || filters_vector.size() != filters_all.size()
+	    || (int) sampling_weight_vector.size() != n_procs || timing_vector.size() != timing_all.size()) {
+	  error_message = "Arrays in the restart file have the wrong size";
+	} else {
+	  for (int k = 0; k < n_procs; k++) {
+	    next_attempt_all[k] = next_attempt_vector[k];
+	    sampling_weight_sums_all[k] = sampling_weight_vector[k];
+	  }
+	  for (std::size_t k = 0; k < filters_all.size(); k++) filters_all[k] = filters_vector[k];
+	  for (std::size_t k = 0; k < timing_all.size(); k++) timing_all[k] = timing_vector[k];
+	}
+      }
+    } catch (std::exception& e) {
+      error_message = std::string("Unable to read restart file: ") + e.what();
+    }
+  }
+
+  // Make every proc throw if proc 0 could not use the file:
+  int error = error_message.empty() ? 0 : 1;
+  MPI_Bcast(&error, 1, MPI_INT, 0, mpi_comm);
+  if (error) {
+    if (proc0) throw std::runtime_error(error_message);
+    throw std::runtime_error("Proc 0 was unable to read the restart file");
+  }
+
+  MPI_Bcast(&random_seed_used, 1, MPI_INT, 0, mpi_comm);
+  MPI_Scatter(&next_attempt_all[0], 1, MPI_UNSIGNED_LONG_LONG, &first_attempt, 1, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+  MPI_Scatter(&sampling_weight_sums_all[0], 1, MPI_QSCFLOAT, &sampling_weight_sum_local, 1, MPI_QSCFLOAT, 0, mpi_comm);
+  MPI_Scatter(&filters_all[0], N_FILTERS, MPI_UNSIGNED_LONG_LONG, &filters_local[0], N_FILTERS, MPI_UNSIGNED_LONG_LONG, 0, mpi_comm);
+  MPI_Scatter(&timing_all[0], N_TIMES, MPI_QSCFLOAT, &timing_local[0], N_TIMES, MPI_QSCFLOAT, 0, mpi_comm);
+}
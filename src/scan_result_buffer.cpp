@@ -0,0 +1,172 @@
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ScanResultBuffer::ScanResultBuffer() {
+  n_parameters = 0;
+  n_fourier_parameters = 0;
+  n_int_parameters = 0;
+  chunk_size_ = 1;
+  n = 0;
+  loaded_index = 0;
+  loaded.in_memory = false;
+}
+
+qsc::ScanResultBuffer::~ScanResultBuffer() {
+  clear();
+}
+
+/** Set the number of each type of parameter, the number of
+ * configurations per chunk, and the spill file, which is not used if
+ * the name is empty. Any configurations already stored are discarded.
+ */
+void qsc::ScanResultBuffer::init(int n_parameters_in, int n_fourier_parameters_in, int n_int_parameters_in,
+				 int chunk_size_in, std::string spill_filename_in) {
+  if (chunk_size_in < 1) throw std::runtime_error("result_chunk_size must be at least 1");
+  clear();
+  n_parameters = n_parameters_in;
+  n_fourier_parameters = n_fourier_parameters_in;
+  n_int_parameters = n_int_parameters_in;
+  chunk_size_ = chunk_size_in;
+  spill_filename = spill_filename_in;
+}
+
+/** Discard all configurations, and delete the spill file.
+ */
+void qsc::ScanResultBuffer::clear() {
+  chunks.clear();
+  n = 0;
+  loaded.in_memory = false;
+  if (spill_file.is_open()) {
+    spill_file.close();
+    std::remove(spill_filename.c_str());
+  }
+}
+
+big qsc::ScanResultBuffer::size() const {
+  return n;
+}
+
+int qsc::ScanResultBuffer::chunk_size() const {
+  return chunk_size_;
+}
+
+/** Number of configurations that have been written to the spill file.
+ */
+big qsc::ScanResultBuffer::n_spilled() const {
+  big n_chunks = 0;
+  for (big j = 0; j < chunks.size(); j++) {
+    if (!chunks[j].in_memory && chunks[j].file_offset >= 0) n_chunks++;
+  }
+  return n_chunks * chunk_size_;
+}
+
+void qsc::ScanResultBuffer::append(const Vector& parameters, const Vector& fourier_parameters,
+				   const std::valarray<int>& int_parameters) {
+  big j_chunk = n / chunk_size_;
+  big j = n % chunk_size_;
+  int k;
+  if (j == 0) {
+    Chunk chunk;
+    chunk.parameters.resize(n_parameters * chunk_size_);
+    chunk.fourier_parameters.resize(n_fourier_parameters * chunk_size_);
+    chunk.int_parameters.resize(n_int_parameters * chunk_size_);
+    chunk.in_memory = true;
+    chunk.file_offset = -1;
+    chunks.push_back(std::move(chunk));
+  }
+  Chunk& chunk = chunks[j_chunk];
+  for (k = 0; k < n_parameters; k++) chunk.parameters[n_parameters * j + k] = parameters[k];
+  for (k = 0; k < n_fourier_parameters; k++) chunk.fourier_parameters[n_fourier_parameters * j + k] = fourier_parameters[k];
+  for (k = 0; k < n_int_parameters; k++) chunk.int_parameters[n_int_parameters * j + k] = int_parameters[k];
+  n++;
+  if (j + 1 == (big) chunk_size_ && !spill_filename.empty()) spill(j_chunk);
+}
+
+/** Write a full chunk to the end of the spill file, and free its memory.
+ */
+void qsc::ScanResultBuffer::spill(big j_chunk) {
+  Chunk& chunk = chunks[j_chunk];
+  if (!spill_file.is_open()) {
+    spill_file.open(spill_filename.c_str(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!spill_file.is_open()) throw std::runtime_error("Unable to open spill file " + spill_filename);
+  }
+  spill_file.seekp(0, std::ios::end);
+  chunk.file_offset = spill_file.tellp();
+  spill_file.write((const char*) &chunk.parameters[0], chunk.parameters.size() * sizeof(qscfloat));
+  spill_file.write((const char*) &chunk.fourier_parameters[0], chunk.fourier_parameters.size() * sizeof(qscfloat));
+  spill_file.write((const char*) &chunk.int_parameters[0], chunk.int_parameters.size() * sizeof(int));
+  if (spill_file.fail()) throw std::runtime_error("Error writing spill file " + spill_filename);
+  chunk.parameters.resize(0);
+  chunk.fourier_parameters.resize(0);
+  chunk.int_parameters.resize(0);
+  chunk.in_memory = false;
+}
+
+/** Return a chunk, reading it from the spill file if needed. The chunk
+ * remains valid until the next call.
+ */
+const ScanResultBuffer::Chunk& qsc::ScanResultBuffer::get_chunk(big j_chunk) {
+  const Chunk& chunk = chunks[j_chunk];
+  if (chunk.in_memory) return chunk;
+  if (chunk.file_offset < 0) throw std::runtime_error("Configurations were read from a ScanResultBuffer after being released");
+  if (loaded.in_memory && loaded_index == j_chunk) return loaded;
+  loaded.parameters.resize(n_parameters * chunk_size_);
+  loaded.fourier_parameters.resize(n_fourier_parameters * chunk_size_);
+  loaded.int_parameters.resize(n_int_parameters * chunk_size_);
+  spill_file.flush();
+  spill_file.seekg(chunk.file_offset);
+  spill_file.read((char*) &loaded.parameters[0], loaded.parameters.size() * sizeof(qscfloat));
+  spill_file.read((char*) &loaded.fourier_parameters[0], loaded.fourier_parameters.size() * sizeof(qscfloat));
+  spill_file.read((char*) &loaded.int_parameters[0], loaded.int_parameters.size() * sizeof(int));
+  if (spill_file.fail()) throw std::runtime_error("Error reading spill file " + spill_filename);
+  loaded.in_memory = true;
+  loaded_index = j_chunk;
+  return loaded;
+}
+
+/** Copy the n_read configurations starting at configuration "first"
+ * into contiguous arrays, with the parameters of each configuration
+ * adjacent, as in the columns of a Matrix.
+ */
+void qsc::ScanResultBuffer::read(big first, big n_read, qscfloat* parameters, qscfloat* fourier_parameters,
+				 int* int_parameters) {
+  if (first + n_read > n) throw std::runtime_error("Attempt to read past the end of a ScanResultBuffer");
+  big j = first;
+  while (j < first + n_read) {
+    big j_chunk = j / chunk_size_;
+    big j_in_chunk = j % chunk_size_;
+    big n_copy = std::min((big) chunk_size_ - j_in_chunk, first + n_read - j);
+    const Chunk& chunk = get_chunk(j_chunk);
+    std::copy(&chunk.parameters[0] + n_parameters * j_in_chunk,
+	      &chunk.parameters[0] + n_parameters * (j_in_chunk + n_copy),
+	      parameters + n_parameters * (j - first));
+    std::copy(&chunk.fourier_parameters[0] + n_fourier_parameters * j_in_chunk,
+	      &chunk.fourier_parameters[0] + n_fourier_parameters * (j_in_chunk + n_copy),
+	      fourier_parameters + n_fourier_parameters * (j - first));
+    std::copy(&chunk.int_parameters[0] + n_int_parameters * j_in_chunk,
+	      &chunk.int_parameters[0] + n_int_parameters * (j_in_chunk + n_copy),
+	      int_parameters + n_int_parameters * (j - first));
+    j += n_copy;
+  }
+}
+
+/** Free the memory of the chunks that hold only configurations before
+ * "first", which will not be read again, e.g. since they have already
+ * been written to the output file. Space in the spill file is not
+ * reclaimed.
+ */
+void qsc::ScanResultBuffer::release(big first) {
+  for (big j_chunk = 0; j_chunk < first / chunk_size_ && j_chunk < chunks.size(); j_chunk++) {
+    Chunk& chunk = chunks[j_chunk];
+    if (!chunk.in_memory) continue;
+    chunk.parameters.resize(0);
+    chunk.fourier_parameters.resize(0);
+    chunk.int_parameters.resize(0);
+    chunk.in_memory = false;
+  }
+}
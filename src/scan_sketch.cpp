@@ -0,0 +1,208 @@
+#include <cmath>
+#include <limits>
+#include <mpi.h>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+// Bins of the sketch: the ratio of the edges of each bin is gamma, so
+// the center 2 * edge / (1 + gamma) of a bin is within a relative
+// error of (gamma - 1) / (gamma + 1) = sketch_accuracy of every value
+// in it.
+static const qscfloat sketch_accuracy = 0.01;
+static const qscfloat sketch_gamma = (1 + sketch_accuracy) / (1 - sketch_accuracy);
+static const qscfloat sketch_min_magnitude = 1.0e-12;
+// Number of bins for each sign, enough to cover magnitudes up to 1e+12:
+static const int sketch_n_magnitudes = (int) std::ceil(std::log(1.0e+24) / std::log(sketch_gamma)) + 1;
+
+qsc::ScanSketch::ScanSketch() {
+  weights.resize(n_bins(), 0.0);
+  n = 0;
+  n_nonfinite = 0;
+  min = std::numeric_limits<qscfloat>::infinity();
+  max = -std::numeric_limits<qscfloat>::infinity();
+  weight_sum = 0;
+  weighted_value_sum = 0;
+}
+
+/** Total number of bins: the negative values in order of decreasing
+ * magnitude, then the bin at 0, then the positive values in order of
+ * increasing magnitude. The bins are therefore in increasing order of
+ * value.
+ */
+int qsc::ScanSketch::n_bins() {
+  return 2 * sketch_n_magnitudes + 1;
+}
+
+/** Bin of a value. Magnitudes beyond the range of the bins, including
+ * infinities, go in the outermost bins. The bin index is clamped
+ * before the conversion to int, which would be undefined for them.
+ */
+int qsc::ScanSketch::bin_of(qscfloat value) {
+  qscfloat magnitude = std::abs(value);
+  if (magnitude <= sketch_min_magnitude) return sketch_n_magnitudes;
+  qscfloat k_real = std::ceil(std::log(magnitude / sketch_min_magnitude) / std::log(sketch_gamma));
+  int k = (k_real < sketch_n_magnitudes) ? (int) k_real : sketch_n_magnitudes;
+  if (k < 1) k = 1;
+  return (value > 0) ? sketch_n_magnitudes + k : sketch_n_magnitudes - k;
+}
+
+qscfloat qsc::ScanSketch::value_of_bin(int bin) {
+  int k = bin - sketch_n_magnitudes;
+  if (k == 0) return 0;
+  qscfloat magnitude = sketch_min_magnitude * 2 * std::pow(sketch_gamma, std::abs(k)) / (1 + sketch_gamma);
+  return (k > 0) ? magnitude : -magnitude;
+}
+
+/** Add a value with a weight. Infinite and NaN values are only
+ * counted, in n_nonfinite, since they have no place in the quantiles
+ * or the mean.
+ */
+void qsc::ScanSketch::add(qscfloat value, qscfloat weight) {
+  if (!std::isfinite(value)) {
+    n_nonfinite++;
+    return;
+  }
+  weights[bin_of(value)] += weight;
+  n++;
+  weight_sum += weight;
+  weighted_value_sum += weight * value;
+  if (value < min) min = value;
+  if (value > max) max = value;
+}
+
+/** Value below which a fraction p of the weight lies, to within the
+ * accuracy of the sketch. p = 0 and 1 give the exact min and max.
+ */
+qscfloat qsc::ScanSketch::quantile(qscfloat p) const {
+  if (n == 0) return std::numeric_limits<qscfloat>::quiet_NaN();
+  if (p <= 0) return min;
+  if (p >= 1) return max;
+  qscfloat target = p * weight_sum, cumulative = 0;
+  int bin;
+  for (bin = 0; bin < n_bins() - 1; bin++) {
+    cumulative += weights[bin];
+    if (cumulative > target) break;
+  }
+  qscfloat value = value_of_bin(bin);
+  if (value < min) value = min;
+  if (value > max) value = max;
+  return value;
+}
+
+/** Save the value of each SKETCH_* diagnostic computed for an attempt
+ * at full resolution, or NaN if the stage that computes it was not
+ * run before the attempt was rejected. The grad grad B and
+ * r_singularity calculations may stop early once a grid point fails
+ * the filter, in which case their values are only bounds, and
+ * r_hat_singularity_robust holds 1e30 at the points not computed, so
+ * these are also saved as NaN.
+ */
+void Scan::record_diagnostics(Qsc& qw, FilterPipeline& pipeline, ScanAttempt& attempt) {
+  const qscfloat nan = std::numeric_limits<qscfloat>::quiet_NaN();
+  Vector& d = attempt.diagnostics;
+  d.resize(N_SKETCHES);
+  d = nan;
+  if (pipeline.stage_ran(STAGE_INIT_AXIS)) {
+    d[SKETCH_MIN_R0] = qw.min_R0;
+    d[SKETCH_MAX_CURVATURE] = qw.max_curvature;
+    d[SKETCH_STANDARD_DEVIATION_OF_R] = qw.standard_deviation_of_R;
+    d[SKETCH_STANDARD_DEVIATION_OF_Z] = qw.standard_deviation_of_Z;
+  }
+  if (pipeline.stage_ran(STAGE_R1)) {
+    d[SKETCH_IOTA] = qw.iota;
+    d[SKETCH_MAX_ELONGATION] = qw.max_elongation;
+    d[SKETCH_MIN_L_GRAD_B] = qw.min_L_grad_B;
+  }
+  if (!q.at_least_order_r2) return;
+  if (pipeline.stage_ran(STAGE_R2)) {
+    d[SKETCH_B20_VARIATION] = qw.B20_grid_variation;
+    d[SKETCH_B20_RESIDUAL] = qw.B20_residual;
+  }
+  if (pipeline.stage_ran(STAGE_MERCIER)) {
+    d[SKETCH_D2_VOLUME_D_PSI2] = qw.d2_volume_d_psi2;
+    d[SKETCH_DMERC_TIMES_R2] = qw.DMerc_times_r2;
+  }
+  if (pipeline.stage_ran(STAGE_GRAD_GRAD_B) && !qw.grad_grad_B_partial) d[SKETCH_MIN_L_GRAD_GRAD_B] = qw.min_L_grad_grad_B;
+  if (pipeline.stage_ran(STAGE_R_SINGULARITY) && !qw.r_singularity_partial) d[SKETCH_MIN_R_SINGULARITY] = qw.min_r_singularity;
+}
+
+/** Add the diagnostics of an attempt to the sketches of this proc.
+ * With multiplicity 2 the attempt also stands for its mirror image,
+ * which has the opposite iota. NaN marks a diagnostic that was not
+ * computed; a diagnostic that was computed but is infinite is
+ * counted by the sketch in n_nonfinite.
+ */
+void Scan::add_to_sketches(ScanAttempt& attempt, int multiplicity) {
+  if (attempt.diagnostics.size() != N_SKETCHES) return;
+  for (int j = 0; j < N_SKETCHES; j++) {
+    qscfloat value = attempt.diagnostics[j];
+    if (std::isnan(value)) continue;
+    sketches_local[j].add(value, attempt.sampling_weight);
+    if (multiplicity == 2) sketches_local[j].add((j == SKETCH_IOTA) ? -value : value, attempt.sampling_weight);
+  }
+}
+
+/** Merge the sketches of all procs, and on proc 0 (or on every proc,
+ * with parallel_netcdf) compute the outputs sketch_n, sketch_means,
+ * and sketch_quantiles. This must be called by every proc.
+ */
+void Scan::collect_sketches() {
+  int mpi_rank, j, k;
+  MPI_Comm_rank(mpi_comm, &mpi_rank);
+  const int n_bins = ScanSketch::n_bins();
+
+  // Pack the sketches so they can be merged with a few reductions:
+  Vector weights_local(N_SKETCHES * n_bins), weights(N_SKETCHES * n_bins);
+  Vector sums_local(2 * N_SKETCHES), sums(2 * N_SKETCHES);
+  Vector mins_local(N_SKETCHES), mins(N_SKETCHES), maxs_local(N_SKETCHES), maxs(N_SKETCHES);
+  // The counts of finite values, then of non-finite ones:
+  std::valarray<big> n_local(2 * N_SKETCHES), n(2 * N_SKETCHES);
+  for (j = 0; j < N_SKETCHES; j++) {
+    ScanSketch& sketch = sketches_local[j];
+    for (k = 0; k < n_bins; k++) weights_local[j * n_bins + k] = sketch.weights[k];
+    sums_local[2 * j] = sketch.weight_sum;
+    sums_local[2 * j + 1] = sketch.weighted_value_sum;
+    mins_local[j] = sketch.min;
+    maxs_local[j] = sketch.max;
+    n_local[j] = sketch.n;
+    n_local[N_SKETCHES + j] = sketch.n_nonfinite;
+  }
+  if (parallel_netcdf) {
+    MPI_Allreduce(&weights_local[0], &weights[0], N_SKETCHES * n_bins, MPI_QSCFLOAT, MPI_SUM, mpi_comm);
+    MPI_Allreduce(&sums_local[0], &sums[0], 2 * N_SKETCHES, MPI_QSCFLOAT, MPI_SUM, mpi_comm);
+    MPI_Allreduce(&mins_local[0], &mins[0], N_SKETCHES, MPI_QSCFLOAT, MPI_MIN, mpi_comm);
+    MPI_Allreduce(&maxs_local[0], &maxs[0], N_SKETCHES, MPI_QSCFLOAT, MPI_MAX, mpi_comm);
+    MPI_Allreduce(&n_local[0], &n[0], 2 * N_SKETCHES, MPI_UNSIGNED_LONG_LONG, MPI_SUM, mpi_comm);
+  } else {
+    MPI_Reduce(&weights_local[0], &weights[0], N_SKETCHES * n_bins, MPI_QSCFLOAT, MPI_SUM, 0, mpi_comm);
+    MPI_Reduce(&sums_local[0], &sums[0], 2 * N_SKETCHES, MPI_QSCFLOAT, MPI_SUM, 0, mpi_comm);
+    MPI_Reduce(&mins_local[0], &mins[0], N_SKETCHES, MPI_QSCFLOAT, MPI_MIN, 0, mpi_comm);
+    MPI_Reduce(&maxs_local[0], &maxs[0], N_SKETCHES, MPI_QSCFLOAT, MPI_MAX, 0, mpi_comm);
+    MPI_Reduce(&n_local[0], &n[0], 2 * N_SKETCHES, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, mpi_comm);
+    if (mpi_rank != 0) return;
+  }
+
+  sketch_quantile_levels.resize(SCAN_N_SKETCH_QUANTILES);
+  for (k = 0; k < SCAN_N_SKETCH_QUANTILES; k++) sketch_quantile_levels[k] = ((qscfloat) k) / (SCAN_N_SKETCH_QUANTILES - 1);
+  sketch_n.resize(N_SKETCHES);
+  sketch_n_nonfinite.resize(N_SKETCHES);
+  sketch_means.resize(N_SKETCHES);
+  sketch_quantiles.resize(N_SKETCHES);
+  ScanSketch merged;
+  for (j = 0; j < N_SKETCHES; j++) {
+    for (k = 0; k < n_bins; k++) merged.weights[k] = weights[j * n_bins + k];
+    merged.weight_sum = sums[2 * j];
+    merged.weighted_value_sum = sums[2 * j + 1];
+    merged.min = mins[j];
+    merged.max = maxs[j];
+    merged.n = n[j];
+    sketch_n[j] = n[j];
+    sketch_n_nonfinite[j] = n[N_SKETCHES + j];
+    sketch_means[j] = (merged.weight_sum > 0) ? merged.weighted_value_sum / merged.weight_sum
+      : std::numeric_limits<qscfloat>::quiet_NaN();
+    sketch_quantiles[j].resize(SCAN_N_SKETCH_QUANTILES);
+    for (k = 0; k < SCAN_N_SKETCH_QUANTILES; k++) sketch_quantiles[j][k] = merged.quantile(sketch_quantile_levels[k]);
+  }
+}
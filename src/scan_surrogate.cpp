@@ -0,0 +1,124 @@
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ScanSurrogate::ScanSurrogate() {
+  n_rounds = 100;
+  learning_rate = 0.3;
+  regularization = 1.0;
+  bias = 0;
+  trained = false;
+}
+
+int qsc::ScanSurrogate::n_splits() const {
+  return split_feature.size();
+}
+
+/** Fit the model to a set of examples, each a vector of features and a
+ * label, true if the configuration was kept. Each round adds the
+ * stump that most reduces a second-order approximation of the
+ * logistic loss, with its two values given by Newton steps. The
+ * examples are sorted along each feature once, so each round costs
+ * O(n_examples * n_features).
+ */
+void qsc::ScanSurrogate::fit(const std::vector<Vector>& features, const std::vector<bool>& labels) {
+  const big n = features.size();
+  if (labels.size() != n) throw std::runtime_error("ScanSurrogate::fit: features and labels must have the same size");
+  big j, k;
+  int f, round;
+
+  split_feature.clear();
+  split_threshold.resize(0);
+  lower_value.resize(0);
+  upper_value.resize(0);
+  trained = false;
+  big n_positive = 0;
+  for (j = 0; j < n; j++) if (labels[j]) n_positive++;
+  // Both classes are needed to learn anything:
+  if (n_positive == 0 || n_positive == n) return;
+  const int n_features = features[0].size();
+
+  // Start from the log-odds of the mean label:
+  qscfloat mean = ((qscfloat) n_positive) / n;
+  bias = std::log(mean / (1 - mean));
+
+  std::vector<std::vector<big>> order(n_features, std::vector<big>(n));
+  for (f = 0; f < n_features; f++) {
+    std::iota(order[f].begin(), order[f].end(), 0);
+    std::stable_sort(order[f].begin(), order[f].end(),
+		     [&](big a, big b) { return features[a][f] < features[b][f]; });
+  }
+
+  std::vector<int> split_feature_new;
+  std::vector<qscfloat> split_threshold_new, lower_value_new, upper_value_new;
+  Vector log_odds(bias, n), gradient(n), hessian(n);
+  for (round = 0; round < n_rounds; round++) {
+    for (j = 0; j < n; j++) {
+      qscfloat p = 1 / (1 + std::exp(-log_odds[j]));
+      gradient[j] = p - (labels[j] ? 1 : 0);
+      hessian[j] = p * (1 - p);
+    }
+    const qscfloat G = gradient.sum(), H = hessian.sum();
+    const qscfloat lambda = regularization;
+    qscfloat best_gain = 0, best_threshold = 0, best_G_lower = 0, best_H_lower = 0;
+    int best_feature = -1;
+    for (f = 0; f < n_features; f++) {
+      qscfloat G_lower = 0, H_lower = 0;
+      for (k = 0; k + 1 < n; k++) {
+	j = order[f][k];
+	G_lower += gradient[j];
+	H_lower += hessian[j];
+	qscfloat x = features[j][f], x_next = features[order[f][k + 1]][f];
+	// Only split between distinct values:
+	if (x == x_next) continue;
+	qscfloat G_upper = G - G_lower, H_upper = H - H_lower;
+	qscfloat gain = G_lower * G_lower / (H_lower + lambda) + G_upper * G_upper / (H_upper + lambda)
+	  - G * G / (H + lambda);
+	if (gain > best_gain) {
+	  best_gain = gain;
+	  best_feature = f;
+	  best_threshold = 0.5 * (x + x_next);
+	  best_G_lower = G_lower;
+	  best_H_lower = H_lower;
+	}
+      }
+    }
+    // Stop if no split reduces the loss:
+    if (best_feature < 0) break;
+    qscfloat lower = -learning_rate * best_G_lower / (best_H_lower + lambda);
+    qscfloat upper = -learning_rate * (G - best_G_lower) / (H - best_H_lower + lambda);
+    split_feature_new.push_back(best_feature);
+    split_threshold_new.push_back(best_threshold);
+    lower_value_new.push_back(lower);
+    upper_value_new.push_back(upper);
+    for (j = 0; j < n; j++) log_odds[j] += (features[j][best_feature] < best_threshold) ? lower : upper;
+  }
+
+  split_feature = split_feature_new;
+  split_threshold.resize(split_threshold_new.size());
+  lower_value.resize(lower_value_new.size());
+  upper_value.resize(upper_value_new.size());
+  for (j = 0; j < split_threshold_new.size(); j++) {
+    split_threshold[j] = split_threshold_new[j];
+    lower_value[j] = lower_value_new[j];
+    upper_value[j] = upper_value_new[j];
+  }
+  trained = true;
+}
+
+/** Predicted probability that a configuration with these features is
+ * kept.
+ */
+qscfloat qsc::ScanSurrogate::probability(const Vector& x) const {
+  qscfloat log_odds = bias;
+  for (std::size_t j = 0; j < split_feature.size(); j++) {
+    log_odds += (x[split_feature[j]] < split_threshold[j]) ? lower_value[j] : upper_value[j];
+  }
+  return 1 / (1 + std::exp(-log_odds));
+}
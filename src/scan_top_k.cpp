@@ -0,0 +1,171 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <mpi.h>
+#include "qsc.hpp"
+#include "scan.hpp"
+
+using namespace qsc;
+
+qsc::ScanTopK::ScanTopK() {
+  k = 0;
+}
+
+big qsc::ScanTopK::size() const {
+  return heap.size();
+}
+
+const ScanTopKEntry& qsc::ScanTopK::entry(big j) const {
+  return heap[j];
+}
+
+void qsc::ScanTopK::clear() {
+  heap.clear();
+}
+
+/** Weighted sum of the parameters of a kept configuration.
+ */
+qscfloat qsc::ScanTopK::score(const Vector& parameters) const {
+  qscfloat total = 0;
+  for (std::size_t j = 0; j < parameter_index.size(); j++) {
+    qscfloat value = parameters[parameter_index[j]];
+    total += weights[j] * (use_abs[j] ? std::abs(value) : value);
+  }
+  return total;
+}
+
+// Returns true if a ranks above b: a higher score, or for equal
+// scores, the lexicographically larger parameters.
+static bool ranks_above(const ScanTopKEntry& a, const ScanTopKEntry& b) {
+  if (a.score != b.score) return a.score > b.score;
+  for (std::size_t j = 0; j < a.parameters.size(); j++) {
+    if (a.parameters[j] != b.parameters[j]) return a.parameters[j] > b.parameters[j];
+  }
+  for (std::size_t j = 0; j < a.fourier_parameters.size(); j++) {
+    if (a.fourier_parameters[j] != b.fourier_parameters[j]) return a.fourier_parameters[j] > b.fourier_parameters[j];
+  }
+  return false;
+}
+
+/** Offer a configuration with the given score. Returns true if it is
+ * now one of the top k, in which case the lowest-ranked entry may have
+ * been dropped. Configurations with a score of NaN are never kept.
+ */
+bool qsc::ScanTopK::insert(qscfloat score, const Vector& parameters, const Vector& fourier_parameters,
+			   const std::valarray<int>& int_parameters) {
+  if (std::isnan(score) || k < 1) return false;
+  ScanTopKEntry e;
+  e.score = score;
+  e.parameters.resize(parameters.size());
+  e.parameters = parameters;
+  e.fourier_parameters.resize(fourier_parameters.size());
+  e.fourier_parameters = fourier_parameters;
+  // With ranks_above as the comparison, the front of the heap is the
+  // lowest-ranked entry:
+  if ((int) heap.size() >= k) {
+    if (!ranks_above(e, heap.front())) return false;
+    std::pop_heap(heap.begin(), heap.end(), ranks_above);
+    heap.pop_back();
+  }
+  e.int_parameters.resize(int_parameters.size());
+  e.int_parameters = int_parameters;
+  heap.push_back(std::move(e));
+  std::push_heap(heap.begin(), heap.end(), ranks_above);
+  return true;
+}
+
+/** Order the entries by decreasing rank. The entries are then no
+ * longer a heap, so no more entries can be inserted until clear().
+ */
+void qsc::ScanTopK::sort() {
+  std::sort(heap.begin(), heap.end(), ranks_above);
+}
+
+/** Set up an empty ScanTopK from the top_k* inputs.
+ */
+void Scan::init_top_k(ScanTopK& best) {
+  const int n_terms = top_k_score_names.size();
+  if (n_terms < 1) throw std::runtime_error("top_k_score_names must not be empty when top_k > 0");
+  if ((int) top_k_score_weights.size() != n_terms)
+    throw std::runtime_error("top_k_score_weights must have the same size as top_k_score_names");
+
+  best.clear();
+  best.k = top_k;
+  best.parameter_index.resize(n_terms);
+  best.use_abs.resize(n_terms);
+  best.weights.resize(n_terms);
+  best.weights = top_k_score_weights;
+  for (int j = 0; j < n_terms; j++) {
+    bool use_abs;
+    best.parameter_index[j] = objective_index(top_k_score_names[j], use_abs);
+    best.use_abs[j] = use_abs;
+  }
+}
+
+/** Merge the entries of best on all procs in a binary tree, so that on
+ * exit best holds the top k of all procs on proc 0, sorted by
+ * decreasing rank. Each step of the tree sends at most k entries, so
+ * the communication grows only logarithmically with the number of
+ * procs. On the other procs, best is left with a partial merge, so it
+ * should be a copy of the entries on this proc. This must be called
+ * by every proc. The messages go on a duplicate of mpi_comm, so they
+ * cannot be matched by the point-to-point messages of
+ * collect_results(), which use the rank of the sender as the tag.
+ */
+void Scan::reduce_top_k(ScanTopK& best) {
+  int mpi_rank, n_procs, step, j, k;
+  MPI_Comm_rank(mpi_comm, &mpi_rank);
+  MPI_Comm_size(mpi_comm, &n_procs);
+  MPI_Status mpi_status;
+  const int n_parameters = SCAN_N_PARAMETERS;
+  const int n_fourier_parameters = R0c_max.size() * 4;
+  const int n_int_parameters = SCAN_N_INT_PARAMETERS;
+  // Each entry is packed as its score, parameters, and Fourier
+  // parameters, with the int parameters in a separate array:
+  const int n_reals = 1 + n_parameters + n_fourier_parameters;
+  const int tag = 1;
+  MPI_Comm top_k_comm;
+  MPI_Comm_dup(mpi_comm, &top_k_comm);
+  Vector reals;
+  std::valarray<int> ints;
+  Vector parameters(n_parameters), fourier_parameters(n_fourier_parameters);
+  std::valarray<int> int_parameters(n_int_parameters);
+
+  for (step = 1; step < n_procs; step *= 2) {
+    if (mpi_rank % (2 * step) == step) {
+      // Send this proc's entries to its partner, and drop out:
+      int n = best.size();
+      reals.resize(n * n_reals);
+      ints.resize(n * n_int_parameters);
+      for (j = 0; j < n; j++) {
+	const ScanTopKEntry& e = best.entry(j);
+	reals[j * n_reals] = e.score;
+	for (k = 0; k < n_parameters; k++) reals[j * n_reals + 1 + k] = e.parameters[k];
+	for (k = 0; k < n_fourier_parameters; k++) reals[j * n_reals + 1 + n_parameters + k] = e.fourier_parameters[k];
+	for (k = 0; k < n_int_parameters; k++) ints[j * n_int_parameters + k] = e.int_parameters[k];
+      }
+      MPI_Send(&n, 1, MPI_INT, mpi_rank - step, tag, top_k_comm);
+      if (n == 0) break;
+      MPI_Send(&reals[0], n * n_reals, MPI_QSCFLOAT, mpi_rank - step, tag, top_k_comm);
+      MPI_Send(&ints[0], n * n_int_parameters, MPI_INT, mpi_rank - step, tag, top_k_comm);
+      break;
+    } else if (mpi_rank % (2 * step) == 0 && mpi_rank + step < n_procs) {
+      // Merge the entries of the partner into this proc's:
+      int n;
+      MPI_Recv(&n, 1, MPI_INT, mpi_rank + step, tag, top_k_comm, &mpi_status);
+      if (n == 0) continue;
+      reals.resize(n * n_reals);
+      ints.resize(n * n_int_parameters);
+      MPI_Recv(&reals[0], n * n_reals, MPI_QSCFLOAT, mpi_rank + step, tag, top_k_comm, &mpi_status);
+      MPI_Recv(&ints[0], n * n_int_parameters, MPI_INT, mpi_rank + step, tag, top_k_comm, &mpi_status);
+      for (j = 0; j < n; j++) {
+	for (k = 0; k < n_parameters; k++) parameters[k] = reals[j * n_reals + 1 + k];
+	for (k = 0; k < n_fourier_parameters; k++) fourier_parameters[k] = reals[j * n_reals + 1 + n_parameters + k];
+	for (k = 0; k < n_int_parameters; k++) int_parameters[k] = ints[j * n_int_parameters + k];
+	best.insert(reals[j * n_reals], parameters, fourier_parameters, int_parameters);
+      }
+    }
+  }
+  MPI_Comm_free(&top_k_comm);
+  if (mpi_rank == 0) best.sort();
+}
@@ -1,5 +1,7 @@
 #include <chrono>
 #include <vector>
+#include <sstream>
+#include <iomanip>
 #include <mpi.h>
 #include "qsc.hpp"
 #include "scan.hpp"
@@ -8,22 +10,39 @@
 using namespace qsc;
 
 void Scan::write_netcdf() {
-  // Only proc 0 should run this subroutine:
+  // Only proc 0 should run this subroutine, unless each proc writes
+  // its own configurations:
   int mpi_rank;
   MPI_Comm_rank(mpi_comm, &mpi_rank);
-  if (mpi_rank != 0) return;
-  
+  if (mpi_rank != 0 && !parallel_netcdf) return;
+  write_netcdf_file(mpi_rank, q);
+}
+
+/** The body of write_netcdf(), with q the Qsc object whose settings
+ * are saved. Without parallel_netcdf this makes no MPI calls, so it
+ * can be run on a snapshot of the scan by the background writer
+ * thread.
+ */
+void ScanOutput::write_netcdf_file(int mpi_rank, Qsc& q) {
   std::chrono::time_point<std::chrono::steady_clock> start;
   if (verbose > 0) start = std::chrono::steady_clock::now();
 
-  if (verbose > 0) std::cout << "Writing output to " << outfilename << std::endl;
-  qsc::NetCDFWriter nc(outfilename, false);
+  if (verbose > 0 && mpi_rank == 0) std::cout << "Writing output to " << outfilename << std::endl;
+  // With append_checkpoints, after the first checkpoint the existing
+  // file is updated: the scalars are overwritten, and the new
+  // configurations are written to rows n_scan_offset, ... of the
+  // n_scan arrays.
+  bool update = append_checkpoints && output_file_started;
+  qsc::NetCDFWriter nc = parallel_netcdf ? qsc::NetCDFWriter(outfilename, mpi_comm, update) : qsc::NetCDFWriter(outfilename, false, update);
 
   // Define dimensions
   dim_id_type nphi_dim, axis_nmax_plus_1_dim, n_scan_dim;
   nphi_dim = nc.dim("nphi", q.nphi);
   axis_nmax_plus_1_dim = nc.dim("axis_nmax_plus_1", R0c_max.size());
-  n_scan_dim = nc.dim("n_scan", n_scan);
+  n_scan_dim = nc.dim("n_scan", append_checkpoints ? NC_UNLIMITED : n_scan);
+  bool write_sketches = diagnostic_sketches && sketch_quantiles.size() == N_SKETCHES;
+  dim_id_type n_sketch_quantiles_dim;
+  if (write_sketches) n_sketch_quantiles_dim = nc.dim("n_sketch_quantiles", SCAN_N_SKETCH_QUANTILES);
   
   // Scalars
   std::string general_option = "random";
@@ -34,6 +53,11 @@ void Scan::write_netcdf() {
   nc.put("order_r_option", q.order_r_option, "Whether the Garren-Boozer equations were solved to 1st or 2nd order in the effective minor radius r");
   nc.put("nfp", q.nfp, "Number of field periods", "dimensionless");
   nc.put("nphi", q.nphi, "Number of grid points in the toroidal angle phi", "dimensionless");
+  nc.put("nphi_tolerance", q.nphi_tolerance, "If > 0, nphi was increased for each configuration until the relative Fourier tail of curvature, sigma, and X20 was below this value. See scan_nphi.", "dimensionless");
+  nc.put("min_nphi", q.min_nphi, "If > 0 and nphi_tolerance > 0, each configuration started from this nphi rather than nphi", "dimensionless");
+  nc.put("max_nphi", q.max_nphi, "Upper limit on nphi when nphi_tolerance > 0", "dimensionless");
+  int fourier_extrema_int = (int) q.fourier_extrema;
+  nc.put("fourier_extrema", fourier_extrema_int, "If 1, the extrema used for the filters and scan_ outputs were found from the trigonometric interpolant between the phi grid points. If 0, only the phi grid points were used.", "dimensionless");
   // In the next line, we cast n_scan to an int because long long ints require netcdf-4, which cannot be read by scipy.io.netcdf.
 
   nc.put("eta_bar_scan_option", eta_bar_scan_option, "Whether a linear vs logarithmic distribution was used for choosing eta_bar in the scan");
@@ -58,8 +82,12 @@ void Scan::write_netcdf() {
   int n_scan_int = (int)n_scan;
   nc.put("n_scan", n_scan_int, "Number of configurations kept from the scan and saved in this file", "dimensionless");
   nc.put("attempts", filters[ATTEMPTS], "Number of configurations examined in the scan", "dimensionless");
-  nc.put("n_sigma_eq_solves", filters[N_SIGMA_EQ_SOLVES], "Number of times the sigma equation was solved during the scan", "dimensionless");
-  nc.put("n_r2_solves", filters[N_R2_SOLVES], "Number of times the O(r^2) equations were solved during the scan", "dimensionless");
+  nc.put("n_sigma_eq_solves", filters[N_SIGMA_EQ_SOLVES], "Number of times the sigma equation was solved during the scan. With mirror_symmetry, one solve serves both members of a mirror pair, so this counts solves rather than configurations.", "dimensionless");
+  nc.put("n_r2_solves", filters[N_R2_SOLVES], "Number of times the O(r^2) equations were solved during the scan. With mirror_symmetry, one solve serves both members of a mirror pair, so this counts solves rather than configurations.", "dimensionless");
+  nc.put("n_screening_rejections", filters[N_SCREENING_REJECTIONS], "Number of configurations in the scan that were rejected based on a calculation with nphi = screening_nphi, without a calculation at the full nphi. These configurations are also included in the rejected_due_to_* counts.", "dimensionless");
+  if (prefilter && !keep_all) {
+    nc.put("n_prefilter_rejections", filters[N_PREFILTER_REJECTIONS], "Number of configurations in the scan that were rejected by the min_R0_to_keep or curvature filter evaluated at a few toroidal angles, before the calculation on the full grid. These configurations are also included in the rejected_due_to_R0 and rejected_due_to_curvature counts.", "dimensionless");
+  }
   nc.put("rejected_due_to_R0_crude", filters[REJECTED_DUE_TO_R0_CRUDE], "Number of configurations in the scan that were rejected due to R0 becoming <= 0 at toroidal angle 0 or half field period", "dimensionless");
   nc.put("rejected_due_to_R0", filters[REJECTED_DUE_TO_R0], "Number of configurations in the scan that were rejected due to R0 becoming <= 0", "dimensionless");
   nc.put("rejected_due_to_curvature", filters[REJECTED_DUE_TO_CURVATURE], "Number of configurations in the scan that were rejected due to the curvature of the magnetic axis exceeding 1 / min_L_grad_B_to_keep", "dimensionless");
@@ -71,10 +99,17 @@ void Scan::write_netcdf() {
   nc.put("rejected_due_to_d2_volume_d_psi2", filters[REJECTED_DUE_TO_D2_VOLUME_D_PSI2], "Number of configurations in the scan that were rejected due to the max_d2_volume_d_psi2_to_keep filter", "dimensionless");
   nc.put("rejected_due_to_DMerc", filters[REJECTED_DUE_TO_DMERC], "Number of configurations in the scan that were rejected due to the min_DMerc_times_r2_to_keep filter", "dimensionless");
   nc.put("rejected_due_to_r_singularity", filters[REJECTED_DUE_TO_R_SINGULARITY], "Number of configurations in the scan that were rejected due to the min_r_singularity_to_keep filter", "dimensionless");
+  nc.put("rejected_due_to_surrogate", filters[REJECTED_DUE_TO_SURROGATE], "Number of configurations in the scan that were rejected without the full calculation, since the surrogate model predicted a probability of being kept below surrogate_threshold", "dimensionless");
+  nc.put("n_surrogate_audits", filters[N_SURROGATE_AUDITS], "Number of configurations that the surrogate model predicted would be rejected, but that were evaluated in full anyway to measure its rate of false rejections. These configurations are also included in the kept or rejected_due_to_* counts.", "dimensionless");
+  nc.put("n_surrogate_audits_kept", filters[N_SURROGATE_AUDITS_KEPT], "Number of the n_surrogate_audits configurations that were kept, i.e. false rejections by the surrogate model", "dimensionless");
 
   nc.put("fraction_kept", filter_fractions[KEPT], "Fraction of the attempted configurations from the scan that were kept and saved in this file", "dimensionless");
-  nc.put("fraction_sigma_eq_solves", filter_fractions[N_SIGMA_EQ_SOLVES], "Fraction of the attempted configurations for which the sigma equation was solved during the scan", "dimensionless");
-  nc.put("fraction_r2_solves", filter_fractions[N_R2_SOLVES], "Fraction of the attempted configurations for which the O(r^2) equations were solved during the scan", "dimensionless");
+  nc.put("fraction_sigma_eq_solves", filter_fractions[N_SIGMA_EQ_SOLVES], "Number of solves of the sigma equation divided by the number of attempted configurations. With mirror_symmetry, one solve serves both members of a mirror pair.", "dimensionless");
+  nc.put("fraction_r2_solves", filter_fractions[N_R2_SOLVES], "Number of solves of the O(r^2) equations divided by the number of attempted configurations. With mirror_symmetry, one solve serves both members of a mirror pair.", "dimensionless");
+  nc.put("fraction_screening_rejections", filter_fractions[N_SCREENING_REJECTIONS], "Fraction of the attempted configurations that were rejected based on a calculation with nphi = screening_nphi, without a calculation at the full nphi", "dimensionless");
+  if (prefilter && !keep_all) {
+    nc.put("fraction_prefilter_rejections", filter_fractions[N_PREFILTER_REJECTIONS], "Fraction of the attempted configurations that were rejected by the min_R0_to_keep or curvature filter evaluated at a few toroidal angles, before the calculation on the full grid", "dimensionless");
+  }
   nc.put("fraction_rejected_due_to_R0_crude", filter_fractions[REJECTED_DUE_TO_R0_CRUDE], "Fraction of configurations in the scan that were rejected due to R0 becoming <= 0 at toroidal angle 0 or half field period", "dimensionless");
   nc.put("fraction_rejected_due_to_R0", filter_fractions[REJECTED_DUE_TO_R0], "Fraction of configurations in the scan that were rejected due to R0 becoming <= 0", "dimensionless");
   nc.put("fraction_rejected_due_to_curvature", filter_fractions[REJECTED_DUE_TO_CURVATURE], "Fraction of configurations in the scan that were rejected due to the curvature of the magnetic axis exceeding 1 / min_L_grad_B_to_keep", "dimensionless");
@@ -86,12 +121,73 @@ void Scan::write_netcdf() {
   nc.put("fraction_rejected_due_to_d2_volume_d_psi2", filter_fractions[REJECTED_DUE_TO_D2_VOLUME_D_PSI2], "Fraction of configurations in the scan that were rejected due to the max_d2_volume_d_psi2_to_keep filter", "dimensionless");
   nc.put("fraction_rejected_due_to_DMerc", filter_fractions[REJECTED_DUE_TO_DMERC], "Fraction of configurations in the scan that were rejected due to the min_DMerc_times_r2_to_keep filter", "dimensionless");
   nc.put("fraction_rejected_due_to_r_singularity", filter_fractions[REJECTED_DUE_TO_R_SINGULARITY], "Fraction of configurations in the scan that were rejected due to the min_r_singularity_to_keep filter", "dimensionless");
+  nc.put("fraction_rejected_due_to_surrogate", filter_fractions[REJECTED_DUE_TO_SURROGATE], "Fraction of configurations in the scan that were rejected without the full calculation, since the surrogate model predicted a probability of being kept below surrogate_threshold", "dimensionless");
+  nc.put("fraction_surrogate_audits", filter_fractions[N_SURROGATE_AUDITS], "Fraction of the attempted configurations that the surrogate model predicted would be rejected, but that were evaluated in full anyway", "dimensionless");
+  nc.put("fraction_surrogate_audits_kept", filter_fractions[N_SURROGATE_AUDITS_KEPT], "Fraction of the attempted configurations that the surrogate model predicted would be rejected, were evaluated in full anyway, and were kept", "dimensionless");
 
   int keep_all_int = (int) keep_all;
   nc.put("keep_all", keep_all_int, "1 if all configurations from the scan were saved, 0 if some configurations were filtered out", "dimensionless");
   int deterministic_int = (int) deterministic;
   nc.put("deterministic", deterministic_int, "1 if a deterministic pseudo-random number generator and seed were used, 1 if a random seed based on the time was used.", "dimensionless");
+  nc.put("random_sequence", random_sequence, "Low-discrepancy sequence used to choose the parameters if deterministic = 1: golden ratio (the same 1D sequence for every parameter, starting at different positions), R_d, or Halton (a multidimensional sequence with one dimension per parameter)");
+  if (!candidates_file.empty()) {
+    nc.put("candidates_file", candidates_file, "File of candidate configurations evaluated by the scan, instead of random ones");
+    nc.put("candidates_distribution", candidates_distribution, "How the candidates were divided among the MPI processes: block (a contiguous range for each process) or cyclic (chunks of candidates dealt to the processes in turn)");
+  }
+  nc.put("random_seed", random_seed_used, "Key of the counter-based Philox generator used to choose the parameters if deterministic = 0. Setting the input random_seed to this value reproduces the scan.", "dimensionless");
+  int parallel_netcdf_int = (int) parallel_netcdf;
+  int append_checkpoints_int = (int) append_checkpoints;
+  nc.put("append_checkpoints", append_checkpoints_int, "1 if configurations were appended to this file at each checkpoint, in which case they are grouped by checkpoint and then by MPI process. 0 if they are grouped only by MPI process.", "dimensionless");
+  nc.put("parallel_netcdf", parallel_netcdf_int, "1 if each MPI process wrote its own configurations to this file using parallel NetCDF-4 I/O, 0 if all configurations were sent to proc 0", "dimensionless");
+  int constrained_sampling_int = (int) constrained_sampling;
+  nc.put("constrained_sampling", constrained_sampling_int, "1 if R0c[0] was drawn only from the range in which R0 > 0 at toroidal angle 0 and half field period, and R0 >= min_R0_to_keep at toroidal angle 0, given the other R0c coefficients. 0 if R0c[0] was drawn from its full range.", "dimensionless");
+  int adaptive_sampling_int = (int) adaptive_sampling;
+  nc.put("adaptive_sampling", adaptive_sampling_int, "1 if a fraction of the configurations was drawn from a proposal distribution fit to the configurations kept so far, 0 if all were drawn from the box distribution given by the *_min and *_max inputs.", "dimensionless");
+  nc.put("adaptive_sampling_fraction", adaptive_sampling_fraction, "Fraction of the configurations drawn from the proposal distribution if adaptive_sampling = 1.", "dimensionless");
+  nc.put("adaptive_sampling_period", adaptive_sampling_period, "Number of attempts on each proc between fits of the proposal distribution if adaptive_sampling = 1.", "dimensionless");
+  int mirror_symmetry_int = (int) mirror_symmetry;
+  nc.put("mirror_symmetry", mirror_symmetry_int, "1 if only one member of each pair of configurations related by the mirror reflection Z -> -Z was evaluated, the one for which the leading varying Z0s (or Z0c, sigma0, B2s) is positive. 0 if all configurations were evaluated.", "dimensionless");
+  int emit_mirror_partners_int = (int) emit_mirror_partners;
+  nc.put("emit_mirror_partners", emit_mirror_partners_int, "1 if, with mirror_symmetry = 1, the mirror image of each kept configuration was also saved, with Z0c, Z0s, sigma0, B2s, iota, and helicity negated, and the counts of attempts and rejections include the mirror images.", "dimensionless");
+  nc.put("mean_sampling_weight", mean_sampling_weight, "Mean of the sampling weight over all attempted configurations. With constrained_sampling or adaptive_sampling, fraction_kept * mean_sampling_weight estimates the fraction of configurations from the box distribution, without either option, that would be kept. 1 without constrained_sampling or adaptive_sampling.", "dimensionless");
+  nc.put("n_threads", n_threads, "Number of threads used on each MPI process to evaluate configurations", "dimensionless");
+  if (pareto_objectives.size() > 0) {
+    std::string pareto_objectives_string, pareto_maximize_string;
+    for (std::size_t j = 0; j < pareto_objectives.size(); j++) {
+      pareto_objectives_string += (j > 0 ? " " : "") + pareto_objectives[j];
+      pareto_maximize_string += (j > 0 ? " " : "") + std::string((pareto_maximize.size() > 0 && pareto_maximize[j]) ? "max" : "min");
+    }
+    nc.put("pareto_objectives", pareto_objectives_string, "If present, the scan_* arrays hold only the configurations that passed the *_to_keep filters and are non-dominated with respect to these objectives, rather than every kept configuration");
+    nc.put("pareto_senses", pareto_maximize_string, "Whether each of the pareto_objectives was minimized or maximized");
+    nc.put("pareto_max_size", pareto_max_size, "Maximum number of configurations on the saved Pareto front. Beyond this, configurations in the most crowded part of the front were dropped.", "dimensionless");
+  }
+  if (top_k > 0) {
+    std::string top_k_score_string;
+    for (std::size_t j = 0; j < top_k_score_names.size(); j++) {
+      std::ostringstream term;
+      term << std::setprecision(17) << top_k_score_weights[j] << " * " << top_k_score_names[j];
+      top_k_score_string += (j > 0 ? " + " : "") + term.str();
+    }
+    nc.put("top_k", top_k, "If present, the scan_* arrays hold only the configurations with the highest top_k_score among those that passed the *_to_keep filters, in order of decreasing score", "dimensionless");
+    nc.put("top_k_score", top_k_score_string, "Score used to rank the configurations for top_k");
+  }
   if (!keep_all) {
+    nc.put("screening_nphi", screening_nphi, "If > 0, each configuration was first evaluated with this number of grid points in phi, and evaluated with the full nphi only if it was within screening_margin of passing all the filters", "dimensionless");
+    nc.put("screening_margin", screening_margin, "Relative margin by which a configuration evaluated with screening_nphi had to fail a filter to be rejected without a calculation at the full nphi", "dimensionless");
+    int adaptive_filter_order_int = (int) adaptive_filter_order;
+    nc.put("adaptive_filter_order", adaptive_filter_order_int, "1 if the order in which the filters were applied was adapted during the scan, based on the rejection rate of each filter and the measured cost of each calculation, combined over all threads and procs at each checkpoint. 0 if the filters were applied in a fixed order. The kept configurations do not depend on this, but the rejected_due_to_* counts do. Since the costs are measured, these counts can differ between runs with the same seed if a checkpoint was written during the scan.", "dimensionless");
+    int prefilter_int = (int) prefilter;
+    nc.put("prefilter", prefilter_int, "1 if the min_R0_to_keep and curvature filters were first tested at a few toroidal angles directly from the axis Fourier coefficients, before the calculation on the full grid. 0 otherwise.", "dimensionless");
+    int surrogate_int = (int) surrogate;
+    nc.put("surrogate", surrogate_int, "1 if configurations were skipped when a surrogate model, fit on each proc to its first surrogate_training_attempts attempts, predicted they were unlikely to be kept. 0 otherwise.", "dimensionless");
+    if (surrogate) {
+      nc.put("surrogate_training_attempts", surrogate_training_attempts, "Number of attempts on each proc used to fit the surrogate model", "dimensionless");
+      nc.put("surrogate_threshold", surrogate_threshold, "Configurations were skipped if the surrogate model gave them a probability of being kept below this value", "dimensionless");
+      nc.put("surrogate_audit_fraction", surrogate_audit_fraction, "Fraction of the configurations that the surrogate model predicted would be rejected that were evaluated in full anyway", "dimensionless");
+      qscfloat surrogate_false_rejection_rate = (filters[N_SURROGATE_AUDITS] > 0)
+	? ((qscfloat) filters[N_SURROGATE_AUDITS_KEPT]) / filters[N_SURROGATE_AUDITS] : 0;
+      nc.put("surrogate_false_rejection_rate", surrogate_false_rejection_rate, "Estimated fraction of the configurations rejected by the surrogate model that would have been kept: n_surrogate_audits_kept / n_surrogate_audits, or 0 if there were no audits", "dimensionless");
+    }
     nc.put("min_R0_to_keep", min_R0_to_keep, "Configurations were kept in the scan only if the major radius of the magnetic axis was at least this value", "meter");
     nc.put("min_iota_to_keep", min_iota_to_keep, "Configurations were kept in the scan only if the absolute value of the on-axis rotational transform was at least this value", "dimensionless");
     nc.put("max_elongation_to_keep", max_elongation_to_keep, "Configurations were kept in the scan only if the elongation (in the plane perpendicular to the magnetic axis) was no greater than this value at all toroidal angles", "dimensionless");
@@ -107,6 +203,8 @@ void Scan::write_netcdf() {
   nc.put("max_newton_iterations", q.max_newton_iterations, "Maximum iterations of Newton's method for solving the sigma equation", "dimensionless");
   nc.put("max_linesearch_iterations", q.max_linesearch_iterations, "Maximum number of times the step size is reduced in the line search for each iteration of Newton's method when solving the sigma equation", "dimensionless");
   nc.put("newton_tolerance", q.newton_tolerance, "L2 norm of the residual used as a stopping criterion for Newton's method when solving the sigma equation", "dimensionless");
+  nc.put("newton_jacobian_period", q.newton_jacobian_period, "Number of Newton iterations between evaluations and LU factorizations of the Jacobian when solving the sigma equation. 1 corresponds to the standard Newton method, larger values to the Shamanskii or chord methods.", "dimensionless");
+  nc.put("newton_linesearch_option", q.newton_linesearch_option, "Line search used in each iteration of Newton's method when solving the sigma equation");
   nc.put("I2", q.I2, "r^2 term in I(r), which is the toroidal current inside the flux surface times mu0/(2pi)", "Tesla/meter");
   nc.put("d_phi", q.d_phi, "Grid spacing in phi", "dimensionless");
   nc.put("B0", q.B0, "Magnetic field magnitude on the magnetic axis", "Telsa");
@@ -127,41 +225,70 @@ void Scan::write_netcdf() {
   nc.put(axis_nmax_plus_1_dim, "Z0s_max", Z0s_max, "Maximum values in the scan for each sin(n*phi) Fourier amplitude of the Cartesian Z component of the magnetic axis", "meter");
   
   nc.put(nphi_dim, "phi", q.phi, "The grid in the standard toroidal angle phi", "dimensionless");
-  nc.put(n_scan_dim, "scan_eta_bar", scan_eta_bar, "For each configuration kept from the scan, the constant equal to B1c / B0", "1/meter");
-  nc.put(n_scan_dim, "scan_sigma0", scan_sigma0, "For each configuration kept from the scan, the value of sigma at phi=0", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_eta_bar", scan_eta_bar, "For each configuration kept from the scan, the constant equal to B1c / B0", "1/meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_sigma0", scan_sigma0, "For each configuration kept from the scan, the value of sigma at phi=0", "dimensionless");
   if (q.at_least_order_r2) {
-    nc.put(n_scan_dim, "scan_B2c", scan_B2c, "For each configuration kept from the scan, the r^2 * cos(2*theta) term in |B|", "Tesla/(meter^2)");
-    nc.put(n_scan_dim, "scan_B2s", scan_B2s, "For each configuration kept from the scan, the r^2 * sin(2*theta) term in |B|", "Tesla/(meter^2)");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_B2c", scan_B2c, "For each configuration kept from the scan, the r^2 * cos(2*theta) term in |B|", "Tesla/(meter^2)");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_B2s", scan_B2s, "For each configuration kept from the scan, the r^2 * sin(2*theta) term in |B|", "Tesla/(meter^2)");
   }
-  nc.put(n_scan_dim, "scan_iota", scan_iota, "For each configuration kept from the scan, the rotational transform on axis", "dimensionless");
-  nc.put(n_scan_dim, "scan_min_R0", scan_min_R0, "For each configuration kept from the scan, the minimum value of R0, the major radius of the magnetic axis. This variable corresponds to grid_min_R0 in a single Qsc calculation.", "meter");
-  nc.put(n_scan_dim, "scan_max_curvature", scan_max_curvature, "For each configuration kept from the scan, the maximum curvature of the magnetic axis", "1/meter");
-  nc.put(n_scan_dim, "scan_max_elongation", scan_max_elongation, "For each configuration kept from the scan, the maximum along the magnetic axis of the elongation in the plane perpendicular to the axis", "dimensionless");
-  nc.put(n_scan_dim, "scan_min_L_grad_B", scan_min_L_grad_B, "For each configuration kept from the scan, the minimum along the magnetic axis of the scale length L_grad_B, (eq (3.1) in Landreman J Plasma Physics (2021). This quantity corresponds to grid_min_L_grad_B for a single Qsc run.", "meter");
-  nc.put(n_scan_dim, "scan_helicity", scan_helicity, "For each configuration kept from the scan, the number of times the normal vector of the magnetic axis rotates poloidally as the axis is followed toroidally for one field period. The integer N appearing in our papers is equal to -helicity * nfp.", "dimensionless");
-  nc.put(n_scan_dim, "scan_standard_deviation_of_R", scan_standard_deviation_of_R, "Standard deviation of the major radius of the magnetic axis, with respect to arclength along the axis", "meter");
-  nc.put(n_scan_dim, "scan_standard_deviation_of_Z", scan_standard_deviation_of_Z, "Standard deviation of the Cartesian Z coordinate of the magnetic axis, with respect to arclength along the axis", "meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_iota", scan_iota, "For each configuration kept from the scan, the rotational transform on axis", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_min_R0", scan_min_R0, "For each configuration kept from the scan, the minimum value of R0, the major radius of the magnetic axis. This variable corresponds to min_R0 in a single Qsc calculation.", "meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_max_curvature", scan_max_curvature, "For each configuration kept from the scan, the maximum curvature of the magnetic axis", "1/meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_max_elongation", scan_max_elongation, "For each configuration kept from the scan, the maximum along the magnetic axis of the elongation in the plane perpendicular to the axis", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_min_L_grad_B", scan_min_L_grad_B, "For each configuration kept from the scan, the minimum along the magnetic axis of the scale length L_grad_B, (eq (3.1) in Landreman J Plasma Physics (2021). This quantity corresponds to min_L_grad_B for a single Qsc run.", "meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_helicity", scan_helicity, "For each configuration kept from the scan, the number of times the normal vector of the magnetic axis rotates poloidally as the axis is followed toroidally for one field period. The integer N appearing in our papers is equal to -helicity * nfp.", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_nphi", scan_nphi, "For each configuration kept from the scan, the number of grid points in phi that were used. This differs from nphi only if nphi_tolerance > 0.", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_standard_deviation_of_R", scan_standard_deviation_of_R, "Standard deviation of the major radius of the magnetic axis, with respect to arclength along the axis", "meter");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_sampling_weight", scan_sampling_weight, "For each configuration kept from the scan, the ratio of the density of the box distribution to the density from which the configuration was drawn. This is the product of the probability that an unconstrained draw of R0c[0] would satisfy the R0 constraints of constrained_sampling, given the other Fourier amplitudes, and the importance weight from adaptive_sampling. Weighting each configuration by scan_sampling_weight recovers the box sampling density. 1 without constrained_sampling or adaptive_sampling.", "dimensionless");
+  nc.put_slab(n_scan_dim, n_scan_offset, "scan_standard_deviation_of_Z", scan_standard_deviation_of_Z, "Standard deviation of the Cartesian Z coordinate of the magnetic axis, with respect to arclength along the axis", "meter");
   if (q.at_least_order_r2) {
-    nc.put(n_scan_dim, "scan_min_L_grad_grad_B", scan_min_L_grad_grad_B, "For each configuration kept from the scan, the minimum along the magnetic axis of the scale length L_grad_grad_B, (eq (3.2) in Landreman J Plasma Physics (2021). This quantity corresponds to grid_min_L_grad_grad_B for a single Qsc run.", "meter");
-    nc.put(n_scan_dim, "scan_B20_variation", scan_B20_variation, "For each configuration kept from the scan, the maximum of B20 along the magnetic axis minus the minimum of B20. This quantity corresponds to B20_grid_variation for a single Qsc run.", "Telsa/(meter^2)");
-    nc.put(n_scan_dim, "scan_B20_residual", scan_B20_residual, "", "");
-    nc.put(n_scan_dim, "scan_r_singularity", scan_r_singularity, "For each configuration kept from the scan, the value of r_singularity_robust. r_singularity_robust is the robust estimate of the minor radius at which the flux surface shapes become singular, r_c, as detailed in section 4.2 of Landreman, J Plasma Physics (2021)", "meter");
-    nc.put(n_scan_dim, "scan_d2_volume_d_psi2", scan_d2_volume_d_psi2, "For each configuration kept from the scan, the value of magnetic well d2_volume_d_psi2, the second derivative of flux surface volume with respect to psi, where 2*pi*psi is the toroidal flux.", "Tesla^{-2} meter^{-1}");
-    nc.put(n_scan_dim, "scan_DMerc_times_r2", scan_DMerc_times_r2, "For each configuration kept from the scan, the overall Mercier stability criterion times the square of the effective minor radius r. This quantity corresponds to DMerc_times_r2 for a single Qsc run. DMerc (without the r^2) corresponds to the quantity DMerc in VMEC, and to DMerc in Landreman and Jorge, J Plasma Phys (2020).", "Tesla^{-2} meter^{-2}");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_min_L_grad_grad_B", scan_min_L_grad_grad_B, "For each configuration kept from the scan, the minimum along the magnetic axis of the scale length L_grad_grad_B, (eq (3.2) in Landreman J Plasma Physics (2021). This quantity corresponds to min_L_grad_grad_B for a single Qsc run.", "meter");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_B20_variation", scan_B20_variation, "For each configuration kept from the scan, the maximum of B20 along the magnetic axis minus the minimum of B20. This quantity corresponds to B20_grid_variation for a single Qsc run.", "Telsa/(meter^2)");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_B20_residual", scan_B20_residual, "", "");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_r_singularity", scan_r_singularity, "For each configuration kept from the scan, the value of min_r_singularity, which equals r_singularity_robust unless fourier_extrema = 1. r_singularity_robust is the robust estimate of the minor radius at which the flux surface shapes become singular, r_c, as detailed in section 4.2 of Landreman, J Plasma Physics (2021)", "meter");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_d2_volume_d_psi2", scan_d2_volume_d_psi2, "For each configuration kept from the scan, the value of magnetic well d2_volume_d_psi2, the second derivative of flux surface volume with respect to psi, where 2*pi*psi is the toroidal flux.", "Tesla^{-2} meter^{-1}");
+    nc.put_slab(n_scan_dim, n_scan_offset, "scan_DMerc_times_r2", scan_DMerc_times_r2, "For each configuration kept from the scan, the overall Mercier stability criterion times the square of the effective minor radius r. This quantity corresponds to DMerc_times_r2 for a single Qsc run. DMerc (without the r^2) corresponds to the quantity DMerc in VMEC, and to DMerc in Landreman and Jorge, J Plasma Phys (2020).", "Tesla^{-2} meter^{-2}");
 
   }
 
+  if (write_sketches) {
+    // Names and units of the SKETCH_* diagnostics:
+    const char* sketch_names[N_SKETCHES][2] = {
+      {"min_R0", "meter"},
+      {"max_curvature", "1/meter"},
+      {"standard_deviation_of_R", "meter"},
+      {"standard_deviation_of_Z", "meter"},
+      {"iota", "dimensionless"},
+      {"max_elongation", "dimensionless"},
+      {"min_L_grad_B", "meter"},
+      {"B20_variation", "Tesla/(meter^2)"},
+      {"B20_residual", ""},
+      {"d2_volume_d_psi2", "Tesla^{-2} meter^{-1}"},
+      {"DMerc_times_r2", "Tesla^{-2} meter^{-2}"},
+      {"min_L_grad_grad_B", "meter"},
+      {"r_singularity", "meter"}};
+    nc.put(n_sketch_quantiles_dim, "sketch_quantile_levels", sketch_quantile_levels, "Probabilities 0, 0.01, ..., 1 at which the sketch_*_quantiles are given", "dimensionless");
+    for (int j = 0; j < N_SKETCHES; j++) {
+      std::string name = sketch_names[j][0];
+      nc.put("sketch_" + name + "_n", sketch_n[j], "Number of attempted configurations, kept or not, for which " + name + " was computed at the full resolution and was finite. Configurations rejected by an earlier filter, or for which the calculation stopped early at a grid point that failed the filter, are not included.", "dimensionless");
+      nc.put("sketch_" + name + "_n_nonfinite", sketch_n_nonfinite[j], "Number of attempted configurations for which " + name + " was computed but was infinite or NaN. These are not included in the sketch_" + name + "_mean or _quantiles.", "dimensionless");
+      nc.put("sketch_" + name + "_mean", sketch_means[j], "Mean of " + name + " over the attempted configurations for which it was computed, weighted by the sampling weight", sketch_names[j][1]);
+      nc.put(n_sketch_quantiles_dim, "sketch_" + name + "_quantiles", sketch_quantiles[j], "Quantiles of " + name + " at sketch_quantile_levels over the attempted configurations for which it was computed, weighted by the sampling weight, from a mergeable sketch with 1% relative accuracy. The first and last values are the exact min and max.", sketch_names[j][1]);
+    }
+  }
+
   // ND arrays for N > 1:
   std::vector<dim_id_type> axis_nmax_plus_1_n_scan_dim {axis_nmax_plus_1_dim, n_scan_dim};
-  nc.put(axis_nmax_plus_1_n_scan_dim, "scan_R0c", &scan_R0c(0, 0), "For each configuration kept from the scan, the amplitudes of the cos(n*phi) components of the major radius of the magnetic axis", "meter");
-  nc.put(axis_nmax_plus_1_n_scan_dim, "scan_R0s", &scan_R0s(0, 0), "For each configuration kept from the scan, the amplitudes of the sin(n*phi) components of the major radius of the magnetic axis", "meter");
-  nc.put(axis_nmax_plus_1_n_scan_dim, "scan_Z0c", &scan_Z0c(0, 0), "For each configuration kept from the scan, the amplitudes of the cos(n*phi) components of the Cartesian Z coordinate of the magnetic axis", "meter");
-  nc.put(axis_nmax_plus_1_n_scan_dim, "scan_Z0s", &scan_Z0s(0, 0), "For each configuration kept from the scan, the amplitudes of the sin(n*phi) components of the Cartesian Z coordinate of the magnetic axis", "meter");
+  nc.put_slab(axis_nmax_plus_1_n_scan_dim, n_scan_offset, "scan_R0c", scan_R0c, "For each configuration kept from the scan, the amplitudes of the cos(n*phi) components of the major radius of the magnetic axis", "meter");
+  nc.put_slab(axis_nmax_plus_1_n_scan_dim, n_scan_offset, "scan_R0s", scan_R0s, "For each configuration kept from the scan, the amplitudes of the sin(n*phi) components of the major radius of the magnetic axis", "meter");
+  nc.put_slab(axis_nmax_plus_1_n_scan_dim, n_scan_offset, "scan_Z0c", scan_Z0c, "For each configuration kept from the scan, the amplitudes of the cos(n*phi) components of the Cartesian Z coordinate of the magnetic axis", "meter");
+  nc.put_slab(axis_nmax_plus_1_n_scan_dim, n_scan_offset, "scan_Z0s", scan_Z0s, "For each configuration kept from the scan, the amplitudes of the sin(n*phi) components of the Cartesian Z coordinate of the magnetic axis", "meter");
  
   // Done defining the NetCDF data.
   nc.write_and_close();
+  output_file_started = true;
   
-  if (verbose > 0) {
+  if (verbose > 0 && mpi_rank == 0) {
     auto end = std::chrono::steady_clock::now();    
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Time for write_netcdf: "
@@ -0,0 +1,99 @@
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include "doctest.h"
+#include "background_writer.hpp"
+
+TEST_CASE("BackgroundWriter runs jobs in order, and drops only skippable jobs that are waiting.") {
+  std::mutex mutex;
+  std::vector<int> done;
+  bool started = false, release = false;
+  auto record = [&](int j) {
+    return [&, j]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.push_back(j);
+    };
+  };
+  // A job that runs until release is set:
+  auto blocker = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      started = true;
+    }
+    while (true) {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (release) break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    done.push_back(0);
+  };
+  auto wait_for_start = [&]() {
+    while (true) {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (started) return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+  auto release_later = [&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+  };
+
+  SUBCASE("Skippable jobs") {
+    qsc::BackgroundWriter writer;
+    writer.submit(blocker, true);
+    // Once the blocker is running, the other jobs have to wait:
+    wait_for_start();
+    writer.submit(record(1), true);
+    writer.submit(record(2), true);
+    writer.submit(record(3), true);
+    std::thread releaser(release_later);
+    writer.wait();
+    releaser.join();
+    // Jobs 1 and 2 were replaced by job 3 while the blocker ran:
+    CHECK(done == std::vector<int>({0, 3}));
+    CHECK(writer.n_completed() == 2);
+    CHECK(writer.n_skipped() == 2);
+  }
+
+  SUBCASE("Jobs that must not be skipped") {
+    qsc::BackgroundWriter writer;
+    writer.submit(blocker, false);
+    wait_for_start();
+    writer.submit(record(1), false);
+    // Both slots are taken, so this waits until the blocker finishes:
+    std::thread releaser(release_later);
+    writer.submit(record(2), false);
+    writer.wait();
+    releaser.join();
+    CHECK(done == std::vector<int>({0, 1, 2}));
+    CHECK(writer.n_completed() == 3);
+    CHECK(writer.n_skipped() == 0);
+  }
+
+  SUBCASE("Exceptions are passed to the submitting thread") {
+    qsc::BackgroundWriter writer;
+    writer.submit([]() { throw std::runtime_error("write failed"); }, false);
+    CHECK_THROWS_AS(writer.wait(), std::runtime_error);
+    // The exception is only reported once, and later jobs still run:
+    writer.submit(record(4), false);
+    writer.wait();
+    CHECK(done == std::vector<int>({4}));
+  }
+
+  SUBCASE("The destructor finishes the jobs") {
+    {
+      qsc::BackgroundWriter writer;
+      for (int j = 1; j <= 5; j++) writer.submit(record(j), false);
+    }
+    CHECK(done == std::vector<int>({1, 2, 3, 4, 5}));
+  }
+}
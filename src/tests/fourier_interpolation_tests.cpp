@@ -0,0 +1,223 @@
+#include <vector>
+#include "doctest.h"
+#include "qsc.hpp"
+
+using namespace qsc;
+using doctest::Approx;
+
+TEST_CASE("Fourier extrema of trigonometric polynomials are exact") {
+  qscfloat tol = 1.0e-12;
+  if (single) tol = 1.0e-5;
+  qscfloat theta, shift;
+
+  for (int n = 5; n < 20; n++) {
+    CAPTURE(n);
+    Vector f(n);
+    for (int j_shift = 0; j_shift < 7; j_shift++) {
+      shift = 0.37 * j_shift;
+      CAPTURE(shift);
+      // The extrema of this function generally fall between grid points:
+      for (int j = 0; j < n; j++) {
+	theta = (2 * pi * j) / n;
+	f[j] = 1.5 + 0.8 * cos(theta + shift);
+      }
+      CHECK(Approx(fourier_minimum(f)).epsilon(tol) == 0.7);
+      CHECK(Approx(fourier_maximum(f)).epsilon(tol) == 2.3);
+      CHECK(fourier_minimum(f) <= f.min());
+      CHECK(fourier_maximum(f) >= f.max());
+
+      // Two harmonics: f = 2 + sin(x) + 0.1 * cos(2x), with a
+      // minimum of 0.9 at x = -pi/2 and a maximum of 2.9 at x = pi/2.
+      for (int j = 0; j < n; j++) {
+	theta = (2 * pi * j) / n + shift;
+	f[j] = 2 + sin(theta) + 0.1 * cos(2 * theta);
+      }
+      CHECK(Approx(fourier_minimum(f)).epsilon(tol) == 0.9);
+      CHECK(Approx(fourier_maximum(f)).epsilon(tol) == 2.9);
+    }
+  }
+}
+
+TEST_CASE("Fourier interpolation onto a finer grid is exact for resolved modes") {
+  qscfloat tol = 1.0e-12;
+  if (single) tol = 1.0e-5;
+  qscfloat theta;
+
+  for (int n = 5; n < 12; n++) {
+    CAPTURE(n);
+    Vector f(n);
+    for (int j = 0; j < n; j++) {
+      theta = (2 * pi * j) / n;
+      f[j] = 0.3 + cos(theta) - 0.5 * sin(2 * theta);
+    }
+    for (int n_out = 1; n_out < 40; n_out += 3) {
+      CAPTURE(n_out);
+      Vector f_out(n_out);
+      fourier_interpolate(f, f_out);
+      for (int j = 0; j < n_out; j++) {
+	theta = (2 * pi * j) / n_out;
+	CHECK(Approx(f_out[j]).epsilon(tol) == 0.3 + cos(theta) - 0.5 * sin(2 * theta));
+      }
+    }
+    // Resampling onto the same grid should return the original values:
+    Vector f_same(n);
+    fourier_interpolate(f, f_same);
+    for (int j = 0; j < n; j++) CHECK(Approx(f_same[j]).epsilon(tol) == f[j]);
+  }
+}
+
+TEST_CASE("Fourier extrema at low resolution approach the high resolution grid extrema") {
+  if (single) return;
+  std::vector<std::string> configs = {
+    "r2 section 5.1",
+    "r2 section 5.2",
+    "r2 section 5.3",
+    "r2 section 5.4",
+    "r2 section 5.5"};
+
+  for (std::size_t jconfig = 0; jconfig < configs.size(); jconfig++) {
+    CAPTURE(jconfig);
+    Qsc q_fine(configs[jconfig]);
+    q_fine.verbose = 0;
+    q_fine.nphi = 401;
+    q_fine.init();
+    q_fine.calculate();
+
+    Qsc q_grid(configs[jconfig]);
+    CHECK(q_grid.min_R0 == q_grid.grid_min_R0);
+    CHECK(q_grid.max_curvature == q_grid.grid_max_curvature);
+    CHECK(q_grid.max_elongation == q_grid.grid_max_elongation);
+    CHECK(q_grid.min_L_grad_B == q_grid.grid_min_L_grad_B);
+    CHECK(q_grid.min_L_grad_grad_B == q_grid.grid_min_L_grad_grad_B);
+    CHECK(q_grid.min_r_singularity == q_grid.r_singularity_robust);
+
+    Qsc q(configs[jconfig]);
+    q.verbose = 0;
+    q.fourier_extrema = true;
+    q.init();
+    q.calculate();
+    // Interpolated extrema are never less extreme than the grid values:
+    CHECK(q.min_R0 <= q.grid_min_R0);
+    CHECK(q.max_curvature >= q.grid_max_curvature);
+    CHECK(q.max_elongation >= q.grid_max_elongation);
+    CHECK(q.min_L_grad_B <= q.grid_min_L_grad_B);
+    CHECK(q.min_L_grad_grad_B <= q.grid_min_L_grad_grad_B);
+    CHECK(q.min_r_singularity <= q.r_singularity_robust);
+
+    CHECK(Approx(q.min_R0).epsilon(1.0e-4) == q_fine.grid_min_R0);
+    CHECK(Approx(q.max_curvature).epsilon(1.0e-3) == q_fine.grid_max_curvature);
+    CHECK(Approx(q.max_elongation).epsilon(1.0e-2) == q_fine.grid_max_elongation);
+    CHECK(Approx(q.min_L_grad_B).epsilon(1.0e-2) == q_fine.grid_min_L_grad_B);
+  }
+}
+
+TEST_CASE("Fourier tail is small for resolved profiles and large for unresolved ones") {
+  qscfloat theta;
+  int n = 31;
+  Vector f(n);
+  for (int j = 0; j < n; j++) {
+    theta = (2 * pi * j) / n;
+    f[j] = 1 + 0.5 * cos(theta) + 0.2 * sin(3 * theta);
+  }
+  CHECK(fourier_tail(f) < 1.0e-10);
+
+  // exp(a cos(theta)) has Fourier amplitudes that decay like I_k(a):
+  for (int j = 0; j < n; j++) {
+    theta = (2 * pi * j) / n;
+    f[j] = exp(8 * cos(theta));
+  }
+  qscfloat tail_31 = fourier_tail(f);
+  CHECK(tail_31 > 1.0e-6);
+  n = 61;
+  f.resize(n);
+  for (int j = 0; j < n; j++) {
+    theta = (2 * pi * j) / n;
+    f[j] = exp(8 * cos(theta));
+  }
+  CHECK(fourier_tail(f) < 1.0e-3 * tail_31);
+
+  // A constant has no tail:
+  f = 2.0;
+  CHECK(fourier_tail(f) < 1.0e-12);
+}
+
+TEST_CASE("Adaptive nphi reaches the requested spectral tail and agrees with a fine grid") {
+  if (single) return;
+  std::vector<std::string> configs = {
+    "r1 section 5.1",
+    "r1 section 5.2",
+    "r1 section 5.3",
+    "r2 section 5.1",
+    "r2 section 5.2",
+    "r2 section 5.3",
+    "r2 section 5.4",
+    "r2 section 5.5"};
+
+  for (std::size_t jconfig = 0; jconfig < configs.size(); jconfig++) {
+    CAPTURE(jconfig);
+    Qsc q_fine(configs[jconfig]);
+    q_fine.verbose = 0;
+    q_fine.nphi = 201;
+    q_fine.init();
+    q_fine.calculate();
+
+    for (int nphi = 9; nphi < 40; nphi += 10) {
+      CAPTURE(nphi);
+      Qsc q(configs[jconfig]);
+      q.verbose = 0;
+      q.nphi = nphi;
+      q.nphi_tolerance = 1.0e-8;
+      q.init();
+      q.calculate();
+      CHECK(q.spectral_tail <= q.nphi_tolerance);
+      CHECK(q.nphi >= nphi);
+      CHECK(q.nphi <= q.max_nphi);
+      CHECK(q.nphi % 2 == 1);
+      CHECK(q.newton_result == NEWTON_CONVERGED);
+      CHECK(Approx(q.iota).epsilon(1.0e-6) == q_fine.iota);
+      CHECK(Approx(q.grid_max_elongation).epsilon(1.0e-2) == q_fine.grid_max_elongation);
+      if (q.at_least_order_r2) {
+	CHECK(Approx(q.B20_mean).epsilon(1.0e-5) == q_fine.B20_mean);
+      }
+    }
+  }
+}
+
+TEST_CASE("Adaptive nphi starting from min_nphi uses a coarse grid where it suffices") {
+  if (single) return;
+  std::vector<std::string> configs = {
+    "r1 section 5.1",
+    "r1 section 5.2",
+    "r2 section 5.1",
+    "r2 section 5.2",
+    "r2 section 5.5"};
+  int n_coarser = 0;
+
+  for (std::size_t jconfig = 0; jconfig < configs.size(); jconfig++) {
+    CAPTURE(jconfig);
+    Qsc q_fine(configs[jconfig]);
+    q_fine.verbose = 0;
+    q_fine.nphi = 201;
+    q_fine.init();
+    q_fine.calculate();
+
+    Qsc q(configs[jconfig]);
+    q.verbose = 0;
+    q.nphi = 61;
+    q.nphi_tolerance = 1.0e-8;
+    q.min_nphi = 9;
+    q.init();
+    q.calculate();
+    CHECK(q.spectral_tail <= q.nphi_tolerance);
+    CHECK(q.nphi >= q.min_nphi);
+    CHECK(q.nphi % 2 == 1);
+    if (q.nphi < 61) n_coarser++;
+    CHECK(q.newton_result == NEWTON_CONVERGED);
+    CHECK(Approx(q.iota).epsilon(1.0e-6) == q_fine.iota);
+    CHECK(Approx(q.grid_max_elongation).epsilon(1.0e-2) == q_fine.grid_max_elongation);
+    if (q.at_least_order_r2) {
+      CHECK(Approx(q.B20_mean).epsilon(1.0e-5) == q_fine.B20_mean);
+    }
+  }
+  CHECK(n_coarser > 0);
+}
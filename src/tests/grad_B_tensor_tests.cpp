@@ -250,3 +250,58 @@ TEST_CASE("grad grad B tensor alternative derivation and symmetry") {
     }
   }
 }
+
+TEST_CASE("Diagnostics with a rejection threshold stop early only when the threshold is violated") {
+  std::vector<std::string> configs = {
+    "r2 section 5.1",
+    "r2 section 5.2",
+    "r2 section 5.3",
+    "r2 section 5.4",
+    "r2 section 5.5"};
+  
+  for (int jconfig = 0; jconfig < configs.size(); jconfig++) {
+    CAPTURE(jconfig);
+    Qsc q(configs[jconfig]);
+    q.verbose = 0;
+    CHECK(!q.grad_grad_B_partial);
+    CHECK(!q.r_singularity_partial);
+    qscfloat min_L_grad_grad_B = q.grid_min_L_grad_grad_B;
+    qscfloat r_singularity = q.r_singularity_robust;
+    Vector L_grad_grad_B = q.L_grad_grad_B;
+    Vector r_hat_singularity = q.r_hat_singularity_robust;
+
+    // Thresholds below the true minima should give the full result:
+    q.calculate_grad_grad_B_tensor(0.9 * min_L_grad_grad_B);
+    CHECK(!q.grad_grad_B_partial);
+    CHECK(q.grid_min_L_grad_grad_B == min_L_grad_grad_B);
+    for (int j = 0; j < q.nphi; j++) CHECK(q.L_grad_grad_B[j] == L_grad_grad_B[j]);
+    q.calculate_r_singularity(0.9 * r_singularity);
+    CHECK(!q.r_singularity_partial);
+    CHECK(q.r_singularity_robust == r_singularity);
+    for (int j = 0; j < q.nphi; j++) CHECK(q.r_hat_singularity_robust[j] == r_hat_singularity[j]);
+
+    // A threshold of 0 means there is no threshold:
+    q.calculate_grad_grad_B_tensor(0);
+    CHECK(!q.grad_grad_B_partial);
+    CHECK(q.grid_min_L_grad_grad_B == min_L_grad_grad_B);
+    q.calculate_r_singularity(0);
+    CHECK(!q.r_singularity_partial);
+    CHECK(q.r_singularity_robust == r_singularity);
+
+    // Thresholds above the largest value anywhere should stop early,
+    // and the configuration should still be rejected:
+    qscfloat threshold = 1.1 * L_grad_grad_B.max();
+    q.calculate_grad_grad_B_tensor(threshold);
+    CHECK(q.grad_grad_B_partial);
+    CHECK(q.grid_min_L_grad_grad_B < threshold);
+    // Partial sums can only over-estimate the scale length:
+    for (int j = 0; j < q.nphi; j++) CHECK(q.L_grad_grad_B[j] >= Approx(L_grad_grad_B[j]));
+
+    threshold = 1.1 * r_hat_singularity.max();
+    q.calculate_r_singularity(threshold);
+    CHECK(q.r_singularity_partial);
+    CHECK(q.r_singularity_robust < threshold);
+    CHECK(q.r_singularity_robust >= r_singularity);
+    CHECK(q.r_hat_singularity_robust[0] == r_hat_singularity[0]);
+  }
+}
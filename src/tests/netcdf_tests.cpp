@@ -1,11 +1,107 @@
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mpi.h>
+#include <netcdf.h>
 #include "doctest.h"
 #include "qsc.hpp"
+#include "scan.hpp"
 
 using namespace qsc;
 using doctest::Approx;
 
+/** Settings shared by the scans in these tests: a small
+    deterministic scan over eta_bar and the n=1 harmonics of the axis,
+    keeping the configurations with max_elongation <= 4.
+ */
+static void set_small_scan(qsc::Scan& scan) {
+  int nf = 2;
+  scan.verbose = 0;
+  scan.deterministic = true;
+  scan.keep_all = false;
+  scan.max_keep_per_proc = 1000;
+  scan.max_seconds = 1000;
+  scan.q.nfp = 3;
+  scan.q.nphi = 31;
+  scan.q.verbose = 0;
+  scan.R0c_min.resize(nf, 0.0);
+  scan.R0c_max.resize(nf, 0.0);
+  scan.R0s_min.resize(nf, 0.0);
+  scan.R0s_max.resize(nf, 0.0);
+  scan.Z0c_min.resize(nf, 0.0);
+  scan.Z0c_max.resize(nf, 0.0);
+  scan.Z0s_min.resize(nf, 0.0);
+  scan.Z0s_max.resize(nf, 0.0);
+  scan.R0c_min[0] = 1.0;
+  scan.R0c_max[0] = 1.0;
+  scan.R0c_min[1] = -0.1;
+  scan.R0c_max[1] =  0.1;
+  scan.Z0s_min[1] = -0.1;
+  scan.Z0s_max[1] =  0.1;
+  scan.eta_bar_min = 0.5;
+  scan.eta_bar_max = 1.5;
+  scan.max_elongation_to_keep = 4.0;
+}
+
+/** Read a numeric variable of any shape from a NetCDF file, flattened
+    in the order of the file. The length of each dimension is stored
+    in shape.
+ */
+static std::vector<double> read_variable(const std::string& filename, const std::string& name,
+					 std::vector<size_t>& shape) {
+  int retval, ncid, var_id, n_dims, dim_ids[NC_MAX_VAR_DIMS];
+  size_t n = 1;
+  if ((retval = nc_open(filename.c_str(), NC_NOWRITE, &ncid))) FAIL(nc_strerror(retval));
+  if ((retval = nc_inq_varid(ncid, name.c_str(), &var_id))) FAIL(nc_strerror(retval));
+  if ((retval = nc_inq_varndims(ncid, var_id, &n_dims))) FAIL(nc_strerror(retval));
+  if ((retval = nc_inq_vardimid(ncid, var_id, dim_ids))) FAIL(nc_strerror(retval));
+  shape.resize(n_dims);
+  for (int j = 0; j < n_dims; j++) {
+    if ((retval = nc_inq_dimlen(ncid, dim_ids[j], &shape[j]))) FAIL(nc_strerror(retval));
+    n *= shape[j];
+  }
+  std::vector<double> data(n);
+  if (n > 0 && (retval = nc_get_var_double(ncid, var_id, &data[0]))) FAIL(nc_strerror(retval));
+  nc_close(ncid);
+  return data;
+}
+
+/** Verify that every numeric variable of one NetCDF file is in a
+    second file with the same shape and values, except for the
+    variables named in skip. NaNs are considered equal.
+ */
+static void compare_netcdf_files(const std::string& filename1, const std::string& filename2,
+				 const std::vector<std::string>& skip) {
+  int retval, ncid, n_vars, var_id;
+  nc_type type;
+  char name[NC_MAX_NAME + 1];
+  std::vector<std::string> names;
+  if ((retval = nc_open(filename1.c_str(), NC_NOWRITE, &ncid))) FAIL(nc_strerror(retval));
+  if ((retval = nc_inq_nvars(ncid, &n_vars))) FAIL(nc_strerror(retval));
+  for (var_id = 0; var_id < n_vars; var_id++) {
+    if ((retval = nc_inq_var(ncid, var_id, name, &type, NULL, NULL, NULL))) FAIL(nc_strerror(retval));
+    if (type == NC_CHAR || type == NC_STRING) continue;
+    if (std::find(skip.begin(), skip.end(), std::string(name)) != skip.end()) continue;
+    names.push_back(name);
+  }
+  nc_close(ncid);
+  CHECK(names.size() > 0);
+
+  std::vector<size_t> shape1, shape2;
+  for (const std::string& variable : names) {
+    CAPTURE(variable);
+    std::vector<double> data1 = read_variable(filename1, variable, shape1);
+    std::vector<double> data2 = read_variable(filename2, variable, shape2);
+    REQUIRE(shape2 == shape1);
+    for (size_t j = 0; j < data1.size(); j++) {
+      CAPTURE(j);
+      CHECK((data2[j] == data1[j] || (std::isnan(data1[j]) && std::isnan(data2[j]))));
+    }
+  }
+}
+
 /** Save Qsc data to a NetCDF file. Read the data in to a different
     Qsc object. Verify that the two objects now have the same data.
  */
@@ -127,3 +223,234 @@ TEST_CASE("netcdf") {
   }
 }
 
+/** Run a scan that appends to its output file at every attempt, and
+    verify that the file holds the same configurations as a scan that
+    collects everything at the end.
+ */
+TEST_CASE("Scan output with append_checkpoints matches a scan without checkpoints. [mpi]") {
+  if (single) return;
+  int mpi_rank, retval, ncid, dim_id, var_id;
+  size_t j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string filename = "qsc_out.append_checkpoints_unitTests.nc";
+
+  qsc::Scan scan1;
+  qsc::Scan scan2;
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    set_small_scan(scan);
+    // Every proc must make the same number of checkpoints, so stop
+    // based on the number of attempts:
+    scan.max_attempts_per_proc = 15;
+    if (j_scan == 1) {
+      scan.append_checkpoints = true;
+      scan.save_period = 0; // Checkpoint before every attempt
+      scan.outfilename = filename;
+    }
+    scan.random();
+  }
+  scan2.write_netcdf();
+
+  if (mpi_rank == 0) {
+    CHECK(scan2.n_scan == scan1.n_scan);
+    CHECK(scan1.n_scan > 0);
+    // scan2 holds only the configurations since the last checkpoint:
+    CHECK(scan2.n_scan_offset + scan2.scan_eta_bar.size() == scan2.n_scan);
+    for (j = 0; j < qsc::N_FILTERS; j++) CHECK(scan2.filters[j] == scan1.filters[j]);
+
+    if ((retval = nc_open(filename.c_str(), NC_NOWRITE, &ncid))) FAIL(nc_strerror(retval));
+    size_t n_scan_file;
+    if ((retval = nc_inq_dimid(ncid, "n_scan", &dim_id))) FAIL(nc_strerror(retval));
+    if ((retval = nc_inq_dimlen(ncid, dim_id, &n_scan_file))) FAIL(nc_strerror(retval));
+    REQUIRE(n_scan_file == scan1.n_scan);
+    int n_scan_int;
+    if ((retval = nc_inq_varid(ncid, "n_scan", &var_id))) FAIL(nc_strerror(retval));
+    if ((retval = nc_get_var_int(ncid, var_id, &n_scan_int))) FAIL(nc_strerror(retval));
+    CHECK(n_scan_int == scan1.n_scan);
+    // The counts in the file are those of the whole scan:
+    std::vector<size_t> shape;
+    CHECK(read_variable(filename, "attempts", shape)[0] == scan1.filters[qsc::ATTEMPTS]);
+    CHECK(read_variable(filename, "rejected_due_to_elongation", shape)[0] == scan1.filters[qsc::REJECTED_DUE_TO_ELONGATION]);
+    std::vector<double> eta_bar_file(n_scan_file);
+    if ((retval = nc_inq_varid(ncid, "scan_eta_bar", &var_id))) FAIL(nc_strerror(retval));
+    if ((retval = nc_get_var_double(ncid, var_id, &eta_bar_file[0]))) FAIL(nc_strerror(retval));
+    nc_close(ncid);
+
+    // With several procs the configurations are grouped by
+    // checkpoint, so they are in a different order than for scan1:
+    std::vector<double> eta_bar_collected(std::begin(scan1.scan_eta_bar), std::end(scan1.scan_eta_bar));
+    std::sort(eta_bar_file.begin(), eta_bar_file.end());
+    std::sort(eta_bar_collected.begin(), eta_bar_collected.end());
+    for (j = 0; j < n_scan_file; j++) {
+      CAPTURE(j);
+      CHECK(Approx(eta_bar_file[j]) == eta_bar_collected[j]);
+    }
+  }
+}
+
+/** Run a scan that keeps every configuration, then use its output
+    file as the candidates_file of a scan with filters, and verify that
+    the same configurations are kept as in a random scan with these
+    filters.
+ */
+TEST_CASE("A scan of the candidates in a scan output file keeps the same configurations as a random scan. [mpi]") {
+  if (single) return;
+  int mpi_rank;
+  qsc::big j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string filename = "qsc_out.candidates_unitTests.nc";
+
+  qsc::Scan scan_all, scan_random, scan_file;
+  for (qsc::Scan* scan : {&scan_all, &scan_random, &scan_file}) {
+    set_small_scan(*scan);
+    scan->keep_all = (scan == &scan_all);
+    scan->max_attempts_per_proc = 40;
+  }
+  scan_all.outfilename = filename;
+  scan_all.random();
+  scan_all.write_netcdf();
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (mpi_rank == 0) {
+    std::vector<size_t> shape;
+    read_variable(filename, "scan_eta_bar", shape);
+    REQUIRE(shape.size() == 1);
+    CHECK(shape[0] == scan_all.n_scan);
+  }
+
+  scan_random.random();
+  scan_file.candidates_file = filename;
+  scan_file.max_attempts_per_proc = -1;
+  scan_file.random();
+
+  if (mpi_rank == 0) {
+    REQUIRE(scan_all.n_scan == scan_all.filters[qsc::ATTEMPTS]);
+    CHECK(scan_random.n_scan > 0);
+    CHECK(scan_random.n_scan < scan_all.n_scan);
+    for (j = 0; j < qsc::N_FILTERS; j++) CHECK(scan_file.filters[j] == scan_random.filters[j]);
+    REQUIRE(scan_file.n_scan == scan_random.n_scan);
+    for (j = 0; j < scan_random.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(Approx(scan_file.scan_eta_bar[j]) == scan_random.scan_eta_bar[j]);
+      CHECK(Approx(scan_file.scan_max_elongation[j]) == scan_random.scan_max_elongation[j]);
+    }
+  }
+}
+
+/** Run a scan with parallel_netcdf, in which each proc writes its own
+    slice of the results, and verify that the file is the same as for
+    a scan in which proc 0 writes everything.
+ */
+TEST_CASE("The output file of a scan with parallel_netcdf matches the serial output file. [mpi]") {
+  if (single) return;
+  int mpi_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string filenames[2] = {"qsc_out.serial_unitTests.nc", "qsc_out.parallel_netcdf_unitTests.nc"};
+
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan scan;
+    set_small_scan(scan);
+    scan.parallel_netcdf = (j_scan == 1);
+    // Give the procs different numbers of attempts, so their slices differ in size:
+    scan.max_attempts_per_proc = 20 + 7 * mpi_rank;
+    scan.outfilename = filenames[j_scan];
+    scan.random();
+    scan.write_netcdf();
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if (mpi_rank == 0) compare_netcdf_files(filenames[0], filenames[1], {"parallel_netcdf"});
+}
+
+/** Run a scan that appends to its output file at every attempt, with
+    and without async_output, and verify that the files are the same,
+    both after the last checkpoint and after the final write.
+ */
+TEST_CASE("Scan output written by the background writer matches the output written synchronously. [mpi]") {
+  if (single) return;
+  int mpi_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string filenames[2] = {"qsc_out.sync_output_file_unitTests.nc", "qsc_out.async_output_file_unitTests.nc"};
+
+  qsc::Scan scan1, scan2;
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    set_small_scan(scan);
+    scan.max_attempts_per_proc = 30;
+    scan.append_checkpoints = true;
+    // Checkpoint before every attempt, so the writer is usually busy:
+    scan.save_period = 0;
+    scan.async_output = (j_scan == 1);
+    scan.outfilename = filenames[j_scan];
+    if (mpi_rank == 0) std::remove(scan.restart_filename().c_str());
+    scan.random();
+  }
+  // Once random() returns, the last checkpoint has been written:
+  if (mpi_rank == 0) compare_netcdf_files(filenames[0], filenames[1], {});
+
+  scan1.write_netcdf();
+  scan2.write_netcdf();
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (mpi_rank == 0) compare_netcdf_files(filenames[0], filenames[1], {});
+}
+
+/** Run a scan without interruption, and a scan that stops early and
+    is continued from its restart file, and verify that their output
+    files hold the same configurations and counts.
+ */
+TEST_CASE("The output file of a scan continued from a restart file matches a scan run without interruption. [mpi]") {
+  if (single) return;
+  int mpi_rank;
+  size_t j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string filenames[2] = {"qsc_out.no_restart_unitTests.nc", "qsc_out.restart_file_unitTests.nc"};
+
+  // scan1 runs without interruption. scan2 stops early, when a few
+  // configurations have been kept, and scan3 continues from where
+  // scan2 stopped, in the same file.
+  for (int j_scan = 0; j_scan < 3; j_scan++) {
+    qsc::Scan scan;
+    set_small_scan(scan);
+    scan.deterministic = false;
+    // scan3 gets the seed from the restart file:
+    scan.random_seed = (j_scan == 2) ? 0 : 12345;
+    scan.max_attempts_per_proc = 40;
+    scan.max_keep_per_proc = (j_scan == 1) ? 3 : 1000;
+    scan.append_checkpoints = true;
+    scan.outfilename = filenames[std::min(j_scan, 1)];
+    if (j_scan < 2 && mpi_rank == 0) std::remove(scan.restart_filename().c_str());
+    scan.restart = (j_scan == 2);
+    scan.random();
+    // As in Scan::run():
+    scan.write_netcdf();
+    if (j_scan == 1) scan.write_restart();
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if (mpi_rank == 0) {
+    std::vector<size_t> shape1, shape2;
+    for (std::string variable : {"n_scan", "attempts", "rejected_due_to_iota", "rejected_due_to_elongation",
+	  "rejected_due_to_L_grad_B", "random_seed"}) {
+      CAPTURE(variable);
+      std::vector<double> data1 = read_variable(filenames[0], variable, shape1);
+      std::vector<double> data2 = read_variable(filenames[1], variable, shape2);
+      REQUIRE(data2.size() == 1);
+      REQUIRE(data1.size() == 1);
+      CHECK(data2[0] == data1[0]);
+    }
+    // The configurations are grouped by checkpoint, which differ
+    // between the two scans, so they are compared in sorted order:
+    for (std::string variable : {"scan_eta_bar", "scan_iota", "scan_max_elongation"}) {
+      CAPTURE(variable);
+      std::vector<double> data1 = read_variable(filenames[0], variable, shape1);
+      std::vector<double> data2 = read_variable(filenames[1], variable, shape2);
+      REQUIRE(shape2 == shape1);
+      CHECK(data1.size() > 0);
+      std::sort(data1.begin(), data1.end());
+      std::sort(data2.begin(), data2.end());
+      for (j = 0; j < data1.size(); j++) {
+	CAPTURE(j);
+	CHECK(data2[j] == data1[j]);
+      }
+    }
+  }
+}
@@ -1,5 +1,6 @@
 #include "doctest.h"
 #include "qsc.hpp"
+#include "newton.hpp"
 
 using namespace qsc;
 using doctest::Approx;
@@ -38,3 +39,79 @@ TEST_CASE("Newton solve") {
   CHECK(result == NEWTON_CONVERGED);
 }
 
+
+TEST_CASE("Templated Newton solve with lambdas, for each Jacobian period and line search") {
+  Matrix m(2, 2);
+  Vector state(2);
+  Vector work1(2), work2(2), residual(2);
+  std::valarray<int> ipiv(2);
+  NewtonStats stats;
+
+  int max_newton_iterations = 30;
+  int max_linesearch_iterations = 5;
+  qscfloat tolerance = 1.0e-12;
+  if (single) tolerance = 1.0e-7;
+  int verbose = 0;
+  int result, newton_factorizations;
+  int linesearch_options[3] = {NEWTON_LINESEARCH_BACKTRACK, NEWTON_LINESEARCH_ARMIJO, NEWTON_LINESEARCH_NONE};
+
+  for (int j_linesearch = 0; j_linesearch < 3; j_linesearch++) {
+    CAPTURE(j_linesearch);
+    for (int jacobian_period = 1; jacobian_period < 100; jacobian_period *= 3) {
+      CAPTURE(jacobian_period);
+      state = 0.0;
+      result = newton_solve([](Vector& s, Vector& r) {residual_function1(s, r, NULL);},
+			    [](Vector& s, Matrix& jac) {jacobian_function1(s, jac, NULL);},
+			    state, residual, work1, work2, ipiv, m,
+			    max_newton_iterations, max_linesearch_iterations,
+			    tolerance, verbose, jacobian_period,
+			    linesearch_options[j_linesearch], stats);
+      CHECK(Approx(state[0]) == -0.5671432904097838);
+      CHECK(Approx(state[1]) == 0.5671432904097838);
+      CHECK(result == NEWTON_CONVERGED);
+      CHECK(stats.iterations > 0);
+      CHECK(stats.linesearch_steps >= stats.iterations);
+      CHECK(stats.residual_evaluations > stats.linesearch_steps);
+      CHECK(stats.factorizations >= 1);
+      CHECK(stats.factorizations <= stats.iterations);
+      if (jacobian_period == 1) {
+	CHECK(stats.factorizations == stats.iterations);
+	newton_factorizations = stats.factorizations;
+      } else {
+	// Chord/Shamanskii iterations should re-use the LU factors:
+	CHECK(stats.factorizations < newton_factorizations);
+      }
+    }
+  }
+}
+
+TEST_CASE("Sigma equation gives the same solution with chord and Shamanskii iterations") {
+  std::string configs[] = {"r1 section 5.1", "r1 section 5.2", "r1 section 5.3",
+			   "r2 section 5.1", "r2 section 5.2", "r2 section 5.3",
+			   "r2 section 5.4", "r2 section 5.5"};
+  for (int j_config = 0; j_config < 8; j_config++) {
+    CAPTURE(j_config);
+    Qsc q_newton(configs[j_config]);
+    q_newton.verbose = 0;
+    q_newton.max_linesearch_iterations = 20;
+    q_newton.init();
+    q_newton.calculate();
+    CHECK(q_newton.newton_result == NEWTON_CONVERGED);
+
+    for (int jacobian_period = 2; jacobian_period <= 4; jacobian_period++) {
+      CAPTURE(jacobian_period);
+      Qsc q(configs[j_config]);
+      q.verbose = 0;
+      q.max_linesearch_iterations = 20;
+      // Shamanskii iterations converge more slowly per iteration, so allow more of them:
+      q.max_newton_iterations = 50;
+      q.newton_jacobian_period = jacobian_period;
+      q.init();
+      q.calculate();
+      CHECK(q.newton_result == NEWTON_CONVERGED);
+      CHECK(Approx(q.iota) == q_newton.iota);
+      for (int j = 0; j < q.nphi; j++) CHECK(Approx(q.sigma[j]) == q_newton.sigma[j]);
+      CHECK(q.newton_stats.factorizations <= q_newton.newton_stats.factorizations);
+    }
+  }
+}
@@ -21,7 +21,12 @@ int main( int argc, char* argv[] ) {
   
   doctest::Context context;
   context.applyCommandLine(argc, argv);
-  MPI_Init(&argc, &argv);
+  int mpi_thread_support;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &mpi_thread_support);
+  // Without this, scans fall back to one thread and synchronous output,
+  // so the tests of threads and async_output prove nothing:
+  if (mpi_thread_support < MPI_THREAD_FUNNELED)
+    std::cout << "Warning: the MPI library does not provide MPI_THREAD_FUNNELED." << std::endl;
   int result = context.run();
   // int result = Catch::Session().run( argc, argv );
   MPI_Finalize();
@@ -1,4 +1,9 @@
 #include <stdexcept>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
 #include "doctest.h"
 #include "random.hpp"
 
@@ -260,3 +265,199 @@ TEST_CASE("Random: verify results make sense for negative min and/or max") {
     
   }
 }
+
+TEST_CASE("Random::get_at_least samples the distribution restricted to values >= lower") {
+  std::vector<std::string> distribs = {"linear", "log"};
+  std::vector<qsc::qscfloat> mins = {1.0, 3.0, -1.0, -3.0, -2.0};
+  std::vector<qsc::qscfloat> maxs = {3.0, 1.0, -3.0, -1.0, 2.0};
+  std::vector<qsc::qscfloat> lowers = {-5.0, -2.5, -1.5, 0.0, 0.5, 1.5, 2.5, 5.0};
+  qsc::qscfloat val, probability, min, max, lower;
+  int N = 10000;
+  int j, n_above;
+
+  for (std::size_t j_distrib = 0; j_distrib < distribs.size(); j_distrib++) {
+    CAPTURE(distribs[j_distrib]);
+    for (std::size_t j_range = 0; j_range < mins.size(); j_range++) {
+      min = mins[j_range];
+      max = maxs[j_range];
+      // The log distribution requires min and max of the same sign:
+      if (j_distrib == 1 && min * max < 0) continue;
+      CAPTURE(min);
+      CAPTURE(max);
+      for (std::size_t j_lower = 0; j_lower < lowers.size(); j_lower++) {
+	lower = lowers[j_lower];
+	CAPTURE(lower);
+
+	// Fraction of unconstrained values that are >= lower:
+	qsc::Random r1(true, distribs[j_distrib], min, max);
+	n_above = 0;
+	for (j = 0; j < N; j++) {
+	  if (r1.get() >= lower) n_above++;
+	}
+
+	qsc::Random r2(true, distribs[j_distrib], min, max);
+	for (j = 0; j < 100; j++) {
+	  val = r2.get_at_least(lower, probability);
+	  CHECK(probability >= 0);
+	  CHECK(probability <= 1);
+	  CHECK(val >= std::min(min, max) - 1.0e-6);
+	  CHECK(val <= std::max(min, max) + 1.0e-6);
+	  if (probability > 0) CHECK(val >= lower - 1.0e-6);
+	}
+	CHECK(std::abs(probability - ((qsc::qscfloat) n_above) / N) < 0.01);
+
+	// get_at_least should advance the sequence exactly as get() does:
+	qsc::Random r3(true, distribs[j_distrib], min, max);
+	for (j = 0; j < 100; j++) r3.get();
+	CHECK(Approx(r2.get()) == r3.get());
+      }
+    }
+  }
+
+  qsc::Random r4(true, "2 sided log", 1.0, 2.0);
+  CHECK_THROWS(r4.get_at_least(0.0, probability));
+}
+
+TEST_CASE("Random::set_to_nth jumps ahead exactly for each sequence") {
+  std::vector<std::string> sequences = {"golden ratio", "R_d", "Halton"};
+  qsc::qscfloat min = -3.0, max = -2.0;
+  for (std::size_t j_sequence = 0; j_sequence < sequences.size(); j_sequence++) {
+    CAPTURE(sequences[j_sequence]);
+    for (int dimension = 0; dimension < 5; dimension++) {
+      CAPTURE(dimension);
+      qsc::Random r1(true, "linear", min, max, sequences[j_sequence], dimension, 5);
+      qsc::Random r2(true, "linear", min, max, sequences[j_sequence], dimension, 5);
+      for (int pos = 0; pos < 40; pos += 13) {
+	CAPTURE(pos);
+	r1.set_to_nth(0);
+	for (int j = 0; j < pos; j++) r1.get();
+	r2.set_to_nth(pos);
+	// The state is an integer, so the results should agree exactly:
+	for (int j = 0; j < 5; j++) CHECK(r1.get() == r2.get());
+      }
+      // Jumping very far ahead should be fast and give valid numbers:
+      r2.set_to_nth(40000000000ULL);
+      qsc::qscfloat val = r2.get();
+      CHECK(val >= min);
+      CHECK(val <= max);
+    }
+  }
+
+  CHECK_THROWS(qsc::Random(true, "linear", 0.0, 1.0, "Sobol"));
+  CHECK_THROWS(qsc::Random(true, "linear", 0.0, 1.0, "R_d", 2, 2));
+}
+
+TEST_CASE("Multidimensional low-discrepancy sequences fill the unit square evenly") {
+  std::vector<std::string> sequences = {"R_d", "Halton"};
+  const int n_bins = 8;
+  const int N = 64 * n_bins * n_bins;
+  int histogram[n_bins][n_bins];
+  int j, k, bin_x, bin_y;
+
+  for (std::size_t j_sequence = 0; j_sequence < sequences.size(); j_sequence++) {
+    CAPTURE(sequences[j_sequence]);
+    // Use two dimensions of a 6D sequence:
+    qsc::Random rx(true, "linear", 0.0, 1.0, sequences[j_sequence], 2, 6);
+    qsc::Random ry(true, "linear", 0.0, 1.0, sequences[j_sequence], 5, 6);
+    rx.set_to_nth(1000);
+    ry.set_to_nth(1000);
+    for (j = 0; j < n_bins; j++) {
+      for (k = 0; k < n_bins; k++) histogram[j][k] = 0;
+    }
+    for (j = 0; j < N; j++) {
+      bin_x = (int) floor(rx.get() * n_bins);
+      bin_y = (int) floor(ry.get() * n_bins);
+      histogram[bin_x][bin_y]++;
+    }
+    // Much more even than the sqrt(64) = 8 fluctuation expected for
+    // independent uniform random numbers:
+    for (j = 0; j < n_bins; j++) {
+      for (k = 0; k < n_bins; k++) {
+	CAPTURE(j);
+	CAPTURE(k);
+	CHECK(histogram[j][k] >= 56);
+	CHECK(histogram[j][k] <= 72);
+      }
+    }
+  }
+}
+
+TEST_CASE("philox4x32 matches the Random123 known-answer tests") {
+  uint32_t result[4];
+  const uint32_t counter1[4] = {0, 0, 0, 0};
+  const uint32_t key1[2] = {0, 0};
+  qsc::philox4x32(counter1, key1, result);
+  CHECK(result[0] == 0x6627e8d5);
+  CHECK(result[1] == 0xe169c58d);
+  CHECK(result[2] == 0xbc57ac4c);
+  CHECK(result[3] == 0x9b00dbd8);
+
+  const uint32_t counter2[4] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+  const uint32_t key2[2] = {0xffffffff, 0xffffffff};
+  qsc::philox4x32(counter2, key2, result);
+  CHECK(result[0] == 0x408f276d);
+  CHECK(result[1] == 0x41c83b0e);
+  CHECK(result[2] == 0xa20bc7c6);
+  CHECK(result[3] == 0x6d5451fd);
+
+  const uint32_t counter3[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+  const uint32_t key3[2] = {0xa4093822, 0x299f31d0};
+  qsc::philox4x32(counter3, key3, result);
+  CHECK(result[0] == 0xd16cfe09);
+  CHECK(result[1] == 0x94fdcceb);
+  CHECK(result[2] == 0x5001e420);
+  CHECK(result[3] == 0x24126ea1);
+}
+
+TEST_CASE("Random::get_nth and Random::get_batch agree with get()") {
+  std::vector<std::string> sequences = {"golden ratio", "R_d", "Halton"};
+  std::vector<std::string> distribs = {"linear", "log", "2 sided log"};
+  const int n = 37;
+  const unsigned long long first = 1000;
+  qsc::Vector batch(n);
+  // The last case is deterministic = false with a fixed seed:
+  for (std::size_t j_sequence = 0; j_sequence <= sequences.size(); j_sequence++) {
+    CAPTURE(j_sequence);
+    bool deterministic = (j_sequence < sequences.size());
+    std::string sequence = deterministic ? sequences[j_sequence] : "golden ratio";
+    for (std::size_t j_distrib = 0; j_distrib < distribs.size(); j_distrib++) {
+      CAPTURE(distribs[j_distrib]);
+      qsc::Random r(deterministic, distribs[j_distrib], 0.01, 3.0, sequence, 3, 4, 987654321ULL);
+      r.set_to_nth(first);
+      r.get_batch(first, batch);
+      for (int j = 0; j < n; j++) {
+	CAPTURE(j);
+	qsc::qscfloat val = r.get();
+	CHECK(r.get_nth(first + j) == val);
+	CHECK(Approx(batch[j]) == val);
+      }
+    }
+  }
+}
+
+TEST_CASE("Random with deterministic = false is reproducible for a given seed") {
+  const int n = 1000;
+  qsc::Random r1(false, "linear", 0.0, 1.0, "golden ratio", 2, 5, 42);
+  qsc::Random r2(false, "linear", 0.0, 1.0, "golden ratio", 2, 5, 42);
+  qsc::Random r3(false, "linear", 0.0, 1.0, "golden ratio", 3, 5, 42);
+  qsc::Random r4(false, "linear", 0.0, 1.0, "golden ratio", 2, 5, 43);
+  CHECK(r1.get_seed() == 42);
+  int n_same_dimension = 0, n_same_seed = 0;
+  qsc::qscfloat val, sum = 0;
+  for (int j = 0; j < n; j++) {
+    val = r1.get();
+    CHECK(r2.get() == val);
+    if (r3.get() == val) n_same_dimension++;
+    if (r4.get() == val) n_same_seed++;
+    sum += val;
+  }
+  CHECK(n_same_dimension == 0);
+  CHECK(n_same_seed == 0);
+  CHECK(Approx(sum / n).epsilon(0.05) == 0.5);
+
+  // A seed of 0 means a seed is chosen from the clock:
+  qsc::Random r5(false, "linear", 0.0, 1.0);
+  CHECK(r5.get_seed() != 0);
+  qsc::Random r6(false, "linear", 0.0, 1.0, "golden ratio", 0, 1, r5.get_seed());
+  for (int j = 0; j < 10; j++) CHECK(r5.get() == r6.get());
+}
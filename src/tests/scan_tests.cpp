@@ -1,12 +1,54 @@
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <functional>
 #include <mpi.h>
 #include "doctest.h"
 #include "scan.hpp"
 
 using doctest::Approx;
 
+/** A small deterministic scan that keeps the configurations passing
+ * the filters: nfp = 3, nphi = 31, nf axis modes with R0c[0] = 1 and
+ * R0c[1] and Z0s[1] in [-amplitude, amplitude], and eta_bar in [0.5,
+ * 1.5]. Each test then sets only the options it exercises.
+ */
+static qsc::Scan make_small_scan(qsc::qscfloat amplitude = 0.1, int nf = 2) {
+  qsc::Scan scan;
+  scan.verbose = 0;
+  scan.deterministic = true;
+  scan.keep_all = false;
+  scan.max_seconds = 60;
+  scan.q.nfp = 3;
+  scan.q.nphi = 31;
+  scan.q.verbose = 0;
+  scan.R0c_min.resize(nf, 0.0);
+  scan.R0c_max.resize(nf, 0.0);
+  scan.R0s_min.resize(nf, 0.0);
+  scan.R0s_max.resize(nf, 0.0);
+  scan.Z0c_min.resize(nf, 0.0);
+  scan.Z0c_max.resize(nf, 0.0);
+  scan.Z0s_min.resize(nf, 0.0);
+  scan.Z0s_max.resize(nf, 0.0);
+  scan.R0c_min[0] = 1.0;
+  scan.R0c_max[0] = 1.0;
+  scan.R0c_min[1] = -amplitude;
+  scan.R0c_max[1] =  amplitude;
+  scan.Z0s_min[1] = -amplitude;
+  scan.Z0s_max[1] =  amplitude;
+  scan.eta_bar_min = 0.5;
+  scan.eta_bar_max = 1.5;
+  return scan;
+}
+
 TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
   int mpi_rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
@@ -18,11 +60,14 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
   // Try both O(r^1) and O(r^2):
   for (int order = 1; order < 3; order++) {
     CAPTURE(order);
-    // Try both keep_all = true and false:
-    for (int j_keep_all = 0; j_keep_all < 2; j_keep_all++) {
+    // Try both keep_all = true and false, the latter also with
+    // adaptive nphi, starting either from nphi or from a coarser grid:
+    for (int j_keep_all = 0; j_keep_all < 4; j_keep_all++) {
       CAPTURE(j_keep_all);
       scan.q.nfp = 3;
       scan.q.nphi = 31;
+      scan.q.nphi_tolerance = (j_keep_all >= 2) ? 1.0e-6 : 0.0;
+      scan.q.min_nphi = (j_keep_all == 3) ? 11 : 0;
       scan.q.verbose = 0;
       scan.q.p2 = -1.0e+4; // Include nonzero pressure so DMerc is nonzero.
       scan.deterministic = true;
@@ -75,7 +120,7 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
       scan.max_keep_per_proc = 20;
       scan.max_seconds = 30;
       scan.max_elongation_to_keep = 15;
-      scan.keep_all = (bool) j_keep_all;
+      scan.keep_all = (j_keep_all == 1);
       
       // Run the scan (without reading an input file):
       scan.random();
@@ -89,8 +134,9 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
 	qsc::Qsc q;
 	q.verbose = scan.q.verbose;
 	q.nfp = scan.q.nfp;
-	q.nphi = scan.q.nphi;
 	q.p2 = scan.q.p2;
+	q.nphi_tolerance = scan.q.nphi_tolerance;
+	q.min_nphi = scan.q.min_nphi;
 	q.order_r_option = scan.q.order_r_option;
 	q.R0c.resize(nf, 0.0);
 	q.R0s.resize(nf, 0.0);
@@ -113,6 +159,7 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
 	  }
 	  
 	  // Run the standalone calculation
+	  q.nphi = 31;
 	  q.init();
 	  q.calculate();
 	  
@@ -126,6 +173,7 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
 	  CHECK(Approx(q.d2_volume_d_psi2) == scan.scan_d2_volume_d_psi2[j]);
 	  CHECK(Approx(q.DMerc_times_r2) == scan.scan_DMerc_times_r2[j]);
 	  CHECK(Approx(q.B20_grid_variation) == scan.scan_B20_variation[j]);
+	  CHECK(q.nphi == scan.scan_nphi[j]);
 	}
       }
     }
@@ -135,8 +183,56 @@ TEST_CASE("Each scan result should match a standalone Qsc. [mpi]") {
 ///////////////////////////////////////////////////
 ///////////////////////////////////////////////////
 
-TEST_CASE("Verify results of a deterministic scan are independent of number of mpi procs. [mpi]") {
-  int j, k;
+TEST_CASE("QscWorkspaces refines nphi with the same results as Qsc::adapt_nphi, within its size limit.") {
+  qsc::Qsc base("r2 section 5.2");
+  base.verbose = 0;
+  base.nphi = 11;
+  base.nphi_tolerance = 1.0e-6;
+  base.init();
+  qsc::QscWorkspaces workspaces;
+  workspaces.base = &base;
+  workspaces.max_workspaces = 2;
+  qsc::Qsc coarse = base;
+  int n_refined = 0;
+
+  for (int j = 0; j < 8; j++) {
+    CAPTURE(j);
+    qsc::qscfloat eta_bar = base.eta_bar * (0.7 + 0.1 * j);
+    qsc::Qsc q = base;
+    q.eta_bar = eta_bar;
+    q.calculate();
+
+    // The same sequence of calculations as in FilterPipeline:
+    coarse.eta_bar = eta_bar;
+    coarse.nphi_refinements = 0;
+    coarse.init_axis();
+    coarse.solve_sigma_equation();
+    coarse.r1_diagnostics();
+    qsc::Qsc& q_r1 = workspaces.refine(coarse, false);
+    q_r1.calculate_r2();
+    qsc::Qsc& q_r2 = workspaces.refine(q_r1, true);
+    q_r2.r2_diagnostics();
+
+    CHECK(coarse.nphi == base.nphi);
+    CHECK(q_r2.nphi == q.nphi);
+    CHECK(q_r2.nphi_refinements == q.nphi_refinements);
+    CHECK(q_r2.spectral_tail <= base.nphi_tolerance);
+    CHECK(Approx(q_r2.iota) == q.iota);
+    CHECK(Approx(q_r2.grid_max_elongation) == q.grid_max_elongation);
+    CHECK(Approx(q_r2.B20_mean) == q.B20_mean);
+    CHECK(Approx(q_r2.r_singularity_robust) == q.r_singularity_robust);
+    CHECK(workspaces.n_workspaces() <= 2);
+    if (q.nphi > base.nphi) n_refined++;
+  }
+  CHECK(n_refined > 0);
+}
+
+///////////////////////////////////////////////////
+///////////////////////////////////////////////////
+
+TEST_CASE("Verify results of a deterministic or fixed-seed scan are independent of number of mpi procs. [mpi]") {
+  qsc::big j;
+  int k;
   qsc::qscfloat amplitude;
   int mpi_rank, n_procs;
   MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
@@ -207,117 +303,131 @@ TEST_CASE("Verify results of a deterministic scan are independent of number of m
   scan2.Z0s_min.resize(nf, 0.0);
   scan2.Z0s_max.resize(nf, 0.0);
   
-  // Try both O(r^1) and O(r^2):
-  for (int order = 1; order < 3; order++) {
-    CAPTURE(order);
-    // Try both keep_all = true and false:
-    for (int j_keep_all = 0; j_keep_all < 2; j_keep_all++) {
-      CAPTURE(j_keep_all);
-      if (order == 1) {
-	scan1.q.order_r_option = "r1";
-      } else if (order == 2) {
-	scan1.q.order_r_option = "r2";
-      } else {
-	throw std::runtime_error("Should not get here");
-      }
-      scan2.q.order_r_option = scan1.q.order_r_option;
-      
-      if ((bool)j_keep_all) {
-	scan1.R0c_min[0] = 0.8;
-	scan1.R0c_max[0] = 1.2;
-	amplitude = 0.02;
-      } else {
-	// Try some crazier cases
-	scan1.R0c_min[0] = 0.6;
-	scan1.R0c_max[0] = 1.2;
-	amplitude = 0.8;
-      }
-      
-      scan1.R0c_min[1] = -amplitude;
-      scan1.R0c_max[1] =  amplitude;
-      
-      scan1.R0s_min[1] = -amplitude;
-      scan1.R0s_max[1] =  amplitude;
-      
-      scan1.Z0c_min[1] = -amplitude;
-      scan1.Z0c_max[1] =  amplitude;
-      
-      scan1.Z0s_min[1] = -amplitude;
-      scan1.Z0s_max[1] =  amplitude;
-      
-      scan2.R0c_min = scan1.R0c_min;
-      scan2.R0c_max = scan1.R0c_max;
-      scan2.R0s_min = scan1.R0s_min;
-      scan2.R0s_max = scan1.R0s_max;
-      scan2.Z0c_min = scan1.Z0c_min;
-      scan2.Z0c_max = scan1.Z0c_max;
-      scan2.Z0s_min = scan1.Z0s_min;
-      scan2.Z0s_max = scan1.Z0s_max;
-      
-      scan1.eta_bar_min = 0.7;
-      scan1.eta_bar_max = 1.4;
-      scan2.eta_bar_min = scan1.eta_bar_min;
-      scan2.eta_bar_max = scan1.eta_bar_max;
-      
-      scan1.sigma0_min = -0.3;
-      scan1.sigma0_max = 0.6;
-      scan2.sigma0_min = scan1.sigma0_min;
-      scan2.sigma0_max = scan1.sigma0_max;
-      
-      scan1.B2c_min = -1.0;
-      scan1.B2c_max = 1.0;
-      scan2.B2c_min = scan1.B2c_min;
-      scan2.B2c_max = scan1.B2c_max;
-      
-      scan1.B2s_min = -1.0;
-      scan1.B2s_max = 1.0;
-      scan2.B2s_min = scan1.B2s_min;
-      scan2.B2s_max = scan1.B2s_max;
-            
-      scan1.keep_all = (bool) j_keep_all;
-      scan2.keep_all = scan1.keep_all;
-      
-      // Run the scans (without reading an input file):
-      if (proc0) scan1.random();
-      
-      MPI_Barrier(MPI_COMM_WORLD); // This might help output look nicer?
-      scan2.random();
-      
-      // Restore printing format:
-      std::cout << std::setprecision(15);
-      
-      if (proc0) {
-	CHECK(scan1.n_scan == scan2.n_scan);
-	for (j = 0; j < qsc::N_FILTERS; j++) {
-	  CAPTURE(j);
-	  CHECK(scan1.filters[j] == scan2.filters[j]);
+  std::vector<std::string> sequences = {qsc::SCAN_SEQUENCE_GOLDEN_RATIO, qsc::SCAN_SEQUENCE_R_D, qsc::SCAN_SEQUENCE_HALTON};
+  // After the low-discrepancy sequences, try the counter-based
+  // generator used for deterministic = false, with a fixed seed:
+  for (std::size_t j_sequence = 0; j_sequence <= sequences.size(); j_sequence++) {
+    CAPTURE(j_sequence);
+    bool fixed_seed = (j_sequence == sequences.size());
+    scan1.deterministic = !fixed_seed;
+    scan2.deterministic = scan1.deterministic;
+    scan1.random_seed = fixed_seed ? 12345 : 0;
+    scan2.random_seed = scan1.random_seed;
+    if (!fixed_seed) scan1.random_sequence = sequences[j_sequence];
+    scan2.random_sequence = scan1.random_sequence;
+
+    // Try both O(r^1) and O(r^2):
+    for (int order = 1; order < 3; order++) {
+      CAPTURE(order);
+      // Try both keep_all = true and false:
+      for (int j_keep_all = 0; j_keep_all < 2; j_keep_all++) {
+	CAPTURE(j_keep_all);
+	if (order == 1) {
+	  scan1.q.order_r_option = "r1";
+	} else if (order == 2) {
+	  scan1.q.order_r_option = "r2";
+	} else {
+	  throw std::runtime_error("Should not get here");
 	}
-	
-	for (j = 0; j < scan1.n_scan; j++) {
-	  CAPTURE(j);
-	  CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
-	  CHECK(Approx(scan1.scan_sigma0[j]) == scan2.scan_sigma0[j]);
-	  CHECK(Approx(scan1.scan_B2s[j]) == scan2.scan_B2s[j]);
-	  CHECK(Approx(scan1.scan_B2c[j]) == scan2.scan_B2c[j]);
-	  CHECK(Approx(scan1.scan_min_R0[j]) == scan2.scan_min_R0[j]);
-	  CHECK(Approx(scan1.scan_max_curvature[j]) == scan2.scan_max_curvature[j]);
-	  CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
-	  CHECK(Approx(scan1.scan_max_elongation[j]) == scan2.scan_max_elongation[j]);
-	  CHECK(Approx(scan1.scan_min_L_grad_B[j]) == scan2.scan_min_L_grad_B[j]);
-	  CHECK(Approx(scan1.scan_min_L_grad_grad_B[j]) == scan2.scan_min_L_grad_grad_B[j]);
-	  CHECK(Approx(scan1.scan_r_singularity[j]) == scan2.scan_r_singularity[j]);
-	  CHECK(Approx(scan1.scan_B20_variation[j]) == scan2.scan_B20_variation[j]);
-	  CHECK(Approx(scan1.scan_d2_volume_d_psi2[j]) == scan2.scan_d2_volume_d_psi2[j]);
-	  CHECK(Approx(scan1.scan_DMerc_times_r2[j]) == scan2.scan_DMerc_times_r2[j]);
-	  
-	  CHECK(scan1.scan_helicity[j] == scan2.scan_helicity[j]);
-	  
-	  for (k = 0; k < nf; k++) {
-	    CAPTURE(k);
-	    CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
-	    CHECK(Approx(scan1.scan_R0s(k, j)) == scan2.scan_R0s(k, j));
-	    CHECK(Approx(scan1.scan_Z0c(k, j)) == scan2.scan_Z0c(k, j));
-	    CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+	scan2.q.order_r_option = scan1.q.order_r_option;
+
+	if ((bool)j_keep_all) {
+	  scan1.R0c_min[0] = 0.8;
+	  scan1.R0c_max[0] = 1.2;
+	  amplitude = 0.02;
+	} else {
+	  // Try some crazier cases
+	  scan1.R0c_min[0] = 0.6;
+	  scan1.R0c_max[0] = 1.2;
+	  amplitude = 0.8;
+	}
+
+	scan1.R0c_min[1] = -amplitude;
+	scan1.R0c_max[1] =  amplitude;
+
+	scan1.R0s_min[1] = -amplitude;
+	scan1.R0s_max[1] =  amplitude;
+
+	scan1.Z0c_min[1] = -amplitude;
+	scan1.Z0c_max[1] =  amplitude;
+
+	scan1.Z0s_min[1] = -amplitude;
+	scan1.Z0s_max[1] =  amplitude;
+
+	scan2.R0c_min = scan1.R0c_min;
+	scan2.R0c_max = scan1.R0c_max;
+	scan2.R0s_min = scan1.R0s_min;
+	scan2.R0s_max = scan1.R0s_max;
+	scan2.Z0c_min = scan1.Z0c_min;
+	scan2.Z0c_max = scan1.Z0c_max;
+	scan2.Z0s_min = scan1.Z0s_min;
+	scan2.Z0s_max = scan1.Z0s_max;
+
+	scan1.eta_bar_min = 0.7;
+	scan1.eta_bar_max = 1.4;
+	scan2.eta_bar_min = scan1.eta_bar_min;
+	scan2.eta_bar_max = scan1.eta_bar_max;
+
+	scan1.sigma0_min = -0.3;
+	scan1.sigma0_max = 0.6;
+	scan2.sigma0_min = scan1.sigma0_min;
+	scan2.sigma0_max = scan1.sigma0_max;
+
+	scan1.B2c_min = -1.0;
+	scan1.B2c_max = 1.0;
+	scan2.B2c_min = scan1.B2c_min;
+	scan2.B2c_max = scan1.B2c_max;
+
+	scan1.B2s_min = -1.0;
+	scan1.B2s_max = 1.0;
+	scan2.B2s_min = scan1.B2s_min;
+	scan2.B2s_max = scan1.B2s_max;
+
+	scan1.keep_all = (bool) j_keep_all;
+	scan2.keep_all = scan1.keep_all;
+
+	// Run the scans (without reading an input file):
+	if (proc0) scan1.random();
+
+	MPI_Barrier(MPI_COMM_WORLD); // This might help output look nicer?
+	scan2.random();
+
+	// Restore printing format:
+	std::cout << std::setprecision(15);
+
+	if (proc0) {
+	  CHECK(scan1.n_scan == scan2.n_scan);
+	  for (j = 0; j < qsc::N_FILTERS; j++) {
+	    CAPTURE(j);
+	    CHECK(scan1.filters[j] == scan2.filters[j]);
+	  }
+
+	  for (j = 0; j < scan1.n_scan; j++) {
+	    CAPTURE(j);
+	    CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
+	    CHECK(Approx(scan1.scan_sigma0[j]) == scan2.scan_sigma0[j]);
+	    CHECK(Approx(scan1.scan_B2s[j]) == scan2.scan_B2s[j]);
+	    CHECK(Approx(scan1.scan_B2c[j]) == scan2.scan_B2c[j]);
+	    CHECK(Approx(scan1.scan_min_R0[j]) == scan2.scan_min_R0[j]);
+	    CHECK(Approx(scan1.scan_max_curvature[j]) == scan2.scan_max_curvature[j]);
+	    CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
+	    CHECK(Approx(scan1.scan_max_elongation[j]) == scan2.scan_max_elongation[j]);
+	    CHECK(Approx(scan1.scan_min_L_grad_B[j]) == scan2.scan_min_L_grad_B[j]);
+	    CHECK(Approx(scan1.scan_min_L_grad_grad_B[j]) == scan2.scan_min_L_grad_grad_B[j]);
+	    CHECK(Approx(scan1.scan_r_singularity[j]) == scan2.scan_r_singularity[j]);
+	    CHECK(Approx(scan1.scan_B20_variation[j]) == scan2.scan_B20_variation[j]);
+	    CHECK(Approx(scan1.scan_d2_volume_d_psi2[j]) == scan2.scan_d2_volume_d_psi2[j]);
+	    CHECK(Approx(scan1.scan_DMerc_times_r2[j]) == scan2.scan_DMerc_times_r2[j]);
+
+	    CHECK(scan1.scan_helicity[j] == scan2.scan_helicity[j]);
+
+	    for (k = 0; k < nf; k++) {
+	      CAPTURE(k);
+	      CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
+	      CHECK(Approx(scan1.scan_R0s(k, j)) == scan2.scan_R0s(k, j));
+	      CHECK(Approx(scan1.scan_Z0c(k, j)) == scan2.scan_Z0c(k, j));
+	      CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+	    }
 	  }
 	}
       }
@@ -707,3 +817,1535 @@ TEST_CASE("Verify the number of configurations attempted or kept in a scan match
     }
   }
 }
+
+TEST_CASE("Verify a scan stops when the totals over all procs reach max_keep or max_attempts. [mpi]") {
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  qsc::Scan scan = make_small_scan();
+  scan.max_elongation_to_keep = 4.0;
+
+  for (int j_limit = 0; j_limit < 3; j_limit++) {
+    CAPTURE(j_limit);
+    // max_attempts_per_proc is only a backstop here:
+    scan.max_attempts_per_proc = 20000;
+    scan.max_keep = -1;
+    scan.max_attempts = -1;
+    if (j_limit == 0) {
+      scan.max_keep = 40;
+    } else if (j_limit == 1) {
+      scan.max_attempts = 100;
+    } else {
+      // Proc 0 stops early on its own, and must keep taking part in
+      // the reductions while the other procs finish:
+      scan.max_keep = 1000000;
+      scan.max_attempts_per_proc = (mpi_rank == 0) ? 10 : 200;
+    }
+    scan.random();
+
+    if (proc0) {
+      if (j_limit == 0) {
+	CHECK(scan.n_scan >= scan.max_keep);
+	CHECK(scan.filters[qsc::ATTEMPTS] < scan.max_attempts_per_proc * n_procs);
+      } else if (j_limit == 1) {
+	CHECK(scan.filters[qsc::ATTEMPTS] >= scan.max_attempts);
+	CHECK(scan.filters[qsc::ATTEMPTS] < scan.max_attempts_per_proc * n_procs);
+      } else {
+	CHECK(scan.filters[qsc::ATTEMPTS] == 10 + 200 * (n_procs - 1));
+      }
+    }
+  }
+}
+
+TEST_CASE("The progress file of a scan holds the final totals over all procs. [mpi]") {
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  qsc::Scan scan = make_small_scan();
+  scan.max_attempts_per_proc = 50;
+  scan.progress_period = 1.0e-6;
+  scan.outfilename = "qsc_out.progress_unitTests.nc";
+  scan.max_elongation_to_keep = 4.0;
+  scan.random();
+
+  if (proc0) {
+    std::ifstream file(scan.progress_filename().c_str());
+    REQUIRE(file.is_open());
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string contents = buffer.str();
+    CAPTURE(contents);
+    CHECK(contents.find("\"finished\": true,") != std::string::npos);
+    CHECK(contents.find("\"n_procs_running\": 0,") != std::string::npos);
+    CHECK(contents.find("\"attempts\": " + std::to_string(scan.filters[qsc::ATTEMPTS]) + ",") != std::string::npos);
+    CHECK(contents.find("\"kept\": " + std::to_string(scan.n_scan) + ",") != std::string::npos);
+    CHECK(contents.find("\"rejected_due_to_elongation\": " + std::to_string(scan.filters[qsc::REJECTED_DUE_TO_ELONGATION])) != std::string::npos);
+    CHECK(contents.find("\"eta_seconds\": 0,") != std::string::npos);
+  }
+}
+
+TEST_CASE("ScanSketch quantiles are within the relative accuracy of the exact quantiles.") {
+  qsc::ScanSketch sketch;
+  std::vector<qsc::qscfloat> values;
+  for (int j = 0; j < 2000; j++) {
+    // A mix of signs and a wide range of magnitudes:
+    qsc::qscfloat value = std::sin(j * 0.7) * std::exp(0.01 * (j % 1000) - 5);
+    if (j % 97 == 0) value = 0;
+    values.push_back(value);
+    sketch.add(value, 1.0);
+  }
+  // Non-finite values are only counted:
+  sketch.add(std::numeric_limits<qsc::qscfloat>::infinity(), 1.0);
+  sketch.add(-std::numeric_limits<qsc::qscfloat>::infinity(), 1.0);
+  sketch.add(std::numeric_limits<qsc::qscfloat>::quiet_NaN(), 1.0);
+  CHECK(sketch.n_nonfinite == 3);
+  CHECK(qsc::ScanSketch::bin_of(std::numeric_limits<qsc::qscfloat>::infinity()) == qsc::ScanSketch::n_bins() - 1);
+  CHECK(qsc::ScanSketch::bin_of(-std::numeric_limits<qsc::qscfloat>::infinity()) == 0);
+  std::sort(values.begin(), values.end());
+  CHECK(sketch.n == values.size());
+  CHECK(sketch.quantile(0) == values.front());
+  CHECK(sketch.quantile(1) == values.back());
+  for (int k = 1; k < 100; k++) {
+    qsc::qscfloat p = k * 0.01;
+    CAPTURE(p);
+    qsc::qscfloat value = sketch.quantile(p);
+    qsc::qscfloat tolerance = 0.0101 * std::abs(value) + 1.0e-12;
+    int n_below = std::lower_bound(values.begin(), values.end(), value - tolerance) - values.begin();
+    int n_at_or_below = std::upper_bound(values.begin(), values.end(), value + tolerance) - values.begin();
+    CHECK(n_below <= p * values.size());
+    CHECK(n_at_or_below >= p * values.size());
+  }
+}
+
+TEST_CASE("Diagnostic sketches of a scan match the quantiles of all attempted configurations. [mpi]") {
+  int mpi_rank, n_procs, j, k;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  qsc::Scan scan = make_small_scan();
+  scan.random_sequence = qsc::SCAN_SEQUENCE_R_D;
+  scan.max_attempts_per_proc = 300 / n_procs;
+  scan.q.p2 = -1.0e+4;
+  scan.q.order_r_option = "r2";
+  scan.B2c_min = -1.0;
+  scan.B2c_max = 1.0;
+
+  scan.diagnostic_sketches = true;
+
+  // With keep_all, every diagnostic is computed for every attempt, so
+  // the sketches describe the same population as the scan_* arrays:
+  scan.keep_all = true;
+  scan.random();
+  if (proc0) {
+    REQUIRE(scan.sketch_quantiles.size() == qsc::N_SKETCHES);
+    REQUIRE(scan.n_scan > 100);
+    for (j = 0; j < qsc::N_SKETCHES; j++) CHECK(scan.sketch_n[j] + scan.sketch_n_nonfinite[j] == scan.n_scan);
+    for (int j_quantity = 0; j_quantity < 4; j_quantity++) {
+      CAPTURE(j_quantity);
+      int j_sketch;
+      qsc::Vector* array;
+      if (j_quantity == 0) {
+	j_sketch = qsc::SKETCH_IOTA;
+	array = &scan.scan_iota;
+      } else if (j_quantity == 1) {
+	j_sketch = qsc::SKETCH_MAX_ELONGATION;
+	array = &scan.scan_max_elongation;
+      } else if (j_quantity == 2) {
+	j_sketch = qsc::SKETCH_DMERC_TIMES_R2;
+	array = &scan.scan_DMerc_times_r2;
+      } else {
+	j_sketch = qsc::SKETCH_MIN_R_SINGULARITY;
+	array = &scan.scan_r_singularity;
+      }
+      std::vector<qsc::qscfloat> values(std::begin(*array), std::end(*array));
+      std::sort(values.begin(), values.end());
+      CHECK(Approx(scan.sketch_means[j_sketch]) == array->sum() / array->size());
+      CHECK(scan.sketch_quantiles[j_sketch][0] == values.front());
+      CHECK(scan.sketch_quantiles[j_sketch][qsc::SCAN_N_SKETCH_QUANTILES - 1] == values.back());
+      for (k = 1; k < qsc::SCAN_N_SKETCH_QUANTILES - 1; k++) {
+	CAPTURE(k);
+	qsc::qscfloat p = scan.sketch_quantile_levels[k];
+	qsc::qscfloat value = scan.sketch_quantiles[j_sketch][k];
+	qsc::qscfloat tolerance = 0.0101 * std::abs(value) + 1.0e-12;
+	int n_below = std::lower_bound(values.begin(), values.end(), value - tolerance) - values.begin();
+	int n_at_or_below = std::upper_bound(values.begin(), values.end(), value + tolerance) - values.begin();
+	CHECK(n_below <= p * values.size() + 1.0e-9);
+	CHECK(n_at_or_below >= p * values.size() - 1.0e-9);
+      }
+    }
+  }
+
+  // With filters, the rejected attempts are included too:
+  qsc::big n_all = scan.n_scan;
+  scan.keep_all = false;
+  scan.prefilter = false;
+  scan.max_elongation_to_keep = 3.0;
+  scan.random();
+  if (proc0) {
+    CHECK(scan.n_scan < n_all);
+    CHECK(scan.sketch_n[qsc::SKETCH_MAX_ELONGATION] == scan.filters[qsc::ATTEMPTS]);
+    CHECK(scan.sketch_quantiles[qsc::SKETCH_MAX_ELONGATION][qsc::SCAN_N_SKETCH_QUANTILES - 1] > scan.max_elongation_to_keep);
+    CHECK(scan.sketch_n[qsc::SKETCH_MIN_R_SINGULARITY] <= scan.filters[qsc::ATTEMPTS]);
+  }
+
+  // Attempts for which the diagnostics stopped early at the filter
+  // are left out, so no 1e30 placeholder reaches the sketch:
+  scan.max_elongation_to_keep = 10.0;
+  scan.min_r_singularity_to_keep = 0.2;
+  scan.random();
+  if (proc0) {
+    CHECK(scan.filters[qsc::REJECTED_DUE_TO_R_SINGULARITY] > 0);
+    CHECK(scan.sketch_n[qsc::SKETCH_MIN_R_SINGULARITY] <= scan.filters[qsc::ATTEMPTS] - scan.filters[qsc::REJECTED_DUE_TO_R_SINGULARITY]);
+    CHECK(scan.sketch_quantiles[qsc::SKETCH_MIN_R_SINGULARITY][qsc::SCAN_N_SKETCH_QUANTILES - 1] < 1.0e+29);
+  }
+}
+
+TEST_CASE("ParetoArchive holds exactly the non-dominated points, within its size and epsilon limits.") {
+  const int n_points = 3000;
+  int j;
+  for (int n_objectives = 2; n_objectives < 4; n_objectives++) {
+    CAPTURE(n_objectives);
+    qsc::ParetoArchive archive;
+    archive.parameter_index.resize(n_objectives);
+    archive.use_abs.resize(n_objectives, false);
+    archive.sign.resize(n_objectives, 1.0);
+    archive.epsilon.resize(n_objectives, 0.0);
+    for (int k = 0; k < n_objectives; k++) archive.parameter_index[k] = k;
+    // Maximize the last objective:
+    archive.sign[n_objectives - 1] = -1.0;
+    archive.max_size = n_points;
+
+    std::vector<qsc::Vector> points;
+    qsc::Vector fourier(1.0, 2);
+    std::valarray<int> ints(0, 2);
+    for (j = 0; j < n_points; j++) {
+      qsc::Vector p(n_objectives + 1);
+      for (int k = 0; k <= n_objectives; k++) p[k] = std::fmod(std::sqrt(2.0 + k) * (j + 1) * (j + 3), 1.0);
+      // Make the last objective, which is maximized, compete with the
+      // others so the front is large:
+      p[n_objectives - 1] = 0.05 * p[n_objectives - 1];
+      for (int k = 0; k < n_objectives - 1; k++) p[n_objectives - 1] += p[k] / (n_objectives - 1);
+      points.push_back(p);
+      archive.insert(p, fourier, ints);
+    }
+
+    // Brute-force front:
+    int n_front = 0;
+    for (j = 0; j < n_points; j++) {
+      bool dominated = false;
+      for (int i = 0; i < n_points && !dominated; i++) {
+	bool weakly = true, strictly = false;
+	for (int k = 0; k < n_objectives; k++) {
+	  qsc::qscfloat a = archive.sign[k] * points[i][k], b = archive.sign[k] * points[j][k];
+	  if (a > b) weakly = false;
+	  if (a < b) strictly = true;
+	}
+	dominated = weakly && strictly;
+      }
+      if (dominated) continue;
+      n_front++;
+      bool found = false;
+      for (qsc::big i = 0; i < archive.size(); i++) {
+	if (archive.entry(i).parameters[n_objectives] == points[j][n_objectives]) found = true;
+      }
+      CHECK(found);
+    }
+    CHECK(archive.size() == n_front);
+    CHECK(n_front > 5);
+
+    // With an epsilon grid the archive is smaller, but every point is
+    // still within epsilon of an entry:
+    qsc::qscfloat eps = 0.002;
+    archive.clear();
+    archive.epsilon = eps;
+    for (j = 0; j < n_points; j++) archive.insert(points[j], fourier, ints);
+    CHECK(archive.size() <= n_front);
+    CHECK(archive.size() > 20);
+    for (j = 0; j < n_points; j++) {
+      bool covered = false;
+      for (qsc::big i = 0; i < archive.size() && !covered; i++) {
+	covered = true;
+	for (int k = 0; k < n_objectives; k++) {
+	  if (archive.entry(i).objectives[k] > archive.sign[k] * points[j][k] + eps) covered = false;
+	}
+      }
+      CHECK(covered);
+    }
+
+    // The size limit is respected:
+    archive.clear();
+    archive.max_size = 20;
+    for (j = 0; j < n_points; j++) archive.insert(points[j], fourier, ints);
+    CHECK(archive.size() == 20);
+  }
+}
+
+TEST_CASE("A scan with pareto_objectives saves the Pareto front of the kept configurations. [mpi]") {
+  int mpi_rank, n_procs;
+  qsc::big j, k;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 keeps everything that passes the filters, and scan2 keeps
+  // only the front:
+  qsc::Scan scan1 = make_small_scan(0.15);
+  qsc::Scan scan2 = make_small_scan(0.15);
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.random_sequence = qsc::SCAN_SEQUENCE_R_D;
+    scan.max_attempts_per_proc = 400 / n_procs;
+    scan.min_iota_to_keep = 0.05;
+    if (j_scan == 1) {
+      scan.pareto_objectives = {"max_elongation", "abs_iota", "min_L_grad_B"};
+      scan.pareto_maximize.resize(3, true);
+      scan.pareto_maximize[0] = false;
+      // The archive bounds its own size, so the scan should not stop
+      // after max_keep_per_proc kept configurations:
+      scan.max_keep_per_proc = 10;
+    }
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan2.filters[qsc::ATTEMPTS] == scan1.filters[qsc::ATTEMPTS]);
+    CHECK(scan2.filters[qsc::KEPT] > scan2.max_keep_per_proc * n_procs);
+    CHECK(scan2.filters[qsc::KEPT] == scan1.n_scan);
+    CHECK(scan2.n_scan < scan1.n_scan);
+    CHECK(scan2.n_scan > 2);
+    REQUIRE(scan2.scan_eta_bar.size() == scan2.n_scan);
+    // Each configuration of scan1 is on the front if and only if no
+    // other configuration of scan1 dominates it:
+    int n_front = 0;
+    for (j = 0; j < scan1.n_scan; j++) {
+      bool dominated = false;
+      for (k = 0; k < scan1.n_scan && !dominated; k++) {
+	bool weakly = (scan1.scan_max_elongation[k] <= scan1.scan_max_elongation[j])
+	  && (std::abs(scan1.scan_iota[k]) >= std::abs(scan1.scan_iota[j]))
+	  && (scan1.scan_min_L_grad_B[k] >= scan1.scan_min_L_grad_B[j]);
+	bool strictly = (scan1.scan_max_elongation[k] < scan1.scan_max_elongation[j])
+	  || (std::abs(scan1.scan_iota[k]) > std::abs(scan1.scan_iota[j]))
+	  || (scan1.scan_min_L_grad_B[k] > scan1.scan_min_L_grad_B[j]);
+	dominated = weakly && strictly;
+      }
+      bool on_front = false;
+      for (k = 0; k < scan2.n_scan; k++) {
+	if (scan2.scan_eta_bar[k] == scan1.scan_eta_bar[j] && scan2.scan_R0c(1, k) == scan1.scan_R0c(1, j)) on_front = true;
+      }
+      CAPTURE(j);
+      CHECK(on_front == !dominated);
+      if (!dominated) n_front++;
+    }
+    CHECK(n_front == scan2.n_scan);
+  }
+
+  scan2.pareto_objectives = {"max_elongation", "not_a_diagnostic"};
+  CHECK_THROWS(scan2.random());
+  scan2.pareto_objectives = {"max_elongation", "abs_iota"};
+  scan2.pareto_max_size = 100001;
+  CHECK_THROWS(scan2.random());
+}
+
+TEST_CASE("ScanTopK holds the configurations with the highest scores, independent of the order of insertion.") {
+  const int n_points = 500;
+  int j;
+  qsc::ScanTopK best1, best2;
+  for (qsc::ScanTopK* best : {&best1, &best2}) {
+    best->k = 17;
+    best->parameter_index = {0, 2};
+    best->use_abs = {false, true};
+    best->weights.resize(2);
+    best->weights[0] = 1.0;
+    best->weights[1] = -0.5;
+  }
+  std::vector<qsc::Vector> points;
+  std::vector<qsc::qscfloat> scores;
+  qsc::Vector fourier(0.0, 4);
+  std::valarray<int> ints(0, 2);
+  for (j = 0; j < n_points; j++) {
+    qsc::Vector p(3);
+    p[0] = std::fmod(std::sqrt(2.0) * (j + 1) * (j + 3), 1.0);
+    p[1] = j;
+    p[2] = std::fmod(std::sqrt(3.0) * (j + 1) * (j + 3), 1.0) - 0.5;
+    // Repeat some scores to check that ties are broken consistently:
+    if (j % 7 == 0 && j > 0) {
+      p[0] = points[j - 1][0];
+      p[2] = -points[j - 1][2];
+    }
+    points.push_back(p);
+    scores.push_back(p[0] - 0.5 * std::abs(p[2]));
+    CHECK(best1.score(p) == Approx(scores[j]));
+  }
+  for (j = 0; j < n_points; j++) best1.insert(best1.score(points[j]), points[j], fourier, ints);
+  for (j = n_points - 1; j >= 0; j--) best2.insert(best2.score(points[j]), points[j], fourier, ints);
+  // A NaN score is never kept:
+  qsc::Vector p_nan(std::numeric_limits<qsc::qscfloat>::quiet_NaN(), 3);
+  CHECK(!best1.insert(best1.score(p_nan), p_nan, fourier, ints));
+  best1.sort();
+  best2.sort();
+
+  std::vector<qsc::qscfloat> sorted_scores = scores;
+  std::sort(sorted_scores.begin(), sorted_scores.end(), std::greater<qsc::qscfloat>());
+  REQUIRE(best1.size() == 17);
+  REQUIRE(best2.size() == 17);
+  for (j = 0; j < 17; j++) {
+    CHECK(best1.entry(j).score == sorted_scores[j]);
+    CHECK(best1.entry(j).parameters[1] == best2.entry(j).parameters[1]);
+  }
+}
+
+TEST_CASE("A scan with top_k saves the kept configurations with the highest scores over all procs. [mpi]") {
+  int mpi_rank, n_procs;
+  qsc::big j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 keeps everything that passes the filters, and scan2 keeps
+  // only the best:
+  qsc::Scan scan1 = make_small_scan(0.15);
+  qsc::Scan scan2 = make_small_scan(0.15);
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.random_sequence = qsc::SCAN_SEQUENCE_R_D;
+    scan.max_attempts_per_proc = 400 / n_procs;
+    scan.min_iota_to_keep = 0.05;
+    if (j_scan == 1) {
+      scan.top_k = 10;
+      scan.top_k_score_names = {"abs_iota", "min_L_grad_B", "max_elongation"};
+      scan.top_k_score_weights.resize(3);
+      scan.top_k_score_weights[0] = 2.0;
+      scan.top_k_score_weights[1] = 1.0;
+      scan.top_k_score_weights[2] = -0.1;
+      // The heap bounds its own size, so the scan should not stop
+      // after max_keep_per_proc kept configurations:
+      scan.max_keep_per_proc = 10;
+    }
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan2.filters[qsc::ATTEMPTS] == scan1.filters[qsc::ATTEMPTS]);
+    CHECK(scan2.filters[qsc::KEPT] > scan2.max_keep_per_proc * n_procs);
+    CHECK(scan2.filters[qsc::KEPT] == scan1.n_scan);
+    REQUIRE(scan1.n_scan > 10);
+    REQUIRE(scan2.n_scan == 10);
+    std::vector<qsc::qscfloat> scores1(scan1.n_scan), scores2(scan2.n_scan);
+    for (j = 0; j < scan1.n_scan; j++) {
+      scores1[j] = 2 * std::abs(scan1.scan_iota[j]) + scan1.scan_min_L_grad_B[j] - 0.1 * scan1.scan_max_elongation[j];
+    }
+    for (j = 0; j < scan2.n_scan; j++) {
+      scores2[j] = 2 * std::abs(scan2.scan_iota[j]) + scan2.scan_min_L_grad_B[j] - 0.1 * scan2.scan_max_elongation[j];
+    }
+    std::sort(scores1.begin(), scores1.end(), std::greater<qsc::qscfloat>());
+    // The configurations are saved in order of decreasing score:
+    for (j = 0; j < scan2.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scores2[j] == Approx(scores1[j]).epsilon(1e-13));
+    }
+  }
+
+  scan2.top_k_score_names = {"abs_iota", "not_a_diagnostic", "max_elongation"};
+  CHECK_THROWS(scan2.random());
+}
+
+TEST_CASE("ScanResultBuffer returns the configurations appended to it, with or without a spill file.") {
+  const int n_parameters = 3, n_fourier_parameters = 4, n_int_parameters = 2, n_configurations = 45;
+  int mpi_rank, j, k;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  std::string spill_filename = "qsc_scan_result_buffer_unitTests.spill" + std::to_string(mpi_rank);
+  for (int use_spill = 0; use_spill < 2; use_spill++) {
+    CAPTURE(use_spill);
+    qsc::ScanResultBuffer buffer;
+    buffer.init(n_parameters, n_fourier_parameters, n_int_parameters, 7, use_spill ? spill_filename : "");
+    qsc::Vector p(n_parameters), f(n_fourier_parameters);
+    std::valarray<int> ip(n_int_parameters);
+    for (j = 0; j < n_configurations; j++) {
+      for (k = 0; k < n_parameters; k++) p[k] = 100 * j + k;
+      for (k = 0; k < n_fourier_parameters; k++) f[k] = -100 * j - k;
+      for (k = 0; k < n_int_parameters; k++) ip[k] = 10 * j + k;
+      buffer.append(p, f, ip);
+    }
+    CHECK(buffer.size() == n_configurations);
+    CHECK(buffer.n_spilled() == (use_spill ? 42 : 0));
+    CHECK(std::ifstream(spill_filename.c_str()).good() == (use_spill == 1));
+
+    // Read ranges that start and end inside chunks and span several:
+    for (int first : {0, 5, 13, 40}) {
+      int n_read = std::min(19, n_configurations - first);
+      qsc::Vector p_read(n_parameters * n_read), f_read(n_fourier_parameters * n_read);
+      std::valarray<int> ip_read(n_int_parameters * n_read);
+      buffer.read(first, n_read, &p_read[0], &f_read[0], &ip_read[0]);
+      for (j = 0; j < n_read; j++) {
+	for (k = 0; k < n_parameters; k++) CHECK(p_read[n_parameters * j + k] == 100 * (first + j) + k);
+	for (k = 0; k < n_fourier_parameters; k++) CHECK(f_read[n_fourier_parameters * j + k] == -100 * (first + j) - k);
+	for (k = 0; k < n_int_parameters; k++) CHECK(ip_read[n_int_parameters * j + k] == 10 * (first + j) + k);
+      }
+    }
+    CHECK_THROWS(buffer.read(40, 6, &p[0], &f[0], &ip[0]));
+
+    // Chunks that were released can no longer be read unless they were spilled:
+    buffer.release(15);
+    qsc::Vector p_read(n_parameters), f_read(n_fourier_parameters);
+    std::valarray<int> ip_read(n_int_parameters);
+    if (use_spill) {
+      buffer.read(3, 1, &p_read[0], &f_read[0], &ip_read[0]);
+      CHECK(p_read[1] == 301);
+    } else {
+      CHECK_THROWS(buffer.read(3, 1, &p_read[0], &f_read[0], &ip_read[0]));
+    }
+    buffer.read(14, 1, &p_read[0], &f_read[0], &ip_read[0]);
+    CHECK(ip_read[1] == 141);
+
+    buffer.clear();
+    CHECK(buffer.size() == 0);
+    CHECK(!std::ifstream(spill_filename.c_str()).good());
+  }
+}
+
+TEST_CASE("A scan gives the same results whether or not kept configurations are spilled to disk. [mpi]") {
+  int mpi_rank, n_procs;
+  qsc::big j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  qsc::Scan scan1 = make_small_scan(0.15);
+  qsc::Scan scan2 = make_small_scan(0.15);
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.max_attempts_per_proc = 300 / n_procs;
+    scan.min_iota_to_keep = 0.05;
+    if (j_scan == 1) {
+      scan.outfilename = "qsc_out.spill_unitTests.nc";
+      scan.spill_directory = ".";
+      scan.result_chunk_size = 3;
+    }
+    scan.random();
+  }
+  // The spill files are deleted at the end of the scan:
+  CHECK(!std::ifstream(("./qsc_out.spill_unitTests.nc.spill" + std::to_string(mpi_rank)).c_str()).good());
+
+  if (proc0) {
+    REQUIRE(scan1.n_scan > 10);
+    REQUIRE(scan2.n_scan == scan1.n_scan);
+    for (j = 0; j < scan1.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scan2.scan_eta_bar[j] == scan1.scan_eta_bar[j]);
+      CHECK(scan2.scan_iota[j] == scan1.scan_iota[j]);
+      CHECK(scan2.scan_Z0s(1, j) == scan1.scan_Z0s(1, j));
+      CHECK(scan2.scan_helicity[j] == scan1.scan_helicity[j]);
+      CHECK(scan2.scan_nphi[j] == scan1.scan_nphi[j]);
+    }
+  }
+}
+
+/** The small scan used for the tests of candidates_file.
+ */
+static qsc::Scan make_candidates_test_scan(int n_procs) {
+  qsc::Scan scan = make_small_scan(0.15);
+  scan.max_attempts_per_proc = 240 / n_procs;
+  scan.sigma0_min = -0.3;
+  scan.sigma0_max = 0.3;
+  return scan;
+}
+
+TEST_CASE("A scan of the candidates in a binary file keeps the same configurations as a random scan. [mpi]") {
+  int mpi_rank, n_procs, k;
+  qsc::big j;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+  std::string filename = "qsc_candidates_unitTests.bin";
+
+  // Save every configuration attempted by a random scan:
+  qsc::Scan scan_all = make_candidates_test_scan(n_procs);
+  scan_all.keep_all = true;
+  scan_all.random();
+  const int axis_nmax_plus_1 = scan_all.R0c_max.size();
+  if (proc0) {
+    REQUIRE(scan_all.n_scan == scan_all.filters[qsc::ATTEMPTS]);
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    int padding = 0;
+    file.write("qsccand1", 8);
+    file.write((const char*) &axis_nmax_plus_1, sizeof(int));
+    file.write((const char*) &padding, sizeof(int));
+    for (j = 0; j < scan_all.n_scan; j++) {
+      std::vector<double> row = {scan_all.scan_eta_bar[j], scan_all.scan_sigma0[j], scan_all.scan_B2c[j], scan_all.scan_B2s[j]};
+      for (qsc::Matrix* m : {&scan_all.scan_R0c, &scan_all.scan_R0s, &scan_all.scan_Z0c, &scan_all.scan_Z0s}) {
+	for (k = 0; k < axis_nmax_plus_1; k++) row.push_back((*m)(k, j));
+      }
+      file.write((const char*) row.data(), row.size() * sizeof(double));
+    }
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // The same scan with filters, from random numbers and from the file:
+  qsc::Scan scan_random = make_candidates_test_scan(n_procs);
+  qsc::Scan scan_block = make_candidates_test_scan(n_procs);
+  qsc::Scan scan_cyclic = make_candidates_test_scan(n_procs);
+  for (qsc::Scan* scan : {&scan_random, &scan_block, &scan_cyclic}) {
+    scan->min_iota_to_keep = 0.2;
+    scan->max_elongation_to_keep = 6.0;
+  }
+  scan_block.candidates_file = filename;
+  scan_block.max_attempts_per_proc = -1;
+  scan_cyclic.candidates_file = filename;
+  scan_cyclic.max_attempts_per_proc = -1;
+  scan_cyclic.candidates_distribution = qsc::SCAN_CANDIDATES_CYCLIC;
+  scan_cyclic.candidates_chunk_size = 7;
+  scan_random.random();
+  scan_block.random();
+  scan_cyclic.random();
+
+  if (proc0) {
+    REQUIRE(scan_random.n_scan > 5);
+    REQUIRE(scan_random.n_scan < scan_all.n_scan);
+    for (j = 0; j < qsc::N_FILTERS; j++) {
+      CAPTURE(j);
+      CHECK(scan_block.filters[j] == scan_random.filters[j]);
+      CHECK(scan_cyclic.filters[j] == scan_random.filters[j]);
+    }
+    // With the block distribution, each proc evaluates the same
+    // configurations as in the random scan, so the order is the same:
+    REQUIRE(scan_block.n_scan == scan_random.n_scan);
+    for (j = 0; j < scan_random.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scan_block.scan_eta_bar[j] == scan_random.scan_eta_bar[j]);
+      CHECK(scan_block.scan_Z0s(1, j) == scan_random.scan_Z0s(1, j));
+      CHECK(scan_block.scan_iota[j] == scan_random.scan_iota[j]);
+      CHECK(scan_block.scan_max_elongation[j] == scan_random.scan_max_elongation[j]);
+    }
+    REQUIRE(scan_cyclic.n_scan == scan_random.n_scan);
+    std::vector<double> eta_bar_random(std::begin(scan_random.scan_eta_bar), std::end(scan_random.scan_eta_bar));
+    std::vector<double> eta_bar_cyclic(std::begin(scan_cyclic.scan_eta_bar), std::end(scan_cyclic.scan_eta_bar));
+    std::sort(eta_bar_random.begin(), eta_bar_random.end());
+    std::sort(eta_bar_cyclic.begin(), eta_bar_cyclic.end());
+    for (j = 0; j < scan_random.n_scan; j++) CHECK(eta_bar_cyclic[j] == eta_bar_random[j]);
+  }
+
+  // The number of axis modes must match the file:
+  scan_block.R0c_max.resize(3, 0.0);
+  CHECK_THROWS(scan_block.random());
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (proc0) std::remove(filename.c_str());
+}
+
+///////////////////////////////////////////////////
+///////////////////////////////////////////////////
+
+TEST_CASE("ScanSurrogate learns a rule from examples of kept and rejected configurations.") {
+  const int n_features = 3, n_train = 2000, n_test = 1000;
+  // Points spread evenly over the unit cube, from a low-discrepancy
+  // sequence:
+  auto point = [&](int j) {
+    const qsc::qscfloat alpha[n_features] = {0.8191725134, 0.6710436067, 0.5497004779};
+    qsc::Vector x(n_features);
+    for (int d = 0; d < n_features; d++) x[d] = std::fmod(0.5 + (j + 1) * alpha[d], 1.0);
+    return x;
+  };
+  // The third feature is irrelevant:
+  auto rule = [](const qsc::Vector& x) { return x[0] > 0.3 && x[1] < 0.5; };
+  std::vector<qsc::Vector> features;
+  std::vector<bool> labels;
+  int j;
+  for (j = 0; j < n_train; j++) {
+    features.push_back(point(j));
+    labels.push_back(rule(features[j]));
+  }
+
+  qsc::ScanSurrogate surrogate;
+  CHECK(!surrogate.trained);
+  surrogate.fit(features, labels);
+  CHECK(surrogate.trained);
+  CHECK(surrogate.n_splits() > 0);
+  int n_correct = 0;
+  for (j = n_train; j < n_train + n_test; j++) {
+    qsc::Vector x = point(j);
+    qsc::qscfloat p = surrogate.probability(x);
+    CHECK(p >= 0);
+    CHECK(p <= 1);
+    if ((p > 0.5) == rule(x)) n_correct++;
+  }
+  CHECK(n_correct > 0.97 * n_test);
+  // Far from the boundary, the predictions should be confident:
+  CHECK(surrogate.probability(qsc::Vector({0.9, 0.1, 0.5})) > 0.9);
+  CHECK(surrogate.probability(qsc::Vector({0.1, 0.9, 0.5})) < 0.1);
+
+  // Fitting again to the same examples gives the same model:
+  qsc::ScanSurrogate surrogate2;
+  surrogate2.fit(features, labels);
+  REQUIRE(surrogate2.n_splits() == surrogate.n_splits());
+  for (j = 0; j < 50; j++) CHECK(surrogate2.probability(point(n_train + j)) == surrogate.probability(point(n_train + j)));
+
+  // With examples of only one class, there is nothing to learn:
+  std::vector<bool> all_kept(n_train, true);
+  surrogate.fit(features, all_kept);
+  CHECK(!surrogate.trained);
+  CHECK_THROWS(surrogate.fit(features, std::vector<bool>(n_train - 1, true)));
+}
+
+TEST_CASE("The surrogate pre-screening skips only configurations it predicts would be rejected, and audits some of them. [mpi]") {
+  qsc::big j, k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+  const qsc::qscfloat audit_fraction = 0.2;
+
+  // scan1 has no surrogate. scan2 audits every configuration the
+  // surrogate would skip, so it should keep the same configurations
+  // as scan1. scan3 and scan4 audit only some, with 1 and 3 threads:
+  qsc::Scan scan1 = make_small_scan(0.2);
+  qsc::Scan scan2 = make_small_scan(0.2);
+  qsc::Scan scan3 = make_small_scan(0.2);
+  qsc::Scan scan4 = make_small_scan(0.2);
+  qsc::Scan* scans[4] = {&scan1, &scan2, &scan3, &scan4};
+  for (int j_scan = 0; j_scan < 4; j_scan++) {
+    CAPTURE(j_scan);
+    qsc::Scan& scan = *scans[j_scan];
+    scan.max_attempts_per_proc = 1200 / n_procs; // Note integer division
+    scan.max_keep_per_proc = scan.max_attempts_per_proc;
+    scan.eta_bar_min = 0.3;
+    scan.eta_bar_max = 2.0;
+    scan.sigma0_min = -0.5;
+    scan.sigma0_max = 0.5;
+    scan.min_iota_to_keep = 0.1;
+    scan.min_L_grad_B_to_keep = 0.4;
+
+    scan.surrogate = (j_scan > 0);
+    scan.surrogate_training_attempts = 300 / n_procs;
+    scan.surrogate_threshold = 0.2;
+    scan.surrogate_audit_fraction = (j_scan == 1) ? 1.0 : audit_fraction;
+    scan.n_threads = (j_scan == 3) ? 3 : 1;
+    scan.random();
+  }
+
+  if (proc0) {
+    for (int j_scan = 0; j_scan < 4; j_scan++) {
+      CAPTURE(j_scan);
+      qsc::Scan& scan = *scans[j_scan];
+      CHECK(scan.filters[qsc::ATTEMPTS] == scan1.filters[qsc::ATTEMPTS]);
+      // Every attempt is kept or rejected for one reason:
+      qsc::big total = scan.filters[qsc::KEPT];
+      for (k = qsc::REJECTED_DUE_TO_R0_CRUDE; k <= qsc::REJECTED_DUE_TO_SURROGATE; k++) total += scan.filters[k];
+      CHECK(total == scan.filters[qsc::ATTEMPTS]);
+      CHECK(scan.filters[qsc::N_SURROGATE_AUDITS_KEPT] <= scan.filters[qsc::N_SURROGATE_AUDITS]);
+    }
+    CHECK(scan1.filters[qsc::REJECTED_DUE_TO_SURROGATE] == 0);
+    CHECK(scan1.filters[qsc::N_SURROGATE_AUDITS] == 0);
+
+    // With every skipped configuration audited, nothing changes but
+    // the audit counts:
+    CHECK(scan2.filters[qsc::REJECTED_DUE_TO_SURROGATE] == 0);
+    CHECK(scan2.filters[qsc::N_SURROGATE_AUDITS] > 0);
+    for (k = 0; k < qsc::N_SURROGATE_AUDITS; k++) {
+      CAPTURE(k);
+      CHECK(scan2.filters[k] == scan1.filters[k]);
+    }
+    REQUIRE(scan2.n_scan == scan1.n_scan);
+    for (j = 0; j < scan1.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scan2.scan_eta_bar[j] == scan1.scan_eta_bar[j]);
+      CHECK(scan2.scan_iota[j] == scan1.scan_iota[j]);
+      CHECK(scan2.scan_sampling_weight[j] == 1.0);
+    }
+
+    // With partial audits, the surrogate saves work, and the kept
+    // configurations are a subset of those of scan1, in the same order:
+    CHECK(scan3.filters[qsc::REJECTED_DUE_TO_SURROGATE] > 0);
+    CHECK(scan3.filters[qsc::N_SURROGATE_AUDITS] > 0);
+    CHECK(scan3.filters[qsc::N_SIGMA_EQ_SOLVES] < scan1.filters[qsc::N_SIGMA_EQ_SOLVES]);
+    CHECK(scan3.n_scan == scan1.n_scan - scan2.filters[qsc::N_SURROGATE_AUDITS_KEPT]
+	  + scan3.filters[qsc::N_SURROGATE_AUDITS_KEPT]);
+    k = 0;
+    for (j = 0; j < scan3.n_scan; j++) {
+      CAPTURE(j);
+      while (k < scan1.n_scan && scan1.scan_eta_bar[k] != scan3.scan_eta_bar[j]) k++;
+      REQUIRE(k < scan1.n_scan);
+      CHECK(scan3.scan_iota[j] == scan1.scan_iota[k]);
+      // Audited configurations stand for 1 / audit_fraction others:
+      CHECK((scan3.scan_sampling_weight[j] == 1.0 || scan3.scan_sampling_weight[j] == Approx(1 / audit_fraction)));
+    }
+
+    // The model is fit to the same attempts for any number of threads:
+    for (k = 0; k < qsc::N_FILTERS; k++) {
+      CAPTURE(k);
+      CHECK(scan4.filters[k] == scan3.filters[k]);
+    }
+    REQUIRE(scan4.n_scan == scan3.n_scan);
+    for (j = 0; j < scan3.n_scan; j++) CHECK(scan4.scan_eta_bar[j] == scan3.scan_eta_bar[j]);
+  }
+
+  // The model is not saved in the restart file:
+  scan3.append_checkpoints = true;
+  scan3.restart = true;
+  CHECK_THROWS(scan3.random());
+}
+
+TEST_CASE("Screening at low nphi keeps the same configurations as a scan without screening. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 evaluates every configuration at full resolution, scan2 screens first.
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+
+  int nf = 2;
+  for (int order = 1; order < 3; order++) {
+    CAPTURE(order);
+    for (int j_scan = 0; j_scan < 2; j_scan++) {
+      qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+      scan.max_attempts_per_proc = 60 / n_procs; // Note integer division
+      scan.q.p2 = -1.0e+4;
+      scan.q.order_r_option = (order == 1) ? "r1" : "r2";
+
+      scan.R0c_min[0] = 0.8;
+      scan.R0c_max[0] = 1.2;
+      scan.sigma0_min = -0.3;
+      scan.sigma0_max = 0.6;
+      scan.B2c_min = -1.0;
+      scan.B2c_max = 1.0;
+
+      scan.min_iota_to_keep = 0.1;
+      scan.max_elongation_to_keep = 4.0;
+      scan.min_L_grad_B_to_keep = 0.3;
+      scan.min_L_grad_grad_B_to_keep = 0.1;
+      scan.min_DMerc_times_r2_to_keep = 0;
+
+      scan.screening_nphi = (j_scan == 0) ? 0 : 11;
+      scan.screening_margin = 0.2;
+      scan.random();
+    }
+
+    if (proc0) {
+      CHECK(scan1.filters[qsc::N_SCREENING_REJECTIONS] == 0);
+      CHECK(scan2.filters[qsc::N_SCREENING_REJECTIONS] > 0);
+      // Screening should save full-resolution solves:
+      CHECK(scan2.filters[qsc::N_SIGMA_EQ_SOLVES] < scan1.filters[qsc::N_SIGMA_EQ_SOLVES]);
+      CHECK(scan1.filters[qsc::ATTEMPTS] == scan2.filters[qsc::ATTEMPTS]);
+      REQUIRE(scan1.n_scan == scan2.n_scan);
+      CHECK(scan1.n_scan > 0);
+      for (j = 0; j < scan1.n_scan; j++) {
+	CAPTURE(j);
+	CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
+	CHECK(Approx(scan1.scan_sigma0[j]) == scan2.scan_sigma0[j]);
+	CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
+	CHECK(Approx(scan1.scan_max_elongation[j]) == scan2.scan_max_elongation[j]);
+	for (k = 0; k < nf; k++) {
+	  CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
+	  CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+	}
+      }
+    }
+  }
+
+  // Screening at the full nphi would save nothing:
+  scan2.screening_nphi = scan2.q.nphi;
+  CHECK_THROWS(scan2.random());
+}
+
+TEST_CASE("Adaptive filter ordering keeps the same configurations as the fixed order. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 applies the filters in the fixed order, scan2 adapts the order.
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+
+  int nf = 2;
+  for (int order = 1; order < 3; order++) {
+    CAPTURE(order);
+    for (int screening_nphi = 0; screening_nphi < 12; screening_nphi += 11) {
+      CAPTURE(screening_nphi);
+      for (int j_scan = 0; j_scan < 2; j_scan++) {
+	qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+	scan.max_attempts_per_proc = 60 / n_procs; // Note integer division
+	scan.q.p2 = -1.0e+4;
+	scan.q.order_r_option = (order == 1) ? "r1" : "r2";
+
+	scan.R0c_min[0] = 0.8;
+	scan.R0c_max[0] = 1.2;
+	scan.sigma0_min = -0.3;
+	scan.sigma0_max = 0.6;
+	scan.B2c_min = -1.0;
+	scan.B2c_max = 1.0;
+
+	scan.min_iota_to_keep = 0.1;
+	scan.max_elongation_to_keep = 4.0;
+	scan.min_L_grad_B_to_keep = 0.3;
+	scan.min_L_grad_grad_B_to_keep = 0.1;
+	scan.min_DMerc_times_r2_to_keep = 0;
+
+	scan.screening_nphi = screening_nphi;
+	scan.screening_margin = 0.2;
+	scan.adaptive_filter_order = (j_scan == 1);
+	scan.random();
+      }
+
+      // With no checkpoint during the scan, the order is not
+      // re-estimated from measured timings, so repeating the scan gives
+      // the same rejection counts:
+      qsc::big filters_first_run[qsc::N_FILTERS];
+      for (k = 0; k < qsc::N_FILTERS; k++) filters_first_run[k] = scan2.filters[k];
+      scan2.random();
+      if (proc0) {
+	for (k = qsc::REJECTED_DUE_TO_R0_CRUDE; k <= qsc::REJECTED_DUE_TO_R_SINGULARITY; k++) {
+	  CAPTURE(k);
+	  CHECK(scan2.filters[k] == filters_first_run[k]);
+	}
+      }
+
+      if (proc0) {
+	CHECK(scan1.filters[qsc::ATTEMPTS] == scan2.filters[qsc::ATTEMPTS]);
+	// Each rejected configuration is counted by exactly one filter,
+	// whichever order the filters were applied in:
+	CHECK(scan1.filters[qsc::ATTEMPTS] - scan1.filters[qsc::KEPT]
+	      == scan2.filters[qsc::ATTEMPTS] - scan2.filters[qsc::KEPT]);
+	qsc::big n_rejected = 0;
+	for (k = qsc::REJECTED_DUE_TO_R0_CRUDE; k <= qsc::REJECTED_DUE_TO_R_SINGULARITY; k++) n_rejected += scan2.filters[k];
+	CHECK(n_rejected == scan2.filters[qsc::ATTEMPTS] - scan2.filters[qsc::KEPT]);
+	REQUIRE(scan1.n_scan == scan2.n_scan);
+	CHECK(scan1.n_scan > 0);
+	for (j = 0; j < scan1.n_scan; j++) {
+	  CAPTURE(j);
+	  CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
+	  CHECK(Approx(scan1.scan_sigma0[j]) == scan2.scan_sigma0[j]);
+	  CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
+	  CHECK(Approx(scan1.scan_max_elongation[j]) == scan2.scan_max_elongation[j]);
+	  CHECK(Approx(scan1.scan_min_L_grad_grad_B[j]) == scan2.scan_min_L_grad_grad_B[j]);
+	  for (k = 0; k < nf; k++) {
+	    CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
+	    CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+	  }
+	}
+      }
+    }
+  }
+}
+
+TEST_CASE("FilterOrder estimates the stage costs and rejection probabilities from the totals of all procs. [mpi]") {
+  int n_procs;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  qsc::FilterOrder order;
+  order.init(2);
+  CHECK(order.rejection_probability[0] == Approx(0.5));
+
+  // Before init_axis has been timed, the typical costs are kept:
+  qsc::qscfloat typical_cost_r2 = order.stage_cost[qsc::STAGE_R2];
+  order.update(MPI_COMM_WORLD);
+  CHECK(order.stage_cost[qsc::STAGE_R2] == typical_cost_r2);
+
+  order.stage_seconds[qsc::STAGE_INIT_AXIS] = 2.0;
+  order.stage_calls[qsc::STAGE_INIT_AXIS] = 4;
+  order.stage_seconds[qsc::STAGE_R1] = 3.0;
+  order.stage_calls[qsc::STAGE_R1] = 2;
+  order.n_tested[0] = 8;
+  order.n_rejected[0] = 2;
+  order.update(MPI_COMM_WORLD);
+  // Every proc adds the same totals, so the means are unchanged:
+  CHECK(order.stage_cost[qsc::STAGE_INIT_AXIS] == Approx(0.5));
+  CHECK(order.stage_cost[qsc::STAGE_R1] == Approx(1.5));
+  // A stage that has not run keeps its typical cost relative to init_axis:
+  CHECK(order.stage_cost[qsc::STAGE_R2] == Approx(0.5 * typical_cost_r2));
+  CHECK(order.rejection_probability[0] == Approx((2.0 * n_procs + 1) / (8.0 * n_procs + 2)));
+  CHECK(order.rejection_probability[1] == Approx(0.5));
+}
+
+TEST_CASE("Adaptive filter ordering re-estimated at every checkpoint keeps the same configurations. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 applies the filters in the fixed order, scan2 adapts the
+  // order from the timings combined at each checkpoint.
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+  int nf = 2;
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.max_attempts_per_proc = 60 / n_procs; // Note integer division
+    scan.n_threads = 2;
+    scan.q.p2 = -1.0e+4;
+    scan.q.order_r_option = "r2";
+    scan.R0c_min[0] = 0.8;
+    scan.R0c_max[0] = 1.2;
+    scan.sigma0_min = -0.3;
+    scan.sigma0_max = 0.6;
+    scan.min_iota_to_keep = 0.1;
+    scan.max_elongation_to_keep = 4.0;
+    scan.min_L_grad_B_to_keep = 0.3;
+    scan.min_L_grad_grad_B_to_keep = 0.1;
+    scan.adaptive_filter_order = (j_scan == 1);
+    scan.save_period = 0; // Checkpoint before every attempt
+    scan.outfilename = "qsc_out.adaptive_filter_order_unitTests.nc";
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan1.filters[qsc::ATTEMPTS] == scan2.filters[qsc::ATTEMPTS]);
+    CHECK(scan1.filters[qsc::ATTEMPTS] - scan1.filters[qsc::KEPT]
+	  == scan2.filters[qsc::ATTEMPTS] - scan2.filters[qsc::KEPT]);
+    REQUIRE(scan1.n_scan == scan2.n_scan);
+    CHECK(scan1.n_scan > 0);
+    for (j = 0; j < scan1.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
+      CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
+      CHECK(Approx(scan1.scan_min_L_grad_grad_B[j]) == scan2.scan_min_L_grad_grad_B[j]);
+      for (k = 0; k < nf; k++) {
+	CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
+	CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+      }
+    }
+  }
+}
+
+TEST_CASE("The axis pre-filter does not change the results of a scan. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  int nf = 3;
+  qsc::Scan scan1 = make_small_scan(0.15, nf);
+  qsc::Scan scan2 = make_small_scan(0.15, nf);
+
+  for (int order = 1; order < 3; order++) {
+    CAPTURE(order);
+    for (int fourier_extrema = 0; fourier_extrema < 2; fourier_extrema++) {
+      CAPTURE(fourier_extrema);
+      for (int j_scan = 0; j_scan < 2; j_scan++) {
+	qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+	scan.max_attempts_per_proc = 100 / n_procs; // Note integer division
+	scan.q.fourier_extrema = (bool) fourier_extrema;
+	scan.q.order_r_option = (order == 1) ? "r1" : "r2";
+
+	scan.R0c_min[0] = 0.8;
+	scan.R0c_max[0] = 1.2;
+	scan.R0c_min[2] = -0.02;
+	scan.R0c_max[2] =  0.02;
+	scan.Z0s_min[2] = -0.02;
+	scan.Z0s_max[2] =  0.02;
+	scan.sigma0_min = -0.3;
+	scan.sigma0_max = 0.6;
+	scan.B2c_min = -1.0;
+	scan.B2c_max = 1.0;
+
+	scan.min_R0_to_keep = 0.8;
+	scan.min_iota_to_keep = 0.1;
+	scan.min_L_grad_B_to_keep = 0.4;
+
+	scan.prefilter = (j_scan == 1);
+	scan.random();
+      }
+
+      if (proc0) {
+	CHECK(scan1.filters[qsc::N_PREFILTER_REJECTIONS] == 0);
+	CHECK(scan2.filters[qsc::N_PREFILTER_REJECTIONS] > 0);
+	CHECK(scan2.filters[qsc::N_PREFILTER_REJECTIONS]
+	      <= scan2.filters[qsc::REJECTED_DUE_TO_R0] + scan2.filters[qsc::REJECTED_DUE_TO_CURVATURE]);
+	// Apart from the pre-filter count, every counter should be unchanged:
+	for (k = 0; k < qsc::N_PREFILTER_REJECTIONS; k++) {
+	  CAPTURE(k);
+	  CHECK(scan1.filters[k] == scan2.filters[k]);
+	}
+	REQUIRE(scan1.n_scan == scan2.n_scan);
+	CHECK(scan1.n_scan > 0);
+	for (j = 0; j < scan1.n_scan; j++) {
+	  CAPTURE(j);
+	  CHECK(Approx(scan1.scan_eta_bar[j]) == scan2.scan_eta_bar[j]);
+	  CHECK(Approx(scan1.scan_min_R0[j]) == scan2.scan_min_R0[j]);
+	  CHECK(Approx(scan1.scan_max_curvature[j]) == scan2.scan_max_curvature[j]);
+	  for (k = 0; k < nf; k++) {
+	    CHECK(Approx(scan1.scan_R0c(k, j)) == scan2.scan_R0c(k, j));
+	    CHECK(Approx(scan1.scan_Z0s(k, j)) == scan2.scan_Z0s(k, j));
+	  }
+	}
+      }
+    }
+  }
+}
+
+TEST_CASE("Constrained sampling of R0c[0] avoids crude R0 rejections. [mpi]") {
+  qsc::big j;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 samples R0c[0] from its full range, scan2 uses constrained_sampling.
+  qsc::Scan scan1 = make_small_scan(0.1, 3);
+  qsc::Scan scan2 = make_small_scan(0.1, 3);
+
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.max_attempts_per_proc = 400 / n_procs; // Note integer division
+    scan.q.order_r_option = "r1";
+    scan.fourier_scan_option = "2 sided log";
+
+    scan.R0c_min[0] = 0.3;
+    scan.R0c_max[0] = 1.2;
+    scan.R0c_min[1] = 0.01;
+    scan.R0c_max[1] = 1.0;
+    scan.Z0s_min[1] = 0.01;
+    scan.Z0s_max[1] = 0.3;
+    scan.R0c_min[2] = 0.001;
+    scan.R0c_max[2] = 0.2;
+    scan.Z0s_min[2] = 0.001;
+    scan.Z0s_max[2] = 0.1;
+
+    scan.min_iota_to_keep = 0.05;
+
+    scan.constrained_sampling = (j_scan == 1);
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan1.filters[qsc::ATTEMPTS] == scan2.filters[qsc::ATTEMPTS]);
+    CHECK(scan1.filters[qsc::REJECTED_DUE_TO_R0_CRUDE] > 0);
+    CHECK(scan2.filters[qsc::REJECTED_DUE_TO_R0_CRUDE] == 0);
+    CHECK(Approx(scan1.mean_sampling_weight) == 1.0);
+    CHECK(scan2.mean_sampling_weight < 1.0);
+    // The mean weight estimates the fraction of unconstrained draws
+    // that pass the crude R0 check:
+    qsc::qscfloat fraction_passing_crude_check = 1.0 - scan1.filter_fractions[qsc::REJECTED_DUE_TO_R0_CRUDE];
+    CHECK(std::abs(scan2.mean_sampling_weight - fraction_passing_crude_check) < 0.1);
+    for (j = 0; j < scan1.n_scan; j++) CHECK(Approx(scan1.scan_sampling_weight[j]) == 1.0);
+    for (j = 0; j < scan2.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scan2.scan_sampling_weight[j] > 0);
+      CHECK(scan2.scan_sampling_weight[j] <= 1);
+      CHECK(scan2.scan_R0c(0, j) >= scan2.R0c_min[0]);
+      CHECK(scan2.scan_R0c(0, j) <= scan2.R0c_max[0]);
+      CHECK(scan2.scan_min_R0[j] > 0);
+    }
+  }
+}
+
+TEST_CASE("Adaptive sampling keeps more configurations, with weights that recover the box distribution. [mpi]") {
+  qsc::big j;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 samples the box distribution, scan2 uses adaptive_sampling.
+  qsc::Scan scan1 = make_small_scan(0.2);
+  qsc::Scan scan2 = make_small_scan(0.2);
+
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.max_attempts_per_proc = 3000 / n_procs; // Note integer division
+    scan.max_keep_per_proc = scan.max_attempts_per_proc;
+    scan.q.order_r_option = "r1";
+
+    scan.eta_bar_min = 0.1;
+    scan.eta_bar_max = 3.0;
+    scan.sigma0_min = -1.0;
+    scan.sigma0_max = 1.0;
+
+    scan.min_iota_to_keep = 0.2;
+    scan.max_elongation_to_keep = 10;
+
+    // adaptive_sampling needs a multidimensional sequence:
+    scan.random_sequence = qsc::SCAN_SEQUENCE_R_D;
+    scan.adaptive_sampling = (j_scan == 1);
+    scan.adaptive_sampling_period = 100;
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan1.filters[qsc::ATTEMPTS] == scan2.filters[qsc::ATTEMPTS]);
+    CHECK(scan2.n_scan > 1.5 * scan1.n_scan);
+    CHECK(Approx(scan1.mean_sampling_weight) == 1.0);
+    // The importance weights have mean 1 over all attempts:
+    CHECK(std::abs(scan2.mean_sampling_weight - 1.0) < 0.1);
+    // The weighted fraction kept estimates the fraction kept from the
+    // box distribution:
+    qsc::qscfloat weighted_fraction_kept = scan2.scan_sampling_weight.sum() / scan2.filters[qsc::ATTEMPTS];
+    CHECK(std::abs(weighted_fraction_kept / scan1.filter_fractions[qsc::KEPT] - 1.0) < 0.2);
+    for (j = 0; j < scan1.n_scan; j++) CHECK(Approx(scan1.scan_sampling_weight[j]) == 1.0);
+    for (j = 0; j < scan2.n_scan; j++) {
+      CAPTURE(j);
+      CHECK(scan2.scan_sampling_weight[j] > 0);
+      CHECK(scan2.scan_sampling_weight[j] < 1 / (1 - scan2.adaptive_sampling_fraction) + 1e-10);
+      CHECK(std::abs(scan2.scan_iota[j]) >= scan2.min_iota_to_keep);
+    }
+  }
+}
+
+TEST_CASE("Mirror-symmetric sampling gives each kept configuration and its exact mirror image. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 samples every configuration, scan2 uses mirror_symmetry.
+  int nf = 3;
+  qsc::Scan scan1 = make_small_scan(0.2, nf);
+  qsc::Scan scan2 = make_small_scan(0.2, nf);
+
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.random_sequence = qsc::SCAN_SEQUENCE_R_D;
+    scan.max_attempts_per_proc = 600 / n_procs; // Note integer division
+    scan.q.p2 = -1.0e+4;
+    scan.q.order_r_option = "r2";
+
+    scan.R0s_min[1] = -0.05;
+    scan.R0s_max[1] = 0.05;
+    scan.Z0c_min[1] = -0.05;
+    scan.Z0c_max[1] = 0.05;
+    scan.Z0s_min[2] = -0.02;
+    scan.Z0s_max[2] = 0.02;
+    scan.sigma0_min = -0.5;
+    scan.sigma0_max = 0.5;
+    scan.B2c_min = -1.0;
+    scan.B2c_max = 1.0;
+    scan.B2s_min = -1.0;
+    scan.B2s_max = 1.0;
+
+    scan.min_iota_to_keep = 0.1;
+    scan.max_elongation_to_keep = 10;
+
+    scan.screening_nphi = 11;
+    scan.screening_margin = 0.2;
+    scan.prefilter = true;
+    scan.mirror_symmetry = (j_scan == 1);
+    scan.random();
+  }
+
+  if (proc0) {
+    CHECK(scan2.filters[qsc::ATTEMPTS] == 2 * scan1.filters[qsc::ATTEMPTS]);
+    // Configuration counts include both members of each mirror pair:
+    CHECK(scan2.filters[qsc::N_SCREENING_REJECTIONS] > 0);
+    CHECK(scan2.filters[qsc::N_SCREENING_REJECTIONS] % 2 == 0);
+    CHECK(scan2.filters[qsc::N_PREFILTER_REJECTIONS] % 2 == 0);
+    CHECK(scan2.n_scan % 2 == 0);
+    CHECK(scan2.n_scan > 0);
+    // Twice the configurations for the same work, and the fraction
+    // kept is that of the full scan:
+    CHECK(scan2.filters[qsc::N_SIGMA_EQ_SOLVES] <= scan1.filters[qsc::N_SIGMA_EQ_SOLVES] + 10);
+    CHECK(std::abs(scan2.filter_fractions[qsc::KEPT] / scan1.filter_fractions[qsc::KEPT] - 1.0) < 0.2);
+
+    // Now set up a standalone Qsc object:
+    qsc::Qsc q;
+    q.verbose = 0;
+    q.nfp = scan2.q.nfp;
+    q.p2 = scan2.q.p2;
+    q.order_r_option = scan2.q.order_r_option;
+    q.R0c.resize(nf, 0.0);
+    q.R0s.resize(nf, 0.0);
+    q.Z0c.resize(nf, 0.0);
+    q.Z0s.resize(nf, 0.0);
+
+    for (j = 0; j < scan2.n_scan; j += 2) {
+      CAPTURE(j);
+      // The representative comes first, then its mirror image:
+      CHECK(scan2.scan_Z0s(1, j) > 0);
+      CHECK(scan2.scan_Z0s(1, j + 1) == -scan2.scan_Z0s(1, j));
+      CHECK(scan2.scan_iota[j + 1] == -scan2.scan_iota[j]);
+      CHECK(scan2.scan_helicity[j + 1] == -scan2.scan_helicity[j]);
+      CHECK(scan2.scan_max_elongation[j + 1] == scan2.scan_max_elongation[j]);
+      if (j >= 20) continue;
+
+      // The mirror image agrees with a standalone calculation:
+      q.eta_bar = scan2.scan_eta_bar[j + 1];
+      q.sigma0 = scan2.scan_sigma0[j + 1];
+      q.B2s = scan2.scan_B2s[j + 1];
+      q.B2c = scan2.scan_B2c[j + 1];
+      for (k = 0; k < nf; k++) {
+	q.R0c[k] = scan2.scan_R0c(k, j + 1);
+	q.R0s[k] = scan2.scan_R0s(k, j + 1);
+	q.Z0c[k] = scan2.scan_Z0c(k, j + 1);
+	q.Z0s[k] = scan2.scan_Z0s(k, j + 1);
+      }
+      q.nphi = 31;
+      q.init();
+      q.calculate();
+      CHECK(Approx(q.iota) == scan2.scan_iota[j + 1]);
+      CHECK(q.helicity == scan2.scan_helicity[j + 1]);
+      CHECK(Approx(q.grid_min_R0) == scan2.scan_min_R0[j + 1]);
+      CHECK(Approx(q.grid_max_elongation) == scan2.scan_max_elongation[j + 1]);
+      CHECK(Approx(q.grid_min_L_grad_B) == scan2.scan_min_L_grad_B[j + 1]);
+      CHECK(Approx(q.grid_min_L_grad_grad_B) == scan2.scan_min_L_grad_grad_B[j + 1]);
+      CHECK(Approx(q.r_singularity_robust) == scan2.scan_r_singularity[j + 1]);
+      CHECK(Approx(q.B20_grid_variation) == scan2.scan_B20_variation[j + 1]);
+      CHECK(Approx(q.d2_volume_d_psi2) == scan2.scan_d2_volume_d_psi2[j + 1]);
+      CHECK(Approx(q.DMerc_times_r2) == scan2.scan_DMerc_times_r2[j + 1]);
+    }
+  }
+
+  // The ranges of the mirrored parameters must be symmetric:
+  scan2.sigma0_min = -0.3;
+  CHECK_THROWS(scan2.random());
+  scan2.sigma0_min = -0.5;
+  scan2.q.I2 = 0.1;
+  CHECK_THROWS(scan2.random());
+}
+
+TEST_CASE("A scan continued from a restart file matches a scan run without interruption. [mpi]") {
+  std::size_t j;
+  qsc::big k;
+  int mpi_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  bool proc0 = (mpi_rank == 0);
+
+  // scan1 runs without interruption. scan2 stops early, when a few
+  // configurations have been kept, and scan3 continues from where
+  // scan2 stopped.
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+  qsc::Scan scan3 = make_small_scan();
+
+  for (int j_scan = 0; j_scan < 3; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : ((j_scan == 1) ? scan2 : scan3);
+    scan.deterministic = false;
+    // scan3 gets the seed from the restart file:
+    scan.random_seed = (j_scan == 2) ? 0 : 12345;
+    scan.max_attempts_per_proc = 60;
+    scan.max_keep_per_proc = (j_scan == 1) ? 3 : 1000;
+    scan.max_seconds = 1000;
+    scan.max_elongation_to_keep = 4.0;
+    if (j_scan > 0) {
+      scan.append_checkpoints = true;
+      scan.outfilename = "qsc_out.restart_unitTests.nc";
+    }
+    scan.restart = (j_scan == 2);
+    scan.random();
+    if (j_scan == 1) scan.write_restart();
+  }
+
+  if (proc0) {
+    CHECK(scan1.n_scan > 2 * scan2.n_scan);
+    CHECK(scan2.filters[qsc::ATTEMPTS] < scan1.filters[qsc::ATTEMPTS]);
+    for (j = 0; j < qsc::N_FILTERS; j++) {
+      CAPTURE(j);
+      CHECK(scan3.filters[j] == scan1.filters[j]);
+    }
+    CHECK(scan3.n_scan == scan1.n_scan);
+    CHECK(Approx(scan3.mean_sampling_weight) == scan1.mean_sampling_weight);
+    // scan3 holds only the configurations kept after the restart,
+    // which are the ones scan1 kept that scan2 did not:
+    REQUIRE(scan3.scan_eta_bar.size() == scan1.n_scan - scan2.n_scan);
+    CHECK(scan3.n_scan_offset == scan2.n_scan);
+    for (j = 0; j < scan3.scan_eta_bar.size(); j++) {
+      CAPTURE(j);
+      int n_matches1 = 0, n_matches2 = 0;
+      for (k = 0; k < scan1.n_scan; k++) if (scan1.scan_eta_bar[k] == scan3.scan_eta_bar[j]) n_matches1++;
+      for (k = 0; k < scan2.n_scan; k++) if (scan2.scan_eta_bar[k] == scan3.scan_eta_bar[j]) n_matches2++;
+      CHECK(n_matches1 == 1);
+      CHECK(n_matches2 == 0);
+    }
+  }
+
+  // The number of procs, max_attempts_per_proc, and random_sequence
+  // must match the restart file:
+  scan3.max_attempts_per_proc = 61;
+  CHECK_THROWS(scan3.random());
+  scan3.max_attempts_per_proc = 60;
+  scan3.append_checkpoints = false;
+  CHECK_THROWS(scan3.random());
+}
+
+TEST_CASE("Checkpoints written by the background writer match those written synchronously. [mpi]") {
+  std::size_t j;
+  int mpi_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  bool proc0 = (mpi_rank == 0);
+  std::string restart_contents[2];
+
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.max_attempts_per_proc = 60;
+    scan.max_seconds = 1000;
+    // Checkpoint before every attempt, so the writer is usually busy:
+    scan.save_period = 0;
+    scan.append_checkpoints = true;
+    scan.async_output = (j_scan == 1);
+    scan.outfilename = "qsc_out.async_output_unitTests.nc";
+    scan.max_elongation_to_keep = 4.0;
+    if (proc0) std::remove(scan.restart_filename().c_str());
+    scan.random();
+
+    // Once random() returns, the last checkpoint has been written.
+    // Its timings differ from run to run, so they are not compared.
+    // The NetCDF files themselves are compared in netcdf_tests.cpp:
+    if (proc0) {
+      std::ifstream file(scan.restart_filename().c_str());
+      REQUIRE(file.is_open());
+      std::string line;
+      while (std::getline(file, line)) {
+	if (line.compare(0, 6, "timing") != 0) restart_contents[j_scan] += line + "\n";
+      }
+    }
+  }
+
+  if (proc0) {
+    CHECK(restart_contents[1] == restart_contents[0]);
+    CHECK(restart_contents[0].find("next_attempt") != std::string::npos);
+    for (j = 0; j < qsc::N_FILTERS; j++) {
+      CAPTURE(j);
+      CHECK(scan2.filters[j] == scan1.filters[j]);
+    }
+    REQUIRE(scan2.scan_eta_bar.size() == scan1.scan_eta_bar.size());
+    CHECK(scan2.n_scan_offset == scan1.n_scan_offset);
+    for (j = 0; j < scan1.scan_eta_bar.size(); j++) CHECK(scan2.scan_eta_bar[j] == scan1.scan_eta_bar[j]);
+  }
+}
+
+TEST_CASE("Verify results of a deterministic scan are independent of the number of threads. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  bool proc0 = (mpi_rank == 0);
+
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+
+  int nf = 2;
+  for (int order = 1; order < 3; order++) {
+    CAPTURE(order);
+    // Stop the scans either by the number of attempts or the number kept:
+    for (int j_limit = 0; j_limit < 2; j_limit++) {
+      CAPTURE(j_limit);
+      for (int j_scan = 0; j_scan < 2; j_scan++) {
+	qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+	scan.n_threads = (j_scan == 0) ? 1 : 3;
+	if (j_limit == 0) {
+	  scan.max_attempts_per_proc = 60 / n_procs; // Note integer division
+	  scan.max_keep_per_proc = 1000;
+	} else {
+	  scan.max_attempts_per_proc = 1000;
+	  scan.max_keep_per_proc = 3;
+	}
+	scan.q.p2 = -1.0e+4;
+	scan.q.order_r_option = (order == 1) ? "r1" : "r2";
+
+	scan.R0c_min[0] = 0.8;
+	scan.R0c_max[0] = 1.2;
+	scan.sigma0_min = -0.3;
+	scan.sigma0_max = 0.6;
+	scan.B2c_min = -1.0;
+	scan.B2c_max = 1.0;
+
+	scan.min_iota_to_keep = 0.1;
+	scan.max_elongation_to_keep = 4.0;
+	scan.min_L_grad_B_to_keep = 0.3;
+	scan.min_L_grad_grad_B_to_keep = 0.1;
+	scan.min_DMerc_times_r2_to_keep = 0;
+	scan.screening_nphi = 11;
+	scan.random();
+      }
+
+      if (proc0) {
+	for (j = 0; j < qsc::N_FILTERS; j++) {
+	  CAPTURE(j);
+	  CHECK(scan1.filters[j] == scan2.filters[j]);
+	}
+	REQUIRE(scan1.n_scan == scan2.n_scan);
+	CHECK(scan1.n_scan > 0);
+	if (j_limit == 1) CHECK(scan1.n_scan == 3 * n_procs);
+	for (j = 0; j < scan1.n_scan; j++) {
+	  CAPTURE(j);
+	  CHECK(scan1.scan_eta_bar[j] == scan2.scan_eta_bar[j]);
+	  CHECK(scan1.scan_sigma0[j] == scan2.scan_sigma0[j]);
+	  CHECK(scan1.scan_B2c[j] == scan2.scan_B2c[j]);
+	  CHECK(Approx(scan1.scan_iota[j]) == scan2.scan_iota[j]);
+	  CHECK(Approx(scan1.scan_max_elongation[j]) == scan2.scan_max_elongation[j]);
+	  CHECK(Approx(scan1.scan_min_L_grad_B[j]) == scan2.scan_min_L_grad_B[j]);
+	  CHECK(scan1.scan_nphi[j] == scan2.scan_nphi[j]);
+	  for (k = 0; k < nf; k++) {
+	    CHECK(scan1.scan_R0c(k, j) == scan2.scan_R0c(k, j));
+	    CHECK(scan1.scan_Z0s(k, j) == scan2.scan_Z0s(k, j));
+	  }
+	}
+      }
+    }
+  }
+}
+
+TEST_CASE("With parallel_netcdf, each proc holds its own slice of the serial scan results. [mpi]") {
+  qsc::big j;
+  int k;
+  int mpi_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+
+  qsc::Scan scan1 = make_small_scan();
+  qsc::Scan scan2 = make_small_scan();
+
+  int nf = 2;
+  for (int j_scan = 0; j_scan < 2; j_scan++) {
+    qsc::Scan& scan = (j_scan == 0) ? scan1 : scan2;
+    scan.parallel_netcdf = (j_scan == 1);
+    // Give the procs different numbers of attempts, so they keep different numbers of configurations:
+    scan.max_attempts_per_proc = 20 + 7 * mpi_rank;
+    scan.q.order_r_option = "r2";
+    scan.sigma0_min = -0.3;
+    scan.sigma0_max = 0.6;
+    scan.B2c_min = -1.0;
+    scan.B2c_max = 1.0;
+    scan.max_elongation_to_keep = 4.0;
+    scan.random();
+  }
+
+  // Share the combined results from the serial scan with all procs:
+  qsc::big n_scan = scan1.n_scan;
+  MPI_Bcast(&n_scan, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+  qsc::Vector eta_bar(n_scan), iota(n_scan);
+  qsc::Matrix Z0s(nf, n_scan);
+  if (mpi_rank == 0) {
+    eta_bar = scan1.scan_eta_bar;
+    iota = scan1.scan_iota;
+    Z0s = scan1.scan_Z0s;
+  }
+  MPI_Bcast(&eta_bar[0], n_scan, MPI_QSCFLOAT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&iota[0], n_scan, MPI_QSCFLOAT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&Z0s[0], nf * n_scan, MPI_QSCFLOAT, 0, MPI_COMM_WORLD);
+
+  CHECK(scan2.n_scan == n_scan);
+  CHECK(n_scan > 0);
+  if (mpi_rank == 0) {
+    for (j = 0; j < qsc::N_FILTERS; j++) CHECK(scan2.filters[j] == scan1.filters[j]);
+  }
+  // The slices on all procs should cover 0 ... n_scan - 1 without gaps:
+  qsc::big n_local = scan2.scan_eta_bar.size();
+  qsc::big n_end, n_total;
+  n_end = scan2.n_scan_offset + n_local;
+  MPI_Allreduce(&n_local, &n_total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  CHECK(n_total == n_scan);
+  if (mpi_rank == n_procs - 1) CHECK(n_end == n_scan);
+  if (mpi_rank == 0) CHECK(scan2.n_scan_offset == 0);
+  for (j = 0; j < n_local; j++) {
+    CAPTURE(j);
+    CHECK(scan2.scan_eta_bar[j] == eta_bar[scan2.n_scan_offset + j]);
+    CHECK(scan2.scan_iota[j] == iota[scan2.n_scan_offset + j]);
+    for (k = 0; k < nf; k++) CHECK(scan2.scan_Z0s(k, j) == Z0s(k, scan2.n_scan_offset + j));
+  }
+}
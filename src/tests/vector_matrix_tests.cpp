@@ -110,3 +110,32 @@ TEST_CASE("linear solve 3") {
   CHECK(Approx(v[1]) == 0.852064220183486);
   CHECK(Approx(v[2]) == 0.212920489296636);
 }
+
+TEST_CASE("LU factors can be re-used for several right-hand sides") {
+  Vector v1 {0.6, -0.9, 0.4};
+  Matrix m(3, 3);
+  m(0, 0) = 1.1;
+  m(1, 0) = 0.7;
+  m(2, 0) = -0.2;
+  m(0, 1) = -0.3;
+  m(1, 1) = -1.3;
+  m(2, 1) = 0.1;
+  m(0, 2) = 0.6;
+  m(1, 2) = -1.2;
+  m(2, 2) = 2.1;
+
+  std::valarray<int> IPIV(3);
+  lu_factor(m, IPIV);
+  
+  lu_solve(m, v1, IPIV);
+  CHECK(Approx(v1[0]) == 0.661697247706422);
+  CHECK(Approx(v1[1]) == 0.852064220183486);
+  CHECK(Approx(v1[2]) == 0.212920489296636);
+
+  // Solve again with the same factors and the same right-hand side:
+  v1 = {0.6, -0.9, 0.4};
+  lu_solve(m, v1, IPIV);
+  CHECK(Approx(v1[0]) == 0.661697247706422);
+  CHECK(Approx(v1[1]) == 0.852064220183486);
+  CHECK(Approx(v1[2]) == 0.212920489296636);
+}
@@ -23,5 +23,32 @@ void Qsc::validate() {
   } else {
     throw std::runtime_error("Invalid setting for order_r_option");
   }
+
+  if (newton_linesearch_option.compare(NEWTON_LINESEARCH_OPTION_BACKTRACK) == 0) {
+    newton_linesearch = NEWTON_LINESEARCH_BACKTRACK;
+  } else if (newton_linesearch_option.compare(NEWTON_LINESEARCH_OPTION_ARMIJO) == 0) {
+    newton_linesearch = NEWTON_LINESEARCH_ARMIJO;
+  } else if (newton_linesearch_option.compare(NEWTON_LINESEARCH_OPTION_NONE) == 0) {
+    newton_linesearch = NEWTON_LINESEARCH_NONE;
+  } else {
+    throw std::runtime_error("Invalid setting for newton_linesearch_option");
+  }
+
+  if (newton_jacobian_period < 1) {
+    throw std::runtime_error("newton_jacobian_period must be at least 1");
+  }
+
+  if (nphi_tolerance < 0) {
+    throw std::runtime_error("nphi_tolerance must be >= 0");
+  }
+  if (nphi_tolerance > 0 && max_nphi < nphi) {
+    throw std::runtime_error("max_nphi must be at least nphi when nphi_tolerance > 0");
+  }
+  if (min_nphi < 0) {
+    throw std::runtime_error("min_nphi must be >= 0");
+  }
+  if (min_nphi > 0 && (min_nphi < 3 || min_nphi > max_nphi)) {
+    throw std::runtime_error("min_nphi must be 0, or from 3 to max_nphi");
+  }
   
 }
@@ -20,6 +20,16 @@ extern "C" {
   void dgesv_(int* N, int* NRHS, double* A, int* LDA, int* IPIV, double* B, int* LDB, int* INFO);
 
   void sgesv_(int* N, int* NRHS, float* A, int* LDA, int* IPIV, float* B, int* LDB, int* INFO);
+
+  // LU factorization:
+  void dgetrf_(int* M, int* N, double* A, int* LDA, int* IPIV, int* INFO);
+
+  void sgetrf_(int* M, int* N, float* A, int* LDA, int* IPIV, int* INFO);
+
+  // Solve linear system using an existing LU factorization:
+  void dgetrs_(char* TRANS, int* N, int* NRHS, double* A, int* LDA, int* IPIV, double* B, int* LDB, int* INFO);
+
+  void sgetrs_(char* TRANS, int* N, int* NRHS, float* A, int* LDA, int* IPIV, float* B, int* LDB, int* INFO);
 }
 
 // Choose either the single or double precision version of BLAS/LAPACK routines:
@@ -27,11 +37,15 @@ extern "C" {
 
 #define gemv_ sgemv_
 #define gesv_ sgesv_
+#define getrf_ sgetrf_
+#define getrs_ sgetrs_
 
 #else
 
 #define gemv_ dgemv_
 #define gesv_ dgesv_
+#define getrf_ dgetrf_
+#define getrs_ dgetrs_
 
 #endif
 
@@ -184,6 +198,44 @@ void qsc::linear_solve(Matrix& m, Vector& v, std::valarray<int>& IPIV) {
   }
 }
 
+/** Compute the LU factorization of a square matrix in place.
+ *
+ *  This subroutine and lu_solve() together do the same work as
+ *  linear_solve(), but split in two so the factors can be re-used for
+ *  several right-hand sides, e.g. in a chord-type Newton iteration.
+ */
+void qsc::lu_factor(Matrix& m, std::valarray<int>& IPIV) {
+  assert(m.ncols() == IPIV.size());
+  assert(m.ncols() == m.nrows());
+
+  int n = m.nrows();
+  int INFO = 0;
+  getrf_(&n, &n, &m(0, 0), &n, &IPIV[0], &INFO);
+  if (INFO != 0) {
+    throw std::runtime_error("LAPACK error in *getrf");
+  }
+}
+
+/** Solve A x = b for x, given the LU factors of A from lu_factor().
+ *
+ *  The vector is over-written with the solution. The factors are not
+ *  modified, so they can be used again.
+ */
+void qsc::lu_solve(Matrix& m, Vector& v, std::valarray<int>& IPIV) {
+  assert(m.ncols() == v.size());
+  assert(m.ncols() == IPIV.size());
+  assert(m.ncols() == m.nrows());
+
+  char TRANS = 'N';
+  int n = m.nrows();
+  int INFO = 0;
+  int one = 1;
+  getrs_(&TRANS, &n, &one, &m(0, 0), &n, &IPIV[0], &v[0], &n, &INFO);
+  if (INFO != 0) {
+    throw std::runtime_error("LAPACK error in *getrs");
+  }
+}
+
 ////////////////////////////////////////////////////
 
 // Default constructor: set all dimensions to 1
@@ -40,6 +40,8 @@ namespace qsc {
   void matrix_vector_product(Matrix&, Vector&, Vector&);
   qscfloat dot_product(Vector&, Vector&);
   void linear_solve(Matrix&, Vector&, std::valarray<int>&);
+  void lu_factor(Matrix&, std::valarray<int>&);
+  void lu_solve(Matrix&, Vector&, std::valarray<int>&);
   
   // These operators should be in the qsc namespace:
   // https://stackoverflow.com/questions/3891402/operator-overloading-and-namespaces